@@ -0,0 +1,72 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Commandlets/BakeRecipeGraphCommandlet.h"
+#include "Misc/PackageName.h"
+#include "UObject/Package.h"
+#include "UObject/SavePackage.h"
+
+#include "GameplaySettings.h"
+#include "Data/RecipeGraphAsset.h"
+
+UBakeRecipeGraphCommandlet::UBakeRecipeGraphCommandlet()
+{
+	IsClient = false;
+	IsEditor = true;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UBakeRecipeGraphCommandlet::Main(const FString& Params)
+{
+#if WITH_EDITOR
+	const UGameplaySettings* Settings = GetDefault<UGameplaySettings>();
+	if (Settings->RecipeGraph.IsNull())
+	{
+		UE_LOG(LogTemp, Error, TEXT("BakeRecipeGraph: RecipeGraph is not set in the gameplay settings"));
+		return 1;
+	}
+
+	const FSoftObjectPath AssetPath = Settings->RecipeGraph.ToSoftObjectPath();
+	const FString PackageName = AssetPath.GetLongPackageName();
+
+	URecipeGraphAsset* RecipeGraph = Settings->RecipeGraph.LoadSynchronous();
+	if (!RecipeGraph)
+	{
+		UPackage* Package = CreatePackage(*PackageName);
+		RecipeGraph = NewObject<URecipeGraphAsset>(Package, *AssetPath.GetAssetName(), RF_Public | RF_Standalone);
+	}
+
+	if (RecipeGraph->RecipeTable.IsNull())
+	{
+		RecipeGraph->RecipeTable = Settings->RecipeDataTable;
+	}
+
+	if (RecipeGraph->ShapeTable.IsNull())
+	{
+		RecipeGraph->ShapeTable = Settings->ShapeDataTable;
+	}
+
+	if (!RecipeGraph->Bake())
+	{
+		UE_LOG(LogTemp, Error, TEXT("BakeRecipeGraph: %s has invalid recipes, see the warnings above"), *PackageName);
+		return 1;
+	}
+
+	// Saving bakes again in PreSave, the asset always matches the tables it was saved with
+	FSavePackageArgs SaveArgs;
+	SaveArgs.TopLevelFlags = RF_Public | RF_Standalone;
+
+	const FString Filename = FPackageName::LongPackageNameToFilename(PackageName, FPackageName::GetAssetPackageExtension());
+	if (!UPackage::SavePackage(RecipeGraph->GetPackage(), RecipeGraph, *Filename, SaveArgs))
+	{
+		UE_LOG(LogTemp, Error, TEXT("BakeRecipeGraph: could not save %s"), *Filename);
+		return 1;
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("BakeRecipeGraph: saved %s"), *Filename);
+	return 0;
+#else
+	UE_LOG(LogTemp, Error, TEXT("BakeRecipeGraph: assets can only be saved by the editor"));
+	return 1;
+#endif
+}
@@ -0,0 +1,27 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "BakeRecipeGraphCommandlet.generated.h"
+
+/**
+ * Create or update the recipe graph asset set in UGameplaySettings::RecipeGraph from the recipe and shape data tables,
+ * then save it. Fails when the bake drops a recipe.
+ *
+ * Usage: IBTestEditor -run=BakeRecipeGraph
+ */
+UCLASS()
+class IBTEST_API UBakeRecipeGraphCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+
+	UBakeRecipeGraphCommandlet();
+
+	// UCommandlet Begin
+	virtual int32 Main(const FString& Params) override;
+	// UCommandlet End
+};
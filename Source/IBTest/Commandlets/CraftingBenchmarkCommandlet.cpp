@@ -0,0 +1,394 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Commandlets/CraftingBenchmarkCommandlet.h"
+#include "Dom/JsonObject.h"
+#include "Engine/Engine.h"
+#include "Engine/GameInstance.h"
+#include "Engine/StreamableManager.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "GameFramework/WorldSettings.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+#include "UObject/StrongObjectPtr.h"
+#include "UObject/UObjectGlobals.h"
+
+#include "Machine.h"
+#include "Shape.h"
+#include "Subsystems/RecipeRegistrySubsystem.h"
+#include "Subsystems/MachineSubsystem.h"
+
+namespace
+{
+	/** Ingredient counts used by the matching benchmarks */
+	const int32 IngredientCounts[] = { 10, 100, 1000 };
+
+	/** Recipes given to the benchmark machine */
+	const int32 NumMachineRecipes = 32;
+
+	/** Number of full recipe scans timed by a single IsMissingIngredient sample */
+	const int32 ScansPerSample = 1000;
+
+	/** Written by the matching benchmarks so the compiler cannot drop their loops */
+	volatile int32 SatisfiedSink = 0;
+
+	/** Ingredients are spawned out of reach of the machine box so they never overlap it */
+	const FVector IngredientLocation(0.f, 0.f, 100000.f);
+}
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCraftingBenchmarkTest, "IBTest.Crafting.Benchmark",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+/** Same run as the commandlet with the test parameters: IBTest -nullrhi -unattended -ExecCmds="Automation RunTests IBTest.Crafting; Quit" */
+bool FCraftingBenchmarkTest::RunTest(const FString& Parameters)
+{
+	// The benchmark collects garbage between runs
+	TStrongObjectPtr<UCraftingBenchmarkCommandlet> Benchmark(NewObject<UCraftingBenchmarkCommandlet>());
+	Benchmark->bAutomationTest = true;
+	return TestEqual(TEXT("CraftingBenchmark exit code"), Benchmark->Main(Parameters), 0);
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
+
+UCraftingBenchmarkCommandlet::UCraftingBenchmarkCommandlet()
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UCraftingBenchmarkCommandlet::Main(const FString& Params)
+{
+	FString OutputDir = FPaths::ProjectSavedDir() / TEXT("Benchmarks");
+	FString BaselineFile;
+	double Threshold = 0.1;
+
+	FParse::Value(*Params, TEXT("Samples="), NumSamples);
+	FParse::Value(*Params, TEXT("Output="), OutputDir);
+	FParse::Value(*Params, TEXT("Baseline="), BaselineFile);
+	FParse::Value(*Params, TEXT("Threshold="), Threshold);
+
+	// Baselines are measured on the benchmark machine on purpose, never as a side effect of a test run
+	const bool bUpdateBaseline = !bAutomationTest && FParse::Param(*Params, TEXT("UpdateBaseline"));
+	if (bUpdateBaseline && BaselineFile.IsEmpty())
+	{
+		UE_LOG(LogTemp, Error, TEXT("CraftingBenchmark: -UpdateBaseline needs -Baseline=<file>"));
+		return 1;
+	}
+
+	NumSamples = FMath::Max(NumSamples, 1);
+	Results.Reset();
+
+	// A standalone game instance gives us a game world with all IBTest subsystems, including the recipe registry
+	UGameInstance* GameInstance = NewObject<UGameInstance>(GEngine);
+	GameInstance->InitializeStandalone();
+	World = GameInstance->GetWorld();
+
+	World->InitializeActorsForPlay(FURL());
+	World->BeginPlay();
+	if (!World->HasBegunPlay())
+	{
+		World->GetWorldSettings()->NotifyBeginPlay();
+	}
+
+	const bool bCompleted = RunBenchmarks(GameInstance);
+
+	// Also when the benchmarks stopped early, the automation test runs inside a process that keeps going
+	GEngine->DestroyWorldContext(World);
+	World->DestroyWorld(false);
+	GameInstance->Shutdown();
+	World = nullptr;
+
+	if (!bCompleted) return 1;
+
+	for (const FBenchmarkResult& Result : Results)
+	{
+		UE_LOG(LogTemp, Display, TEXT("CraftingBenchmark: %-24s median %10.1f ns  p99 %10.1f ns  (includes %s)"), *Result.Name, Result.Median, Result.P99, *Result.Includes);
+	}
+
+	WriteCsv(OutputDir / TEXT("CraftingBenchmark.csv"));
+	WriteJson(OutputDir / TEXT("CraftingBenchmark.json"));
+
+	if (bUpdateBaseline)
+	{
+		WriteJson(BaselineFile);
+		UE_LOG(LogTemp, Display, TEXT("CraftingBenchmark: baseline updated in %s"), *BaselineFile);
+		return 0;
+	}
+
+	// Timings only mean something against medians measured on the same machine, there is no default baseline
+	if (BaselineFile.IsEmpty()) return 0;
+
+	return CompareWithBaseline(BaselineFile, Threshold) ? 0 : 1;
+}
+
+bool UCraftingBenchmarkCommandlet::RunBenchmarks(UGameInstance* GameInstance)
+{
+	URecipeRegistrySubsystem* RecipeRegistry = GameInstance->GetSubsystem<URecipeRegistrySubsystem>();
+	const FRecipeRegistry& Registry = RecipeRegistry->GetRegistry();
+	if (Registry.GetNumRecipes() == 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("CraftingBenchmark: no recipe found"));
+		return false;
+	}
+
+	// Class loading is not what we measure here
+	if (TSharedPtr<FStreamableHandle> LoadHandle = RecipeRegistry->RequestAllShapeClasses())
+	{
+		LoadHandle->WaitUntilComplete();
+	}
+
+	AMachine* Machine = World->SpawnActor<AMachine>();
+	for (int32 i = 0; i < NumMachineRecipes; ++i)
+	{
+		const FRecipeRecord* Recipe = Registry.GetRecipe(i % Registry.GetNumRecipes());
+		if (Recipe->TotalShapes > 1)
+		{
+			Machine->RecipeIDs.Add(Recipe->RecipeID);
+		}
+	}
+
+	// Consumed shapes are destroyed instead of pooled
+	Machine->ShapePool = nullptr;
+
+	// Outputs are spawned in the machine box, they must not become ingredients and queue evaluations while timed
+	Machine->CollisionBox->SetGenerateOverlapEvents(false);
+
+	// The first call compiles the recipe list and sizes the evaluation slot, the timed ones reuse both
+	Machine->InitializeRecipes();
+
+	const UMachineSubsystem* MachineSubsystem = World->GetSubsystem<UMachineSubsystem>();
+	const int32 NumSlots = MachineSubsystem ? MachineSubsystem->GetNumSlots() : 0;
+
+	RunBenchmark(TEXT("InitializeRecipes"), TEXT("shared recipe list lookup, matcher copy, evaluation slot and journal registration"), 1,
+		[]() {},
+		[Machine]() { Machine->InitializeRecipes(); },
+		[]() {});
+
+	if (MachineSubsystem && MachineSubsystem->GetNumSlots() != NumSlots)
+	{
+		UE_LOG(LogTemp, Error, TEXT("CraftingBenchmark: InitializeRecipes allocated %d evaluation slots instead of reusing its own"), MachineSubsystem->GetNumSlots() - NumSlots);
+		return false;
+	}
+
+	if (Machine->RecipeMatcher.GetNumRecipes() == 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("CraftingBenchmark: no recipe with at least 2 ingredients"));
+		return false;
+	}
+
+	for (const int32 NumIngredients : IngredientCounts)
+	{
+		RunBenchmark(FString::Printf(TEXT("IsMissingIngredient_%d"), NumIngredients), TEXT("one scan of every recipe"), ScansPerSample,
+			[this, Machine, NumIngredients]() { FillMachine(Machine, NumIngredients); },
+			[Machine]()
+			{
+				int32 NumSatisfied = 0;
+				for (int32 Scan = 0; Scan < ScansPerSample; ++Scan)
+				{
+					for (int32 RecipeIndex = 0; RecipeIndex < Machine->RecipeMatcher.GetNumRecipes(); ++RecipeIndex)
+					{
+						NumSatisfied += Machine->IsMissingIngredient(RecipeIndex) ? 0 : 1;
+					}
+				}
+				// Keep the scans from being optimized away
+				SatisfiedSink = NumSatisfied;
+			},
+			[this, Machine]() { ClearMachine(Machine); });
+
+		RunBenchmark(FString::Printf(TEXT("CheckRecipes_%d"), NumIngredients), TEXT("shape destruction, output actor spawns, journal"), 1,
+			[this, Machine, NumIngredients]() { FillMachine(Machine, NumIngredients); },
+			[Machine]() { Machine->CheckRecipes(); },
+			[this, Machine]() { ClearMachine(Machine); });
+	}
+
+	RunBenchmark(TEXT("ConsumeRecipe"), TEXT("shape destruction, output actor spawn, journal"), 1,
+		[this, Machine]()
+		{
+			for (const FRecipeIngredient& Ingredient : Machine->RecipeMatcher.GetRecipe(0).Record->InShapes)
+			{
+				for (int32 i = 0; i < Ingredient.Count; ++i)
+				{
+					Machine->AddIngredient(SpawnIngredient(Ingredient.ShapeIndex));
+				}
+			}
+		},
+		[Machine]() { Machine->ConsumeRecipe(0); },
+		[this, Machine]() { ClearMachine(Machine); });
+
+	const int32 OutShapeIndex = Machine->RecipeMatcher.GetRecipe(0).Record->OutShapeIndex;
+	RunBenchmark(TEXT("SpawnShapeByName"), TEXT("actor spawn"), 1,
+		[]() {},
+		[Machine, OutShapeIndex]() { Machine->SpawnShape(OutShapeIndex); },
+		[this, Machine]() { ClearMachine(Machine); });
+
+	return true;
+}
+
+void UCraftingBenchmarkCommandlet::RunBenchmark(const FString& Name, const TCHAR* Includes, int32 OpsPerSample, TFunctionRef<void()> Setup, TFunctionRef<void()> Run, TFunctionRef<void()> Teardown)
+{
+	FBenchmarkResult& Result = Results.AddDefaulted_GetRef();
+	Result.Name = Name;
+	Result.Includes = Includes;
+	Result.Samples.Reserve(NumSamples);
+
+	for (int32 Sample = 0; Sample < NumSamples; ++Sample)
+	{
+		Setup();
+
+		const uint64 StartCycles = FPlatformTime::Cycles64();
+		Run();
+		const uint64 EndCycles = FPlatformTime::Cycles64();
+
+		Teardown();
+
+		Result.Samples.Add(FPlatformTime::ToSeconds64(EndCycles - StartCycles) * 1.0e9 / OpsPerSample);
+	}
+
+	// Keep destroyed actors from piling up across benchmarks
+	CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+
+	TArray<double> SortedSamples = Result.Samples;
+	SortedSamples.Sort();
+
+	Result.Median = SortedSamples[SortedSamples.Num() / 2];
+	Result.P99 = SortedSamples[FMath::Clamp(FMath::CeilToInt(SortedSamples.Num() * 0.99) - 1, 0, SortedSamples.Num() - 1)];
+}
+
+void UCraftingBenchmarkCommandlet::FillMachine(AMachine* Machine, int32 NumShapes)
+{
+	TArray<int32> InputShapes;
+	for (int32 RecipeIndex = 0; RecipeIndex < Machine->RecipeMatcher.GetNumRecipes(); ++RecipeIndex)
+	{
+		for (const FRecipeIngredient& Ingredient : Machine->RecipeMatcher.GetRecipe(RecipeIndex).Record->InShapes)
+		{
+			InputShapes.AddUnique(Ingredient.ShapeIndex);
+		}
+	}
+
+	if (InputShapes.IsEmpty()) return;
+
+	// Ingredients are added without requesting an evaluation, nothing is crafted before the timed part
+	for (int32 i = 0; i < NumShapes; ++i)
+	{
+		Machine->AddIngredient(SpawnIngredient(InputShapes[i % InputShapes.Num()]));
+	}
+}
+
+void UCraftingBenchmarkCommandlet::ClearMachine(AMachine* Machine)
+{
+	for (TArray<AShape*>& Shapes : Machine->ShapeIngredients)
+	{
+		Shapes.Reset();
+	}
+	Machine->RecipeMatcher.ResetCounts();
+	Machine->PendingSpawns.Reset();
+
+	for (TActorIterator<AShape> It(World); It; ++It)
+	{
+		It->Destroy();
+	}
+}
+
+AShape* UCraftingBenchmarkCommandlet::SpawnIngredient(int32 ShapeIndex)
+{
+	const URecipeRegistrySubsystem* RecipeRegistry = URecipeRegistrySubsystem::Get(World);
+	const FShapeRecord* Shape = RecipeRegistry->GetRegistry().GetShape(ShapeIndex);
+	const UClass* ShapeClass = Shape->ShapeClass ? Shape->ShapeClass.Get() : AShape::StaticClass();
+
+	const FTransform Transform(IngredientLocation);
+	AShape* Ingredient = World->SpawnActorDeferred<AShape>(ShapeClass, Transform, nullptr, nullptr, ESpawnActorCollisionHandlingMethod::AlwaysSpawn);
+	Ingredient->ShapeID = Shape->ShapeID;
+	Ingredient->FinishSpawning(Transform);
+
+	return Ingredient;
+}
+
+void UCraftingBenchmarkCommandlet::WriteCsv(const FString& File) const
+{
+	FString Csv = TEXT("name,samples,median_ns,p99_ns,includes\n");
+	for (const FBenchmarkResult& Result : Results)
+	{
+		Csv += FString::Printf(TEXT("%s,%d,%.1f,%.1f,\"%s\"\n"), *Result.Name, Result.Samples.Num(), Result.Median, Result.P99, *Result.Includes);
+	}
+
+	FFileHelper::SaveStringToFile(Csv, *File);
+}
+
+void UCraftingBenchmarkCommandlet::WriteJson(const FString& File) const
+{
+	TArray<TSharedPtr<FJsonValue>> Benchmarks;
+	for (const FBenchmarkResult& Result : Results)
+	{
+		TSharedRef<FJsonObject> Benchmark = MakeShared<FJsonObject>();
+		Benchmark->SetStringField(TEXT("name"), Result.Name);
+		Benchmark->SetNumberField(TEXT("samples"), Result.Samples.Num());
+		Benchmark->SetNumberField(TEXT("median_ns"), Result.Median);
+		Benchmark->SetNumberField(TEXT("p99_ns"), Result.P99);
+		Benchmark->SetStringField(TEXT("includes"), Result.Includes);
+
+		Benchmarks.Add(MakeShared<FJsonValueObject>(Benchmark));
+	}
+
+	TSharedRef<FJsonObject> Root = MakeShared<FJsonObject>();
+	Root->SetArrayField(TEXT("benchmarks"), Benchmarks);
+
+	FString Json;
+	const TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&Json);
+	FJsonSerializer::Serialize(Root, Writer);
+
+	FFileHelper::SaveStringToFile(Json, *File);
+}
+
+bool UCraftingBenchmarkCommandlet::CompareWithBaseline(const FString& BaselineFile, double Threshold) const
+{
+	FString Json;
+	if (!FFileHelper::LoadFileToString(Json, *BaselineFile))
+	{
+		UE_LOG(LogTemp, Error, TEXT("CraftingBenchmark: no baseline found at %s, run with -UpdateBaseline to create one"), *BaselineFile);
+		return false;
+	}
+
+	TSharedPtr<FJsonObject> Root;
+	if (!FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(Json), Root) || !Root.IsValid())
+	{
+		UE_LOG(LogTemp, Error, TEXT("CraftingBenchmark: failed to parse baseline %s"), *BaselineFile);
+		return false;
+	}
+
+	TMap<FString, double> BaselineMedians;
+	for (const TSharedPtr<FJsonValue>& Value : Root->GetArrayField(TEXT("benchmarks")))
+	{
+		const TSharedPtr<FJsonObject>& Benchmark = Value->AsObject();
+		BaselineMedians.Add(Benchmark->GetStringField(TEXT("name")), Benchmark->GetNumberField(TEXT("median_ns")));
+	}
+
+	bool bPassed = true;
+	for (const FBenchmarkResult& Result : Results)
+	{
+		// A benchmark missing from the baseline would never be checked
+		const double* BaselineMedian = BaselineMedians.Find(Result.Name);
+		if (!BaselineMedian || *BaselineMedian <= 0.0)
+		{
+			UE_LOG(LogTemp, Error, TEXT("CraftingBenchmark: %s has no baseline, run with -UpdateBaseline to add it"), *Result.Name);
+			bPassed = false;
+			continue;
+		}
+
+		const double Ratio = Result.Median / *BaselineMedian;
+		if (Ratio > 1.0 + Threshold)
+		{
+			UE_LOG(LogTemp, Error, TEXT("CraftingBenchmark: %s regressed, median %.1f ns vs baseline %.1f ns (%+.1f%%)"),
+				*Result.Name, Result.Median, *BaselineMedian, (Ratio - 1.0) * 100.0);
+			bPassed = false;
+		}
+	}
+
+	return bPassed;
+}
@@ -0,0 +1,88 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "CraftingBenchmarkCommandlet.generated.h"
+
+class AMachine;
+class AShape;
+class UGameInstance;
+class UWorld;
+
+/**
+ * Fixed size crafting microbenchmarks.
+ * Runs AMachine recipe initialization, matching, consumption and spawning in a standalone game world
+ * and writes median and p99 timings as CSV and JSON. Given a baseline measured on the same machine with -UpdateBaseline,
+ * returns a non-zero exit code if any median regressed past the threshold or has no baseline.
+ * Also runs as the IBTest.Crafting.Benchmark automation test, with the test parameters and never updating a baseline.
+ *
+ * Usage: IBTest -run=CraftingBenchmark -nullrhi -unattended [-Samples=200] [-Output=<dir>] [-Baseline=<file>] [-Threshold=0.1] [-UpdateBaseline]
+ *   Samples:        number of timed samples per benchmark
+ *   Output:         directory receiving CraftingBenchmark.csv and CraftingBenchmark.json, Saved/Benchmarks by default
+ *   Baseline:       JSON results to compare against, nothing is compared without it
+ *   Threshold:      allowed median regression ratio, 0.1 fails past +10%
+ *   UpdateBaseline: store the current results as the new baseline in the Baseline file
+ *
+ * Every timed run goes through the real AMachine code path, the output of each benchmark lists the side effects it includes.
+ */
+UCLASS()
+class IBTEST_API UCraftingBenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+
+	UCraftingBenchmarkCommandlet();
+
+	// UCommandlet Begin
+	virtual int32 Main(const FString& Params) override;
+	// UCommandlet End
+
+	/** Set by the automation test, baselines are never updated */
+	bool bAutomationTest = false;
+
+private:
+
+	/** Timings of a single benchmark, in nanoseconds per operation */
+	struct FBenchmarkResult
+	{
+		FString Name;
+
+		/** Work timed along with the operation itself */
+		FString Includes;
+
+		TArray<double> Samples;
+		double Median = 0.0;
+		double P99 = 0.0;
+	};
+
+	/** Run every benchmark in World, return false if they could not run */
+	bool RunBenchmarks(UGameInstance* GameInstance);
+
+	/** Time Run NumSamples times, Setup and Teardown are not part of the measure */
+	void RunBenchmark(const FString& Name, const TCHAR* Includes, int32 OpsPerSample, TFunctionRef<void()> Setup, TFunctionRef<void()> Run, TFunctionRef<void()> Teardown);
+
+	/** Spawn NumShapes ingredients, spread over the machine input shapes, and give them to the machine */
+	void FillMachine(AMachine* Machine, int32 NumShapes);
+
+	/** Remove all ingredients from the machine and destroy every shape in the world */
+	void ClearMachine(AMachine* Machine);
+
+	AShape* SpawnIngredient(int32 ShapeIndex);
+
+	void WriteCsv(const FString& File) const;
+
+	void WriteJson(const FString& File) const;
+
+	/** Return false if a benchmark median regressed past the threshold */
+	bool CompareWithBaseline(const FString& BaselineFile, double Threshold) const;
+
+	TArray<FBenchmarkResult> Results;
+
+	UPROPERTY(Transient)
+	TObjectPtr<UWorld> World;
+
+	int32 NumSamples = 200;
+};
@@ -0,0 +1,274 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Commandlets/CraftingReplayCommandlet.h"
+#include "HAL/FileManager.h"
+#include "Misc/Paths.h"
+
+#include "GameplaySettings.h"
+#include "Crafting/CraftingJournal.h"
+#include "Crafting/RecipeRegistry.h"
+#include "Crafting/SimulatedMachine.h"
+
+namespace
+{
+	/** A recorded machine and its own records, machines never affect each other so they are replayed one after the other */
+	struct FReplayMachine
+	{
+		TArray<const FRecipeRecord*> Recipes;
+
+		TArray<FCraftingJournalRecord> Records;
+
+		FSimulatedMachine Machine;
+
+		bool bInitiallyEnabled = true;
+
+		bool bDrainIngredients = false;
+	};
+
+	struct FReplayStats
+	{
+		int64 NumEvaluations = 0;
+		int64 NumCrafts = 0;
+		int64 NumMismatches = 0;
+	};
+
+	FString FindLatestJournal()
+	{
+		const FString Directory = FPaths::ProjectSavedDir() / TEXT("Journals");
+
+		TArray<FString> Files;
+		IFileManager::Get().FindFiles(Files, *(Directory / TEXT("*.ibj")), true, false);
+
+		FString Latest;
+		FDateTime LatestTime = FDateTime::MinValue();
+		for (const FString& File : Files)
+		{
+			const FDateTime Time = IFileManager::Get().GetTimeStamp(*(Directory / File));
+			if (Time > LatestTime)
+			{
+				LatestTime = Time;
+				Latest = Directory / File;
+			}
+		}
+
+		return Latest;
+	}
+
+	void ReplayMachine(FReplayMachine& Replay, const FRecipeRegistry& Registry, FReplayStats& Stats)
+	{
+		FSimulatedMachine& Machine = Replay.Machine;
+		const TArray<FCraftingJournalRecord>& Records = Replay.Records;
+		int32 Cursor = 0;
+
+		// Apply the ingredient changes, toggles and recipe changes up to the next craft or evaluation boundary
+		auto ApplyChanges = [&Machine, &Records, &Cursor, &Registry, &Stats]()
+		{
+			for (; Cursor < Records.Num(); ++Cursor)
+			{
+				const FCraftingJournalRecord& Record = Records[Cursor];
+				switch (Record.Type)
+				{
+				case ECraftingJournalEvent::IngredientAdded:
+					Machine.AddShape(Record.Index);
+					break;
+
+				case ECraftingJournalEvent::IngredientRemoved:
+					Machine.RemoveShape(Record.Index);
+					break;
+
+				case ECraftingJournalEvent::Enabled:
+					Machine.SetEnabled(Record.Index != 0);
+					break;
+
+				case ECraftingJournalEvent::RecipesChanged:
+				{
+					TArray<const FRecipeRecord*> Recipes;
+					while (Records.IsValidIndex(Cursor + 1) && Records[Cursor + 1].Type == ECraftingJournalEvent::MachineRecipe)
+					{
+						if (const FRecipeRecord* Recipe = Registry.GetRecipe(Records[++Cursor].Index))
+						{
+							Recipes.Add(Recipe);
+						}
+					}
+
+					// Initializing clears the craft counter, the crafts made with the previous recipes still count
+					Stats.NumCrafts += Machine.GetNumCrafts();
+					Machine.Initialize(Recipes, Registry.GetNumShapes());
+					break;
+				}
+
+				default:
+					return;
+				}
+			}
+		};
+
+		// Outputs that landed in the machine were journaled right after the craft that spawned them,
+		// applying them here keeps them visible to the rest of the evaluation as on the server
+		Machine.SetOutputHandler([&Records, &Cursor, &Stats, &ApplyChanges](int32 RecipeIndex, int32 NumCrafts)
+			{
+				const bool bMatches = Records.IsValidIndex(Cursor)
+					&& Records[Cursor].Type == ECraftingJournalEvent::Craft
+					&& Records[Cursor].Index == RecipeIndex
+					&& Records[Cursor].Count == NumCrafts;
+
+				if (!bMatches)
+				{
+					++Stats.NumMismatches;
+					return;
+				}
+
+				++Cursor;
+				ApplyChanges();
+			});
+
+		while (Cursor < Records.Num())
+		{
+			ApplyChanges();
+			if (Cursor >= Records.Num()) break;
+
+			const FCraftingJournalRecord& Record = Records[Cursor++];
+			if (Record.Type != ECraftingJournalEvent::EvaluationBegin) continue;
+
+			++Stats.NumEvaluations;
+			Machine.Evaluate(Replay.bDrainIngredients);
+
+			// Crafts of the journal the simulation did not make
+			while (Cursor < Records.Num() && Records[Cursor].Type != ECraftingJournalEvent::EvaluationEnd)
+			{
+				++Stats.NumMismatches;
+				++Cursor;
+				ApplyChanges();
+			}
+
+			++Cursor;
+		}
+
+		Machine.SetOutputHandler(nullptr);
+
+		Stats.NumCrafts += Machine.GetNumCrafts();
+	}
+}
+
+UCraftingReplayCommandlet::UCraftingReplayCommandlet()
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UCraftingReplayCommandlet::Main(const FString& Params)
+{
+	FString JournalFile;
+	int32 NumRepeats = 1;
+
+	FParse::Value(*Params, TEXT("Journal="), JournalFile);
+	FParse::Value(*Params, TEXT("Repeat="), NumRepeats);
+
+	NumRepeats = FMath::Max(NumRepeats, 1);
+
+	if (JournalFile.IsEmpty())
+	{
+		JournalFile = FindLatestJournal();
+	}
+
+	FCraftingJournalHeader Header;
+	TArray<FCraftingJournalRecord> Records;
+	if (JournalFile.IsEmpty() || !LoadCraftingJournal(JournalFile, Header, Records))
+	{
+		UE_LOG(LogTemp, Error, TEXT("CraftingReplay: no journal to replay, record one with -CraftingJournal or pass -Journal=<file>"));
+		return 1;
+	}
+
+	const UGameplaySettings* Settings = GetDefault<UGameplaySettings>();
+
+	FRecipeRegistry Registry;
+	Registry.Build(*Settings);
+
+	// Registry indices are only meaningful with the recipes the journal was recorded with
+	if (Header.NumShapes != Registry.GetNumShapes() || Header.NumRecipes != Registry.GetNumRecipes())
+	{
+		UE_LOG(LogTemp, Error, TEXT("CraftingReplay: %s was recorded with %d shapes and %d recipes, the current tables have %d and %d"),
+			*JournalFile, Header.NumShapes, Header.NumRecipes, Registry.GetNumShapes(), Registry.GetNumRecipes());
+		return 1;
+	}
+
+	TArray<FReplayMachine> Machines;
+	int64 NumJournalCrafts = 0;
+	for (const FCraftingJournalRecord& Record : Records)
+	{
+		if (Record.Type == ECraftingJournalEvent::MachineAdded)
+		{
+			if (Record.Machine >= Machines.Num())
+			{
+				Machines.SetNum(Record.Machine + 1);
+			}
+
+			Machines[Record.Machine].bInitiallyEnabled = Record.Index != 0;
+			Machines[Record.Machine].bDrainIngredients = Record.Count != 0;
+			continue;
+		}
+
+		if (!Machines.IsValidIndex(Record.Machine)) continue;
+
+		// Recipes written when the machine registered, the ones following a RecipesChanged are replayed in order
+		if (Record.Type == ECraftingJournalEvent::MachineRecipe && Machines[Record.Machine].Records.IsEmpty())
+		{
+			if (const FRecipeRecord* Recipe = Registry.GetRecipe(Record.Index))
+			{
+				Machines[Record.Machine].Recipes.Add(Recipe);
+			}
+			continue;
+		}
+
+		if (Record.Type == ECraftingJournalEvent::Craft)
+		{
+			NumJournalCrafts += Record.Count;
+		}
+
+		Machines[Record.Machine].Records.Add(Record);
+	}
+
+	FReplayStats Stats;
+	double BestSeconds = TNumericLimits<double>::Max();
+	double TotalSeconds = 0.0;
+
+	for (int32 Repeat = 0; Repeat < NumRepeats; ++Repeat)
+	{
+		for (FReplayMachine& Replay : Machines)
+		{
+			Replay.Machine.Initialize(Replay.Recipes, Registry.GetNumShapes());
+			Replay.Machine.SetEnabled(Replay.bInitiallyEnabled);
+		}
+
+		Stats = FReplayStats();
+		const uint64 StartCycles = FPlatformTime::Cycles64();
+
+		for (FReplayMachine& Replay : Machines)
+		{
+			ReplayMachine(Replay, Registry, Stats);
+		}
+
+		const double Seconds = FPlatformTime::ToSeconds64(FPlatformTime::Cycles64() - StartCycles);
+		BestSeconds = FMath::Min(BestSeconds, Seconds);
+		TotalSeconds += Seconds;
+	}
+
+	const float RecordedSpan = Records.Num() > 0 ? Records.Last().Time - Records[0].Time : 0.f;
+
+	UE_LOG(LogTemp, Display, TEXT("CraftingReplay: %s, %d records, %d machines, %.1f s of recorded play"),
+		*JournalFile, Records.Num(), Machines.Num(), RecordedSpan);
+	UE_LOG(LogTemp, Display, TEXT("  Time:            %.3f ms best, %.3f ms average over %d runs"), BestSeconds * 1000.0, TotalSeconds * 1000.0 / NumRepeats, NumRepeats);
+	UE_LOG(LogTemp, Display, TEXT("  Records:         %.1f ns/record"), Records.Num() > 0 ? BestSeconds * 1.0e9 / Records.Num() : 0.0);
+	UE_LOG(LogTemp, Display, TEXT("  Evaluations:     %lld (%.2f us each)"), Stats.NumEvaluations, Stats.NumEvaluations > 0 ? BestSeconds * 1.0e6 / Stats.NumEvaluations : 0.0);
+	UE_LOG(LogTemp, Display, TEXT("  Crafts:          %lld replayed, %lld journaled"), Stats.NumCrafts, NumJournalCrafts);
+
+	if (Stats.NumMismatches > 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("CraftingReplay: %lld crafts differ from the journal, it may have dropped records or the machine logic changed"), Stats.NumMismatches);
+		return 1;
+	}
+
+	return 0;
+}
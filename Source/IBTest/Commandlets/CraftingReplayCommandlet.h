@@ -0,0 +1,32 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "CraftingReplayCommandlet.generated.h"
+
+/**
+ * Headless replay of a crafting journal recorded by UCraftingJournalSubsystem.
+ * Rebuilds every recorded machine as an FSimulatedMachine and feeds it the journaled ingredient changes, toggles and
+ * evaluations in their original order, outputs come back through the journaled ingredients like on the server.
+ * Reports the time spent in the machine logic and every craft that differs from the journal.
+ * Returns a non-zero exit code if the journal cannot be read or the replay diverged.
+ *
+ * Usage: IBTest -run=CraftingReplay -nullrhi [-Journal=<file>] [-Repeat=1]
+ *   Journal: journal to replay, the most recent one in Saved/Journals by default
+ *   Repeat:  number of timed replays, the fastest one is reported
+ */
+UCLASS()
+class IBTEST_API UCraftingReplayCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+
+	UCraftingReplayCommandlet();
+
+	// UCommandlet Begin
+	virtual int32 Main(const FString& Params) override;
+	// UCommandlet End
+};
@@ -0,0 +1,122 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Commandlets/CraftingSimulationCommandlet.h"
+#include "Math/RandomStream.h"
+
+#include "GameplaySettings.h"
+#include "Crafting/RecipeRegistry.h"
+#include "Crafting/SimulatedMachine.h"
+
+UCraftingSimulationCommandlet::UCraftingSimulationCommandlet()
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UCraftingSimulationCommandlet::Main(const FString& Params)
+{
+	int32 NumMachines = 100;
+	int32 NumRecipes = 8;
+	int32 NumIngredients = 10000;
+	int32 BatchSize = 1;
+	int32 Seed = 0;
+
+	FParse::Value(*Params, TEXT("Machines="), NumMachines);
+	FParse::Value(*Params, TEXT("Recipes="), NumRecipes);
+	FParse::Value(*Params, TEXT("Ingredients="), NumIngredients);
+	FParse::Value(*Params, TEXT("Batch="), BatchSize);
+	FParse::Value(*Params, TEXT("Seed="), Seed);
+	const bool bDrainIngredients = FParse::Param(*Params, TEXT("Drain"));
+
+	NumMachines = FMath::Max(NumMachines, 1);
+	NumRecipes = FMath::Max(NumRecipes, 1);
+	BatchSize = FMath::Max(BatchSize, 1);
+
+	const UGameplaySettings* Settings = GetDefault<UGameplaySettings>();
+
+	FRecipeRegistry Registry;
+	Registry.Build(*Settings);
+
+	// Baking already drops recipes with less than 2 inputs, they would craft forever
+	TArray<const FRecipeRecord*> ValidRecipes;
+	for (int32 RecipeIndex = 0; RecipeIndex < Registry.GetNumRecipes(); ++RecipeIndex)
+	{
+		const FRecipeRecord* Recipe = Registry.GetRecipe(RecipeIndex);
+		if (Recipe->TotalShapes > 1)
+		{
+			ValidRecipes.Add(Recipe);
+		}
+	}
+
+	if (ValidRecipes.IsEmpty())
+	{
+		UE_LOG(LogTemp, Error, TEXT("CraftingSimulation: no valid recipe found in the recipe graph or data tables"));
+		return 1;
+	}
+
+	FRandomStream Random(Seed);
+
+	// Every machine gets a random selection of recipes, repeated when more are asked than available
+	TArray<FSimulatedMachine> Machines;
+	Machines.SetNum(NumMachines);
+	for (FSimulatedMachine& Machine : Machines)
+	{
+		TArray<const FRecipeRecord*> MachineRecipes;
+		for (int32 i = 0; i < NumRecipes; ++i)
+		{
+			MachineRecipes.Add(ValidRecipes[Random.RandHelper(ValidRecipes.Num())]);
+		}
+
+		Machine.Initialize(MachineRecipes, Registry.GetNumShapes());
+	}
+
+	// Generate the stream up front so random numbers are not part of the measure
+	TArray<uint8> Stream;
+	Stream.SetNumUninitialized(NumIngredients);
+	for (uint8& Choice : Stream)
+	{
+		Choice = static_cast<uint8>(Random.RandHelper(256));
+	}
+
+	int64 NumOperations = 0;
+	const uint64 StartCycles = FPlatformTime::Cycles64();
+
+	for (int32 StreamIndex = 0; StreamIndex < NumIngredients; StreamIndex += BatchSize)
+	{
+		const int32 BatchEnd = FMath::Min(StreamIndex + BatchSize, NumIngredients);
+
+		for (FSimulatedMachine& Machine : Machines)
+		{
+			const TArray<int32>& InputShapes = Machine.GetInputShapes();
+
+			for (int32 i = StreamIndex; i < BatchEnd; ++i)
+			{
+				Machine.AddShape(InputShapes[Stream[i] % InputShapes.Num()]);
+			}
+
+			Machine.Evaluate(bDrainIngredients);
+			NumOperations += BatchEnd - StreamIndex + 1;
+		}
+	}
+
+	const double Seconds = FPlatformTime::ToSeconds64(FPlatformTime::Cycles64() - StartCycles);
+
+	int64 NumCrafts = 0;
+	SIZE_T TotalMemory = 0;
+	for (const FSimulatedMachine& Machine : Machines)
+	{
+		NumCrafts += Machine.GetNumCrafts();
+		TotalMemory += Machine.GetAllocatedSize();
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("CraftingSimulation: %d machines, %d recipes each, %d ingredients each, batch %d, %s mode"),
+		NumMachines, NumRecipes, NumIngredients, BatchSize, bDrainIngredients ? TEXT("drain") : TEXT("single"));
+	UE_LOG(LogTemp, Display, TEXT("  Time:            %.3f s"), Seconds);
+	UE_LOG(LogTemp, Display, TEXT("  Crafts:          %lld (%.0f crafts/s)"), NumCrafts, Seconds > 0.0 ? NumCrafts / Seconds : 0.0);
+	UE_LOG(LogTemp, Display, TEXT("  Matching:        %.1f ns/op over %lld ops"), NumOperations > 0 ? Seconds * 1.0e9 / NumOperations : 0.0, NumOperations);
+	UE_LOG(LogTemp, Display, TEXT("  Memory:          %.1f bytes/machine"), static_cast<double>(TotalMemory) / NumMachines);
+
+	return 0;
+}
@@ -0,0 +1,33 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "CraftingSimulationCommandlet.generated.h"
+
+/**
+ * Headless factory throughput simulation.
+ * Loads the recipe and shape tables through UGameplaySettings and runs the machine recipe matching logic
+ * against synthetic ingredient streams, without any world, actor or physics.
+ *
+ * Usage: IBTest -run=CraftingSimulation -nullrhi [-Machines=100] [-Recipes=8] [-Ingredients=10000] [-Batch=1] [-Seed=0] [-Drain]
+ *   Machines:    number of simulated machines
+ *   Recipes:     number of recipes given to each machine
+ *   Ingredients: number of shapes fed to each machine
+ *   Batch:       number of shapes fed between two evaluations, like several overlaps in one frame
+ *   Drain:       evaluate with the bulk drain mode
+ */
+UCLASS()
+class IBTEST_API UCraftingSimulationCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+
+	UCraftingSimulationCommandlet();
+
+	// UCommandlet Begin
+	virtual int32 Main(const FString& Params) override;
+	// UCommandlet End
+};
@@ -0,0 +1,439 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Conveyor.h"
+#include "Components/BoxComponent.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Components/SplineComponent.h"
+#include "Engine/StreamableManager.h"
+#include "Engine/World.h"
+#include "GameFramework/GameStateBase.h"
+#include "Net/UnrealNetwork.h"
+
+#include "Machine.h"
+#include "Shape.h"
+#include "Subsystems/ConveyorSubsystem.h"
+#include "Subsystems/NetDormancySubsystem.h"
+#include "Subsystems/RecipeRegistrySubsystem.h"
+#include "Subsystems/ShapePoolSubsystem.h"
+
+void FConveyorItem::PostReplicatedAdd(const FConveyorItemArray& InArraySerializer)
+{
+	if (InArraySerializer.Conveyor)
+	{
+		InArraySerializer.Conveyor->OnItemAdded(*this);
+	}
+}
+
+void FConveyorItem::PreReplicatedRemove(const FConveyorItemArray& InArraySerializer)
+{
+	if (InArraySerializer.Conveyor)
+	{
+		InArraySerializer.Conveyor->OnItemRemoved(*this);
+	}
+}
+
+// Sets default values
+AConveyor::AConveyor()
+	: Speed(200.f)
+	, ItemSpacing(60.f)
+	, ItemHeight(30.f)
+{
+	// Moved by UConveyorSubsystem with every other belt
+	PrimaryActorTick.bCanEverTick = false;
+
+	Spline = CreateDefaultSubobject<USplineComponent>(TEXT("Spline"));
+	RootComponent = Spline;
+
+	InputBox = CreateDefaultSubobject<UBoxComponent>(TEXT("InputBox"));
+	InputBox->SetBoxExtent(FVector(50.f));
+	InputBox->SetupAttachment(Spline);
+
+	InputBox->OnComponentBeginOverlap.AddDynamic(this, &ThisClass::OnInputBeginOverlap);
+	InputBox->OnComponentEndOverlap.AddDynamic(this, &ThisClass::OnInputEndOverlap);
+
+	SetReplicates(true);
+	SetReplicatingMovement(false);
+
+	// Only sends the items that entered or left the belt since the last flush
+	NetDormancy = DORM_DormantAll;
+
+	ReplicatedItems.Conveyor = this;
+}
+
+void AConveyor::PostInitializeComponents()
+{
+	Super::PostInitializeComponents();
+
+	// Items can be received before BeginPlay
+	BeltLength = Spline->GetSplineLength();
+}
+
+void AConveyor::BeginPlay()
+{
+	Super::BeginPlay();
+
+	if (UConveyorSubsystem* ConveyorSubsystem = GetWorld()->GetSubsystem<UConveyorSubsystem>())
+	{
+		ConveyorSubsystem->RegisterConveyor(this);
+	}
+}
+
+void AConveyor::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (UConveyorSubsystem* ConveyorSubsystem = GetWorld()->GetSubsystem<UConveyorSubsystem>())
+	{
+		ConveyorSubsystem->UnregisterConveyor(this);
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
+bool AConveyor::CanInsertItem() const
+{
+	return ItemDistances.IsEmpty() || ItemDistances.Last() >= ItemSpacing;
+}
+
+bool AConveyor::InsertItem(int32 ShapeIndex)
+{
+	if (!HasAuthority() || ShapeIndex < 0 || ShapeIndex > MAX_uint16 || !CanInsertItem()) return false;
+
+	AddItem(ShapeIndex, 0.f);
+	return true;
+}
+
+bool AConveyor::RestoreItem(int32 ShapeIndex, float Distance)
+{
+	if (!HasAuthority() || ShapeIndex < 0 || ShapeIndex > MAX_uint16) return false;
+
+	AddItem(ShapeIndex, FMath::Clamp(Distance, 0.f, BeltLength));
+	return true;
+}
+
+void AConveyor::RemoveAllItems()
+{
+	if (!HasAuthority()) return;
+
+	ItemDistances.Reset();
+	ItemShapes.Reset();
+	ItemIds.Reset();
+	WaitingShapes.Reset();
+	bItemsDirty = true;
+
+	ReplicatedItems.Items.Reset();
+	ReplicatedItems.MarkArrayDirty();
+	MARK_PROPERTY_DIRTY_AND_FLUSH_DORMANCY(AConveyor, ReplicatedItems, this);
+}
+
+void AConveyor::AddItem(int32 ShapeIndex, float Distance)
+{
+	const uint32 ItemId = NextItemId++;
+	AddSimulatedItem(ItemId, ShapeIndex, Distance);
+
+	// Clients place items by the time they have spent on the belt
+	const float TimeOnBelt = Speed > 0.f ? Distance / Speed : 0.f;
+
+	FConveyorItem& Item = ReplicatedItems.Items.AddDefaulted_GetRef();
+	Item.ItemId = ItemId;
+	Item.ShapeIndex = static_cast<uint16>(ShapeIndex);
+	Item.EnterTime = static_cast<float>(GetServerWorldTime()) - TimeOnBelt;
+
+	ReplicatedItems.MarkItemDirty(Item);
+	MARK_PROPERTY_DIRTY_AND_FLUSH_DORMANCY(AConveyor, ReplicatedItems, this);
+}
+
+void AConveyor::ForEachItem(TFunctionRef<void(int32 ShapeIndex, float Distance)> Visitor) const
+{
+	for (int32 Index = 0; Index < ItemDistances.Num(); ++Index)
+	{
+		Visitor(ItemShapes[Index], ItemDistances[Index]);
+	}
+}
+
+void AConveyor::AdvanceItems(float DeltaTime)
+{
+	const int32 NumItems = ItemDistances.Num();
+	if (NumItems == 0 || Speed <= 0.f) return;
+
+	// Every item moves by the same step, a straight loop over the distances the compiler vectorizes
+	const float Step = Speed * DeltaTime;
+	float* RESTRICT Distances = ItemDistances.GetData();
+	for (int32 Index = 0; Index < NumItems; ++Index)
+	{
+		Distances[Index] += Step;
+	}
+
+	// Gaps don't change while every item moves, only the items right behind a front item held at the end of the belt close up
+	float Limit = BeltLength;
+	for (int32 Index = 0; Index < NumItems && Distances[Index] > Limit; ++Index)
+	{
+		Distances[Index] = Limit;
+		Limit -= ItemSpacing;
+	}
+
+	bItemsDirty = true;
+}
+
+void AConveyor::DeliverItems()
+{
+	// Only the front item can reach the end, the next one is at least ItemSpacing behind
+	int32 NumDeliveredItems = 0;
+	while (NumDeliveredItems < ItemDistances.Num() && ItemDistances[NumDeliveredItems] >= BeltLength && DeliverItem(ItemShapes[NumDeliveredItems]))
+	{
+		++NumDeliveredItems;
+	}
+
+	if (NumDeliveredItems == 0) return;
+
+	// Items leave from the front, in the same order on the server as in the replicated array
+	ItemDistances.RemoveAt(0, NumDeliveredItems, false);
+	ItemShapes.RemoveAt(0, NumDeliveredItems, false);
+	ItemIds.RemoveAt(0, NumDeliveredItems, false);
+
+	ReplicatedItems.Items.RemoveAt(0, NumDeliveredItems, false);
+	ReplicatedItems.MarkArrayDirty();
+	MARK_PROPERTY_DIRTY_AND_FLUSH_DORMANCY(AConveyor, ReplicatedItems, this);
+
+	NumDelivered += NumDeliveredItems;
+	bItemsDirty = true;
+}
+
+bool AConveyor::DeliverItem(int32 ShapeIndex)
+{
+	if (NextConveyor)
+	{
+		return NextConveyor->InsertItem(ShapeIndex);
+	}
+
+	// Machines take the shapes their recipes use
+	if (OutputMachine && OutputMachine->AddItemIngredient(ShapeIndex))
+	{
+		return true;
+	}
+
+	// Belts leading nowhere, and shapes the machine has no recipe for, are dropped as shapes so the belt never jams
+	const URecipeRegistrySubsystem* RecipeRegistry = URecipeRegistrySubsystem::Get(this);
+	const FShapeRecord* Shape = RecipeRegistry ? RecipeRegistry->GetRegistry().GetShape(ShapeIndex) : nullptr;
+	UShapePoolSubsystem* ShapePool = GetWorld()->GetSubsystem<UShapePoolSubsystem>();
+	if (!Shape || !Shape->ShapeClass || !ShapePool) return false;
+
+	return ShapePool->AcquireShape(Shape->ShapeClass, GetItemTransform(BeltLength), this) != nullptr;
+}
+
+void AConveyor::AbsorbWaitingShapes()
+{
+	while (!WaitingShapes.IsEmpty() && CanInsertItem())
+	{
+		AShape* Shape = WaitingShapes[0].Get();
+		WaitingShapes.RemoveAt(0, 1, false);
+
+		if (IsValid(Shape) && !Shape->IsPooled())
+		{
+			AbsorbShape(Shape);
+		}
+	}
+}
+
+bool AConveyor::AbsorbShape(AShape* Shape)
+{
+	const int32 ShapeIndex = Shape->GetShapeIndex();
+	if (ShapeIndex == INDEX_NONE || !CanInsertItem()) return false;
+
+	// Releasing the shape ends its overlap with the input box, it is no longer waiting
+	if (UShapePoolSubsystem* ShapePool = GetWorld()->GetSubsystem<UShapePoolSubsystem>())
+	{
+		ShapePool->ReleaseShape(Shape);
+	}
+	else
+	{
+		Shape->Destroy();
+	}
+
+	return InsertItem(ShapeIndex);
+}
+
+void AConveyor::OnInputBeginOverlap(UPrimitiveComponent* OverlappedComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, int32 OtherBodyIndex, bool bFromSweep, const FHitResult& SweepResult)
+{
+	// Items are only put on the belt by the server, clients get them through replication
+	AShape* Shape = Cast<AShape>(OtherActor);
+	if (!Shape || Shape->IsPooled() || !HasAuthority()) return;
+
+	if (!AbsorbShape(Shape))
+	{
+		WaitingShapes.AddUnique(Shape);
+	}
+}
+
+void AConveyor::OnInputEndOverlap(UPrimitiveComponent* OverlappedComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, int32 OtherBodyIndex)
+{
+	if (AShape* Shape = Cast<AShape>(OtherActor))
+	{
+		WaitingShapes.Remove(Shape);
+	}
+}
+
+void AConveyor::AddSimulatedItem(uint32 ItemId, int32 ShapeIndex, float Distance)
+{
+	// Items enter at the back, replicated items may arrive in any order
+	int32 Index = ItemIds.Num();
+	while (Index > 0 && ItemIds[Index - 1] > ItemId)
+	{
+		--Index;
+	}
+
+	const float Limit = Index > 0 ? ItemDistances[Index - 1] - ItemSpacing : BeltLength;
+
+	ItemDistances.Insert(FMath::Min(Distance, Limit), Index);
+	ItemShapes.Insert(static_cast<uint16>(ShapeIndex), Index);
+	ItemIds.Insert(ItemId, Index);
+
+	bItemsDirty = true;
+}
+
+void AConveyor::RemoveSimulatedItem(uint32 ItemId)
+{
+	const int32 Index = ItemIds.Find(ItemId);
+	if (Index == INDEX_NONE) return;
+
+	ItemDistances.RemoveAt(Index, 1, false);
+	ItemShapes.RemoveAt(Index, 1, false);
+	ItemIds.RemoveAt(Index, 1, false);
+
+	bItemsDirty = true;
+}
+
+void AConveyor::OnItemAdded(const FConveyorItem& Item)
+{
+	// The server already added it
+	if (HasAuthority()) return;
+
+	const float TimeOnBelt = FMath::Max(0.f, static_cast<float>(GetServerWorldTime()) - Item.EnterTime);
+	AddSimulatedItem(Item.ItemId, Item.ShapeIndex, TimeOnBelt * Speed);
+}
+
+void AConveyor::OnItemRemoved(const FConveyorItem& Item)
+{
+	if (HasAuthority()) return;
+
+	RemoveSimulatedItem(Item.ItemId);
+}
+
+void AConveyor::DrawItems()
+{
+	if (!bItemsDirty) return;
+
+	bItemsDirty = false;
+
+	for (TArray<FTransform>& Transforms : ItemTransforms)
+	{
+		Transforms.Reset();
+	}
+
+	for (int32 Index = 0; Index < ItemDistances.Num(); ++Index)
+	{
+		const int32 ShapeIndex = ItemShapes[Index];
+		if (!GetItemMesh(ShapeIndex)) continue;
+
+		ItemTransforms[ShapeIndex].Add(GetItemTransform(ItemDistances[Index]));
+	}
+
+	// Instances are reused in order, only their count and transforms change
+	for (int32 ShapeIndex = 0; ShapeIndex < ItemMeshes.Num(); ++ShapeIndex)
+	{
+		UInstancedStaticMeshComponent* ItemMesh = ItemMeshes[ShapeIndex];
+		if (!ItemMesh) continue;
+
+		const TArray<FTransform>& Transforms = ItemTransforms[ShapeIndex];
+		const int32 NumInstances = ItemMesh->GetInstanceCount();
+
+		if (NumInstances < Transforms.Num())
+		{
+			ItemMesh->AddInstances(TArray<FTransform>(Transforms.GetData() + NumInstances, Transforms.Num() - NumInstances), false, true);
+		}
+		else if (NumInstances > Transforms.Num())
+		{
+			TArray<int32> RemovedInstances;
+			for (int32 InstanceIndex = NumInstances - 1; InstanceIndex >= Transforms.Num(); --InstanceIndex)
+			{
+				RemovedInstances.Add(InstanceIndex);
+			}
+
+			ItemMesh->RemoveInstances(RemovedInstances);
+		}
+
+		if (!Transforms.IsEmpty())
+		{
+			ItemMesh->BatchUpdateInstancesTransforms(0, Transforms, true, true, true);
+		}
+	}
+}
+
+UInstancedStaticMeshComponent* AConveyor::GetItemMesh(int32 ShapeIndex)
+{
+	if (ItemMeshes.IsValidIndex(ShapeIndex) && ItemMeshes[ShapeIndex])
+	{
+		return ItemMeshes[ShapeIndex];
+	}
+
+	URecipeRegistrySubsystem* RecipeRegistry = URecipeRegistrySubsystem::Get(this);
+	if (!RecipeRegistry) return nullptr;
+
+	const FShapeRecord* Shape = RecipeRegistry->GetRegistry().GetShape(ShapeIndex);
+	const AShape* ShapeCDO = Shape && Shape->ShapeClass ? Shape->ShapeClass->GetDefaultObject<AShape>() : nullptr;
+	if (!ShapeCDO)
+	{
+		// Clients can receive items whose class was never loaded, they show up once it is
+		if (Shape && !RequestedShapeClasses.Contains(ShapeIndex))
+		{
+			RequestedShapeClasses.Add(ShapeIndex);
+			ShapeClassesHandles.Add(RecipeRegistry->RequestShapeClasses({ ShapeIndex }, FStreamableDelegate::CreateUObject(this, &ThisClass::OnShapeClassesLoaded)));
+		}
+		return nullptr;
+	}
+
+	UInstancedStaticMeshComponent* ItemMesh = ShapeCDO->CreateInstancedMesh(this);
+	if (!ItemMesh) return nullptr;
+
+	// Items are moved as data, their meshes neither collide nor overlap
+	ItemMesh->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+
+	if (ItemMeshes.Num() <= ShapeIndex)
+	{
+		ItemMeshes.SetNum(ShapeIndex + 1);
+		ItemTransforms.SetNum(ShapeIndex + 1);
+	}
+
+	ItemMeshes[ShapeIndex] = ItemMesh;
+	return ItemMesh;
+}
+
+void AConveyor::OnShapeClassesLoaded()
+{
+	ShapeClassesHandles.RemoveAll([](const TSharedPtr<FStreamableHandle>& Handle) { return !Handle || Handle->HasLoadCompleted(); });
+
+	bItemsDirty = true;
+}
+
+FTransform AConveyor::GetItemTransform(float Distance) const
+{
+	FTransform Transform = Spline->GetTransformAtDistanceAlongSpline(FMath::Clamp(Distance, 0.f, BeltLength), ESplineCoordinateSpace::World);
+	Transform.AddToTranslation(Transform.GetRotation().GetUpVector() * ItemHeight);
+	Transform.SetScale3D(FVector::OneVector);
+
+	return Transform;
+}
+
+double AConveyor::GetServerWorldTime() const
+{
+	const AGameStateBase* GameState = GetWorld()->GetGameState();
+	return GameState ? GameState->GetServerWorldTimeSeconds() : GetWorld()->GetTimeSeconds();
+}
+
+void AConveyor::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	FDoRepLifetimeParams Params;
+	Params.bIsPushBased = true;
+
+	DOREPLIFETIME_WITH_PARAMS_FAST(AConveyor, ReplicatedItems, Params);
+}
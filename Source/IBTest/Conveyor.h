@@ -0,0 +1,240 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "Net/Serialization/FastArraySerializer.h"
+
+#include "Conveyor.generated.h"
+
+class AConveyor;
+class AMachine;
+class AShape;
+class UBoxComponent;
+class UInstancedStaticMeshComponent;
+class USplineComponent;
+class UConveyorSubsystem;
+struct FStreamableHandle;
+
+/** An item entering a belt, only sent when it enters and leaves */
+USTRUCT()
+struct FConveyorItem : public FFastArraySerializerItem
+{
+	GENERATED_BODY()
+
+	/** Increases along the belt, items ahead have smaller ids */
+	UPROPERTY()
+	uint32 ItemId = 0;
+
+	/** Index of the shape in the recipe registry */
+	UPROPERTY()
+	uint16 ShapeIndex = 0;
+
+	/** Server world time at which the item entered the belt, places items received by late joining clients */
+	UPROPERTY()
+	float EnterTime = 0.f;
+
+	void PostReplicatedAdd(const struct FConveyorItemArray& InArraySerializer);
+	void PreReplicatedRemove(const struct FConveyorItemArray& InArraySerializer);
+};
+
+/** Items of a belt, clients move them along the belt themselves */
+USTRUCT()
+struct FConveyorItemArray : public FFastArraySerializer
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	TArray<FConveyorItem> Items;
+
+	/** Belt the array belongs to, adds and removes the simulated items as they replicate */
+	AConveyor* Conveyor = nullptr;
+
+	bool NetDeltaSerialize(FNetDeltaSerializeInfo& DeltaParms)
+	{
+		return FFastArraySerializer::FastArrayDeltaSerialize<FConveyorItem, FConveyorItemArray>(Items, DeltaParms, *this);
+	}
+};
+
+template<>
+struct TStructOpsTypeTraits<FConveyorItemArray> : public TStructOpsTypeTraitsBase2<FConveyorItemArray>
+{
+	enum
+	{
+		WithNetDeltaSerializer = true,
+	};
+};
+
+/**
+ * Belt segment moving shapes along a spline as plain data, with no actor, rigid body or overlap per item.
+ * Items are kept as arrays of distances, shape indices and ids, front item first, and advanced by UConveyorSubsystem in one pass
+ * over the distances per tick. Items only queue up behind each other when the front one cannot leave the belt.
+ * Shapes dropped in the input box at the start of the spline become items. At the end, items go on to NextConveyor, straight
+ * into the ingredients of OutputMachine, or fall off as shape actors when the belt leads nowhere.
+ * Machines put their outputs on their OutputConveyors.
+ * Only item arrivals and departures replicate, clients move the items themselves and draw them with one instanced mesh per shape class.
+ */
+UCLASS()
+class IBTEST_API AConveyor : public AActor
+{
+	GENERATED_BODY()
+
+	friend class UConveyorSubsystem;
+
+private:
+
+	UPROPERTY(Replicated)
+	FConveyorItemArray ReplicatedItems;
+
+	/** Distance along the spline of each item, front item first */
+	TArray<float> ItemDistances;
+
+	/** Registry shape index of each item, front item first */
+	TArray<uint16> ItemShapes;
+
+	/** Id of each item, front item first */
+	TArray<uint32> ItemIds;
+
+	/** Id of the next item put on the belt, server only */
+	uint32 NextItemId = 1;
+
+	/** Shapes touching the input box while the start of the belt was full, server only */
+	TArray<TWeakObjectPtr<AShape>> WaitingShapes;
+
+	/** Instanced meshes by registry shape index, created on first use */
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UInstancedStaticMeshComponent>> ItemMeshes;
+
+	/** Transforms of the items of each shape class, rebuilt when the items are drawn */
+	TArray<TArray<FTransform>> ItemTransforms;
+
+	/** Client: shape classes requested for received items, kept loaded until then */
+	TArray<int32> RequestedShapeClasses;
+	TArray<TSharedPtr<FStreamableHandle>> ShapeClassesHandles;
+
+	/** Length of the spline, cached once the components are initialized */
+	float BeltLength = 0.f;
+
+	/** Items moved or changed since they were last drawn */
+	bool bItemsDirty = false;
+
+	/** Items delivered at the end of the belt, server only */
+	int64 NumDelivered = 0;
+
+protected:
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Conveyor")
+	TObjectPtr<USplineComponent> Spline;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Conveyor")
+	TObjectPtr<UBoxComponent> InputBox;
+
+public:
+
+	/** Belt speed */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Conveyor", meta = (ClampMin = "0.0", Units = "cm/s"))
+	float Speed;
+
+	/** Distance kept between items */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Conveyor", meta = (ClampMin = "1.0", Units = "cm"))
+	float ItemSpacing;
+
+	/** Height of the items above the spline */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Conveyor", meta = (Units = "cm"))
+	float ItemHeight;
+
+	/** Belt the items go on to at the end of this one */
+	UPROPERTY(EditInstanceOnly, Category = "Conveyor")
+	TObjectPtr<AConveyor> NextConveyor;
+
+	/** Machine the items are fed into at the end of the belt, when there is no next belt */
+	UPROPERTY(EditInstanceOnly, Category = "Conveyor")
+	TObjectPtr<AMachine> OutputMachine;
+
+public:
+
+	// Sets default values for this actor's properties
+	AConveyor();
+
+	/** Put a shape at the start of the belt, false if the start of the belt is full (server only) */
+	bool InsertItem(int32 ShapeIndex);
+
+	/** True if an item can be put at the start of the belt right now */
+	bool CanInsertItem() const;
+
+	/** Put a shape behind the last item, as far along the belt as Distance allows (server only) */
+	bool RestoreItem(int32 ShapeIndex, float Distance);
+
+	/** Remove every item and forget the shapes waiting in the input box (server only) */
+	void RemoveAllItems();
+
+	FORCEINLINE int32 GetNumItems() const { return ItemDistances.Num(); }
+
+	FORCEINLINE int64 GetNumDelivered() const { return NumDelivered; }
+
+	/** Call Visitor with the shape index and distance along the belt of every item, front item first */
+	void ForEachItem(TFunctionRef<void(int32 ShapeIndex, float Distance)> Visitor) const;
+
+	// AActor Begin
+	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+	// AActor End
+
+protected:
+
+	virtual void PostInitializeComponents() override;
+
+	// Called when the game starts or when spawned
+	virtual void BeginPlay() override;
+
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	UFUNCTION()
+	void OnInputBeginOverlap(UPrimitiveComponent* OverlappedComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, int32 OtherBodyIndex, bool bFromSweep, const FHitResult& SweepResult);
+
+	UFUNCTION()
+	void OnInputEndOverlap(UPrimitiveComponent* OverlappedComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, int32 OtherBodyIndex);
+
+private:
+
+	/** Move every item forward, items only queue up when the front one is held at the end of the belt */
+	void AdvanceItems(float DeltaTime);
+
+	/** Hand the items at the end of the belt to what follows it, server only */
+	void DeliverItems();
+
+	/** Try again to put the shapes waiting in the input box on the belt, server only */
+	void AbsorbWaitingShapes();
+
+	/** Release a shape to the pool and put it on the belt, false if the belt is full */
+	bool AbsorbShape(AShape* Shape);
+
+	/** Pass the item at the end of the belt on, false if it has to wait */
+	bool DeliverItem(int32 ShapeIndex);
+
+	/** Update the instanced meshes to the item positions */
+	void DrawItems();
+
+	/** Return the instanced mesh of a shape class, null until the class is loaded */
+	UInstancedStaticMeshComponent* GetItemMesh(int32 ShapeIndex);
+
+	/** Client: draw the items that were waiting for their class */
+	void OnShapeClassesLoaded();
+
+	/** Add a new item behind the others and replicate it, server only */
+	void AddItem(int32 ShapeIndex, float Distance);
+
+	/** Add an item at the back of the simulated items, ordered by id */
+	void AddSimulatedItem(uint32 ItemId, int32 ShapeIndex, float Distance);
+
+	void RemoveSimulatedItem(uint32 ItemId);
+
+	/** Client: add a replicated item, placed by the time it has spent on the belt */
+	void OnItemAdded(const FConveyorItem& Item);
+
+	void OnItemRemoved(const FConveyorItem& Item);
+
+	FTransform GetItemTransform(float Distance) const;
+
+	double GetServerWorldTime() const;
+};
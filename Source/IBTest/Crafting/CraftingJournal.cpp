@@ -0,0 +1,161 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Crafting/CraftingJournal.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/RunnableThread.h"
+#include "Misc/FileHelper.h"
+
+namespace
+{
+	/** Records buffered between the game thread and the writer, 1 MiB */
+	const uint32 JournalBufferSize = 1 << 16;
+
+	/** Records moved to the file at once */
+	const int32 JournalWriteChunk = 4096;
+
+	/** Time the writer sleeps when the buffer is empty */
+	const float JournalWriteInterval = 0.01f;
+}
+
+FCraftingJournalWriter::FCraftingJournalWriter()
+	: Records(JournalBufferSize)
+{
+}
+
+FCraftingJournalWriter::~FCraftingJournalWriter()
+{
+	Close();
+}
+
+bool FCraftingJournalWriter::Open(const FString& InFilename, const FCraftingJournalHeader& Header)
+{
+	Close();
+
+	Archive = IFileManager::Get().CreateFileWriter(*InFilename);
+	if (!Archive)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Crafting journal: cannot create %s"), *InFilename);
+		return false;
+	}
+
+	Filename = InFilename;
+	NumWritten = 0;
+	NumDropped = 0;
+	bStopping = false;
+
+	FCraftingJournalHeader HeaderCopy = Header;
+	Archive->Serialize(&HeaderCopy, sizeof(HeaderCopy));
+
+	WriteBuffer.Reserve(JournalWriteChunk);
+
+	Thread = FRunnableThread::Create(this, TEXT("CraftingJournalWriter"), 0, TPri_BelowNormal);
+	if (!Thread)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Crafting journal: cannot start the writer thread for %s"), *InFilename);
+
+		// Leaves a header only file behind, Close would log it as a written journal
+		Archive->Close();
+		delete Archive;
+		Archive = nullptr;
+		return false;
+	}
+
+	return true;
+}
+
+void FCraftingJournalWriter::Close()
+{
+	if (Thread)
+	{
+		// Run writes what is left in the buffer before returning
+		Stop();
+		Thread->WaitForCompletion();
+
+		delete Thread;
+		Thread = nullptr;
+	}
+
+	if (Archive)
+	{
+		Archive->Close();
+		delete Archive;
+		Archive = nullptr;
+
+		UE_LOG(LogTemp, Log, TEXT("Crafting journal: %lld records written to %s, %lld dropped"), GetNumWritten(), *Filename, NumDropped);
+	}
+}
+
+uint32 FCraftingJournalWriter::Run()
+{
+	while (!bStopping.load(std::memory_order_acquire))
+	{
+		if (WriteRecords() == 0)
+		{
+			FPlatformProcess::Sleep(JournalWriteInterval);
+		}
+	}
+
+	while (WriteRecords() > 0) {}
+
+	Archive->Flush();
+	return 0;
+}
+
+void FCraftingJournalWriter::Stop()
+{
+	bStopping.store(true, std::memory_order_release);
+}
+
+int32 FCraftingJournalWriter::WriteRecords()
+{
+	WriteBuffer.Reset();
+
+	FCraftingJournalRecord Record;
+	while (WriteBuffer.Num() < JournalWriteChunk && Records.Dequeue(Record))
+	{
+		WriteBuffer.Add(Record);
+	}
+
+	if (WriteBuffer.Num() > 0)
+	{
+		Archive->Serialize(WriteBuffer.GetData(), WriteBuffer.Num() * sizeof(FCraftingJournalRecord));
+		NumWritten.fetch_add(WriteBuffer.Num(), std::memory_order_relaxed);
+	}
+
+	return WriteBuffer.Num();
+}
+
+bool LoadCraftingJournal(const FString& Filename, FCraftingJournalHeader& OutHeader, TArray<FCraftingJournalRecord>& OutRecords)
+{
+	TArray<uint8> Data;
+	if (!FFileHelper::LoadFileToArray(Data, *Filename))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Crafting journal: cannot read %s"), *Filename);
+		return false;
+	}
+
+	if (Data.Num() < sizeof(FCraftingJournalHeader))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Crafting journal: %s is too small"), *Filename);
+		return false;
+	}
+
+	FMemory::Memcpy(&OutHeader, Data.GetData(), sizeof(FCraftingJournalHeader));
+
+	if (OutHeader.Magic != FCraftingJournalHeader::ExpectedMagic
+		|| OutHeader.Version == 0
+		|| OutHeader.Version > FCraftingJournalHeader::LatestVersion
+		|| OutHeader.RecordSize != sizeof(FCraftingJournalRecord))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Crafting journal: %s is not a journal of version %u or older"), *Filename, FCraftingJournalHeader::LatestVersion);
+		return false;
+	}
+
+	// A journal cut short by a crash ends with a partial record, which is ignored
+	const int32 NumRecords = (Data.Num() - sizeof(FCraftingJournalHeader)) / sizeof(FCraftingJournalRecord);
+	OutRecords.SetNumUninitialized(NumRecords);
+	FMemory::Memcpy(OutRecords.GetData(), Data.GetData() + sizeof(FCraftingJournalHeader), NumRecords * sizeof(FCraftingJournalRecord));
+
+	return true;
+}
@@ -0,0 +1,149 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/CircularQueue.h"
+#include "HAL/Runnable.h"
+#include <atomic>
+
+class FRunnableThread;
+
+/** What a journal record describes, see FCraftingJournalRecord */
+enum class ECraftingJournalEvent : uint8
+{
+	/** A machine started recording. Index is bEnabled, Count is bDrainIngredients */
+	MachineAdded,
+
+	/** One recipe of a machine, in RecipeIDs order. Index is the registry recipe index */
+	MachineRecipe,
+
+	/** A shape entered the ingredients of a machine. Index is the registry shape index */
+	IngredientAdded,
+
+	/** A shape left the ingredients of a machine without being consumed. Index is the registry shape index */
+	IngredientRemoved,
+
+	/** The machine was turned on or off. Index is the new bEnabled */
+	Enabled,
+
+	/** AMachine::EvaluateRecipes started */
+	EvaluationBegin,
+
+	/** A recipe was completed, written right before its outputs spawn. Index is the matcher recipe index, Count the number of crafts */
+	Craft,
+
+	/** AMachine::EvaluateRecipes ended */
+	EvaluationEnd,
+
+	/** The machine recipes were initialized again, its ingredients are cleared and the MachineRecipe records that follow replace its recipes */
+	RecipesChanged,
+};
+
+/**
+ * One entry of the crafting journal.
+ * Fixed size and written as raw memory, so journals are read back on a platform of the same endianness.
+ */
+struct FCraftingJournalRecord
+{
+	/** World time of the event */
+	float Time;
+
+	/** Id given to the machine by the journal when it started recording */
+	uint16 Machine;
+
+	ECraftingJournalEvent Type;
+
+	uint8 Padding;
+
+	int32 Index;
+
+	int32 Count;
+};
+
+static_assert(sizeof(FCraftingJournalRecord) == 16, "Crafting journal records are read back as raw memory");
+
+/** Start of a journal file, followed by the records */
+struct FCraftingJournalHeader
+{
+	static constexpr uint32 ExpectedMagic = 0x4A424249; // "IBBJ"
+	/** 2: RecipesChanged records */
+	static constexpr uint32 LatestVersion = 2;
+
+	uint32 Magic = ExpectedMagic;
+
+	uint32 Version = LatestVersion;
+
+	uint32 RecordSize = sizeof(FCraftingJournalRecord);
+
+	/** Size of the registry the journal was recorded with, replays need the same tables */
+	int32 NumShapes = 0;
+
+	int32 NumRecipes = 0;
+};
+
+/**
+ * Streams journal records to a file from a background thread.
+ * The game thread pushes records into a lock free single producer single consumer ring buffer and never waits on the disk,
+ * records pushed while the buffer is full are dropped and counted.
+ */
+class IBTEST_API FCraftingJournalWriter : public FRunnable
+{
+public:
+
+	FCraftingJournalWriter();
+	virtual ~FCraftingJournalWriter();
+
+	/** Create the file, write the header and start the writer thread. Return false if the file cannot be created */
+	bool Open(const FString& InFilename, const FCraftingJournalHeader& Header);
+
+	/** Write the records left in the buffer, then stop the thread and close the file */
+	void Close();
+
+	/** Queue a record, only called from the game thread */
+	FORCEINLINE void Add(const FCraftingJournalRecord& Record)
+	{
+		if (!Records.Enqueue(Record))
+		{
+			++NumDropped;
+		}
+	}
+
+	FORCEINLINE bool IsOpen() const { return Thread != nullptr; }
+
+	FORCEINLINE const FString& GetFilename() const { return Filename; }
+
+	FORCEINLINE int64 GetNumDropped() const { return NumDropped; }
+
+	FORCEINLINE int64 GetNumWritten() const { return NumWritten.load(std::memory_order_relaxed); }
+
+	// FRunnable Begin
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+	// FRunnable End
+
+private:
+
+	/** Write every record currently in the buffer, return the number written */
+	int32 WriteRecords();
+
+	TCircularQueue<FCraftingJournalRecord> Records;
+
+	/** Records moved out of the ring buffer before being written, writer thread only */
+	TArray<FCraftingJournalRecord> WriteBuffer;
+
+	FArchive* Archive = nullptr;
+
+	FRunnableThread* Thread = nullptr;
+
+	FString Filename;
+
+	std::atomic<bool> bStopping{ false };
+
+	std::atomic<int64> NumWritten{ 0 };
+
+	int64 NumDropped = 0;
+};
+
+/** Read a journal file written by FCraftingJournalWriter. Return false and log an error if it is missing or invalid */
+IBTEST_API bool LoadCraftingJournal(const FString& Filename, FCraftingJournalHeader& OutHeader, TArray<FCraftingJournalRecord>& OutRecords);
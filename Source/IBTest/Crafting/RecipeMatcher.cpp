@@ -0,0 +1,194 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Crafting/RecipeMatcher.h"
+#include "Crafting/RecipeRegistry.h"
+
+void FRecipeMatcher::Compile(const TArray<const FRecipeRecord*>& InRecipes, int32 NumRegistryShapes)
+{
+	Reset();
+
+	ShapeIndices.Init(INDEX_NONE, NumRegistryShapes);
+	int32 NumShapes = 0;
+
+	Recipes.Reserve(InRecipes.Num());
+	for (const FRecipeRecord* Record : InRecipes)
+	{
+		if (!Record) continue;
+
+		FCompiledRecipe& Recipe = Recipes.AddDefaulted_GetRef();
+		Recipe.Record = Record;
+		Recipe.Requirements.Reserve(Record->InShapes.Num());
+
+		for (const FRecipeIngredient& Ingredient : Record->InShapes)
+		{
+			if (Ingredient.Count <= 0 || !ShapeIndices.IsValidIndex(Ingredient.ShapeIndex)) continue;
+
+			int32& ShapeIndex = ShapeIndices[Ingredient.ShapeIndex];
+			if (ShapeIndex == INDEX_NONE)
+			{
+				ShapeIndex = NumShapes++;
+			}
+
+			Recipe.Requirements.Add({ ShapeIndex, Ingredient.Count });
+			Recipe.TotalShapes += Ingredient.Count;
+		}
+
+		// A recipe without ingredients would always be satisfied
+		if (Recipe.Requirements.IsEmpty())
+		{
+			Recipes.Pop();
+		}
+	}
+
+	// Sort recipes by number of required ingredients in descending order
+	// In case of different recipes requiring the same ingredients, we will give priority to the one with most ingredients
+	// e.g. Recipe1: {2 cubes}, Recipe2: {2 cubes, 1 sphere} -> choose Recipe2 in this case
+	Recipes.StableSort([](const FCompiledRecipe& A, const FCompiledRecipe& B) {
+		return A.TotalShapes > B.TotalShapes;
+		});
+
+	// Build the inverted index once recipes are in their final order, so each usage list is in priority order too
+	ShapeUsages.SetNum(NumShapes);
+	ShapeCounts.SetNumZeroed(NumShapes);
+	UnmetRequirements.SetNumUninitialized(Recipes.Num());
+
+	for (int32 RecipeIndex = 0; RecipeIndex < Recipes.Num(); ++RecipeIndex)
+	{
+		const FCompiledRecipe& Recipe = Recipes[RecipeIndex];
+		for (const FRecipeRequirement& Requirement : Recipe.Requirements)
+		{
+			ShapeUsages[Requirement.ShapeIndex].Add({ RecipeIndex, Requirement.Count });
+		}
+
+		UnmetRequirements[RecipeIndex] = Recipe.Requirements.Num();
+	}
+
+	NumSatisfiedRecipes = 0;
+}
+
+void FRecipeMatcher::Reset()
+{
+	Recipes.Reset();
+	ShapeIndices.Reset();
+	ShapeUsages.Reset();
+	ShapeCounts.Reset();
+	UnmetRequirements.Reset();
+	NumSatisfiedRecipes = 0;
+}
+
+void FRecipeMatcher::ResetCounts()
+{
+	FMemory::Memzero(ShapeCounts.GetData(), ShapeCounts.Num() * sizeof(int32));
+
+	for (int32 RecipeIndex = 0; RecipeIndex < Recipes.Num(); ++RecipeIndex)
+	{
+		UnmetRequirements[RecipeIndex] = Recipes[RecipeIndex].Requirements.Num();
+	}
+
+	NumSatisfiedRecipes = 0;
+}
+
+void FRecipeMatcher::AddShape(int32 ShapeIndex)
+{
+	check(ShapeCounts.IsValidIndex(ShapeIndex));
+
+	const int32 OldCount = ShapeCounts[ShapeIndex]++;
+	UpdateRecipes(ShapeIndex, OldCount, OldCount + 1);
+}
+
+void FRecipeMatcher::RemoveShape(int32 ShapeIndex)
+{
+	RemoveShapes(ShapeIndex, 1);
+}
+
+void FRecipeMatcher::RemoveShapes(int32 ShapeIndex, int32 Count)
+{
+	check(ShapeCounts.IsValidIndex(ShapeIndex));
+
+	const int32 OldCount = ShapeCounts[ShapeIndex];
+	const int32 NewCount = FMath::Max(OldCount - Count, 0);
+	if (OldCount == NewCount) return;
+
+	ShapeCounts[ShapeIndex] = NewCount;
+	UpdateRecipes(ShapeIndex, OldCount, NewCount);
+}
+
+void FRecipeMatcher::ComputeCraftCounts(TArray<FRecipeCraft>& OutCrafts) const
+{
+	OutCrafts.Reset();
+	if (NumSatisfiedRecipes == 0) return;
+
+	TArray<int32, TInlineAllocator<32>> RemainingCounts(ShapeCounts);
+
+	for (int32 RecipeIndex = 0; RecipeIndex < Recipes.Num(); ++RecipeIndex)
+	{
+		// Recipes not satisfied by the full counters can't be satisfied by what is left of them
+		if (!IsRecipeSatisfied(RecipeIndex)) continue;
+
+		const FCompiledRecipe& Recipe = Recipes[RecipeIndex];
+
+		int32 NumCrafts = MAX_int32;
+		for (const FRecipeRequirement& Requirement : Recipe.Requirements)
+		{
+			NumCrafts = FMath::Min(NumCrafts, RemainingCounts[Requirement.ShapeIndex] / Requirement.Count);
+		}
+
+		if (NumCrafts <= 0) continue;
+
+		for (const FRecipeRequirement& Requirement : Recipe.Requirements)
+		{
+			RemainingCounts[Requirement.ShapeIndex] -= NumCrafts * Requirement.Count;
+		}
+
+		OutCrafts.Add({ RecipeIndex, NumCrafts });
+	}
+}
+
+void FRecipeMatcher::UpdateRecipes(int32 ShapeIndex, int32 OldCount, int32 NewCount)
+{
+	for (const FShapeUsage& Usage : ShapeUsages[ShapeIndex])
+	{
+		const bool bWasMet = OldCount >= Usage.Count;
+		const bool bIsMet = NewCount >= Usage.Count;
+		if (bWasMet == bIsMet) continue;
+
+		int32& Unmet = UnmetRequirements[Usage.RecipeIndex];
+		if (bIsMet)
+		{
+			if (--Unmet == 0)
+			{
+				++NumSatisfiedRecipes;
+			}
+		}
+		else
+		{
+			if (Unmet++ == 0)
+			{
+				--NumSatisfiedRecipes;
+			}
+		}
+	}
+}
+
+SIZE_T FRecipeMatcher::GetAllocatedSize() const
+{
+	SIZE_T Size = sizeof(*this);
+
+	Size += Recipes.GetAllocatedSize();
+	for (const FCompiledRecipe& Recipe : Recipes)
+	{
+		Size += Recipe.Requirements.GetAllocatedSize();
+	}
+
+	Size += ShapeUsages.GetAllocatedSize();
+	for (const TArray<FShapeUsage>& Usages : ShapeUsages)
+	{
+		Size += Usages.GetAllocatedSize();
+	}
+
+	Size += ShapeIndices.GetAllocatedSize();
+	Size += ShapeCounts.GetAllocatedSize();
+	Size += UnmetRequirements.GetAllocatedSize();
+
+	return Size;
+}
@@ -0,0 +1,126 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+struct FRecipeRecord;
+
+/** Amount of a single shape required by a compiled recipe */
+struct FRecipeRequirement
+{
+	/** Dense shape index inside the owning matcher */
+	int32 ShapeIndex = INDEX_NONE;
+
+	/** Number of shapes needed */
+	int32 Count = 0;
+};
+
+/** Recipe flattened into dense shape indices */
+struct FCompiledRecipe
+{
+	/** Source record of the recipe */
+	const FRecipeRecord* Record = nullptr;
+
+	/** Shapes required by the recipe, one entry per shape */
+	TArray<FRecipeRequirement> Requirements;
+
+	/** Sum of all required shapes, used for priority */
+	int32 TotalShapes = 0;
+};
+
+/** Number of times a recipe can be completed */
+struct FRecipeCraft
+{
+	/** Index of the recipe in the matcher */
+	int32 RecipeIndex;
+
+	/** Number of times the recipe can be completed */
+	int32 NumCrafts;
+};
+
+/**
+ * Incremental recipe matcher.
+ * Recipes are compiled once into requirement vectors over dense shape indices, with an inverted index
+ * from each shape to the recipes using it. Shape counters are kept up to date as ingredients come and go,
+ * so that only the recipes affected by a change are re-evaluated.
+ */
+class IBTEST_API FRecipeMatcher
+{
+public:
+
+	/** Compile the given recipes, sorted by number of required ingredients in descending order */
+	void Compile(const TArray<const FRecipeRecord*>& InRecipes, int32 NumRegistryShapes);
+
+	/** Remove all recipes and counters */
+	void Reset();
+
+	/** Reset all shape counters to zero, keeping compiled recipes */
+	void ResetCounts();
+
+	/** Return the dense index of a registry shape, or INDEX_NONE if no recipe uses it */
+	FORCEINLINE int32 FindShapeIndex(int32 RegistryShapeIndex) const
+	{
+		return ShapeIndices.IsValidIndex(RegistryShapeIndex) ? ShapeIndices[RegistryShapeIndex] : INDEX_NONE;
+	}
+
+	/** Update counters after a shape has been added */
+	void AddShape(int32 ShapeIndex);
+
+	/** Update counters after a shape has been removed */
+	void RemoveShape(int32 ShapeIndex);
+
+	/** Update counters after several shapes of the same kind have been removed */
+	void RemoveShapes(int32 ShapeIndex, int32 Count);
+
+	/**
+	 * Work out how many times each recipe can be completed from the current counters, in priority order.
+	 * Recipes with higher priority use the ingredients first. Counters are left untouched.
+	 */
+	void ComputeCraftCounts(TArray<FRecipeCraft>& OutCrafts) const;
+
+	FORCEINLINE int32 GetNumShapes() const { return ShapeCounts.Num(); }
+
+	FORCEINLINE int32 GetNumRecipes() const { return Recipes.Num(); }
+
+	FORCEINLINE const FCompiledRecipe& GetRecipe(int32 RecipeIndex) const { return Recipes[RecipeIndex]; }
+
+	FORCEINLINE int32 GetShapeCount(int32 ShapeIndex) const { return ShapeCounts[ShapeIndex]; }
+
+	FORCEINLINE bool IsRecipeSatisfied(int32 RecipeIndex) const { return UnmetRequirements[RecipeIndex] == 0; }
+
+	FORCEINLINE bool HasSatisfiedRecipes() const { return NumSatisfiedRecipes > 0; }
+
+	/** Memory used by the matcher, including its own size */
+	SIZE_T GetAllocatedSize() const;
+
+private:
+
+	/** Recipe using a shape and the amount of that shape it requires */
+	struct FShapeUsage
+	{
+		int32 RecipeIndex;
+		int32 Count;
+	};
+
+	/** Re-evaluate the recipes using a shape after its counter went from OldCount to NewCount */
+	void UpdateRecipes(int32 ShapeIndex, int32 OldCount, int32 NewCount);
+
+	/** Compiled recipes in priority order */
+	TArray<FCompiledRecipe> Recipes;
+
+	/** Registry shape index to dense shape index */
+	TArray<int32> ShapeIndices;
+
+	/** Inverted index: for each shape, the recipes that use it */
+	TArray<TArray<FShapeUsage>> ShapeUsages;
+
+	/** Number of shapes currently available, per shape index */
+	TArray<int32> ShapeCounts;
+
+	/** Number of requirements not met yet, per recipe */
+	TArray<int32> UnmetRequirements;
+
+	/** Number of recipes that can currently be completed */
+	int32 NumSatisfiedRecipes = 0;
+};
@@ -0,0 +1,105 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Crafting/RecipeRegistry.h"
+#include "Engine/DataTable.h"
+#include "UObject/Package.h"
+
+#include "GameplaySettings.h"
+#include "Shape.h"
+#include "Data/RecipeGraphAsset.h"
+
+void FRecipeRegistry::Build(const UDataTable* RecipeTable, const UDataTable* ShapeTable)
+{
+	// Bake the tables like the asset does, so recipes are validated, analysed and ordered the same way on both paths
+	URecipeGraphAsset* RecipeGraph = NewObject<URecipeGraphAsset>(GetTransientPackage());
+	RecipeGraph->RecipeTable = TSoftObjectPtr<UDataTable>(FSoftObjectPath(RecipeTable));
+	RecipeGraph->ShapeTable = TSoftObjectPtr<UDataTable>(FSoftObjectPath(ShapeTable));
+	RecipeGraph->Bake();
+
+	Build(*RecipeGraph);
+}
+
+void FRecipeRegistry::Build(const URecipeGraphAsset& RecipeGraph)
+{
+	Shapes.Reset(RecipeGraph.GetNumShapes());
+	Recipes.Reset(RecipeGraph.GetNumRecipes());
+	ShapeIndices.Reset();
+	RecipeIndices.Reset();
+
+	for (int32 ShapeIndex = 0; ShapeIndex < RecipeGraph.GetNumShapes(); ++ShapeIndex)
+	{
+		FShapeRecord& Shape = Shapes.AddDefaulted_GetRef();
+		Shape.ShapeID = RecipeGraph.ShapeIDs[ShapeIndex];
+		Shape.ShapeClassPath = RecipeGraph.ShapeClasses[ShapeIndex];
+		Shape.ShapeClass = Shape.ShapeClassPath.Get();
+
+		ShapeIndices.Add(Shape.ShapeID, ShapeIndex);
+	}
+
+	for (int32 RecipeIndex = 0; RecipeIndex < RecipeGraph.GetNumRecipes(); ++RecipeIndex)
+	{
+		FRecipeRecord& Recipe = Recipes.AddDefaulted_GetRef();
+		Recipe.RecipeID = RecipeGraph.RecipeIDs[RecipeIndex];
+		Recipe.Name = RecipeGraph.RecipeNames[RecipeIndex];
+		Recipe.OutShapeIndex = RecipeGraph.RecipeOutShapes[RecipeIndex];
+		Recipe.TotalShapes = RecipeGraph.RecipeTotalShapes[RecipeIndex];
+
+		const int32 FirstRequirement = RecipeGraph.RequirementOffsets[RecipeIndex];
+		const int32 LastRequirement = RecipeGraph.RequirementOffsets[RecipeIndex + 1];
+		Recipe.InShapes.Reserve(LastRequirement - FirstRequirement);
+		for (int32 Requirement = FirstRequirement; Requirement < LastRequirement; ++Requirement)
+		{
+			Recipe.InShapes.Add({ RecipeGraph.RequirementShapes[Requirement], RecipeGraph.RequirementCounts[Requirement] });
+		}
+
+		RecipeIndices.Add(Recipe.RecipeID, RecipeIndex);
+	}
+}
+
+void FRecipeRegistry::Build(const UGameplaySettings& Settings)
+{
+	const URecipeGraphAsset* RecipeGraph = Settings.RecipeGraph.LoadSynchronous();
+	if (RecipeGraph && RecipeGraph->IsBaked())
+	{
+		Build(*RecipeGraph);
+		return;
+	}
+
+	if (!Settings.RecipeGraph.IsNull())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Recipe graph %s is missing or not baked, recipes are baked from the data tables"), *Settings.RecipeGraph.ToString());
+	}
+
+	Build(Settings.RecipeDataTable.LoadSynchronous(), Settings.ShapeDataTable.LoadSynchronous());
+}
+
+void FRecipeRegistry::ResolveShapeClasses()
+{
+	for (FShapeRecord& Shape : Shapes)
+	{
+		if (!Shape.ShapeClass)
+		{
+			Shape.ShapeClass = Shape.ShapeClassPath.Get();
+		}
+	}
+}
+
+int32 FRecipeRegistry::FindShapeIndex(const FName& ShapeID) const
+{
+	const int32* ShapeIndex = ShapeIndices.Find(ShapeID);
+	return ShapeIndex ? *ShapeIndex : INDEX_NONE;
+}
+
+int32 FRecipeRegistry::FindRecipeIndex(const FName& RecipeID) const
+{
+	const int32* RecipeIndex = RecipeIndices.Find(RecipeID);
+	return RecipeIndex ? *RecipeIndex : INDEX_NONE;
+}
+
+const FRecipeRecord* FRecipeRegistry::GetRandomRecipe() const
+{
+	if (Recipes.IsEmpty()) return nullptr;
+
+	const int32 RecipeIndex = FMath::RandRange(0, Recipes.Num() - 1);
+	return &Recipes[RecipeIndex];
+}
@@ -0,0 +1,128 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/SubclassOf.h"
+#include "RecipeRegistry.generated.h"
+
+class AShape;
+class UDataTable;
+class UGameplaySettings;
+class URecipeGraphAsset;
+
+/** Immutable shape entry resolved from the shape data table */
+USTRUCT()
+struct FShapeRecord
+{
+	GENERATED_BODY()
+
+	/** Row name of the shape, matching AShape::ShapeID */
+	UPROPERTY()
+	FName ShapeID;
+
+	/** Soft reference to the class of the shape actor, streamed in asynchronously */
+	UPROPERTY()
+	TSoftClassPtr<AShape> ShapeClassPath;
+
+	/** Resolved class of the shape actor, null until ShapeClassPath has been loaded */
+	UPROPERTY()
+	TSubclassOf<AShape> ShapeClass;
+};
+
+/** Amount of a shape required by a recipe record */
+USTRUCT()
+struct FRecipeIngredient
+{
+	GENERATED_BODY()
+
+	/** Index of the shape in the registry */
+	UPROPERTY()
+	int32 ShapeIndex = INDEX_NONE;
+
+	/** Number of shapes needed */
+	UPROPERTY()
+	int32 Count = 0;
+};
+
+/** Immutable recipe entry resolved from the recipe data table */
+USTRUCT()
+struct FRecipeRecord
+{
+	GENERATED_BODY()
+
+	/** Row name of the recipe */
+	UPROPERTY()
+	FName RecipeID;
+
+	/** Display name of the recipe */
+	UPROPERTY()
+	FText Name;
+
+	/** Shapes required for the recipe */
+	UPROPERTY()
+	TArray<FRecipeIngredient> InShapes;
+
+	/** Index of the shape produced by the recipe */
+	UPROPERTY()
+	int32 OutShapeIndex = INDEX_NONE;
+
+	/** Sum of all required shapes */
+	UPROPERTY()
+	int32 TotalShapes = 0;
+};
+
+/**
+ * Flat tables of recipes and shapes with stable integer indices.
+ * Built once from the recipe and shape data tables, records are never modified afterwards
+ * so pointers and indices can be cached by machines and shapes.
+ */
+USTRUCT()
+struct IBTEST_API FRecipeRegistry
+{
+	GENERATED_BODY()
+
+public:
+
+	/** Bake the given data tables into a transient recipe graph and build from it, shape classes are not loaded */
+	void Build(const UDataTable* RecipeTable, const UDataTable* ShapeTable);
+
+	/** Build all records from a baked recipe graph, recipes are already validated and in priority order */
+	void Build(const URecipeGraphAsset& RecipeGraph);
+
+	/** Build from the baked recipe graph of the settings, or bake their data tables if the graph is not set or not baked */
+	void Build(const UGameplaySettings& Settings);
+
+	/** Cache the classes of shapes that have been loaded since the last call */
+	void ResolveShapeClasses();
+
+	/** Return the index of a shape, or INDEX_NONE if it does not exist. Not meant for hot paths */
+	int32 FindShapeIndex(const FName& ShapeID) const;
+
+	/** Return the index of a recipe, or INDEX_NONE if it does not exist. Not meant for hot paths */
+	int32 FindRecipeIndex(const FName& RecipeID) const;
+
+	FORCEINLINE int32 GetNumShapes() const { return Shapes.Num(); }
+
+	FORCEINLINE int32 GetNumRecipes() const { return Recipes.Num(); }
+
+	FORCEINLINE const FShapeRecord* GetShape(int32 ShapeIndex) const { return Shapes.IsValidIndex(ShapeIndex) ? &Shapes[ShapeIndex] : nullptr; }
+
+	FORCEINLINE const FRecipeRecord* GetRecipe(int32 RecipeIndex) const { return Recipes.IsValidIndex(RecipeIndex) ? &Recipes[RecipeIndex] : nullptr; }
+
+	FORCEINLINE bool IsShapeClassLoaded(int32 ShapeIndex) const { return Shapes.IsValidIndex(ShapeIndex) && Shapes[ShapeIndex].ShapeClass; }
+
+	const FRecipeRecord* GetRandomRecipe() const;
+
+private:
+
+	UPROPERTY()
+	TArray<FShapeRecord> Shapes;
+
+	UPROPERTY()
+	TArray<FRecipeRecord> Recipes;
+
+	TMap<FName, int32> ShapeIndices;
+
+	TMap<FName, int32> RecipeIndices;
+};
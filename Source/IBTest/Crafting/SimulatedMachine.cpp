@@ -0,0 +1,112 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Crafting/SimulatedMachine.h"
+#include "Crafting/RecipeRegistry.h"
+
+void FSimulatedMachine::Initialize(const TArray<const FRecipeRecord*>& Recipes, int32 NumRegistryShapes)
+{
+	Matcher.Compile(Recipes, NumRegistryShapes);
+	NumCrafts = 0;
+
+	InputShapes.Reset();
+	for (const FRecipeRecord* Recipe : Recipes)
+	{
+		if (!Recipe) continue;
+
+		for (const FRecipeIngredient& Ingredient : Recipe->InShapes)
+		{
+			InputShapes.AddUnique(Ingredient.ShapeIndex);
+		}
+	}
+}
+
+bool FSimulatedMachine::AddShape(int32 RegistryShapeIndex)
+{
+	const int32 ShapeIndex = Matcher.FindShapeIndex(RegistryShapeIndex);
+	if (ShapeIndex == INDEX_NONE) return false;
+
+	Matcher.AddShape(ShapeIndex);
+	return true;
+}
+
+bool FSimulatedMachine::RemoveShape(int32 RegistryShapeIndex)
+{
+	const int32 ShapeIndex = Matcher.FindShapeIndex(RegistryShapeIndex);
+	if (ShapeIndex == INDEX_NONE || Matcher.GetShapeCount(ShapeIndex) == 0) return false;
+
+	Matcher.RemoveShape(ShapeIndex);
+	return true;
+}
+
+int32 FSimulatedMachine::Evaluate(bool bDrainIngredients)
+{
+	if (!bEnabled || !Matcher.HasSatisfiedRecipes()) return 0;
+
+	const int64 NumCraftsBefore = NumCrafts;
+
+	if (bDrainIngredients)
+	{
+		TArray<FRecipeCraft> Crafts;
+		Matcher.ComputeCraftCounts(Crafts);
+
+		// Everything is consumed before the outputs land in the machine, as in AMachine::DrainRecipes
+		for (const FRecipeCraft& Craft : Crafts)
+		{
+			ConsumeIngredients(Craft.RecipeIndex, Craft.NumCrafts);
+		}
+
+		for (const FRecipeCraft& Craft : Crafts)
+		{
+			AddOutputs(Craft.RecipeIndex, Craft.NumCrafts);
+		}
+	}
+	else
+	{
+		do
+		{
+			for (int32 RecipeIndex = 0; RecipeIndex < Matcher.GetNumRecipes(); ++RecipeIndex)
+			{
+				if (Matcher.IsRecipeSatisfied(RecipeIndex))
+				{
+					ConsumeIngredients(RecipeIndex, 1);
+					AddOutputs(RecipeIndex, 1);
+				}
+			}
+		}
+		while (Matcher.HasSatisfiedRecipes());
+	}
+
+	return static_cast<int32>(NumCrafts - NumCraftsBefore);
+}
+
+void FSimulatedMachine::ConsumeIngredients(int32 RecipeIndex, int32 NumRecipeCrafts)
+{
+	for (const FRecipeRequirement& Requirement : Matcher.GetRecipe(RecipeIndex).Requirements)
+	{
+		Matcher.RemoveShapes(Requirement.ShapeIndex, Requirement.Count * NumRecipeCrafts);
+	}
+
+	NumCrafts += NumRecipeCrafts;
+}
+
+void FSimulatedMachine::AddOutputs(int32 RecipeIndex, int32 NumRecipeCrafts)
+{
+	if (OutputHandler)
+	{
+		OutputHandler(RecipeIndex, NumRecipeCrafts);
+		return;
+	}
+
+	const int32 OutShapeIndex = Matcher.FindShapeIndex(Matcher.GetRecipe(RecipeIndex).Record->OutShapeIndex);
+	if (OutShapeIndex == INDEX_NONE) return;
+
+	for (int32 i = 0; i < NumRecipeCrafts; ++i)
+	{
+		Matcher.AddShape(OutShapeIndex);
+	}
+}
+
+SIZE_T FSimulatedMachine::GetAllocatedSize() const
+{
+	return sizeof(*this) - sizeof(Matcher) + Matcher.GetAllocatedSize() + InputShapes.GetAllocatedSize();
+}
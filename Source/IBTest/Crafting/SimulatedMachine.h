@@ -0,0 +1,72 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Crafting/RecipeMatcher.h"
+
+struct FRecipeRecord;
+
+/**
+ * Machine without actors, physics or overlaps.
+ * Runs the same recipe matcher and evaluation order as AMachine on plain ingredient counters,
+ * outputs are fed straight back as ingredients like shapes spawned inside the machine box.
+ * Used to benchmark and replay crafting workloads headlessly.
+ */
+class IBTEST_API FSimulatedMachine
+{
+public:
+
+	/** Compile the given recipes */
+	void Initialize(const TArray<const FRecipeRecord*>& Recipes, int32 NumRegistryShapes);
+
+	/** Add an ingredient, shapes unused by the machine recipes are ignored. Return true if it was used */
+	bool AddShape(int32 RegistryShapeIndex);
+
+	/** Remove an ingredient. Return true if it was tracked by the machine */
+	bool RemoveShape(int32 RegistryShapeIndex);
+
+	/**
+	 * Complete every recipe that can be made from the current ingredients, see AMachine::EvaluateRecipes.
+	 * Return the number of crafts.
+	 */
+	int32 Evaluate(bool bDrainIngredients);
+
+	/** Same as AMachine::SetMachineEnabled, a disabled machine does not craft */
+	FORCEINLINE void SetEnabled(bool bInEnabled) { bEnabled = bInEnabled; }
+
+	FORCEINLINE bool IsEnabled() const { return bEnabled; }
+
+	/**
+	 * Give the outputs of every craft to the handler instead of feeding them back as ingredients.
+	 * Called with the matcher recipe index and number of crafts, at the point AMachine spawns the outputs.
+	 */
+	FORCEINLINE void SetOutputHandler(TFunction<void(int32, int32)> InOutputHandler) { OutputHandler = MoveTemp(InOutputHandler); }
+
+	FORCEINLINE const FRecipeMatcher& GetMatcher() const { return Matcher; }
+
+	FORCEINLINE int64 GetNumCrafts() const { return NumCrafts; }
+
+	/** Registry indices of all shapes used as ingredients by the machine recipes */
+	FORCEINLINE const TArray<int32>& GetInputShapes() const { return InputShapes; }
+
+	SIZE_T GetAllocatedSize() const;
+
+private:
+
+	/** Consume the ingredients of NumRecipeCrafts completions of a recipe */
+	void ConsumeIngredients(int32 RecipeIndex, int32 NumRecipeCrafts);
+
+	/** Feed the outputs of NumRecipeCrafts completions of a recipe back into the machine */
+	void AddOutputs(int32 RecipeIndex, int32 NumRecipeCrafts);
+
+	FRecipeMatcher Matcher;
+
+	TArray<int32> InputShapes;
+
+	TFunction<void(int32, int32)> OutputHandler;
+
+	bool bEnabled = true;
+
+	int64 NumCrafts = 0;
+};
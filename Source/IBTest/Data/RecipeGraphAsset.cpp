@@ -0,0 +1,276 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Data/RecipeGraphAsset.h"
+#include "Engine/DataTable.h"
+#include "UObject/ObjectSaveContext.h"
+
+#include "Shape.h"
+#include "Data/RecipeData.h"
+#include "Data/ShapeData.h"
+
+namespace
+{
+	/** Recipe resolved from its table row, before sorting */
+	struct FBakeRecipe
+	{
+		FName RecipeID;
+		FText Name;
+		int32 OutShape = INDEX_NONE;
+		int32 TotalShapes = 0;
+		TArray<TPair<int32, int32>> Requirements;
+	};
+
+	/** Cycles reported at most, a badly broken table would flood the log otherwise */
+	const int32 MaxReportedCycles = 16;
+}
+
+bool URecipeGraphAsset::Bake()
+{
+	ShapeIDs.Reset();
+	ShapeClasses.Reset();
+	RecipeIDs.Reset();
+	RecipeNames.Reset();
+	RecipeOutShapes.Reset();
+	RecipeTotalShapes.Reset();
+	RequirementOffsets.Reset();
+	RequirementShapes.Reset();
+	RequirementCounts.Reset();
+	BakeIssues.Reset();
+
+	const UDataTable* LoadedShapeTable = ShapeTable.LoadSynchronous();
+	const UDataTable* LoadedRecipeTable = RecipeTable.LoadSynchronous();
+	if (!LoadedShapeTable || !LoadedRecipeTable)
+	{
+		AddIssue(TEXT("the recipe or shape table is missing"));
+		return false;
+	}
+
+	bool bValid = true;
+
+	// Shapes keep their table row order, like FRecipeRegistry::Build
+	TMap<FName, int32> ShapeIndices;
+	LoadedShapeTable->ForeachRow<FShapeData>(TEXT("URecipeGraphAsset::Bake"), [this, &ShapeIndices](const FName& RowName, const FShapeData& ShapeData)
+		{
+			ShapeIndices.Add(RowName, ShapeIDs.Add(RowName));
+			ShapeClasses.Add(ShapeData.ShapeClass);
+		});
+
+	if (ShapeIDs.Num() > MAX_uint16)
+	{
+		AddIssue(FString::Printf(TEXT("%d shapes, only %d fit in the baked shape indices"), ShapeIDs.Num(), MAX_uint16));
+		ShapeIDs.Reset();
+		ShapeClasses.Reset();
+		return false;
+	}
+
+	TArray<FBakeRecipe> Recipes;
+	LoadedRecipeTable->ForeachRow<FRecipeData>(TEXT("URecipeGraphAsset::Bake"), [this, &ShapeIndices, &Recipes, &bValid](const FName& RowName, const FRecipeData& RecipeData)
+		{
+			FBakeRecipe Recipe;
+			Recipe.RecipeID = RowName;
+			Recipe.Name = RecipeData.Name;
+
+			const int32* OutShape = ShapeIndices.Find(RecipeData.OutShape);
+			bool bKnownShapes = OutShape != nullptr;
+			Recipe.OutShape = OutShape ? *OutShape : INDEX_NONE;
+
+			for (const auto& InputShape : RecipeData.InShapes)
+			{
+				const int32* ShapeIndex = ShapeIndices.Find(InputShape.Key);
+				bKnownShapes &= ShapeIndex != nullptr;
+
+				if (ShapeIndex && InputShape.Value > 0)
+				{
+					Recipe.Requirements.Add({ *ShapeIndex, InputShape.Value });
+					Recipe.TotalShapes += InputShape.Value;
+				}
+			}
+
+			if (!bKnownShapes)
+			{
+				AddIssue(FString::Printf(TEXT("recipe %s references an unknown shape and is dropped"), *RowName.ToString()));
+				bValid = false;
+			}
+			// Every craft must use more shapes than it makes, otherwise a machine keeps crafting from its own outputs
+			else if (Recipe.TotalShapes <= 1)
+			{
+				AddIssue(FString::Printf(TEXT("recipe %s needs at least 2 input shapes and is dropped"), *RowName.ToString()));
+				bValid = false;
+			}
+			else if (Recipe.TotalShapes > MAX_uint16)
+			{
+				AddIssue(FString::Printf(TEXT("recipe %s needs more than %d shapes and is dropped"), *RowName.ToString(), MAX_uint16));
+				bValid = false;
+			}
+			else
+			{
+				Recipes.Add(MoveTemp(Recipe));
+			}
+		});
+
+	// Same priority as FRecipeMatcher, so machines compile the baked recipes without reordering them
+	Recipes.StableSort([](const FBakeRecipe& A, const FBakeRecipe& B) { return A.TotalShapes > B.TotalShapes; });
+
+	RequirementOffsets.Reserve(Recipes.Num() + 1);
+	for (const FBakeRecipe& Recipe : Recipes)
+	{
+		RecipeIDs.Add(Recipe.RecipeID);
+		RecipeNames.Add(Recipe.Name);
+		RecipeOutShapes.Add(static_cast<uint16>(Recipe.OutShape));
+		RecipeTotalShapes.Add(static_cast<uint16>(Recipe.TotalShapes));
+		RequirementOffsets.Add(RequirementShapes.Num());
+
+		for (const TPair<int32, int32>& Requirement : Recipe.Requirements)
+		{
+			RequirementShapes.Add(static_cast<uint16>(Requirement.Key));
+			RequirementCounts.Add(static_cast<uint16>(Requirement.Value));
+		}
+	}
+
+	RequirementOffsets.Add(RequirementShapes.Num());
+
+	FindCycles();
+	FindAmbiguities();
+
+	UE_LOG(LogTemp, Log, TEXT("%s: baked %d shapes, %d recipes and %d requirements, %d issues"),
+		*GetName(), ShapeIDs.Num(), RecipeIDs.Num(), RequirementShapes.Num(), BakeIssues.Num());
+
+	return bValid;
+}
+
+void URecipeGraphAsset::Rebuild()
+{
+	Bake();
+	MarkPackageDirty();
+}
+
+#if WITH_EDITOR
+void URecipeGraphAsset::PreSave(FObjectPreSaveContext SaveContext)
+{
+	Super::PreSave(SaveContext);
+
+	// Tables may have changed since the last save, the cooked asset always matches the cooked tables
+	if (!Bake() && SaveContext.IsCooking())
+	{
+		UE_LOG(LogTemp, Error, TEXT("%s: cooked with invalid recipes, see the warnings above"), *GetName());
+	}
+}
+#endif
+
+void URecipeGraphAsset::FindCycles()
+{
+	const int32 NumShapes = ShapeIDs.Num();
+
+	// Edges from every input shape of a recipe to its output shape
+	TArray<TArray<int32>> Successors;
+	Successors.SetNum(NumShapes);
+	for (int32 RecipeIndex = 0; RecipeIndex < RecipeIDs.Num(); ++RecipeIndex)
+	{
+		for (int32 Requirement = RequirementOffsets[RecipeIndex]; Requirement < RequirementOffsets[RecipeIndex + 1]; ++Requirement)
+		{
+			Successors[RequirementShapes[Requirement]].AddUnique(RecipeOutShapes[RecipeIndex]);
+		}
+	}
+
+	// Depth first search, a successor still on the path closes a cycle
+	enum class EVisit : uint8 { New, OnPath, Done };
+	TArray<EVisit> Visits;
+	Visits.Init(EVisit::New, NumShapes);
+
+	TArray<int32> Path;
+	TArray<int32> NextSuccessor;
+	NextSuccessor.Init(0, NumShapes);
+	int32 NumCycles = 0;
+
+	for (int32 RootShape = 0; RootShape < NumShapes; ++RootShape)
+	{
+		if (Visits[RootShape] != EVisit::New) continue;
+
+		Path.Add(RootShape);
+		Visits[RootShape] = EVisit::OnPath;
+
+		while (!Path.IsEmpty())
+		{
+			const int32 Shape = Path.Last();
+			if (NextSuccessor[Shape] >= Successors[Shape].Num())
+			{
+				Visits[Shape] = EVisit::Done;
+				Path.Pop(false);
+				continue;
+			}
+
+			const int32 Successor = Successors[Shape][NextSuccessor[Shape]++];
+			if (Visits[Successor] == EVisit::New)
+			{
+				Visits[Successor] = EVisit::OnPath;
+				Path.Add(Successor);
+			}
+			else if (Visits[Successor] == EVisit::OnPath && NumCycles++ < MaxReportedCycles)
+			{
+				// Crafts always shrink the number of shapes so this terminates, but machines holding these recipes convert shapes back and forth
+				FString Cycle;
+				for (int32 PathIndex = Path.Find(Successor); PathIndex < Path.Num(); ++PathIndex)
+				{
+					Cycle += ShapeIDs[Path[PathIndex]].ToString() + TEXT(" -> ");
+				}
+
+				AddIssue(FString::Printf(TEXT("crafting loop %s%s"), *Cycle, *ShapeIDs[Successor].ToString()));
+			}
+		}
+	}
+
+	if (NumCycles > MaxReportedCycles)
+	{
+		AddIssue(FString::Printf(TEXT("%d more crafting loops not listed"), NumCycles - MaxReportedCycles));
+	}
+}
+
+void URecipeGraphAsset::FindAmbiguities()
+{
+	// Return true if the recipes require a common shape, bOutIdentical is set when they require exactly the same ingredients
+	auto CompareIngredients = [this](int32 A, int32 B, bool& bOutIdentical)
+	{
+		int32 NumShared = 0;
+		int32 NumSame = 0;
+		for (int32 RequirementA = RequirementOffsets[A]; RequirementA < RequirementOffsets[A + 1]; ++RequirementA)
+		{
+			for (int32 RequirementB = RequirementOffsets[B]; RequirementB < RequirementOffsets[B + 1]; ++RequirementB)
+			{
+				if (RequirementShapes[RequirementA] != RequirementShapes[RequirementB]) continue;
+
+				++NumShared;
+				NumSame += RequirementCounts[RequirementA] == RequirementCounts[RequirementB] ? 1 : 0;
+			}
+		}
+
+		bOutIdentical = NumSame == RequirementOffsets[A + 1] - RequirementOffsets[A] && NumSame == RequirementOffsets[B + 1] - RequirementOffsets[B];
+		return NumShared > 0;
+	};
+
+	// Recipes are sorted by priority, only neighbours of the same priority can be ambiguous
+	for (int32 A = 0; A < RecipeIDs.Num(); ++A)
+	{
+		for (int32 B = A + 1; B < RecipeIDs.Num() && RecipeTotalShapes[B] == RecipeTotalShapes[A]; ++B)
+		{
+			bool bIdentical = false;
+			if (!CompareIngredients(A, B, bIdentical)) continue;
+
+			if (bIdentical)
+			{
+				AddIssue(FString::Printf(TEXT("recipes %s and %s need the same ingredients, %s never crafts on a machine holding both"),
+					*RecipeIDs[A].ToString(), *RecipeIDs[B].ToString(), *RecipeIDs[B].ToString()));
+			}
+			else
+			{
+				AddIssue(FString::Printf(TEXT("recipes %s and %s have the same priority and compete for ingredients, table order decides"),
+					*RecipeIDs[A].ToString(), *RecipeIDs[B].ToString()));
+			}
+		}
+	}
+}
+
+void URecipeGraphAsset::AddIssue(const FString& Issue)
+{
+	UE_LOG(LogTemp, Warning, TEXT("%s: %s"), *GetName(), *Issue);
+	BakeIssues.Add(Issue);
+}
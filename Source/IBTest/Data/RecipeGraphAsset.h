@@ -0,0 +1,98 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "RecipeGraphAsset.generated.h"
+
+class AShape;
+class UDataTable;
+
+/**
+ * Recipe and shape tables compiled into flat arrays when the asset is saved or cooked.
+ * Shapes are small integers in shape table row order, recipes are sorted by priority (most ingredients first, then table order)
+ * and their requirements are stored as structure of arrays, so the registry is filled without any table or map lookup at startup.
+ * Baking also validates the recipe graph: recipes that would craft forever are dropped,
+ * crafting loops between shapes and recipes competing for the same ingredients are reported.
+ */
+UCLASS(BlueprintType)
+class IBTEST_API URecipeGraphAsset : public UPrimaryDataAsset
+{
+	GENERATED_BODY()
+
+public:
+
+	UPROPERTY(EditAnywhere, Category = "Source")
+	TSoftObjectPtr<UDataTable> RecipeTable;
+
+	UPROPERTY(EditAnywhere, Category = "Source")
+	TSoftObjectPtr<UDataTable> ShapeTable;
+
+	/** Row names of the shapes, indexed by shape */
+	UPROPERTY(VisibleAnywhere, Category = "Baked")
+	TArray<FName> ShapeIDs;
+
+	UPROPERTY(VisibleAnywhere, Category = "Baked")
+	TArray<TSoftClassPtr<AShape>> ShapeClasses;
+
+	/** Row names of the recipes, indexed by recipe in priority order */
+	UPROPERTY(VisibleAnywhere, Category = "Baked")
+	TArray<FName> RecipeIDs;
+
+	UPROPERTY(VisibleAnywhere, Category = "Baked")
+	TArray<FText> RecipeNames;
+
+	/** Shape produced by each recipe */
+	UPROPERTY(VisibleAnywhere, Category = "Baked")
+	TArray<uint16> RecipeOutShapes;
+
+	/** Sum of the shapes required by each recipe, in descending order */
+	UPROPERTY(VisibleAnywhere, Category = "Baked")
+	TArray<uint16> RecipeTotalShapes;
+
+	/** Requirements of recipe i are the entries RequirementOffsets[i] to RequirementOffsets[i + 1] - 1 */
+	UPROPERTY(VisibleAnywhere, Category = "Baked")
+	TArray<int32> RequirementOffsets;
+
+	UPROPERTY(VisibleAnywhere, Category = "Baked")
+	TArray<uint16> RequirementShapes;
+
+	UPROPERTY(VisibleAnywhere, Category = "Baked")
+	TArray<uint16> RequirementCounts;
+
+	/** Problems found by the last bake */
+	UPROPERTY(VisibleAnywhere, Category = "Baked")
+	TArray<FString> BakeIssues;
+
+public:
+
+	/** Compile the source tables and analyse the recipe graph. Return false if the tables are missing or a recipe had to be dropped */
+	bool Bake();
+
+	/** Bake now instead of waiting for the next save */
+	UFUNCTION(CallInEditor, Category = "Source")
+	void Rebuild();
+
+	FORCEINLINE bool IsBaked() const { return !ShapeIDs.IsEmpty(); }
+
+	FORCEINLINE int32 GetNumShapes() const { return ShapeIDs.Num(); }
+
+	FORCEINLINE int32 GetNumRecipes() const { return RecipeIDs.Num(); }
+
+#if WITH_EDITOR
+	// UObject Begin
+	virtual void PreSave(FObjectPreSaveContext SaveContext) override;
+	// UObject End
+#endif
+
+private:
+
+	/** Report shapes that can be crafted back into themselves */
+	void FindCycles();
+
+	/** Report recipes of the same priority competing for the same ingredients */
+	void FindAmbiguities();
+
+	void AddIssue(const FString& Issue);
+};
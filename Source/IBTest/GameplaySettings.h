@@ -7,6 +7,42 @@
 #include "GameplaySettings.generated.h"
 
 class UDataTable;
+class URecipeGraphAsset;
+
+/** One step of the scripted load followed by bot clients, see AIBTestPlayerController */
+USTRUCT()
+struct FBotLoadPhase
+{
+	GENERATED_BODY()
+
+	/** Time spent by bots in this phase */
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0.0", Units = "s"))
+	float Duration = 60.f;
+
+	/** Average number of actions started per second by each bot */
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0.0"))
+	float ActionsPerSecond = 0.5f;
+
+	/** Relative chance of pressing a machine button with the primary interaction */
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0.0"))
+	float Interact1Weight = 1.f;
+
+	/** Relative chance of toggling a machine with the secondary interaction */
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0.0"))
+	float Interact2Weight = 0.1f;
+
+	/** Relative chance of grabbing a shape */
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0.0"))
+	float GrabWeight = 1.f;
+
+	/** Time a grabbed shape is carried before being released */
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0.0", Units = "s"))
+	float GrabDuration = 2.f;
+
+	/** Bots walk to their targets and wander between actions, otherwise they only act on what is in range */
+	UPROPERTY(EditAnywhere)
+	bool bWalk = true;
+};
 
 UCLASS(Config=Game, defaultconfig, meta = (DisplayName="Gameplay Settings"))
 class IBTEST_API UGameplaySettings : public UDeveloperSettings
@@ -20,4 +56,123 @@ public:
 
 	UPROPERTY(EditAnywhere, Config, Category = "Machine")
 	TSoftObjectPtr<UDataTable> ShapeDataTable;
+
+	/** Recipes and shapes baked from the tables at save and cook time, see UBakeRecipeGraphCommandlet. The tables are baked at startup while it is missing */
+	UPROPERTY(EditAnywhere, Config, Category = "Machine")
+	TSoftObjectPtr<URecipeGraphAsset> RecipeGraph;
+
+	/** Seconds between two recipe evaluations of dirty machines, 0 evaluates them once per frame */
+	UPROPERTY(EditAnywhere, Config, Category = "Machine", meta = (ClampMin = "0.0", Units = "s"))
+	float RecipeEvaluationInterval = 0.f;
+
+	/** Evaluate dirty machines as one batch over the ingredient counts of the machine subsystem, see UMachineSubsystem */
+	UPROPERTY(EditAnywhere, Config, Category = "Machine")
+	bool bBatchRecipeEvaluation = true;
+
+	/** Batches with fewer machines than this are evaluated on the game thread, bigger ones on the task graph */
+	UPROPERTY(EditAnywhere, Config, Category = "Machine", meta = (ClampMin = "1", EditCondition = "bBatchRecipeEvaluation"))
+	int32 ParallelEvaluationMinMachines = 64;
+
+	/** Record the ingredient changes and crafts of every machine to Saved/Journals for the CraftingReplay commandlet, also enabled by -CraftingJournal */
+	UPROPERTY(EditAnywhere, Config, Category = "Machine")
+	bool bRecordCraftingJournal = false;
+
+	/** Number of shapes of each class spawned in advance when the world begins play */
+	UPROPERTY(EditAnywhere, Config, Category = "Shape Pool", meta = (ClampMin = "0"))
+	int32 ShapePoolWarmSize = 0;
+
+	/** Maximum number of inactive shapes kept per class, extra released shapes are destroyed */
+	UPROPERTY(EditAnywhere, Config, Category = "Shape Pool", meta = (ClampMin = "0"))
+	int32 ShapePoolMaxSize = 64;
+
+	/** Turn shapes resting far from every player into instanced meshes, see UShapeDemotionSubsystem */
+	UPROPERTY(EditAnywhere, Config, Category = "Shape Demotion")
+	bool bDemoteRestingShapes = true;
+
+	/** Time a shape has to rest before it can be demoted */
+	UPROPERTY(EditAnywhere, Config, Category = "Shape Demotion", meta = (ClampMin = "0.0", Units = "s"))
+	float ShapeDemotionDelay = 10.f;
+
+	/** Resting shapes further than this from every player are demoted */
+	UPROPERTY(EditAnywhere, Config, Category = "Shape Demotion", meta = (ClampMin = "0.0", Units = "cm"))
+	float ShapeDemotionDistance = 6000.f;
+
+	/** Demoted shapes closer than this to a player become actors again, kept below ShapeDemotionDistance so shapes between both do not flip back and forth */
+	UPROPERTY(EditAnywhere, Config, Category = "Shape Demotion", meta = (ClampMin = "0.0", Units = "cm"))
+	float ShapePromotionDistance = 4000.f;
+
+	/** Time between two demotion and promotion passes */
+	UPROPERTY(EditAnywhere, Config, Category = "Shape Demotion", meta = (ClampMin = "0.1", Units = "s"))
+	float ShapeDemotionInterval = 1.f;
+
+	/** Maximum number of grab target updates sent per second by a client, 0 only sends the initial target */
+	UPROPERTY(EditAnywhere, Config, Category = "Grabbing", meta = (ClampMin = "0.0"))
+	float GrabTargetUpdateRate = 20.f;
+
+	/** Minimum time between two requests of the same interaction sent by a client, presses in between are merged into the one already sent */
+	UPROPERTY(EditAnywhere, Config, Category = "Interaction", meta = (ClampMin = "0.0", Units = "s"))
+	float InteractionRequestInterval = 0.25f;
+
+	/** Interaction requests the server accepts per second from a connection, extra requests are dropped */
+	UPROPERTY(EditAnywhere, Config, Category = "Interaction", meta = (ClampMin = "0.1"))
+	float InteractionTokenRate = 8.f;
+
+	/** Interaction requests a connection can send in a burst before being limited to InteractionTokenRate */
+	UPROPERTY(EditAnywhere, Config, Category = "Interaction", meta = (ClampMin = "1.0"))
+	float InteractionTokenBurst = 4.f;
+
+	/** Phases played in order by clients started with -IBTestBot */
+	UPROPERTY(EditAnywhere, Config, Category = "Bots")
+	TArray<FBotLoadPhase> BotLoadProfile;
+
+	/** Restart the load profile once its last phase ends, otherwise bots go idle */
+	UPROPERTY(EditAnywhere, Config, Category = "Bots")
+	bool bLoopBotLoadProfile = true;
+
+	/** Size of the replication graph grid cells, relevancy is decided per cell */
+	UPROPERTY(EditAnywhere, Config, Category = "Replication Graph", meta = (ClampMin = "100.0", Units = "cm"))
+	float ReplicationGridCellSize = 4000.f;
+
+	/** Offset of the grid origin, cells start at this location so it should be below the level bounds */
+	UPROPERTY(EditAnywhere, Config, Category = "Replication Graph")
+	FVector2D ReplicationGridSpatialBias = FVector2D(-100000.f, -100000.f);
+
+	/** Cosmetic events further than this from every local view are not played, 0 plays them all */
+	UPROPERTY(EditAnywhere, Config, Category = "Cosmetics", meta = (ClampMin = "0.0", Units = "cm"))
+	float CosmeticEventCullDistance = 5000.f;
+
+	/** Save the machines and shapes of the server and restore them when the map starts again, also enabled by -FactorySnapshot */
+	UPROPERTY(EditAnywhere, Config, Category = "Snapshots")
+	bool bFactorySnapshots = false;
+
+	/** Seconds between two factory snapshots, 0 only saves when the world is torn down */
+	UPROPERTY(EditAnywhere, Config, Category = "Snapshots", meta = (ClampMin = "0.0", Units = "s"))
+	float FactorySnapshotInterval = 300.f;
+
+	/** Shapes spawned per frame while restoring a factory snapshot */
+	UPROPERTY(EditAnywhere, Config, Category = "Snapshots", meta = (ClampMin = "1"))
+	int32 FactorySnapshotRestoreBatchSize = 256;
+
+	/** Seconds between two server performance reports, 0 disables them */
+	UPROPERTY(EditAnywhere, Config, Category = "Server Stats", meta = (ClampMin = "0.0", Units = "s"))
+	float ServerStatsReportInterval = 10.f;
+
+public:
+
+	/** Coordinates of the replication grid cell containing the location */
+	FIntPoint GetReplicationGridCell(const FVector& Location) const
+	{
+		return FIntPoint(
+			FMath::FloorToInt((Location.X - ReplicationGridSpatialBias.X) / ReplicationGridCellSize),
+			FMath::FloorToInt((Location.Y - ReplicationGridSpatialBias.Y) / ReplicationGridCellSize));
+	}
+
+	/** Center of a replication grid cell, at the given height */
+	FVector GetReplicationGridCellCenter(const FIntPoint& Cell, double Z) const
+	{
+		return FVector(
+			ReplicationGridSpatialBias.X + (Cell.X + 0.5) * ReplicationGridCellSize,
+			ReplicationGridSpatialBias.Y + (Cell.Y + 0.5) * ReplicationGridCellSize,
+			Z);
+	}
 };
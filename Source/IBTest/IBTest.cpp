@@ -4,4 +4,26 @@
 #include "Modules/ModuleManager.h"
 
 IMPLEMENT_PRIMARY_GAME_MODULE( FDefaultGameModuleImpl, IBTest, "IBTest" );
- 
\ No newline at end of file
+
+DEFINE_STAT(STAT_IBTest_EvaluateRecipes);
+DEFINE_STAT(STAT_IBTest_SpawnShape);
+DEFINE_STAT(STAT_IBTest_ReleaseShapes);
+DEFINE_STAT(STAT_IBTest_InteractionRPC);
+DEFINE_STAT(STAT_IBTest_GrabUpdate);
+DEFINE_STAT(STAT_IBTest_ConveyorUpdate);
+
+DEFINE_STAT(STAT_IBTest_RecipeChecks);
+DEFINE_STAT(STAT_IBTest_IngredientsAdded);
+DEFINE_STAT(STAT_IBTest_IngredientsRemoved);
+DEFINE_STAT(STAT_IBTest_Crafts);
+DEFINE_STAT(STAT_IBTest_ShapesSpawned);
+DEFINE_STAT(STAT_IBTest_ShapesReleased);
+DEFINE_STAT(STAT_IBTest_ShapesDemoted);
+DEFINE_STAT(STAT_IBTest_ShapesPromoted);
+DEFINE_STAT(STAT_IBTest_InteractionRPCs);
+DEFINE_STAT(STAT_IBTest_GrabUpdates);
+DEFINE_STAT(STAT_IBTest_ConveyorItems);
+
+CSV_DEFINE_CATEGORY_MODULE(IBTEST_API, IBTest, true);
+
+UE_TRACE_CHANNEL_DEFINE(IBTestChannel);
@@ -3,3 +3,51 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "ProfilingDebugging/CsvProfiler.h"
+#include "Stats/Stats.h"
+#include "Trace/Trace.h"
+
+/**
+ * IBTest instrumentation.
+ * Cycle stats and counters show with "stat IBTest", in Insights on the IBTest channel (-trace=cpu,IBTest)
+ * and in the IBTest category of CSV captures (-csvprofile or csvprofile start).
+ */
+DECLARE_STATS_GROUP(TEXT("IBTest"), STATGROUP_IBTest, STATCAT_Advanced);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Evaluate Recipes"), STAT_IBTest_EvaluateRecipes, STATGROUP_IBTest, IBTEST_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Spawn Shape"), STAT_IBTest_SpawnShape, STATGROUP_IBTest, IBTEST_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Release Shapes"), STAT_IBTest_ReleaseShapes, STATGROUP_IBTest, IBTEST_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Interaction RPC"), STAT_IBTest_InteractionRPC, STATGROUP_IBTest, IBTEST_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Grab Update"), STAT_IBTest_GrabUpdate, STATGROUP_IBTest, IBTEST_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Conveyor Update"), STAT_IBTest_ConveyorUpdate, STATGROUP_IBTest, IBTEST_API);
+
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Recipe Checks"), STAT_IBTest_RecipeChecks, STATGROUP_IBTest, IBTEST_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Ingredients Added"), STAT_IBTest_IngredientsAdded, STATGROUP_IBTest, IBTEST_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Ingredients Removed"), STAT_IBTest_IngredientsRemoved, STATGROUP_IBTest, IBTEST_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Crafts"), STAT_IBTest_Crafts, STATGROUP_IBTest, IBTEST_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Shapes Spawned"), STAT_IBTest_ShapesSpawned, STATGROUP_IBTest, IBTEST_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Shapes Released"), STAT_IBTest_ShapesReleased, STATGROUP_IBTest, IBTEST_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Shapes Demoted"), STAT_IBTest_ShapesDemoted, STATGROUP_IBTest, IBTEST_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Shapes Promoted"), STAT_IBTest_ShapesPromoted, STATGROUP_IBTest, IBTEST_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Interaction RPCs"), STAT_IBTest_InteractionRPCs, STATGROUP_IBTest, IBTEST_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Grab Updates"), STAT_IBTest_GrabUpdates, STATGROUP_IBTest, IBTEST_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Conveyor Items"), STAT_IBTest_ConveyorItems, STATGROUP_IBTest, IBTEST_API);
+
+CSV_DECLARE_CATEGORY_MODULE_EXTERN(IBTEST_API, IBTest);
+
+UE_TRACE_CHANNEL_EXTERN(IBTestChannel, IBTEST_API);
+
+/** Time the enclosing scope as STAT_IBTest_<Name>, as an Insights scope and as a CSV timing stat. Expands to several scoped declarations, so use it as a full statement at block scope, never as the body of an unbraced if or loop */
+#define IBTEST_SCOPE_CYCLE_COUNTER(Name) \
+	SCOPE_CYCLE_COUNTER(STAT_IBTest_##Name); \
+	TRACE_CPUPROFILER_EVENT_SCOPE_ON_CHANNEL(IBTest_##Name, IBTestChannel); \
+	CSV_SCOPED_TIMING_STAT(IBTest, Name)
+
+/** Add to the STAT_IBTest_<Name> counter and to the CSV stat of the same name */
+#define IBTEST_INC_COUNTER(Name, Amount) \
+	do \
+	{ \
+		INC_DWORD_STAT_BY(STAT_IBTest_##Name, Amount); \
+		CSV_CUSTOM_STAT(IBTest, Name, static_cast<int32>(Amount), ECsvCustomStatOp::Accumulate); \
+	} while (0)
@@ -1,20 +1,49 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "IBTestCharacter.h"
+#include "IBTest.h"
 #include "Animation/AnimInstance.h"
 #include "Camera/CameraComponent.h"
 #include "Components/CapsuleComponent.h"
 #include "Components/SkeletalMeshComponent.h"
+#include "Components/StaticMeshComponent.h"
 #include "EnhancedInputComponent.h"
 #include "EnhancedInputSubsystems.h"
 #include "InputActionValue.h"
 #include "Engine/LocalPlayer.h"
-#include "PhysicsEngine/PhysicsHandleComponent.h"
 #include "Interfaces/IInteractionInterface.h"
 #include "Kismet/GameplayStatics.h"
+#include "GameplaySettings.h"
+#include "Shape.h"
+#include "Networking/ShapeInstanceCell.h"
+#include "Subsystems/GrabSubsystem.h"
+#include "Subsystems/InteractionSubsystem.h"
+#include "Subsystems/ServerStatsSubsystem.h"
+#include "Subsystems/ShapeDemotionSubsystem.h"
 
 DEFINE_LOG_CATEGORY(LogTemplateCharacter);
 
+namespace
+{
+	/** Length of the ray used to interact with objects */
+	const float InteractionRange = 500.f;
+
+	/** Extra distance accepted by the server when validating grabs, covers movement since the client trace */
+	const float GrabRangeTolerance = 200.f;
+
+	/** Maximum distance between the view origin sent by a client and the server one, covers movement since the client trace */
+	const float InteractionOriginTolerance = 200.f;
+
+	/** Time before a client asks again for the promotion of a demoted shape it still traces, the previous request may have been dropped */
+	const double PromotionRequestInterval = 1.0;
+
+	bool bAlwaysTickCharacters = false;
+	FAutoConsoleVariableRef CVarAlwaysTickCharacters(
+		TEXT("IBTest.Grab.AlwaysTickCharacters"),
+		bAlwaysTickCharacters,
+		TEXT("Keep characters ticking when they grab nothing, the behavior before grabs moved to the physics thread. Used to compare costs with IBTest.Grab.Stats"));
+}
+
 //////////////////////////////////////////////////////////////////////////
 // AIBTestCharacter
 
@@ -41,7 +70,8 @@ AIBTestCharacter::AIBTestCharacter()
 	//Mesh1P->SetRelativeRotation(FRotator(0.9f, -19.19f, 5.2f));
 	Mesh1P->SetRelativeLocation(FVector(-30.f, 0.f, -150.f));
 
-	PhysicsHandleComponent = CreateDefaultSubobject<UPhysicsHandleComponent>(TEXT("PhysicsHandle"));
+	// Only grabbing needs the tick, see StartGrab
+	PrimaryActorTick.bStartWithTickEnabled = false;
 }
 
 void AIBTestCharacter::BeginPlay()
@@ -58,19 +88,66 @@ void AIBTestCharacter::BeginPlay()
 		}
 	}
 
+	SetActorTickEnabled(bAlwaysTickCharacters);
 }
 
 void AIBTestCharacter::Tick(float DeltaSeconds)
 {
+	const uint64 StartCycles = FPlatformTime::Cycles64();
+
 	Super::Tick(DeltaSeconds);
 
-	// Update physics handle used for grabbing actions
-	if (PhysicsHandleComponent && PhysicsHandleComponent->GetGrabbedComponent())
+	UGrabSubsystem* GrabSubsystem = GetWorld()->GetSubsystem<UGrabSubsystem>();
+
+	// Feed the grab target to the physics thread driver
+	if (UPrimitiveComponent* Grabbed = GrabbedComponent.Get())
+	{
+		// Consumed or pooled shapes stop simulating, the server ends the grab for both sides
+		if (HasAuthority() && !Grabbed->IsSimulatingPhysics())
+		{
+			ReleaseGrab();
+			if (!IsLocallyControlled())
+			{
+				Client_EndGrab();
+			}
+		}
+		else
+		{
+			FVector TargetLocation;
+			if (IsLocallyControlled())
+			{
+				// The owning client moves its own copy right away, the server copy follows the target stream
+				FVector StartLocation;
+				GetPlayerInteractionRange(StartLocation, TargetLocation);
+
+				if (!HasAuthority())
+				{
+					SendGrabTarget(DeltaSeconds);
+				}
+			}
+			else
+			{
+				// Extrapolated for at most one update interval, so the target does not move in steps between updates
+				const float UpdateRate = GetDefault<UGameplaySettings>()->GrabTargetUpdateRate;
+				const float Extrapolation = UpdateRate > 0.f ? FMath::Min(static_cast<float>(GetWorld()->GetTimeSeconds() - GrabViewRotationTime), 1.f / UpdateRate) : 0.f;
+				TargetLocation = GetGrabTargetLocation(GrabViewRotation + GrabViewRotationRate * Extrapolation);
+			}
+
+			// The first target of a grab has nothing to be compared with, it does not move yet
+			const FVector TargetVelocity = bHasLastGrabTarget && DeltaSeconds > 0.f ? (TargetLocation - LastGrabTargetLocation) / DeltaSeconds : FVector::ZeroVector;
+			LastGrabTargetLocation = TargetLocation;
+			bHasLastGrabTarget = true;
+
+			if (GrabSubsystem)
+			{
+				GrabSubsystem->SetGrabTarget(Grabbed, TargetLocation, TargetVelocity);
+			}
+		}
+	}
+
+	if (GrabSubsystem)
 	{
-		FVector StartLocation;
-		FVector EndLocation; 
-		GetPlayerInteractionRange(StartLocation, EndLocation);
-		PhysicsHandleComponent->SetTargetLocation(EndLocation);
+		GrabSubsystem->RecordCharacterTick(FPlatformTime::Cycles64() - StartCycles);
 	}
 }
 
@@ -107,38 +184,127 @@ void AIBTestCharacter::SetupPlayerInputComponent(UInputComponent* PlayerInputCom
 	}
 }
 
-void AIBTestCharacter::Server_Interact1_Implementation(const FHitResult& HitResult)
+void AIBTestCharacter::Server_Interact1_Implementation(const FInteractionRequest& Request)
 {
-	AActor* HitActor = HitResult.GetActor();
+	IBTEST_SCOPE_CYCLE_COUNTER(InteractionRPC);
+	IBTEST_INC_COUNTER(InteractionRPCs, 1);
 
-	if (HitActor &&
-		HitActor->GetClass()->ImplementsInterface(UInteractionInterface::StaticClass()))
+	if (UServerStatsSubsystem* ServerStats = UServerStatsSubsystem::Get(this))
 	{
-		IInteractionInterface::Execute_Interact1(HitActor);
+		ServerStats->RecordRPC(this);
+	}
+
+	if (!ConsumeInteractionToken()) return;
+
+	UInteractionSubsystem* InteractionSubsystem = GetWorld()->GetSubsystem<UInteractionSubsystem>();
+	if (const FInteractable* Interactable = InteractionSubsystem ? InteractionSubsystem->FindInteractable(ResolveInteractionTarget(Request)) : nullptr)
+	{
+		Interactable->Interact1();
 	}
 }
 
-bool AIBTestCharacter::Server_Interact1_Validate(const FHitResult& HitResult)
+bool AIBTestCharacter::Server_Interact1_Validate(const FInteractionRequest& Request)
 {
-	return true;
+	return !Request.ViewOrigin.ContainsNaN();
 }
 
-void AIBTestCharacter::Server_Interact2_Implementation(const FHitResult& HitResult)
+void AIBTestCharacter::Server_Interact2_Implementation(const FInteractionRequest& Request)
 {
-	AActor* HitActor = HitResult.GetActor();
+	IBTEST_SCOPE_CYCLE_COUNTER(InteractionRPC);
+	IBTEST_INC_COUNTER(InteractionRPCs, 1);
+
+	if (UServerStatsSubsystem* ServerStats = UServerStatsSubsystem::Get(this))
+	{
+		ServerStats->RecordRPC(this);
+	}
 
-	if (HitActor &&
-		HitActor->GetClass()->ImplementsInterface(UInteractionInterface::StaticClass()))
+	if (!ConsumeInteractionToken()) return;
+
+	UInteractionSubsystem* InteractionSubsystem = GetWorld()->GetSubsystem<UInteractionSubsystem>();
+	if (const FInteractable* Interactable = InteractionSubsystem ? InteractionSubsystem->FindInteractable(ResolveInteractionTarget(Request)) : nullptr)
 	{
-		IInteractionInterface::Execute_Interact2(HitActor);
+		Interactable->Interact2();
 	}
 }
 
-bool AIBTestCharacter::Server_Interact2_Validate(const FHitResult& HitResult)
+bool AIBTestCharacter::Server_Interact2_Validate(const FInteractionRequest& Request)
 {
+	return !Request.ViewOrigin.ContainsNaN();
+}
+
+bool AIBTestCharacter::CanSendInteraction(int32 InteractionIndex)
+{
+	const double Time = GetWorld()->GetTimeSeconds();
+	if (Time - LastInteractionTimes[InteractionIndex] < GetDefault<UGameplaySettings>()->InteractionRequestInterval) return false;
+
+	LastInteractionTimes[InteractionIndex] = Time;
 	return true;
 }
 
+bool AIBTestCharacter::ConsumeInteractionToken()
+{
+	const UGameplaySettings* Settings = GetDefault<UGameplaySettings>();
+	const double Time = GetWorld()->GetTimeSeconds();
+
+	// Refill for the time elapsed since the last request, a new connection starts with a full bucket
+	InteractionTokens = FMath::Min(Settings->InteractionTokenBurst, InteractionTokens + static_cast<float>(FMath::Min(Time - InteractionTokensTime, 1000.0)) * Settings->InteractionTokenRate);
+	InteractionTokensTime = Time;
+
+	if (InteractionTokens >= 1.f)
+	{
+		InteractionTokens -= 1.f;
+		return true;
+	}
+
+	++NumDroppedInteractions;
+	UE_LOG(LogTemp, Verbose, TEXT("%s dropped an interaction request, %d so far"), *GetNameSafe(this), NumDroppedInteractions);
+
+	if (UServerStatsSubsystem* ServerStats = UServerStatsSubsystem::Get(this))
+	{
+		ServerStats->RecordDroppedRPC(this);
+	}
+
+	return false;
+}
+
+FInteractionRequest AIBTestCharacter::MakeInteractionRequest(const FHitResult& HitResult) const
+{
+	// The view the hit was traced from, focus hits are a frame old
+	FInteractionRequest Request;
+	Request.Target = HitResult.GetActor();
+	Request.ViewOrigin = HitResult.TraceStart;
+	Request.PackedViewRotation = FInteractionRequest::PackViewRotation((HitResult.TraceEnd - HitResult.TraceStart).Rotation());
+
+	return Request;
+}
+
+AActor* AIBTestCharacter::ResolveInteractionTarget(const FInteractionRequest& Request)
+{
+	// Both interactions of a key press arrive in the same frame, the trace is done once
+	if (ResolvedRequestFrame == GFrameCounter && ResolvedRequest == Request)
+	{
+		return ResolvedTarget.Get();
+	}
+
+	ResolvedRequestFrame = GFrameCounter;
+	ResolvedRequest = Request;
+	ResolvedTarget.Reset();
+
+	if (!Request.Target) return nullptr;
+
+	// The client view may lag behind the server one, but not by much
+	const FVector ServerViewOrigin = FirstPersonCameraComponent->GetComponentLocation();
+	if (FVector::DistSquared(ServerViewOrigin, Request.ViewOrigin) > FMath::Square(InteractionOriginTolerance)) return nullptr;
+
+	// Same range check as the client, from the quantized view
+	const FVector EndLocation = Request.ViewOrigin + Request.GetViewRotation().Vector() * InteractionRange;
+	const FHitResult HitResult = TraceInteraction(Request.ViewOrigin, EndLocation);
+	if (HitResult.GetActor() != Request.Target) return nullptr;
+
+	ResolvedTarget = Request.Target;
+	return Request.Target;
+}
+
 void AIBTestCharacter::Move(const FInputActionValue& Value)
 {
 	// input is a Vector2D
@@ -167,23 +333,47 @@ void AIBTestCharacter::Look(const FInputActionValue& Value)
 
 void AIBTestCharacter::Interact1(const FInputActionValue& Value)
 {
+	TryInteract1();
+}
+
+void AIBTestCharacter::Interact2(const FInputActionValue& Value)
+{
+	TryInteract2();
+}
+
+void AIBTestCharacter::BeginGrab(const FInputActionValue& Value)
+{
+	TryBeginGrab();
+}
+
+void AIBTestCharacter::EndGrab(const FInputActionValue& Value)
+{
+	TryEndGrab();
+}
+
+void AIBTestCharacter::TryInteract1()
+{
+	// Holding the key triggers every frame, only one request goes out per interval
+	if (!CanSendInteraction(0)) return;
+
 	FHitResult HitResult = PlayerTrace();    
-	AActor* HitActor = HitResult.GetActor();
 
-	if (HitActor &&
-		HitActor->GetClass()->ImplementsInterface(UInteractionInterface::StaticClass()))
+	UInteractionSubsystem* InteractionSubsystem = GetWorld()->GetSubsystem<UInteractionSubsystem>();
+	if (const FInteractable* Interactable = InteractionSubsystem ? InteractionSubsystem->FindInteractable(HitResult.GetActor()) : nullptr)
 	{
-		const bool bCanInteract = IInteractionInterface::Execute_CanInteract(HitActor);
+		const bool bCanInteract = Interactable->CanInteract();
 		if (bCanInteract)
 		{
 			if (GetLocalRole() != ROLE_Authority)
 			{
-				Server_Interact1(HitResult);
+				const FInteractionRequest Request = MakeInteractionRequest(HitResult);
+				InteractionSubsystem->RecordInteractionPayload(Request, HitResult);
+				Server_Interact1(Request);
 			}
 			else if (GetNetMode() != NM_DedicatedServer)
 			{
 				// Call non-rpc version for listen server
-				Server_Interact1_Implementation(HitResult);
+				Server_Interact1_Implementation(MakeInteractionRequest(HitResult));
 			}
 		}
 		else
@@ -193,44 +383,259 @@ void AIBTestCharacter::Interact1(const FInputActionValue& Value)
 	}
 }
 
-void AIBTestCharacter::Interact2(const FInputActionValue& Value)
+void AIBTestCharacter::TryInteract2()
 {
+	if (!CanSendInteraction(1)) return;
+
 	FHitResult HitResult = PlayerTrace();    
+
+	// Nothing for the server to act on
+	if (!HitResult.GetActor()) return;
+
 	if (GetLocalRole() != ROLE_Authority)
 	{
-		Server_Interact2(HitResult);
+		const FInteractionRequest Request = MakeInteractionRequest(HitResult);
+		if (UInteractionSubsystem* InteractionSubsystem = GetWorld()->GetSubsystem<UInteractionSubsystem>())
+		{
+			InteractionSubsystem->RecordInteractionPayload(Request, HitResult);
+		}
+
+		Server_Interact2(Request);
 	}
 	else if (GetNetMode() != NM_DedicatedServer)
 	{
 		// Call non-rpc version for listen server
-		Server_Interact2_Implementation(HitResult);
+		Server_Interact2_Implementation(MakeInteractionRequest(HitResult));
 	}
 }
 
-void AIBTestCharacter::BeginGrab(const FInputActionValue& Value)
+void AIBTestCharacter::TryBeginGrab()
 {
-	// TODO: Consider putting this stuff under IInteractionInterface and add support for multiplayer
+	// TODO: Consider putting this stuff under IInteractionInterface
 
 	FHitResult HitResult = PlayerTrace();    
 	AActor* HitActor = HitResult.GetActor();
 	UPrimitiveComponent* HitComponent = HitResult.GetComponent();
 
-	if (HitActor && HitComponent)
+	// Demoted shapes become actors first, remote clients grab them once the actor has replicated
+	if (!IsGrabbing() && Cast<AShapeInstanceCell>(HitActor))
 	{
-		PhysicsHandleComponent->GrabComponentAtLocation
-		(
-			HitComponent,
-			NAME_None,
-			HitComponent->GetComponentLocation()
-		);
+		AShape* Shape = PromoteTracedShape(HitResult);
+		HitActor = Shape;
+		HitComponent = Shape ? Shape->GetMeshComponent() : nullptr;
 	}
+
+	if (!HitActor || !HitComponent || IsGrabbing()) return;
+
+	if (!HasAuthority())
+	{
+		// Only replicated physics actors can be grabbed by clients, the server moves them with its own physics handle
+		if (!HitActor->GetIsReplicated() || HitComponent != HitActor->GetRootComponent()) return;
+
+		LastSentGrabTarget = FInteractionRequest::PackViewRotation(GetControlRotation());
+		GrabTargetSendTime = 0.f;
+		Server_BeginGrab(HitActor, LastSentGrabTarget);
+
+		// Replicated movement is ignored while grabbed so the local copy does not fight the server one
+		if (AShape* Shape = Cast<AShape>(HitActor))
+		{
+			Shape->SetLocallyGrabbed(true);
+		}
+	}
+
+	StartGrab(HitComponent);
 }
 
-void AIBTestCharacter::EndGrab(const FInputActionValue& Value)
+void AIBTestCharacter::TryEndGrab()
 {
-	if (PhysicsHandleComponent && PhysicsHandleComponent->GetGrabbedComponent())
+	if (!IsGrabbing()) return;
+
+	ReleaseGrab();
+
+	if (!HasAuthority())
 	{
-		PhysicsHandleComponent->ReleaseComponent();
+		Server_EndGrab();
+	}
+}
+
+void AIBTestCharacter::StartGrab(UPrimitiveComponent* Component)
+{
+	GrabbedComponent = Component;
+	bHasLastGrabTarget = false;
+
+	if (UGrabSubsystem* GrabSubsystem = GetWorld()->GetSubsystem<UGrabSubsystem>())
+	{
+		GrabSubsystem->BeginGrab(Component);
+	}
+
+	SetActorTickEnabled(true);
+}
+
+void AIBTestCharacter::ReleaseGrab()
+{
+	UPrimitiveComponent* Grabbed = GrabbedComponent.Get();
+	GrabbedComponent.Reset();
+
+	SetActorTickEnabled(bAlwaysTickCharacters);
+
+	if (!Grabbed) return;
+
+	if (AShape* Shape = Cast<AShape>(Grabbed->GetOwner()))
+	{
+		Shape->SetLocallyGrabbed(false);
+	}
+
+	if (UGrabSubsystem* GrabSubsystem = GetWorld()->GetSubsystem<UGrabSubsystem>())
+	{
+		GrabSubsystem->EndGrab(Grabbed);
+	}
+}
+
+void AIBTestCharacter::SendGrabTarget(float DeltaSeconds)
+{
+	GrabTargetSendTime += DeltaSeconds;
+
+	const float UpdateRate = GetDefault<UGameplaySettings>()->GrabTargetUpdateRate;
+	if (UpdateRate <= 0.f || GrabTargetSendTime < 1.f / UpdateRate) return;
+
+	const uint32 PackedViewRotation = FInteractionRequest::PackViewRotation(GetControlRotation());
+	if (PackedViewRotation == LastSentGrabTarget) return;
+
+	LastSentGrabTarget = PackedViewRotation;
+	GrabTargetSendTime = 0.f;
+	Server_UpdateGrabTarget(PackedViewRotation);
+}
+
+void AIBTestCharacter::Server_BeginGrab_Implementation(AActor* Target, uint32 PackedViewRotation)
+{
+	if (UServerStatsSubsystem* ServerStats = UServerStatsSubsystem::Get(this))
+	{
+		ServerStats->RecordRPC(this);
+	}
+
+	ReleaseGrab();
+
+	UPrimitiveComponent* Component = Target ? Cast<UPrimitiveComponent>(Target->GetRootComponent()) : nullptr;
+
+	// Reject what the client could not have reached
+	const FVector ViewLocation = FirstPersonCameraComponent->GetComponentLocation();
+	if (!Component || !Component->IsSimulatingPhysics() ||
+		FVector::DistSquared(ViewLocation, Component->GetComponentLocation()) > FMath::Square(InteractionRange + GrabRangeTolerance))
+	{
+		Client_EndGrab();
+		return;
+	}
+
+	GrabViewRotation = FInteractionRequest::UnpackViewRotation(PackedViewRotation);
+	GrabViewRotationRate = FRotator::ZeroRotator;
+	GrabViewRotationTime = GetWorld()->GetTimeSeconds();
+
+	// Resting shapes are dormant, moving them needs regular replication again
+	if (AShape* Shape = Cast<AShape>(Target))
+	{
+		Shape->WakeUpNetDormancy();
+	}
+
+	StartGrab(Component);
+}
+
+bool AIBTestCharacter::Server_BeginGrab_Validate(AActor* Target, uint32 PackedViewRotation)
+{
+	return true;
+}
+
+void AIBTestCharacter::Server_UpdateGrabTarget_Implementation(uint32 PackedViewRotation)
+{
+	IBTEST_INC_COUNTER(GrabUpdates, 1);
+
+	if (UServerStatsSubsystem* ServerStats = UServerStatsSubsystem::Get(this))
+	{
+		ServerStats->RecordRPC(this);
+	}
+
+	// Updates older than two intervals mean the view stopped moving in between
+	const FRotator ViewRotation = FInteractionRequest::UnpackViewRotation(PackedViewRotation);
+	const float UpdateRate = GetDefault<UGameplaySettings>()->GrabTargetUpdateRate;
+	const double Time = GetWorld()->GetTimeSeconds();
+	const double Elapsed = Time - GrabViewRotationTime;
+
+	GrabViewRotationRate = Elapsed > UE_KINDA_SMALL_NUMBER && UpdateRate > 0.f && Elapsed < 2.f / UpdateRate
+		? (ViewRotation - GrabViewRotation).GetNormalized() * (1.f / Elapsed)
+		: FRotator::ZeroRotator;
+	GrabViewRotation = ViewRotation;
+	GrabViewRotationTime = Time;
+}
+
+bool AIBTestCharacter::Server_UpdateGrabTarget_Validate(uint32 PackedViewRotation)
+{
+	return true;
+}
+
+void AIBTestCharacter::Server_EndGrab_Implementation()
+{
+	if (UServerStatsSubsystem* ServerStats = UServerStatsSubsystem::Get(this))
+	{
+		ServerStats->RecordRPC(this);
+	}
+
+	ReleaseGrab();
+}
+
+bool AIBTestCharacter::Server_EndGrab_Validate()
+{
+	return true;
+}
+
+void AIBTestCharacter::Client_EndGrab_Implementation()
+{
+	ReleaseGrab();
+}
+
+bool AIBTestCharacter::IsGrabbing() const
+{
+	return GrabbedComponent.IsValid();
+}
+
+AShape* AIBTestCharacter::PromoteTracedShape(const FHitResult& HitResult)
+{
+	AShapeInstanceCell* Cell = Cast<AShapeInstanceCell>(HitResult.GetActor());
+	const uint32 InstanceId = Cell ? Cell->GetHitInstanceId(HitResult) : 0;
+	if (InstanceId == 0) return nullptr;
+
+	if (HasAuthority())
+	{
+		UShapeDemotionSubsystem* ShapeDemotion = GetWorld()->GetSubsystem<UShapeDemotionSubsystem>();
+		return ShapeDemotion ? ShapeDemotion->PromoteTracedShape(Cell, InstanceId) : nullptr;
+	}
+
+	const double Time = GetWorld()->GetTimeSeconds();
+	if (InstanceId != LastPromotionRequest || Time - LastPromotionRequestTime >= PromotionRequestInterval)
+	{
+		LastPromotionRequest = InstanceId;
+		LastPromotionRequestTime = Time;
+		Server_PromoteShape(Cell, InstanceId);
+	}
+
+	return nullptr;
+}
+
+void AIBTestCharacter::Server_PromoteShape_Implementation(AShapeInstanceCell* Cell, uint32 InstanceId)
+{
+	if (UServerStatsSubsystem* ServerStats = UServerStatsSubsystem::Get(this))
+	{
+		ServerStats->RecordRPC(this);
+	}
+
+	if (!Cell || !ConsumeInteractionToken()) return;
+
+	// Reject what the client could not have traced
+	const FShapeInstance* Instance = Cell->FindInstance(InstanceId);
+	const FVector ViewLocation = FirstPersonCameraComponent->GetComponentLocation();
+	if (!Instance || FVector::DistSquared(ViewLocation, Instance->Location) > FMath::Square(InteractionRange + GrabRangeTolerance)) return;
+
+	if (UShapeDemotionSubsystem* ShapeDemotion = GetWorld()->GetSubsystem<UShapeDemotionSubsystem>())
+	{
+		ShapeDemotion->PromoteTracedShape(Cell, InstanceId);
 	}
 }
 
@@ -244,30 +649,65 @@ void AIBTestCharacter::PlayErrorSFX()
 
 FHitResult AIBTestCharacter::PlayerTrace() 
 {
-	FHitResult HitResult;    
-    FCollisionQueryParams QueryParams(FName(TEXT("PlayerTrace")), false, GetOwner());    
+	// Interactions and grabs triggered in the same frame share the trace
+	if (PlayerTraceFrame == GFrameCounter)
+	{
+		return CachedPlayerTrace;
+	}
+
+	PlayerTraceFrame = GFrameCounter;
+
+	// Locally controlled characters are traced by the interaction subsystem every frame
+	UInteractionSubsystem* InteractionSubsystem = GetWorld()->GetSubsystem<UInteractionSubsystem>();
+	if (InteractionSubsystem && InteractionSubsystem->GetFocusHit(this, CachedPlayerTrace))
+	{
+		return CachedPlayerTrace;
+	}
 
 	FVector StartLocation;
 	FVector EndLocation; 
 	GetPlayerInteractionRange(StartLocation, EndLocation);
 
+	CachedPlayerTrace = TraceInteraction(StartLocation, EndLocation);
+
+	if (InteractionSubsystem)
+	{
+		InteractionSubsystem->RecordSyncTrace();
+	}
+
+	return CachedPlayerTrace;
+}
+
+FHitResult AIBTestCharacter::TraceInteraction(const FVector& StartLocation, const FVector& EndLocation) const
+{
+	FHitResult HitResult;    
+
 	GetWorld()->LineTraceSingleByChannel
     (
         HitResult,
         StartLocation,
         EndLocation,                      
 		ECollisionChannel::ECC_Visibility,
-        QueryParams
+        GetInteractionQueryParams()
     );
 
 	return HitResult;
 }
 
-void AIBTestCharacter::GetPlayerInteractionRange(FVector& StartLocation, FVector& EndLocation)
+FCollisionQueryParams AIBTestCharacter::GetInteractionQueryParams() const
+{
+	return FCollisionQueryParams(FName(TEXT("PlayerTrace")), false, GetOwner());
+}
+
+void AIBTestCharacter::GetPlayerInteractionRange(FVector& StartLocation, FVector& EndLocation) const
 {
 	if(!FirstPersonCameraComponent) return;
 
-	const float Range = 500.f;
 	StartLocation = FirstPersonCameraComponent->GetComponentLocation();
-	EndLocation = StartLocation + FirstPersonCameraComponent->GetForwardVector() * Range;
+	EndLocation = StartLocation + FirstPersonCameraComponent->GetForwardVector() * InteractionRange;
+}
+
+FVector AIBTestCharacter::GetGrabTargetLocation(const FRotator& ViewRotation) const
+{
+	return FirstPersonCameraComponent->GetComponentLocation() + ViewRotation.Vector() * InteractionRange;
 }
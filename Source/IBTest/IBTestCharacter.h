@@ -5,14 +5,16 @@
 #include "CoreMinimal.h"
 #include "GameFramework/Character.h"
 #include "Logging/LogMacros.h"
+#include "Networking/InteractionRequest.h"
 #include "IBTestCharacter.generated.h"
 
 class UInputComponent;
 class USkeletalMeshComponent;
 class UCameraComponent;
-class UPhysicsHandleComponent;
 class UInputAction;
 class UInputMappingContext;
+class AShape;
+class AShapeInstanceCell;
 struct FInputActionValue;
 
 DECLARE_LOG_CATEGORY_EXTERN(LogTemplateCharacter, Log, All);
@@ -30,10 +32,6 @@ class AIBTestCharacter : public ACharacter
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = Camera, meta = (AllowPrivateAccess = "true"))
 	UCameraComponent* FirstPersonCameraComponent;
 
-	/** Physics handle */
-	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = Camera, meta = (AllowPrivateAccess = "true"))
-	UPhysicsHandleComponent* PhysicsHandleComponent;
-
 	/** MappingContext */
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category=Input, meta=(AllowPrivateAccess = "true"))
 	UInputMappingContext* DefaultMappingContext;
@@ -103,11 +101,35 @@ protected:
 	/** Play error sound */
 	void PlayErrorSFX();
 
-	/** Line trace used to interact with interactable objects */
+	/** Line trace used to interact with interactable objects, cached for the frame. Uses the batched focus trace when there is one */
 	FHitResult PlayerTrace();
 
-	/** Return start and end location of the ray used to scan for objects */
-	void GetPlayerInteractionRange(FVector& StartLocation, FVector& EndLocation);
+	/** Interaction line trace between the given locations */
+	FHitResult TraceInteraction(const FVector& StartLocation, const FVector& EndLocation) const;
+
+	/** Build the compact interaction request sent to the server for a player trace hit */
+	FInteractionRequest MakeInteractionRequest(const FHitResult& HitResult) const;
+
+	/** Server: re-trace the interaction from the client view, return the target if it is really in range. Cached for the frame */
+	AActor* ResolveInteractionTarget(const FInteractionRequest& Request);
+
+	/** Return the grab target at the end of the interaction ray for the given view rotation */
+	FVector GetGrabTargetLocation(const FRotator& ViewRotation) const;
+
+	/** Send the view rotation driving the server grab, at most GrabTargetUpdateRate times per second and only when it changed */
+	void SendGrabTarget(float DeltaSeconds);
+
+	/** Start pulling the component toward the grab target on this side only, the character ticks until it is released */
+	void StartGrab(UPrimitiveComponent* Component);
+
+	/** Release the grabbed object on this side only */
+	void ReleaseGrab();
+
+	/** Client: return true if the interaction was last sent at least InteractionRequestInterval ago, and restart its interval */
+	bool CanSendInteraction(int32 InteractionIndex);
+
+	/** Server: take a token from the interaction bucket of this connection, false means the request must be dropped */
+	bool ConsumeInteractionToken();
 
 	// APawn interface
 	virtual void SetupPlayerInputComponent(UInputComponent* InputComponent) override;
@@ -115,13 +137,106 @@ protected:
 
 	/** Server rpc to perform first interaction */
 	UFUNCTION(Server, Reliable, WithValidation)
-	void Server_Interact1(const FHitResult& HitResult);
+	void Server_Interact1(const FInteractionRequest& Request);
 
 	/** Server rpc to perform second interaction */
 	UFUNCTION(Server, Reliable, WithValidation)
-	void Server_Interact2(const FHitResult& HitResult);
+	void Server_Interact2(const FInteractionRequest& Request);
+
+	/** Server rpc to grab a replicated physics actor, the server runs the physics handle */
+	UFUNCTION(Server, Reliable, WithValidation)
+	void Server_BeginGrab(AActor* Target, uint32 PackedViewRotation);
+
+	/** Server rpc streaming the quantized view rotation that drives the grab target */
+	UFUNCTION(Server, Unreliable, WithValidation)
+	void Server_UpdateGrabTarget(uint32 PackedViewRotation);
+
+	/** Server rpc to release the grabbed actor */
+	UFUNCTION(Server, Reliable, WithValidation)
+	void Server_EndGrab();
+
+	/** Tell the owning client its grab was rejected or ended by the server */
+	UFUNCTION(Client, Reliable)
+	void Client_EndGrab();
+
+	/** Server rpc to turn a demoted shape grabbed by the client back into an actor, out of range shapes are ignored */
+	UFUNCTION(Server, Unreliable)
+	void Server_PromoteShape(AShapeInstanceCell* Cell, uint32 InstanceId);
+
+private:
+
+	/** Component pulled by the grab subsystem for this character */
+	TWeakObjectPtr<UPrimitiveComponent> GrabbedComponent;
+
+	/** View rotation received from the owning client, used by the server to place the grab target */
+	FRotator GrabViewRotation;
+
+	/** Rotation per second between the last two view rotations received, extrapolates the view between updates */
+	FRotator GrabViewRotationRate;
+
+	/** Time the last view rotation was received */
+	double GrabViewRotationTime = 0.;
+
+	/** Grab target of the previous tick, gives the target velocity */
+	FVector LastGrabTargetLocation;
+
+	/** Set once LastGrabTargetLocation holds a target of the current grab */
+	bool bHasLastGrabTarget = false;
+
+	/** Last packed view rotation sent to the server */
+	uint32 LastSentGrabTarget = 0;
+
+	/** Time since the last grab target was sent */
+	float GrabTargetSendTime = 0.f;
+
+	/** Result of the last PlayerTrace and the frame it was done in */
+	FHitResult CachedPlayerTrace;
+	uint64 PlayerTraceFrame = 0;
+
+	/** Last interaction request checked by the server, its target and the frame it was checked in */
+	FInteractionRequest ResolvedRequest;
+	TWeakObjectPtr<AActor> ResolvedTarget;
+	uint64 ResolvedRequestFrame = 0;
+
+	/** Time each interaction was last sent to the server, Interact1 then Interact2 */
+	double LastInteractionTimes[2] = { -DBL_MAX, -DBL_MAX };
+
+	/** Server side token bucket limiting the interaction requests of the owning connection */
+	float InteractionTokens = 0.f;
+	double InteractionTokensTime = -DBL_MAX;
+
+	/** Interaction requests of the owning connection dropped by the token bucket */
+	int32 NumDroppedInteractions = 0;
+
+	/** Last demoted shape the client asked the server to promote and when, traces keep hitting it until the actor replicates */
+	uint32 LastPromotionRequest = 0;
+	double LastPromotionRequestTime = -DBL_MAX;
 
 public:
+	/** Trace from the camera and run the primary interaction on the hit actor, shared by input and bots */
+	void TryInteract1();
+
+	/** Trace from the camera and run the secondary interaction on the hit actor, shared by input and bots */
+	void TryInteract2();
+
+	/** Grab the traced physics object, shared by input and bots */
+	void TryBeginGrab();
+
+	/** Release the grabbed physics object, if any */
+	void TryEndGrab();
+
+	/** Return true if a physics object is currently grabbed */
+	bool IsGrabbing() const;
+
+	/** Turn the demoted shape hit by a trace back into an actor, right away on the server and through Server_PromoteShape on clients. Return the actor if it is already there */
+	AShape* PromoteTracedShape(const FHitResult& HitResult);
+
+	/** Return start and end location of the ray used to scan for objects */
+	void GetPlayerInteractionRange(FVector& StartLocation, FVector& EndLocation) const;
+
+	/** Query parameters of the interaction traces */
+	FCollisionQueryParams GetInteractionQueryParams() const;
+
 	/** Returns Mesh1P subobject **/
 	USkeletalMeshComponent* GetMesh1P() const { return Mesh1P; }
 	/** Returns FirstPersonCameraComponent subobject **/
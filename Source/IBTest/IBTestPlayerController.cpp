@@ -3,6 +3,26 @@
 
 #include "IBTestPlayerController.h"
 #include "EnhancedInputSubsystems.h"
+#include "Camera/CameraComponent.h"
+#include "EngineUtils.h"
+#include "Misc/CommandLine.h"
+
+#include "IBTestCharacter.h"
+#include "GameplaySettings.h"
+#include "MachineButton.h"
+#include "Shape.h"
+
+namespace
+{
+	/** Distance at which bots stop walking and act, below the character interaction range */
+	const float BotActionRange = 300.f;
+
+	/** Bots give up targets they could not reach in this time */
+	const float BotTargetTimeout = 10.f;
+
+	/** Time between two changes of direction of wandering bots */
+	const float BotWanderDuration = 3.f;
+}
 
 void AIBTestPlayerController::BeginPlay()
 {
@@ -16,4 +36,202 @@ void AIBTestPlayerController::BeginPlay()
 
 		UE_LOG(LogTemp, Warning, TEXT("BeginPlay"));
 	}
-}
\ No newline at end of file
+
+	bBotMode = IsLocalController() && FParse::Param(FCommandLine::Get(), TEXT("IBTestBot"));
+	if (bBotMode)
+	{
+		int32 BotSeed = static_cast<int32>(FPlatformTime::Cycles());
+		FParse::Value(FCommandLine::Get(), TEXT("BotSeed="), BotSeed);
+		BotRandom.Initialize(BotSeed);
+
+		UE_LOG(LogTemp, Display, TEXT("%s: running as a bot, seed %d"), *GetName(), BotSeed);
+	}
+}
+
+void AIBTestPlayerController::PlayerTick(float DeltaTime)
+{
+	Super::PlayerTick(DeltaTime);
+
+	if (bBotMode)
+	{
+		TickBot(DeltaTime);
+	}
+}
+
+void AIBTestPlayerController::TickBot(float DeltaTime)
+{
+	AIBTestCharacter* BotCharacter = GetPawn<AIBTestCharacter>();
+	if (!BotCharacter) return;
+
+	// Carried shapes are released after a while, wherever the bot is
+	if (BotCharacter->IsGrabbing())
+	{
+		BotGrabTimeLeft -= DeltaTime;
+		if (BotGrabTimeLeft <= 0.f)
+		{
+			BotCharacter->TryEndGrab();
+		}
+	}
+
+	const FBotLoadPhase* Phase = UpdateBotPhase(DeltaTime);
+	if (!Phase) return;
+
+	if (BotAction == EBotAction::None)
+	{
+		BotActionDelay -= DeltaTime;
+		if (BotActionDelay <= 0.f && !BotCharacter->IsGrabbing())
+		{
+			ChooseBotAction(*Phase);
+			BotActionDelay = GetNextBotActionDelay(*Phase);
+		}
+	}
+
+	AActor* Target = BotTarget.Get();
+	if (BotAction != EBotAction::None && !Target)
+	{
+		BotAction = EBotAction::None;
+	}
+
+	if (BotAction == EBotAction::None)
+	{
+		if (!Phase->bWalk) return;
+
+		// Wander around between actions, so the server also sees movement only clients
+		BotWanderTimeLeft -= DeltaTime;
+		if (BotWanderTimeLeft <= 0.f)
+		{
+			BotWanderDirection = FRotator(0.f, BotRandom.FRandRange(-180.f, 180.f), 0.f).Vector();
+			BotWanderTimeLeft = BotWanderDuration;
+		}
+
+		BotCharacter->AddMovementInput(BotWanderDirection);
+		return;
+	}
+
+	// Aim at the target so the character trace hits it
+	const FVector ViewLocation = BotCharacter->GetFirstPersonCameraComponent()->GetComponentLocation();
+	const FVector ToTarget = Target->GetActorLocation() - ViewLocation;
+	SetControlRotation(ToTarget.Rotation());
+
+	if (ToTarget.SizeSquared() <= FMath::Square(BotActionRange))
+	{
+		PerformBotAction(BotCharacter);
+		return;
+	}
+
+	BotTargetTime += DeltaTime;
+	if (!Phase->bWalk || BotTargetTime > BotTargetTimeout)
+	{
+		BotAction = EBotAction::None;
+		BotTarget.Reset();
+		return;
+	}
+
+	BotCharacter->AddMovementInput(FVector(ToTarget.X, ToTarget.Y, 0.f).GetSafeNormal());
+}
+
+const FBotLoadPhase* AIBTestPlayerController::UpdateBotPhase(float DeltaTime)
+{
+	const UGameplaySettings* Settings = GetDefault<UGameplaySettings>();
+	const TArray<FBotLoadPhase>& Profile = Settings->BotLoadProfile;
+	if (Profile.IsEmpty()) return nullptr;
+
+	BotPhaseTime += DeltaTime;
+
+	while (Profile.IsValidIndex(BotPhaseIndex) && BotPhaseTime > Profile[BotPhaseIndex].Duration)
+	{
+		BotPhaseTime -= Profile[BotPhaseIndex].Duration;
+		++BotPhaseIndex;
+
+		if (BotPhaseIndex == Profile.Num() && Settings->bLoopBotLoadProfile)
+		{
+			BotPhaseIndex = 0;
+		}
+
+		if (Profile.IsValidIndex(BotPhaseIndex))
+		{
+			UE_LOG(LogTemp, Display, TEXT("%s: bot entering load phase %d"), *GetName(), BotPhaseIndex);
+			BotActionDelay = GetNextBotActionDelay(Profile[BotPhaseIndex]);
+		}
+
+		// Guard against a profile made of empty phases
+		if (BotPhaseIndex == 0 && Profile[0].Duration <= 0.f) break;
+	}
+
+	return Profile.IsValidIndex(BotPhaseIndex) ? &Profile[BotPhaseIndex] : nullptr;
+}
+
+void AIBTestPlayerController::ChooseBotAction(const FBotLoadPhase& Phase)
+{
+	const float TotalWeight = Phase.Interact1Weight + Phase.Interact2Weight + Phase.GrabWeight;
+	if (TotalWeight <= 0.f) return;
+
+	const float Roll = BotRandom.FRandRange(0.f, TotalWeight);
+	if (Roll < Phase.Interact1Weight)
+	{
+		BotAction = EBotAction::Interact1;
+	}
+	else if (Roll < Phase.Interact1Weight + Phase.Interact2Weight)
+	{
+		BotAction = EBotAction::Interact2;
+	}
+	else
+	{
+		BotAction = EBotAction::Grab;
+	}
+
+	BotTarget = FindBotTarget(BotAction == EBotAction::Grab ? AShape::StaticClass() : AMachineButton::StaticClass());
+	BotTargetTime = 0.f;
+}
+
+void AIBTestPlayerController::PerformBotAction(AIBTestCharacter* BotCharacter)
+{
+	switch (BotAction)
+	{
+	case EBotAction::Interact1:
+		BotCharacter->TryInteract1();
+		break;
+
+	case EBotAction::Interact2:
+		BotCharacter->TryInteract2();
+		break;
+
+	case EBotAction::Grab:
+		BotCharacter->TryBeginGrab();
+		BotGrabTimeLeft = GetDefault<UGameplaySettings>()->BotLoadProfile[BotPhaseIndex].GrabDuration;
+		break;
+
+	default:
+		break;
+	}
+
+	BotAction = EBotAction::None;
+	BotTarget.Reset();
+}
+
+AActor* AIBTestPlayerController::FindBotTarget(UClass* TargetClass) const
+{
+	// Reservoir sampling, targets are picked rarely enough that a full scan is fine
+	AActor* Target = nullptr;
+	int32 NumCandidates = 0;
+
+	for (TActorIterator<AActor> It(GetWorld(), TargetClass); It; ++It)
+	{
+		if (It->IsHidden()) continue;
+
+		++NumCandidates;
+		if (BotRandom.RandHelper(NumCandidates) == 0)
+		{
+			Target = *It;
+		}
+	}
+
+	return Target;
+}
+
+float AIBTestPlayerController::GetNextBotActionDelay(const FBotLoadPhase& Phase)
+{
+	if (Phase.ActionsPerSecond <= 0.f) return Phase.Duration;
+
+	return -FMath::Loge(1.f - BotRandom.GetFraction() * 0.999f) / Phase.ActionsPerSecond;
+}
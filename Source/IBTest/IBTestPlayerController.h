@@ -7,15 +7,33 @@
 #include "IBTestPlayerController.generated.h"
 
 class UInputMappingContext;
+class AIBTestCharacter;
+struct FBotLoadPhase;
+
+/** Actions performed by bot clients */
+UENUM()
+enum class EBotAction : uint8
+{
+	None,
+	Interact1,
+	Interact2,
+	Grab
+};
 
 /**
+ * Player controller of the first person character.
  *
+ * Local controllers of clients started with -IBTestBot are driven by a bot following the BotLoadProfile of UGameplaySettings:
+ * they walk to machine buttons and shapes, aim at them and go through the same traces and server RPCs as real players.
+ * Used to load a dedicated server with many headless clients, for example:
+ *   IBTest -server -log
+ *   IBTest 127.0.0.1 -game -nullrhi -nosound -unattended -IBTestBot [-BotSeed=<seed>]   (once per bot)
  */
 UCLASS()
 class IBTEST_API AIBTestPlayerController : public APlayerController
 {
 	GENERATED_BODY()
-	
+
 protected:
 
 	/** Input Mapping Context to be used for player input */
@@ -28,4 +46,58 @@ protected:
 	virtual void BeginPlay() override;
 
 	// End Actor interface
+
+	// Begin PlayerController interface
+public:
+
+	virtual void PlayerTick(float DeltaTime) override;
+
+	// End PlayerController interface
+
+	/** Return true if this controller is driven by a bot */
+	FORCEINLINE bool IsBot() const { return bBotMode; }
+
+private:
+
+	/** Run the bot for one frame */
+	void TickBot(float DeltaTime);
+
+	/** Return the current phase of the load profile, or nullptr once it is over */
+	const FBotLoadPhase* UpdateBotPhase(float DeltaTime);
+
+	/** Pick the next action and its target according to the phase weights */
+	void ChooseBotAction(const FBotLoadPhase& Phase);
+
+	/** Run the chosen action on the target in front of the character */
+	void PerformBotAction(AIBTestCharacter* BotCharacter);
+
+	/** Find a random actor of the given class, or nullptr if there is none */
+	AActor* FindBotTarget(UClass* TargetClass) const;
+
+	/** Time to wait before the next action, actions follow a Poisson process */
+	float GetNextBotActionDelay(const FBotLoadPhase& Phase);
+
+	UPROPERTY(Transient)
+	TWeakObjectPtr<AActor> BotTarget;
+
+	FRandomStream BotRandom;
+
+	FVector BotWanderDirection = FVector::ZeroVector;
+
+	int32 BotPhaseIndex = 0;
+
+	float BotPhaseTime = 0.f;
+
+	float BotActionDelay = 0.f;
+
+	/** Time spent walking to the current target, it is given up past a limit */
+	float BotTargetTime = 0.f;
+
+	float BotGrabTimeLeft = 0.f;
+
+	float BotWanderTimeLeft = 0.f;
+
+	EBotAction BotAction = EBotAction::None;
+
+	bool bBotMode = false;
 };
@@ -2,31 +2,29 @@
 
 #include "Machine.h"
 #include "Components/BoxComponent.h"
+#include "Misc/ScopeExit.h"
 
+#include "IBTest.h"
+#include "Conveyor.h"
 #include "Shape.h"
-#include "Data/ShapeData.h"
-#include "GameplaySettings.h"
+#include "Subsystems/RecipeRegistrySubsystem.h"
+#include "Subsystems/ShapePoolSubsystem.h"
+#include "Subsystems/MachineSubsystem.h"
+#include "Subsystems/NetDormancySubsystem.h"
+#include "Subsystems/CosmeticEventSubsystem.h"
+#include "Subsystems/CraftingJournalSubsystem.h"
+#include "Subsystems/ShapeDemotionSubsystem.h"
+#include "Kismet/GameplayStatics.h"
 #include "NiagaraFunctionLibrary.h"
-#include "Algo/Accumulate.h"
 #include "Net/UnrealNetwork.h"
-#include "Kismet/DataTableFunctionLibrary.h"
 #include "Net/Core/PushModel/PushModel.h"
 
-namespace
-{
-	int32 GetTotalShapesInRecipe(const FRecipeData& RecipeData)
-	{
-		TArray<int32> Shapes;
-		RecipeData.InShapes.GenerateValueArray(Shapes);
-		const int32 TotalShapes = Algo::Accumulate(Shapes, 0);
-
-		return TotalShapes;
-	}
-}
-
 // Sets default values
 AMachine::AMachine()
-	: bEnabled(true)
+	: bPendingRecipeEvaluation(false)
+	, bEvaluatingRecipes(false)
+	, bEnabled(true)
+	, bDrainIngredients(false)
 {
 	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
 	PrimaryActorTick.bCanEverTick = false;
@@ -46,6 +44,9 @@ AMachine::AMachine()
 	CollisionBox->OnComponentEndOverlap.AddDynamic(this, &ThisClass::OnEndOverlap);
 
 	SetReplicates(true);
+
+	// Machines only replicate when enabled or disabled and when they craft, they are flushed on every change
+	NetDormancy = DORM_DormantAll;
 }
 
 // Called when the game starts or when spawned
@@ -53,89 +54,388 @@ void AMachine::BeginPlay()
 {
 	Super::BeginPlay();
 
+	RecipeRegistry = URecipeRegistrySubsystem::Get(this);
+	ShapePool = GetWorld()->GetSubsystem<UShapePoolSubsystem>();
+	MachineSubsystem = GetWorld()->GetSubsystem<UMachineSubsystem>();
+
+	ProfileStartTime = FPlatformTime::Seconds();
+
 	InitializeRecipes();
+
+	PreloadOutputClasses();
+
+	// Demoted shapes have no overlaps, the ones already inside the box become ingredients as actors
+	UShapeDemotionSubsystem* ShapeDemotion = GetWorld()->GetSubsystem<UShapeDemotionSubsystem>();
+	if (HasAuthority() && ShapeDemotion && CollisionBox)
+	{
+		ShapeDemotion->PromoteShapesInBox(CollisionBox->Bounds.GetBox());
+	}
+}
+
+void AMachine::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (MachineSubsystem && EvaluationSlot != INDEX_NONE)
+	{
+		MachineSubsystem->UnregisterMachine(EvaluationSlot);
+		EvaluationSlot = INDEX_NONE;
+	}
+
+	Super::EndPlay(EndPlayReason);
 }
 
 void AMachine::InitializeRecipes()
 {
-	for (const auto& RecipeID : RecipeIDs)
+	if (!RecipeRegistry) return;
+
+	// Recipes are validated and sorted by priority when the registry is built, machines sharing a recipe list share its compiled matcher
+	const FMachineRecipes& MachineRecipes = RecipeRegistry->GetMachineRecipes(RecipeIDs);
+	RecipeMatcher = MachineRecipes.Matcher;
+
+	ShapeIngredients.Reset();
+	ShapeIngredients.SetNum(RecipeMatcher.GetNumShapes());
+
+	ItemIngredients.Reset();
+	ItemIngredients.SetNumZeroed(RecipeMatcher.GetNumShapes());
+
+	// The evaluation slot is sized for the compiled recipes, the same slot comes back when their size did not change
+	if (MachineSubsystem && EvaluationSlot != INDEX_NONE)
 	{
-		if (FRecipeData* RecipeData = GetRecipeData(RecipeID))
-		{
-			// Recipes need at least 2 input shapes to avoid infinite loops
-			check(GetTotalShapesInRecipe(*RecipeData) > 1);
+		MachineSubsystem->UnregisterMachine(EvaluationSlot);
+		EvaluationSlot = INDEX_NONE;
+	}
 
-			CachedRecipes.Add(RecipeData);
-		}
+	// Ingredients are only tracked by the server
+	if (MachineSubsystem && HasAuthority())
+	{
+		EvaluationSlot = MachineSubsystem->RegisterMachine(this);
+	}
+
+	// Replays compile the same recipes in the same order, so matcher recipe indices match.
+	// Machines are registered once, later initializations replace their recipes under the same id
+	if (CraftingJournal)
+	{
+		CraftingJournal->RecordRecipesChanged(JournalId, MachineRecipes.RecipeIndices);
 	}
+	else if (HasAuthority())
+	{
+		UCraftingJournalSubsystem* Journal = GetWorld()->GetSubsystem<UCraftingJournalSubsystem>();
+		JournalId = Journal ? Journal->RegisterMachine(this, MachineRecipes.RecipeIndices) : INDEX_NONE;
+		CraftingJournal = JournalId != INDEX_NONE ? Journal : nullptr;
+	}
+}
+
+void AMachine::PreloadOutputClasses()
+{
+	if (!RecipeRegistry || !HasAuthority()) return;
 
-	// Sort recipes by number of required ingredients in descending order
-	// In case of different recipes requiring the same ingredients, we will give priority to the one with most ingredients 
-	// e.g. Recipe1: {2 cubes}, Recipe2: {2 cubes, 1 sphere} -> choose Recipe2 in this case 
-	CachedRecipes.Sort([](const FRecipeData& A, const FRecipeData& B) {
-		const int32 TotalAShapes = GetTotalShapesInRecipe(A);
-		const int32 TotalBShapes = GetTotalShapesInRecipe(B);
+	TArray<int32> OutputShapes;
+	for (int32 RecipeIndex = 0; RecipeIndex < RecipeMatcher.GetNumRecipes(); ++RecipeIndex)
+	{
+		OutputShapes.AddUnique(RecipeMatcher.GetRecipe(RecipeIndex).Record->OutShapeIndex);
+	}
 
-		return TotalAShapes > TotalBShapes;
-		});
+	OutputClassesHandle = RecipeRegistry->RequestShapeClasses(OutputShapes);
 }
 
 void AMachine::CheckRecipes()
 {
-	if(!bEnabled) return;
+	if(!bEnabled || !RecipeMatcher.HasSatisfiedRecipes()) return;
 
-	for (FRecipeData* RecipeData : CachedRecipes)
+	// Recipes are walked in priority order, the matcher counters tell which ones can be completed
+	for (int32 RecipeIndex = 0; RecipeIndex < RecipeMatcher.GetNumRecipes(); ++RecipeIndex)
 	{
-		if (RecipeData && !IsMissingIngredient(RecipeData))
+		if (!IsMissingIngredient(RecipeIndex))
 		{
-			ConsumeRecipe(RecipeData);
+			ConsumeRecipe(RecipeIndex);
 		}
 	}
 }
 
-void AMachine::ConsumeRecipe(const FRecipeData* RecipeData, bool bConsumeIngredients /* = true */)
+void AMachine::RequestRecipeEvaluation()
+{
+	if (bRestoringSnapshot || !bEnabled || !RecipeMatcher.HasSatisfiedRecipes()) return;
+
+	if (MachineSubsystem)
+	{
+		MachineSubsystem->MarkMachineDirty(this);
+	}
+	else
+	{
+		EvaluateRecipes();
+	}
+}
+
+void AMachine::EvaluateRecipes()
+{
+	// Re-entrant calls, from outputs spawned into the box while evaluating, return without doing anything
+	if (bEvaluatingRecipes) return;
+
+	TGuardValue<bool> EvaluatingGuard(bEvaluatingRecipes, true);
+
+	IBTEST_SCOPE_CYCLE_COUNTER(EvaluateRecipes);
+	IBTEST_INC_COUNTER(RecipeChecks, 1);
+
+	RecordJournal(ECraftingJournalEvent::EvaluationBegin);
+
+	const uint64 StartCycles = FPlatformTime::Cycles64();
+	ON_SCOPE_EXIT
+	{
+		++NumProfiledEvaluations;
+		EvaluationCycles += FPlatformTime::Cycles64() - StartCycles;
+
+		RecordJournal(ECraftingJournalEvent::EvaluationEnd);
+	};
+
+	if (bDrainIngredients)
+	{
+		DrainRecipes();
+		return;
+	}
+
+	// Several shapes may have arrived since the last evaluation, keep going until nothing can be crafted.
+	// Every craft uses at least 2 shapes to make 1, so this always ends
+	do
+	{
+		CheckRecipes();
+	}
+	while (bEnabled && RecipeMatcher.HasSatisfiedRecipes());
+}
+
+void AMachine::DrainRecipes()
+{
+	if (!bEnabled || !RecipeMatcher.HasSatisfiedRecipes()) return;
+
+	TArray<FRecipeCraft> Crafts;
+	RecipeMatcher.ComputeCraftCounts(Crafts);
+
+	CompleteCrafts(Crafts);
+}
+
+void AMachine::CompleteCrafts(TArray<FRecipeCraft>& Crafts)
+{
+	// Consume everything first so outputs landing in the box don't interfere with the batch
+	TArray<AShape*> ConsumedShapes;
+	for (FRecipeCraft& Craft : Crafts)
+	{
+		// Crafts of batched evaluations were found earlier in the pass, shapes may have left the box since
+		Craft.NumCrafts = FMath::Min(Craft.NumCrafts, GetMaxCrafts(Craft.RecipeIndex));
+		ConsumeIngredients(Craft.RecipeIndex, Craft.NumCrafts, ConsumedShapes);
+	}
+
+	Crafts.RemoveAll([](const FRecipeCraft& Craft) { return Craft.NumCrafts <= 0; });
+	if (Crafts.IsEmpty()) return;
+
+	ReleaseShapes(ConsumedShapes);
+
+	for (const FRecipeCraft& Craft : Crafts)
+	{
+		RecordJournal(ECraftingJournalEvent::Craft, Craft.RecipeIndex, Craft.NumCrafts);
+		SpawnShapes(RecipeMatcher.GetRecipe(Craft.RecipeIndex).Record->OutShapeIndex, Craft.NumCrafts);
+	}
+
+	// One event for the whole batch
+	int32 NumBatchCrafts = 0;
+	for (const FRecipeCraft& Craft : Crafts)
+	{
+		NumBatchCrafts += Craft.NumCrafts;
+	}
+
+	IBTEST_INC_COUNTER(Crafts, NumBatchCrafts);
+	NumCompletedCrafts += NumBatchCrafts;
+
+	QueueCosmeticEvent(ECosmeticEvent::CraftCompleted, NumBatchCrafts);
+}
+
+void AMachine::ApplyEvaluation(TConstArrayView<FMachineCraft> Crafts, uint64 ComputeCycles)
 {
-	// Destroy shape ingredients (only the ones used by the recipe)
-	if (bConsumeIngredients)
-	{ 
-		const TMap<FName, int>& InputShapes = RecipeData->InShapes;
-		for (const auto& InputShape : InputShapes)
+	// Same bookkeeping as EvaluateRecipes, only the search for crafts ran in the machine subsystem
+	if (bEvaluatingRecipes) return;
+
+	TGuardValue<bool> EvaluatingGuard(bEvaluatingRecipes, true);
+
+	IBTEST_SCOPE_CYCLE_COUNTER(EvaluateRecipes);
+	IBTEST_INC_COUNTER(RecipeChecks, 1);
+
+	RecordJournal(ECraftingJournalEvent::EvaluationBegin);
+
+	const uint64 StartCycles = FPlatformTime::Cycles64();
+	ON_SCOPE_EXIT
+	{
+		++NumProfiledEvaluations;
+		EvaluationCycles += ComputeCycles + FPlatformTime::Cycles64() - StartCycles;
+
+		RecordJournal(ECraftingJournalEvent::EvaluationEnd);
+	};
+
+	if (!bEnabled || Crafts.IsEmpty()) return;
+
+	if (bDrainIngredients)
+	{
+		TArray<FRecipeCraft> RecipeCrafts;
+		for (const FMachineCraft& Craft : Crafts)
 		{
-			const FName ShapeName = InputShape.Key;
-			const int32 NumOfShapes = InputShape.Value;
-			TArray<AShape*> ShapesToDestroy;
-			ShapeIngredients.MultiFind(ShapeName, ShapesToDestroy);
-
-			for (int32 i = 0; i < NumOfShapes; ++i)
-			{
-				if (ShapesToDestroy.IsValidIndex(i))
-				{
-					ShapeIngredients.Remove(ShapeName, ShapesToDestroy[i]);
-					ShapesToDestroy[i]->Destroy();
-				}
-			}
+			RecipeCrafts.Add({ Craft.RecipeIndex, Craft.NumCrafts });
 		}
+
+		CompleteCrafts(RecipeCrafts);
+		return;
 	}
 
-	// Finally spawn the output shape
-	SpawnShapeByName(RecipeData->OutShape);
+	// One completion at a time in the order of CheckRecipes, so the journal reads the same as an evaluation on the machine
+	for (const FMachineCraft& Craft : Crafts)
+	{
+		for (int32 CraftIndex = 0; CraftIndex < Craft.NumCrafts && !IsMissingIngredient(Craft.RecipeIndex); ++CraftIndex)
+		{
+			ConsumeRecipe(Craft.RecipeIndex);
+		}
+	}
+}
+
+int32 AMachine::GetMaxCrafts(int32 RecipeIndex) const
+{
+	int32 NumCrafts = MAX_int32;
+	for (const FRecipeRequirement& Requirement : RecipeMatcher.GetRecipe(RecipeIndex).Requirements)
+	{
+		NumCrafts = FMath::Min(NumCrafts, RecipeMatcher.GetShapeCount(Requirement.ShapeIndex) / Requirement.Count);
+	}
+
+	return NumCrafts;
+}
+
+void AMachine::SyncIngredientCount(int32 ShapeIndex)
+{
+	if (MachineSubsystem && EvaluationSlot != INDEX_NONE)
+	{
+		MachineSubsystem->SetIngredientCount(EvaluationSlot, ShapeIndex, RecipeMatcher.GetShapeCount(ShapeIndex));
+	}
+}
+
+void AMachine::ConsumeRecipe(int32 RecipeIndex)
+{
+	// Recycle shape ingredients (only the ones used by the recipe)
+	TArray<AShape*> ConsumedShapes;
+	ConsumeIngredients(RecipeIndex, 1, ConsumedShapes);
+	ReleaseShapes(ConsumedShapes);
+
+	RecordJournal(ECraftingJournalEvent::Craft, RecipeIndex, 1);
+	CompleteRecipe(RecipeMatcher.GetRecipe(RecipeIndex).Record);
+}
 
-	if (GetLocalRole() == ROLE_Authority && GetNetMode() != NM_DedicatedServer)
+void AMachine::ConsumeIngredients(int32 RecipeIndex, int32 NumCrafts, TArray<AShape*>& OutConsumedShapes)
+{
+	const FCompiledRecipe& Recipe = RecipeMatcher.GetRecipe(RecipeIndex);
+
+	for (const FRecipeRequirement& Requirement : Recipe.Requirements)
 	{
-		PlaySpawnEffect_Implementation();
+		// Conveyor items are used first, they have no actor to release
+		int32& NumItems = ItemIngredients[Requirement.ShapeIndex];
+		const int32 NumItemsToConsume = FMath::Min(Requirement.Count * NumCrafts, NumItems);
+		NumItems -= NumItemsToConsume;
+
+		TArray<AShape*>& Shapes = ShapeIngredients[Requirement.ShapeIndex];
+		const int32 NumToConsume = FMath::Min(Requirement.Count * NumCrafts - NumItemsToConsume, Shapes.Num());
+
+		OutConsumedShapes.Append(Shapes.GetData() + Shapes.Num() - NumToConsume, NumToConsume);
+		Shapes.RemoveAt(Shapes.Num() - NumToConsume, NumToConsume, false);
+
+		RecipeMatcher.RemoveShapes(Requirement.ShapeIndex, NumItemsToConsume + NumToConsume);
+		SyncIngredientCount(Requirement.ShapeIndex);
 	}
 }
 
-bool AMachine::IsMissingIngredient(const FRecipeData* RecipeData) const
+void AMachine::ReleaseShapes(const TArray<AShape*>& Shapes)
 {
-	for (const auto& Shape : RecipeData->InShapes)
+	IBTEST_SCOPE_CYCLE_COUNTER(ReleaseShapes);
+	IBTEST_INC_COUNTER(ShapesReleased, Shapes.Num());
+
+	for (AShape* Shape : Shapes)
 	{
-		const FName RecipeShapeName = Shape.Key;
-		const int32 RecipeShapeNum = Shape.Value;
+		if (!IsValid(Shape)) continue;
 
-		if (!ShapeIngredients.Contains(RecipeShapeName) ||
-			ShapeIngredients.Num(RecipeShapeName) < RecipeShapeNum)
+		if (ShapePool)
+		{
+			ShapePool->ReleaseShape(Shape);
+		}
+		else
 		{
+			Shape->Destroy();
+		}
+	}
+}
+
+void AMachine::CompleteRecipe(const FRecipeRecord* Recipe)
+{
+	// Finally spawn the output shape
+	SpawnShape(Recipe->OutShapeIndex);
+
+	IBTEST_INC_COUNTER(Crafts, 1);
+	++NumCompletedCrafts;
+
+	QueueCosmeticEvent(ECosmeticEvent::CraftCompleted);
+}
+
+bool AMachine::IsMissingIngredient(int32 RecipeIndex) const
+{
+	return !RecipeMatcher.IsRecipeSatisfied(RecipeIndex);
+}
+
+void AMachine::AddIngredient(AShape* ShapeActor)
+{
+	const int32 ShapeIndex = RecipeMatcher.FindShapeIndex(ShapeActor->GetShapeIndex());
+
+	// Shapes not used by any recipe of this machine are ignored
+	if (ShapeIndex == INDEX_NONE) return;
+
+	ShapeIngredients[ShapeIndex].Add(ShapeActor);
+	RecipeMatcher.AddShape(ShapeIndex);
+	SyncIngredientCount(ShapeIndex);
+
+	IBTEST_INC_COUNTER(IngredientsAdded, 1);
+	RecordJournal(ECraftingJournalEvent::IngredientAdded, ShapeActor->GetShapeIndex());
+}
+
+bool AMachine::RemoveIngredient(AShape* ShapeActor)
+{
+	const int32 ShapeIndex = RecipeMatcher.FindShapeIndex(ShapeActor->GetShapeIndex());
+	if (ShapeIndex == INDEX_NONE) return false;
+
+	// Shapes consumed by a recipe were already removed
+	if (ShapeIngredients[ShapeIndex].RemoveSingleSwap(ShapeActor, false) == 0) return false;
+
+	RecipeMatcher.RemoveShape(ShapeIndex);
+	SyncIngredientCount(ShapeIndex);
+
+	IBTEST_INC_COUNTER(IngredientsRemoved, 1);
+	RecordJournal(ECraftingJournalEvent::IngredientRemoved, ShapeActor->GetShapeIndex());
+	return true;
+}
+
+bool AMachine::AddItemIngredient(int32 ShapeIndex)
+{
+	const int32 MatcherShapeIndex = HasAuthority() ? RecipeMatcher.FindShapeIndex(ShapeIndex) : INDEX_NONE;
+	if (MatcherShapeIndex == INDEX_NONE) return false;
+
+	++ItemIngredients[MatcherShapeIndex];
+	RecipeMatcher.AddShape(MatcherShapeIndex);
+	SyncIngredientCount(MatcherShapeIndex);
+
+	IBTEST_INC_COUNTER(IngredientsAdded, 1);
+	RecordJournal(ECraftingJournalEvent::IngredientAdded, ShapeIndex);
+
+	RequestRecipeEvaluation();
+	return true;
+}
+
+bool AMachine::PutOnOutputConveyor(int32 ShapeIndex)
+{
+	for (int32 Attempt = 0; Attempt < OutputConveyors.Num(); ++Attempt)
+	{
+		AConveyor* Conveyor = OutputConveyors[NextOutputConveyor % OutputConveyors.Num()];
+		NextOutputConveyor = (NextOutputConveyor + 1) % OutputConveyors.Num();
+
+		if (Conveyor && Conveyor->InsertItem(ShapeIndex))
+		{
+			IBTEST_INC_COUNTER(ShapesSpawned, 1);
 			return true;
 		}
 	}
@@ -143,28 +443,138 @@ bool AMachine::IsMissingIngredient(const FRecipeData* RecipeData) const
 	return false;
 }
 
-void AMachine::SpawnShapeByName(const FName& ShapeName)
+void AMachine::SpawnShapes(int32 ShapeIndex, int32 Count)
+{
+	for (int32 i = 0; i < Count; ++i)
+	{
+		SpawnShape(ShapeIndex);
+	}
+}
+
+void AMachine::SpawnShape(int32 ShapeIndex)
+{
+	// Shapes are replicated, only the server spawns them
+	if (!RecipeRegistry || !HasAuthority()) return;
+
+	// Outputs on a belt are plain data, they need no class and no actor
+	if (PutOnOutputConveyor(ShapeIndex)) return;
+
+	if (RecipeRegistry->GetRegistry().IsShapeClassLoaded(ShapeIndex))
+	{
+		SpawnLoadedShape(ShapeIndex);
+		return;
+	}
+
+	// Never block the game thread on a load, the shape is spawned once its class is streamed in
+	PendingSpawns.Add({ ShapeIndex, FPlatformTime::Seconds() });
+	RecipeRegistry->RequestShapeClasses({ ShapeIndex }, FStreamableDelegate::CreateUObject(this, &ThisClass::ProcessPendingSpawns));
+}
+
+void AMachine::ProcessPendingSpawns()
 {
-	const UGameplaySettings* Settings = GetDefault<UGameplaySettings>();
-	const TSoftObjectPtr<UDataTable> Shapes = Settings->ShapeDataTable.LoadSynchronous();
-	if (Shapes)
+	if (!RecipeRegistry) return;
+
+	const FRecipeRegistry& Registry = RecipeRegistry->GetRegistry();
+	const double Now = FPlatformTime::Seconds();
+
+	// Spawning may queue new shapes through overlaps, so the queue is split before spawning anything
+	TArray<FPendingShapeSpawn> ReadySpawns;
+	TArray<FPendingShapeSpawn> StillPendingSpawns;
+	for (const FPendingShapeSpawn& PendingSpawn : PendingSpawns)
 	{
-		if (FShapeData* ShapeData = Shapes->FindRow<FShapeData>(ShapeName, ""))
+		const FShapeRecord* Shape = Registry.GetShape(PendingSpawn.ShapeIndex);
+
+		if (!Shape || Shape->ShapeClassPath.IsNull())
 		{
-			FActorSpawnParameters SpawnParameters;
-			SpawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButAlwaysSpawn;
-			SpawnParameters.Owner = this;
-			const FTransform ShapeTransform = FTransform(FQuat::Identity, GetActorLocation());
-	
-			UClass* ShapeClass = ShapeData->ShapeClass.LoadSynchronous();
-			GetWorld()->SpawnActor<AActor>(ShapeClass, ShapeTransform, SpawnParameters);
+			UE_LOG(LogTemp, Error, TEXT("%s: shape %d has no class and cannot be spawned"), *GetName(), PendingSpawn.ShapeIndex);
 		}
+		else if (Shape->ShapeClass)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("%s: spawn of %s waited %.2f ms for its class to load"),
+				*GetName(), *Shape->ShapeID.ToString(), (Now - PendingSpawn.RequestTime) * 1000.0);
+
+			ReadySpawns.Add(PendingSpawn);
+		}
+		else
+		{
+			StillPendingSpawns.Add(PendingSpawn);
+		}
+	}
+
+	PendingSpawns = MoveTemp(StillPendingSpawns);
+
+	for (const FPendingShapeSpawn& ReadySpawn : ReadySpawns)
+	{
+		SpawnLoadedShape(ReadySpawn.ShapeIndex);
 	}
 }
 
-void AMachine::PlaySpawnEffect_Implementation()
+void AMachine::SpawnLoadedShape(int32 ShapeIndex)
 {
-	UNiagaraFunctionLibrary::SpawnSystemAtLocation(GetWorld(), SpawnEffect, GetActorLocation());
+	const FShapeRecord* Shape = RecipeRegistry->GetRegistry().GetShape(ShapeIndex);
+	if (!Shape || !Shape->ShapeClass) return;
+
+	IBTEST_SCOPE_CYCLE_COUNTER(SpawnShape);
+	IBTEST_INC_COUNTER(ShapesSpawned, 1);
+
+	const FTransform ShapeTransform = FTransform(FQuat::Identity, GetActorLocation());
+
+	if (ShapePool)
+	{
+		ShapePool->AcquireShape(Shape->ShapeClass, ShapeTransform, this);
+		return;
+	}
+
+	FActorSpawnParameters SpawnParameters;
+	SpawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButAlwaysSpawn;
+	SpawnParameters.Owner = this;
+
+	GetWorld()->SpawnActor<AActor>(Shape->ShapeClass, ShapeTransform, SpawnParameters);
+}
+
+void AMachine::RecordJournal(ECraftingJournalEvent Type, int32 Index, int32 Count)
+{
+	if (CraftingJournal)
+	{
+		CraftingJournal->Record(JournalId, Type, Index, Count);
+	}
+}
+
+void AMachine::QueueCosmeticEvent(ECosmeticEvent Type, int32 Count)
+{
+	if (!HasAuthority()) return;
+
+	// Sent through the cell of the machine, the machine itself stays dormant
+	if (UCosmeticEventSubsystem* CosmeticEvents = GetWorld()->GetSubsystem<UCosmeticEventSubsystem>())
+	{
+		CosmeticEvents->QueueEvent(this, Type, Count);
+	}
+}
+
+void AMachine::PlayCosmeticEvent(ECosmeticEvent Type, int32 Count)
+{
+	switch (Type)
+	{
+	case ECosmeticEvent::CraftCompleted:
+		// Pooled by the Niagara world manager, a batch of crafts plays a single effect
+		UNiagaraFunctionLibrary::SpawnSystemAtLocation(GetWorld(), SpawnEffect, GetActorLocation(), FRotator::ZeroRotator, FVector::OneVector,
+			true, true, ENCPoolMethod::AutoRelease, true);
+		break;
+
+	case ECosmeticEvent::Toggled:
+		if (ToggleSFX)
+		{
+			UGameplayStatics::PlaySoundAtLocation(GetWorld(), ToggleSFX, GetActorLocation());
+		}
+		break;
+
+	case ECosmeticEvent::Error:
+		if (ErrorSFX)
+		{
+			UGameplayStatics::PlaySoundAtLocation(GetWorld(), ErrorSFX, GetActorLocation());
+		}
+		break;
+	}
 }
 
 void AMachine::GetLifetimeReplicatedProps(TArray< FLifetimeProperty >& OutLifetimeProps) const
@@ -188,36 +598,17 @@ void AMachine::OnRep_SetEnabled()
 	}
 }
 
-FRecipeData* AMachine::GetRecipeData(const FName& RecipeName) const
+const FRecipeRecord* AMachine::GetRecipe(const FName& RecipeName) const
 {
-	FRecipeData* RecipeData = nullptr;
+	if (!RecipeRegistry) return nullptr;
 
-	const UGameplaySettings* Settings = GetDefault<UGameplaySettings>();
-	const TSoftObjectPtr<UDataTable> Recipes = Settings->RecipeDataTable.LoadSynchronous();
-	if (Recipes)
-	{
-		RecipeData = Recipes->FindRow<FRecipeData>(RecipeName, "");
-	}
-
-	return RecipeData;
+	const FRecipeRegistry& Registry = RecipeRegistry->GetRegistry();
+	return Registry.GetRecipe(Registry.FindRecipeIndex(RecipeName));
 }
 
-FRecipeData* AMachine::GetRandomRecipeData() const
+const FRecipeRecord* AMachine::GetRandomRecipe() const
 {
-	FRecipeData* RecipeData = nullptr;
-
-	const UGameplaySettings* Settings = GetDefault<UGameplaySettings>();
-	const TSoftObjectPtr<UDataTable> Recipes = Settings->RecipeDataTable.LoadSynchronous();
-	if (Recipes)
-	{
-		TArray<FName> RecipeList;
-		UDataTableFunctionLibrary::GetDataTableRowNames(Recipes.Get(), RecipeList);
-
-		const int32 RecipeIdx = FMath::RandRange(0, RecipeList.Num() - 1);
-		RecipeData = Recipes->FindRow<FRecipeData>(RecipeList[RecipeIdx], "");
-	}
-
-	return RecipeData;
+	return RecipeRegistry ? RecipeRegistry->GetRegistry().GetRandomRecipe() : nullptr;
 }
 
 void AMachine::SetMachineEnabled(bool bMachineEnabled)
@@ -225,45 +616,84 @@ void AMachine::SetMachineEnabled(bool bMachineEnabled)
 	if (bEnabled == bMachineEnabled) return;
 
 	bEnabled = bMachineEnabled;
-	MARK_PROPERTY_DIRTY_FROM_NAME(AMachine, bEnabled, this);
+	MARK_PROPERTY_DIRTY_AND_FLUSH_DORMANCY(AMachine, bEnabled, this);
+
+	RecordJournal(ECraftingJournalEvent::Enabled, bEnabled ? 1 : 0);
+
+	QueueCosmeticEvent(ECosmeticEvent::Toggled);
 
 	if (bEnabled)
 	{
-		CheckRecipes();
+		RequestRecipeEvaluation();
 	}
 }
 
+void AMachine::BeginSnapshotRestore(bool bSavedEnabled)
+{
+	bRestoringSnapshot = true;
+
+	if (bEnabled != bSavedEnabled)
+	{
+		bEnabled = bSavedEnabled;
+		MARK_PROPERTY_DIRTY_AND_FLUSH_DORMANCY(AMachine, bEnabled, this);
+
+		RecordJournal(ECraftingJournalEvent::Enabled, bEnabled ? 1 : 0);
+	}
+}
+
+void AMachine::RestoreIngredient(AShape* ShapeActor)
+{
+	const int32 ShapeIndex = ShapeActor ? RecipeMatcher.FindShapeIndex(ShapeActor->GetShapeIndex()) : INDEX_NONE;
+	if (ShapeIndex == INDEX_NONE || ShapeIngredients[ShapeIndex].Contains(ShapeActor)) return;
+
+	AddIngredient(ShapeActor);
+}
+
+void AMachine::EndSnapshotRestore()
+{
+	bRestoringSnapshot = false;
+
+	RequestRecipeEvaluation();
+}
+
 void AMachine::CompleteRandomRecipe()
 {
-	if(!bEnabled) return;
+	// The client checked the machine was on, it was turned off in the meantime
+	if (!bEnabled)
+	{
+		QueueCosmeticEvent(ECosmeticEvent::Error);
+		return;
+	}
 
-	FRecipeData* RecipeData = GetRandomRecipeData();
-	if (RecipeData)
+	if (const FRecipeRecord* Recipe = GetRandomRecipe())
 	{
-		ConsumeRecipe(RecipeData, false);
-		PlaySpawnEffect();
+		CompleteRecipe(Recipe);
 	}
 }
 
 void AMachine::OnBeginOverlap(UPrimitiveComponent* OverlappedComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, int32 OtherBodyIndex, bool bFromSweep, const FHitResult& SweepResult)
 {
+	// Ingredients are only tracked by the server, clients see the results through replication
 	AShape* ShapeActor = Cast<AShape>(OtherActor);
-	if (!ShapeActor) return;
+	if (!ShapeActor || !HasAuthority()) return;
 
-	const FName ShapeId = ShapeActor->GetShapeID();
+	// Restored shapes can overlap before or after the snapshot links them
+	if (bRestoringSnapshot)
+	{
+		RestoreIngredient(ShapeActor);
+		return;
+	}
 
-	ShapeIngredients.Add(ShapeId, ShapeActor);
+	AddIngredient(ShapeActor);
 
-	CheckRecipes();
+	RequestRecipeEvaluation();
 }
 
 void AMachine::OnEndOverlap(UPrimitiveComponent* OverlappedComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, int32 OtherBodyIndex)
 {
 	AShape* ShapeActor = Cast<AShape>(OtherActor);
-	if (!ShapeActor) return;
-
-	const FName ShapeId = ShapeActor->GetShapeID();
+	if (!ShapeActor || !HasAuthority()) return;
 
-	ShapeIngredients.Remove(ShapeId, ShapeActor);
+	RemoveIngredient(ShapeActor);
 }
 
@@ -4,27 +4,100 @@
 
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
-#include "Data/RecipeData.h"
+#include "Crafting/RecipeMatcher.h"
+#include "Crafting/CraftingJournal.h"
+#include "Networking/CosmeticEventCell.h"
 
 #include "Machine.generated.h"
 
 class UBoxComponent;
+class AConveyor;
 class AShape;
 class UNiagaraSystem;
 class USoundBase;
+class URecipeRegistrySubsystem;
+class UCraftingJournalSubsystem;
+class UShapePoolSubsystem;
+class UMachineSubsystem;
+struct FMachineCraft;
+struct FRecipeRecord;
+struct FStreamableHandle;
+
+/** Output shape waiting for its class to be streamed in */
+struct FPendingShapeSpawn
+{
+	/** Registry index of the shape to spawn */
+	int32 ShapeIndex;
+
+	/** Time at which the spawn was requested */
+	double RequestTime;
+};
 
 UCLASS()
 class IBTEST_API AMachine : public AActor
 {
 	GENERATED_BODY()
 
+	friend class UMachineSubsystem;
+	friend class UCraftingBenchmarkCommandlet;
+	friend class UFactorySnapshotSubsystem;
+
 private:
 
-	/** Cached recipes sorted by total number of recipes */
-	TArray<FRecipeData*> CachedRecipes; 
+	/** Registry holding the recipe and shape records, cached at BeginPlay */
+	UPROPERTY(Transient)
+	TObjectPtr<URecipeRegistrySubsystem> RecipeRegistry;
+
+	/** Pool used to recycle consumed shapes and spawn outputs, cached at BeginPlay */
+	UPROPERTY(Transient)
+	TObjectPtr<UShapePoolSubsystem> ShapePool;
+
+	/** Compiled recipes and ingredient counters used to find recipes ready to be processed */
+	FRecipeMatcher RecipeMatcher;
+
+	/** All shapes ready to be processed by the machine, indexed by the matcher shape index */
+	TArray<TArray<AShape*>> ShapeIngredients;
+
+	/** Ingredients delivered by conveyors, counted by matcher shape index, they have no actor */
+	TArray<int32> ItemIngredients;
+
+	/** Output conveyor the next output is put on first, round robin */
+	int32 NextOutputConveyor = 0;
+
+	/** Keeps the output classes of this machine's recipes loaded */
+	TSharedPtr<FStreamableHandle> OutputClassesHandle;
+
+	/** Spawns waiting for their shape class to be loaded */
+	TArray<FPendingShapeSpawn> PendingSpawns;
+
+	/** Subsystem coalescing recipe evaluations, cached at BeginPlay */
+	UPROPERTY(Transient)
+	TObjectPtr<UMachineSubsystem> MachineSubsystem;
+
+	/** Journal recording this machine, null when the crafting journal is off */
+	UPROPERTY(Transient)
+	TObjectPtr<UCraftingJournalSubsystem> CraftingJournal;
 
-	/** All shapes ready to be processed by the machine */
-	TMultiMap<FName, AShape*> ShapeIngredients; 
+	/** Id of the machine in the crafting journal */
+	int32 JournalId = INDEX_NONE;
+
+	/** Slot of the machine in the batched evaluations of the machine subsystem, INDEX_NONE when evaluated on its own */
+	int32 EvaluationSlot = INDEX_NONE;
+
+	/** The machine is queued for a recipe evaluation */
+	bool bPendingRecipeEvaluation;
+
+	/** The machine is currently evaluating its recipes */
+	bool bEvaluatingRecipes;
+
+	/** Ingredients are being restored from a factory snapshot, recipes are evaluated once it is done */
+	bool bRestoringSnapshot = false;
+
+	/** Crafts completed and recipe evaluations run since ProfileStartTime, see IBTest.Machines.Profile */
+	int64 NumCompletedCrafts = 0;
+	int64 NumProfiledEvaluations = 0;
+	uint64 EvaluationCycles = 0;
+	double ProfileStartTime = 0.;
 
 	/** The machine can only process recipes when bEnabled is true */
 	UPROPERTY(ReplicatedUsing=OnRep_SetEnabled)
@@ -44,11 +117,27 @@ protected:
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Machine")
 	TObjectPtr<UNiagaraSystem> SpawnEffect;
 
+	/** Sound played when the machine is turned on or off */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Machine")
+	TObjectPtr<USoundBase> ToggleSFX;
+
+	/** Sound played when a recipe is requested while the machine is off */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Machine")
+	TObjectPtr<USoundBase> ErrorSFX;
+
 public:
 
+	/** Complete each recipe as many times as the ingredients allow in one batch, instead of once per evaluation */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Machine")
+	bool bDrainIngredients;
+
 	/** Recipe id used by this machine */
 	UPROPERTY(EditInstanceOnly, Category="Machine")
 	TArray<FName> RecipeIDs;
+
+	/** Belts the outputs are put on, outputs are spawned as shapes when every belt is full */
+	UPROPERTY(EditInstanceOnly, Category="Machine")
+	TArray<TObjectPtr<AConveyor>> OutputConveyors;
 	
 public:	
 	// Sets default values for this actor's properties
@@ -58,18 +147,67 @@ protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
 
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 	void InitializeRecipes();
 
+	/** Start streaming the output classes of the machine recipes */
+	void PreloadOutputClasses();
+
 	void CheckRecipes();
 
-	void ConsumeRecipe(const FRecipeData* RecipeData, bool bConsumeIngredients = true);
+	/** Queue a recipe evaluation, run once at the end of the frame no matter how many times it is requested */
+	void RequestRecipeEvaluation();
+
+	void ConsumeRecipe(int32 RecipeIndex);
+
+	/** Complete every satisfiable recipe as many times as possible in one batch, in priority order */
+	void DrainRecipes();
+
+	/** Consume the ingredients of every craft first, then spawn their outputs. Crafts are cut down to the ingredients left */
+	void CompleteCrafts(TArray<FRecipeCraft>& Crafts);
+
+	/** Complete the crafts found for this machine by a batched evaluation of the machine subsystem */
+	void ApplyEvaluation(TConstArrayView<FMachineCraft> Crafts, uint64 ComputeCycles);
+
+	/** Number of times a recipe can be completed from the current ingredients */
+	int32 GetMaxCrafts(int32 RecipeIndex) const;
+
+	/** Copy the count of a matcher shape to the slot of the machine in the machine subsystem */
+	void SyncIngredientCount(int32 ShapeIndex);
+
+	/** Remove the ingredients of NumCrafts completions of a recipe, without releasing them */
+	void ConsumeIngredients(int32 RecipeIndex, int32 NumCrafts, TArray<AShape*>& OutConsumedShapes);
+
+	/** Give consumed shapes back to the pool */
+	void ReleaseShapes(const TArray<AShape*>& Shapes);
+
+	void CompleteRecipe(const FRecipeRecord* Recipe);
+
+	bool IsMissingIngredient(int32 RecipeIndex) const;
+
+	void AddIngredient(AShape* ShapeActor);
 
-	bool IsMissingIngredient(const FRecipeData* RecipeData) const;
+	bool RemoveIngredient(AShape* ShapeActor);
 
-	void SpawnShapeByName(const FName& ShapeName);
+	/** Put an output on an output conveyor, false if there is none with room */
+	bool PutOnOutputConveyor(int32 ShapeIndex);
 
-	UFUNCTION(NetMulticast, Unreliable)
-	void PlaySpawnEffect();
+	/** Put a shape on an output conveyor, or spawn it right away if its class is loaded, otherwise queue it until it is */
+	void SpawnShape(int32 ShapeIndex);
+
+	void SpawnShapes(int32 ShapeIndex, int32 Count);
+
+	/** Spawn the queued shapes whose class has been loaded */
+	void ProcessPendingSpawns();
+
+	void SpawnLoadedShape(int32 ShapeIndex);
+
+	/** Add a record to the crafting journal if it is recording this machine */
+	void RecordJournal(ECraftingJournalEvent Type, int32 Index = 0, int32 Count = 0);
+
+	/** Send a cosmetic event to the players around the machine (server only) */
+	void QueueCosmeticEvent(ECosmeticEvent Type, int32 Count = 1);
 
 	// Replication
 	void GetLifetimeReplicatedProps(TArray< FLifetimeProperty >& OutLifetimeProps) const override;
@@ -79,14 +217,34 @@ public:
 	UFUNCTION()
 	void OnRep_SetEnabled();
 
-	FRecipeData* GetRecipeData(const FName& RecipeName) const;
+	/** Play the effects of a cosmetic event, Count events of the same type are played as one */
+	void PlayCosmeticEvent(ECosmeticEvent Type, int32 Count);
+
+	const FRecipeRecord* GetRecipe(const FName& RecipeName) const;
 
-	FRecipeData* GetRandomRecipeData() const;
+	const FRecipeRecord* GetRandomRecipe() const;
 
 	FORCEINLINE bool IsMachineEnabled() const { return bEnabled; }
 
+	FORCEINLINE bool IsEvaluatingRecipes() const { return bEvaluatingRecipes; }
+
+	/** Complete every recipe that can be made from the current ingredients */
+	void EvaluateRecipes();
+
 	void SetMachineEnabled(bool bEnabled);
 
+	/** Take the saved enabled state and hold recipe evaluations until EndSnapshotRestore (server only) */
+	void BeginSnapshotRestore(bool bSavedEnabled);
+
+	/** Add an ingredient without actor, delivered by a conveyor. False if no recipe of the machine uses the shape (server only) */
+	bool AddItemIngredient(int32 ShapeIndex);
+
+	/** Link a restored shape as an ingredient, shapes already linked by their overlap are skipped */
+	void RestoreIngredient(AShape* ShapeActor);
+
+	/** Evaluate the recipes with every restored ingredient */
+	void EndSnapshotRestore();
+
 	void CompleteRandomRecipe();
 
 	UFUNCTION()
@@ -0,0 +1,168 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Networking/CosmeticEventCell.h"
+#include "Engine/World.h"
+#include "GameFramework/GameStateBase.h"
+#include "Net/UnrealNetwork.h"
+#include "Net/Core/PushModel/PushModel.h"
+
+#include "Machine.h"
+#include "Subsystems/CosmeticEventSubsystem.h"
+
+namespace
+{
+	/** Events sent per batch, extra events of a busy frame are dropped */
+	const int32 MaxBatchEvents = 255;
+
+	/** Events merged into one entry */
+	const int32 MaxEventCount = 255;
+
+	/**
+	 * Batches older than this when received are stale, e.g. the last batch of a cell that just became relevant.
+	 * Pending events that waited this long for a net update of their cell are dropped by the server.
+	 */
+	const float MaxBatchAge = 1.f;
+}
+
+bool FCosmeticEventBatch::NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess)
+{
+	if (!Map)
+	{
+		bOutSuccess = false;
+		return false;
+	}
+
+	bOutSuccess = true;
+
+	Ar << BatchId;
+	Ar << ServerTime;
+
+	uint32 NumEvents = FMath::Min(Events.Num(), MaxBatchEvents);
+	Ar.SerializeIntPacked(NumEvents);
+
+	if (Ar.IsLoading())
+	{
+		if (NumEvents > MaxBatchEvents)
+		{
+			Ar.SetError();
+			bOutSuccess = false;
+			return false;
+		}
+
+		Events.SetNum(NumEvents);
+	}
+
+	for (uint32 Index = 0; Index < NumEvents; ++Index)
+	{
+		FCosmeticEvent& Event = Events[Index];
+
+		UObject* MachineObject = Event.Machine;
+		bOutSuccess &= Map->SerializeObject(Ar, AMachine::StaticClass(), MachineObject);
+		Event.Machine = Cast<AMachine>(MachineObject);
+
+		uint32 Type = static_cast<uint32>(Event.Type);
+		Ar.SerializeBits(&Type, 2);
+		Event.Type = static_cast<ECosmeticEvent>(Type);
+
+		uint32 Count = Event.Count;
+		Ar.SerializeIntPacked(Count);
+		Event.Count = static_cast<uint8>(FMath::Min<uint32>(Count, MaxEventCount));
+	}
+
+	return true;
+}
+
+ACosmeticEventCell::ACosmeticEventCell()
+{
+	PrimaryActorTick.bCanEverTick = false;
+
+	RootComponent = CreateDefaultSubobject<USceneComponent>(TEXT("Root"));
+
+	bReplicates = true;
+	SetReplicatingMovement(false);
+
+	// Covers the neighbouring cells, viewers at the edge of a cell still get the events of the next one
+	NetCullDistanceSquared = FMath::Square(8000.f);
+	NetUpdateFrequency = 20.f;
+}
+
+void ACosmeticEventCell::AddEvent(AMachine* Machine, ECosmeticEvent Type, int32 Count)
+{
+	FCosmeticEvent* Event = PendingEvents.FindByPredicate([Machine, Type](const FCosmeticEvent& Event) { return Event.Machine == Machine && Event.Type == Type; });
+	if (!Event)
+	{
+		if (PendingEvents.Num() >= MaxBatchEvents) return;
+
+		// The batch is as old as its oldest event, not as the net update sending it
+		if (PendingEvents.IsEmpty())
+		{
+			PendingEventsTime = GetWorld()->GetTimeSeconds();
+		}
+
+		Event = &PendingEvents.AddDefaulted_GetRef();
+		Event->Machine = Machine;
+		Event->Type = Type;
+		Event->Count = 0;
+	}
+
+	Event->Count = static_cast<uint8>(FMath::Min(Event->Count + Count, MaxEventCount));
+}
+
+void ACosmeticEventCell::PreReplication(IRepChangedPropertyTracker& ChangedPropertyTracker)
+{
+	Super::PreReplication(ChangedPropertyTracker);
+
+	if (PendingEvents.IsEmpty()) return;
+
+	UCosmeticEventSubsystem* CosmeticEvents = GetWorld()->GetSubsystem<UCosmeticEventSubsystem>();
+
+	// Events queued while no connection replicated the cell would be played long after the fact
+	if (GetWorld()->GetTimeSeconds() - PendingEventsTime > MaxBatchAge)
+	{
+		if (CosmeticEvents)
+		{
+			CosmeticEvents->RecordEventsDiscarded(PendingEvents.Num());
+		}
+
+		PendingEvents.Reset();
+		return;
+	}
+
+	// Everything queued since the last net update goes out as one batch
+	++Batch.BatchId;
+	Batch.ServerTime = PendingEventsTime;
+	Batch.Events = MoveTemp(PendingEvents);
+	PendingEvents.Reset();
+
+	MARK_PROPERTY_DIRTY_FROM_NAME(ACosmeticEventCell, Batch, this);
+
+	if (CosmeticEvents)
+	{
+		CosmeticEvents->RecordBatchSent(Batch);
+	}
+}
+
+void ACosmeticEventCell::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	FDoRepLifetimeParams Params;
+	Params.bIsPushBased = true;
+	Params.RepNotifyCondition = REPNOTIFY_OnChanged;
+
+	DOREPLIFETIME_WITH_PARAMS_FAST(ACosmeticEventCell, Batch, Params);
+}
+
+void ACosmeticEventCell::OnRep_Batch()
+{
+	const AGameStateBase* GameState = GetWorld()->GetGameState();
+	if (GameState && GameState->GetServerWorldTimeSeconds() - Batch.ServerTime > MaxBatchAge) return;
+
+	UCosmeticEventSubsystem* CosmeticEvents = GetWorld()->GetSubsystem<UCosmeticEventSubsystem>();
+	if (!CosmeticEvents) return;
+
+	for (const FCosmeticEvent& Event : Batch.Events)
+	{
+		CosmeticEvents->PlayEvent(Event.Machine, Event.Type, Event.Count);
+	}
+}
@@ -0,0 +1,108 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "CosmeticEventCell.generated.h"
+
+class AMachine;
+
+/** Cosmetic events played by machines, see AMachine::PlayCosmeticEvent */
+UENUM()
+enum class ECosmeticEvent : uint8
+{
+	CraftCompleted,
+	Toggled,
+	Error,
+};
+
+/** One cosmetic event of a machine, events of the same machine and type in a batch are merged into a count */
+USTRUCT()
+struct FCosmeticEvent
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	TObjectPtr<AMachine> Machine;
+
+	ECosmeticEvent Type = ECosmeticEvent::CraftCompleted;
+
+	uint8 Count = 1;
+};
+
+/**
+ * Cosmetic events gathered by a cell during one net update.
+ * Sent as the packed NetGUID of the machine, 2 bits of type and a packed count per event.
+ */
+USTRUCT()
+struct FCosmeticEventBatch
+{
+	GENERATED_BODY()
+
+	/** Lets clients tell two batches with the same events apart */
+	uint16 BatchId = 0;
+
+	/** Server world time the oldest event of the batch was queued at, clients ignore batches received long after it */
+	float ServerTime = 0.f;
+
+	UPROPERTY()
+	TArray<FCosmeticEvent> Events;
+
+	bool NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess);
+
+	bool operator==(const FCosmeticEventBatch& Other) const
+	{
+		return BatchId == Other.BatchId && ServerTime == Other.ServerTime;
+	}
+};
+
+template<>
+struct TStructOpsTypeTraits<FCosmeticEventBatch> : public TStructOpsTypeTraitsBase2<FCosmeticEventBatch>
+{
+	enum
+	{
+		WithNetSerializer = true,
+		WithIdenticalViaEquality = true,
+	};
+};
+
+/**
+ * Replicates the cosmetic events of one replication grid cell.
+ * Events queued during a frame are sent as one batch at the next net update of the cell,
+ * instead of one multicast RPC per event on every machine.
+ * Spawned on demand by UCosmeticEventSubsystem, relevant to the connections viewing the cell.
+ */
+UCLASS(NotPlaceable, Transient)
+class IBTEST_API ACosmeticEventCell : public AActor
+{
+	GENERATED_BODY()
+
+private:
+
+	UPROPERTY(ReplicatedUsing=OnRep_Batch)
+	FCosmeticEventBatch Batch;
+
+	/** Events queued since the last net update (server only) */
+	TArray<FCosmeticEvent> PendingEvents;
+
+	/** Server world time the first pending event was queued at */
+	float PendingEventsTime = 0.f;
+
+public:
+
+	ACosmeticEventCell();
+
+	/** Queue an event for the next net update (server only) */
+	void AddEvent(AMachine* Machine, ECosmeticEvent Type, int32 Count);
+
+	// AActor Begin
+	virtual void PreReplication(IRepChangedPropertyTracker& ChangedPropertyTracker) override;
+	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+	// AActor End
+
+protected:
+
+	UFUNCTION()
+	void OnRep_Batch();
+};
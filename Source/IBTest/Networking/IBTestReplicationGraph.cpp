@@ -0,0 +1,234 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Networking/IBTestReplicationGraph.h"
+#include "Engine/LevelScriptActor.h"
+#include "Engine/NetConnection.h"
+#include "Engine/NetDriver.h"
+#include "Engine/World.h"
+#include "GameFramework/Info.h"
+#include "GameFramework/Pawn.h"
+#include "HAL/IConsoleManager.h"
+#include "UObject/UObjectIterator.h"
+
+#include "GameplaySettings.h"
+#include "Conveyor.h"
+#include "Machine.h"
+#include "Networking/CosmeticEventCell.h"
+#include "Networking/ShapeInstanceCell.h"
+#include "MachineButton.h"
+#include "Shape.h"
+
+namespace
+{
+	FAutoConsoleCommandWithWorld DumpReplicationGraphCommand(
+		TEXT("IBTest.RepGraph.Dump"),
+		TEXT("Print the number of actors in every node of the IBTest replication graph"),
+		FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+			{
+				const UNetDriver* NetDriver = World ? World->GetNetDriver() : nullptr;
+				if (const UIBTestReplicationGraph* Graph = NetDriver ? NetDriver->GetReplicationDriver<UIBTestReplicationGraph>() : nullptr)
+				{
+					Graph->DumpNodes();
+				}
+				else
+				{
+					UE_LOG(LogTemp, Log, TEXT("The IBTest replication graph is not used by this world"));
+				}
+			}));
+
+	int32 CountActors(const UReplicationGraphNode* Node)
+	{
+		TArray<FActorRepListType> Actors;
+		Node->GetAllActorsInNode_Debugging(Actors);
+		return Actors.Num();
+	}
+}
+
+void UIBTestReplicationGraph::InitGlobalActorClassSettings()
+{
+	Super::InitGlobalActorClassSettings();
+
+	// Explicit rules, everything else is deduced from the class default object
+	ClassRepNodePolicies.Set(ALevelScriptActor::StaticClass(), EClassRepNodeMapping::NotRouted);
+	ClassRepNodePolicies.Set(AInfo::StaticClass(), EClassRepNodeMapping::RelevantAllConnections);
+	ClassRepNodePolicies.Set(AShape::StaticClass(), EClassRepNodeMapping::Spatialize_Dormancy);
+	ClassRepNodePolicies.Set(AMachine::StaticClass(), EClassRepNodeMapping::Spatialize_Dormancy);
+	ClassRepNodePolicies.Set(AMachineButton::StaticClass(), EClassRepNodeMapping::Spatialize_Static);
+	ClassRepNodePolicies.Set(ACosmeticEventCell::StaticClass(), EClassRepNodeMapping::Spatialize_Static);
+	ClassRepNodePolicies.Set(AShapeInstanceCell::StaticClass(), EClassRepNodeMapping::Spatialize_Dormancy);
+	ClassRepNodePolicies.Set(AConveyor::StaticClass(), EClassRepNodeMapping::Spatialize_Dormancy);
+
+	for (TObjectIterator<UClass> It; It; ++It)
+	{
+		UClass* Class = *It;
+		const AActor* ActorCDO = Cast<AActor>(Class->GetDefaultObject(false));
+		if (!ActorCDO || !ActorCDO->GetIsReplicated()) continue;
+
+		// Skip blueprint compilation leftovers
+		if (Class->GetName().StartsWith(TEXT("SKEL_")) || Class->GetName().StartsWith(TEXT("REINST_"))) continue;
+
+		if (!ClassRepNodePolicies.Get(Class))
+		{
+			ClassRepNodePolicies.Set(Class, GetDefaultMappingPolicy(ActorCDO));
+		}
+
+		FClassReplicationInfo ClassInfo;
+		ClassInfo.ReplicationPeriodFrame = GetReplicationPeriodFrameForFrequency(ActorCDO->NetUpdateFrequency);
+		ClassInfo.SetCullDistanceSquared(ActorCDO->NetCullDistanceSquared);
+
+		GlobalActorReplicationInfoMap.SetClassInfo(Class, ClassInfo);
+	}
+}
+
+void UIBTestReplicationGraph::InitGlobalGraphNodes()
+{
+	const UGameplaySettings* Settings = GetDefault<UGameplaySettings>();
+
+	GridNode = CreateNewNode<UReplicationGraphNode_GridSpatialization2D>();
+	GridNode->CellSize = Settings->ReplicationGridCellSize;
+	GridNode->SpatialBias = Settings->ReplicationGridSpatialBias;
+	AddGlobalGraphNode(GridNode);
+
+	AlwaysRelevantNode = CreateNewNode<UReplicationGraphNode_ActorList>();
+	AddGlobalGraphNode(AlwaysRelevantNode);
+}
+
+void UIBTestReplicationGraph::InitConnectionGraphNodes(UNetReplicationGraphConnection* ConnectionManager)
+{
+	Super::InitConnectionGraphNodes(ConnectionManager);
+
+	// The engine node already gathers the player controller, pawn and view target of every viewer of the connection
+	UReplicationGraphNode_AlwaysRelevant_ForConnection* ConnectionNode = CreateNewNode<UReplicationGraphNode_AlwaysRelevant_ForConnection>();
+	AddConnectionGraphNode(ConnectionNode, ConnectionManager);
+
+	ConnectionNodes.Add(ConnectionManager, ConnectionNode);
+}
+
+void UIBTestReplicationGraph::RemoveClientConnection(UNetConnection* NetConnection)
+{
+	// Entries of connections that are already gone are dropped on the way
+	for (auto It = ConnectionNodes.CreateIterator(); It; ++It)
+	{
+		const UNetReplicationGraphConnection* ConnectionManager = It.Key().Get();
+		if (!ConnectionManager || ConnectionManager->NetConnection == NetConnection)
+		{
+			It.RemoveCurrent();
+		}
+	}
+
+	Super::RemoveClientConnection(NetConnection);
+}
+
+EClassRepNodeMapping UIBTestReplicationGraph::GetMappingPolicy(const FNewReplicatedActorInfo& ActorInfo) const
+{
+	if (ActorInfo.Actor->bAlwaysRelevant)
+	{
+		return EClassRepNodeMapping::RelevantAllConnections;
+	}
+
+	const EClassRepNodeMapping* Policy = ClassRepNodePolicies.Get(ActorInfo.Class);
+	return Policy ? *Policy : EClassRepNodeMapping::Spatialize_Dynamic;
+}
+
+EClassRepNodeMapping UIBTestReplicationGraph::GetDefaultMappingPolicy(const AActor* ActorCDO) const
+{
+	if (ActorCDO->bAlwaysRelevant)
+	{
+		return EClassRepNodeMapping::RelevantAllConnections;
+	}
+
+	// Owner only actors are gathered by the per-connection node
+	if (ActorCDO->bOnlyRelevantToOwner)
+	{
+		return EClassRepNodeMapping::NotRouted;
+	}
+
+	return ActorCDO->IsA<APawn>() || ActorCDO->IsReplicatingMovement() ? EClassRepNodeMapping::Spatialize_Dynamic : EClassRepNodeMapping::Spatialize_Dormancy;
+}
+
+void UIBTestReplicationGraph::RouteAddNetworkActorToNodes(const FNewReplicatedActorInfo& ActorInfo, FGlobalActorReplicationInfo& GlobalInfo)
+{
+	switch (GetMappingPolicy(ActorInfo))
+	{
+	case EClassRepNodeMapping::RelevantAllConnections:
+		AlwaysRelevantNode->NotifyAddNetworkActor(ActorInfo);
+		break;
+
+	case EClassRepNodeMapping::Spatialize_Static:
+		GridNode->AddActor_Static(ActorInfo, GlobalInfo);
+		break;
+
+	case EClassRepNodeMapping::Spatialize_Dynamic:
+		GridNode->AddActor_Dynamic(ActorInfo, GlobalInfo);
+		break;
+
+	case EClassRepNodeMapping::Spatialize_Dormancy:
+		GridNode->AddActor_Dormancy(ActorInfo, GlobalInfo);
+		break;
+
+	default:
+		break;
+	}
+}
+
+void UIBTestReplicationGraph::RouteRemoveNetworkActorToNodes(const FNewReplicatedActorInfo& ActorInfo)
+{
+	switch (GetMappingPolicy(ActorInfo))
+	{
+	case EClassRepNodeMapping::RelevantAllConnections:
+		AlwaysRelevantNode->NotifyRemoveNetworkActor(ActorInfo);
+		break;
+
+	case EClassRepNodeMapping::Spatialize_Static:
+		GridNode->RemoveActor_Static(ActorInfo);
+		break;
+
+	case EClassRepNodeMapping::Spatialize_Dynamic:
+		GridNode->RemoveActor_Dynamic(ActorInfo);
+		break;
+
+	case EClassRepNodeMapping::Spatialize_Dormancy:
+		GridNode->RemoveActor_Dormancy(ActorInfo);
+		break;
+
+	default:
+		break;
+	}
+}
+
+void UIBTestReplicationGraph::DumpNodes() const
+{
+	int32 NumCells = 0;
+	int32 NumUsedCells = 0;
+	int32 NumGridActors = 0;
+	int32 MaxCellActors = 0;
+
+	// Dynamic actors are counted in every cell they overlap
+	for (const TArray<UReplicationGraphNode_GridCell*>& Column : GridNode->Grid)
+	{
+		for (const UReplicationGraphNode_GridCell* Cell : Column)
+		{
+			++NumCells;
+			if (!Cell) continue;
+
+			const int32 NumCellActors = CountActors(Cell);
+			NumUsedCells += NumCellActors > 0 ? 1 : 0;
+			NumGridActors += NumCellActors;
+			MaxCellActors = FMath::Max(MaxCellActors, NumCellActors);
+		}
+	}
+
+	UE_LOG(LogTemp, Log, TEXT("Replication graph for %s: %d replicated actors"), *GetNameSafe(GetWorld()), GlobalActorReplicationInfoMap.Num());
+	UE_LOG(LogTemp, Log, TEXT("  Always relevant: %d actors"), CountActors(AlwaysRelevantNode));
+	UE_LOG(LogTemp, Log, TEXT("  Grid: %d cells, %d used, %d actor entries, %.1f per used cell, %d max"),
+		NumCells, NumUsedCells, NumGridActors, NumUsedCells > 0 ? static_cast<float>(NumGridActors) / NumUsedCells : 0.f, MaxCellActors);
+
+	for (const auto& ConnectionNode : ConnectionNodes)
+	{
+		const UNetReplicationGraphConnection* ConnectionManager = ConnectionNode.Key.Get();
+		const UReplicationGraphNode* Node = ConnectionNode.Value.Get();
+		if (!ConnectionManager || !Node) continue;
+
+		UE_LOG(LogTemp, Log, TEXT("  Connection %s: %d actors"), *GetNameSafe(ConnectionManager->NetConnection), CountActors(Node));
+	}
+}
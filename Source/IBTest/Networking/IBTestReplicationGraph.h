@@ -0,0 +1,69 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ReplicationGraph.h"
+#include "IBTestReplicationGraph.generated.h"
+
+/** How actors of a class are routed to the replication graph nodes */
+UENUM()
+enum class EClassRepNodeMapping : uint8
+{
+	/** Not added to any node, replicated by other means (player controllers through the per-connection node) */
+	NotRouted,
+	/** Replicated to every connection */
+	RelevantAllConnections,
+	/** Never move, bucketed once in the grid */
+	Spatialize_Static,
+	/** Move every frame, bucketed in the grid every frame */
+	Spatialize_Dynamic,
+	/** Handled as static while dormant and as dynamic while awake */
+	Spatialize_Dormancy,
+};
+
+/**
+ * Replication graph of IBTest.
+ * Shapes, machines, buttons and pawns are bucketed in a 2D spatial grid so relevancy is decided per cell instead of per actor:
+ * shapes, machines, conveyors and shape instance cells use the dormancy aware path of the grid, buttons and cosmetic event cells the static one.
+ * Game state, player states and always relevant actors go in a global node, each connection gets its player controller,
+ * pawn and view target through its own node.
+ * Enabled through ReplicationDriverClassName in DefaultEngine.ini, IBTest.RepGraph.Dump prints node sizes.
+ */
+UCLASS(Transient, config=Engine)
+class IBTEST_API UIBTestReplicationGraph : public UReplicationGraph
+{
+	GENERATED_BODY()
+
+public:
+
+	// UReplicationGraph Begin
+	virtual void InitGlobalActorClassSettings() override;
+	virtual void InitGlobalGraphNodes() override;
+	virtual void InitConnectionGraphNodes(UNetReplicationGraphConnection* ConnectionManager) override;
+	virtual void RouteAddNetworkActorToNodes(const FNewReplicatedActorInfo& ActorInfo, FGlobalActorReplicationInfo& GlobalInfo) override;
+	virtual void RouteRemoveNetworkActorToNodes(const FNewReplicatedActorInfo& ActorInfo) override;
+	virtual void RemoveClientConnection(UNetConnection* NetConnection) override;
+	// UReplicationGraph End
+
+	/** Print the number of actors in every node to the log */
+	void DumpNodes() const;
+
+	UPROPERTY()
+	TObjectPtr<UReplicationGraphNode_GridSpatialization2D> GridNode;
+
+	UPROPERTY()
+	TObjectPtr<UReplicationGraphNode_ActorList> AlwaysRelevantNode;
+
+private:
+
+	EClassRepNodeMapping GetMappingPolicy(const FNewReplicatedActorInfo& ActorInfo) const;
+
+	/** Policy of classes without an explicit rule, deduced from their default object */
+	EClassRepNodeMapping GetDefaultMappingPolicy(const AActor* ActorCDO) const;
+
+	TClassMap<EClassRepNodeMapping> ClassRepNodePolicies;
+
+	/** Per-connection nodes, kept alive by their connection and removed with it */
+	TMap<TWeakObjectPtr<UNetReplicationGraphConnection>, TWeakObjectPtr<UReplicationGraphNode_AlwaysRelevant_ForConnection>> ConnectionNodes;
+};
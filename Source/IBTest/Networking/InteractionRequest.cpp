@@ -0,0 +1,35 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Networking/InteractionRequest.h"
+#include "Engine/NetSerialization.h"
+
+bool FInteractionRequest::NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess)
+{
+	if (!Map)
+	{
+		bOutSuccess = false;
+		return false;
+	}
+
+	bOutSuccess = true;
+
+	UObject* TargetObject = Target;
+	bOutSuccess &= Map->SerializeObject(Ar, AActor::StaticClass(), TargetObject);
+	Target = Cast<AActor>(TargetObject);
+
+	bOutSuccess &= SerializePackedVector<1, 24>(ViewOrigin, Ar);
+
+	Ar << PackedViewRotation;
+
+	return true;
+}
+
+uint32 FInteractionRequest::PackViewRotation(const FRotator& Rotation)
+{
+	return (static_cast<uint32>(FRotator::CompressAxisToShort(Rotation.Pitch)) << 16) | FRotator::CompressAxisToShort(Rotation.Yaw);
+}
+
+FRotator FInteractionRequest::UnpackViewRotation(uint32 PackedRotation)
+{
+	return FRotator(FRotator::DecompressAxisFromShort(PackedRotation >> 16), FRotator::DecompressAxisFromShort(PackedRotation & 0xFFFF), 0.f);
+}
@@ -0,0 +1,50 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "UObject/CoreNet.h"
+#include "InteractionRequest.generated.h"
+
+/**
+ * Interaction sent by a client: the actor it traced and a quantized view origin and direction.
+ * The server re-runs the trace from this view instead of trusting a client FHitResult.
+ */
+USTRUCT()
+struct IBTEST_API FInteractionRequest
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	TObjectPtr<AActor> Target;
+
+	/** Start of the interaction ray, sent with a 1 cm precision */
+	FVector ViewOrigin = FVector::ZeroVector;
+
+	/** Pitch and yaw of the interaction ray, see PackViewRotation */
+	uint32 PackedViewRotation = 0;
+
+	bool NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess);
+
+	bool operator==(const FInteractionRequest& Other) const
+	{
+		return Target == Other.Target && ViewOrigin == Other.ViewOrigin && PackedViewRotation == Other.PackedViewRotation;
+	}
+
+	FORCEINLINE FRotator GetViewRotation() const { return UnpackViewRotation(PackedViewRotation); }
+
+	/** Pitch and yaw compressed to 16 bits each, enough for a target 5 meters away */
+	static uint32 PackViewRotation(const FRotator& Rotation);
+
+	static FRotator UnpackViewRotation(uint32 PackedRotation);
+};
+
+template<>
+struct TStructOpsTypeTraits<FInteractionRequest> : public TStructOpsTypeTraitsBase2<FInteractionRequest>
+{
+	enum
+	{
+		WithNetSerializer = true,
+	};
+};
@@ -0,0 +1,17 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Networking/PayloadSizePackageMap.h"
+
+namespace
+{
+	/** NetGUID value used for object references when measuring, dynamic actors usually need 2 or 3 bytes */
+	const uint32 TypicalNetGUID = 4000;
+}
+
+bool UPayloadSizePackageMap::SerializeObject(FArchive& Ar, UClass* InClass, UObject*& Obj, FNetworkGUID* OutNetGUID)
+{
+	uint32 NetGUID = Obj ? TypicalNetGUID : 0;
+	Ar.SerializeIntPacked(NetGUID);
+
+	return true;
+}
@@ -0,0 +1,23 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/CoreNet.h"
+#include "PayloadSizePackageMap.generated.h"
+
+/**
+ * Package map used to measure the size of replicated payloads without touching a connection,
+ * see UInteractionSubsystem and UCosmeticEventSubsystem. Object references are written as a typical packed NetGUID.
+ */
+UCLASS(Transient)
+class UPayloadSizePackageMap : public UPackageMap
+{
+	GENERATED_BODY()
+
+public:
+
+	// UPackageMap Begin
+	virtual bool SerializeObject(FArchive& Ar, UClass* InClass, UObject*& Obj, FNetworkGUID* OutNetGUID = nullptr) override;
+	// UPackageMap End
+};
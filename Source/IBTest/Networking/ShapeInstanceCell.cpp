@@ -0,0 +1,182 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Networking/ShapeInstanceCell.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Engine/StreamableManager.h"
+#include "Net/UnrealNetwork.h"
+
+#include "Shape.h"
+#include "Subsystems/NetDormancySubsystem.h"
+#include "Subsystems/RecipeRegistrySubsystem.h"
+
+void FShapeInstance::PostReplicatedAdd(const FShapeInstanceArray& InArraySerializer)
+{
+	if (InArraySerializer.Cell)
+	{
+		InArraySerializer.Cell->ShowInstance(*this);
+	}
+}
+
+void FShapeInstance::PreReplicatedRemove(const FShapeInstanceArray& InArraySerializer)
+{
+	if (InArraySerializer.Cell)
+	{
+		InArraySerializer.Cell->HideInstance(*this);
+	}
+}
+
+AShapeInstanceCell::AShapeInstanceCell()
+{
+	PrimaryActorTick.bCanEverTick = false;
+
+	RootComponent = CreateDefaultSubobject<USceneComponent>(TEXT("Root"));
+
+	bReplicates = true;
+	SetReplicatingMovement(false);
+
+	// Only sends the shapes demoted or promoted since the last flush
+	NetDormancy = DORM_DormantAll;
+
+	// Covers the neighbouring cells, like the shape actors the instances replace
+	NetCullDistanceSquared = FMath::Square(8000.f);
+
+	Instances.Cell = this;
+}
+
+void AShapeInstanceCell::AddInstance(uint32 InstanceId, int32 ShapeIndex, const FTransform& Transform)
+{
+	FShapeInstance& Instance = Instances.Items.AddDefaulted_GetRef();
+	Instance.InstanceId = InstanceId;
+	Instance.ShapeIndex = static_cast<uint16>(ShapeIndex);
+	Instance.Location = Transform.GetLocation();
+	Instance.Rotation = Transform.Rotator();
+	Instance.Scale = Transform.GetScale3D();
+
+	Instances.MarkItemDirty(Instance);
+	MARK_PROPERTY_DIRTY_AND_FLUSH_DORMANCY(AShapeInstanceCell, Instances, this);
+
+	ShowInstance(Instance);
+}
+
+bool AShapeInstanceCell::RemoveInstance(uint32 InstanceId, FShapeInstance& OutInstance)
+{
+	const int32 Index = Instances.Items.IndexOfByPredicate([InstanceId](const FShapeInstance& Instance) { return Instance.InstanceId == InstanceId; });
+	if (Index == INDEX_NONE) return false;
+
+	OutInstance = Instances.Items[Index];
+	HideInstance(OutInstance);
+
+	Instances.Items.RemoveAtSwap(Index, 1, false);
+	Instances.MarkArrayDirty();
+	MARK_PROPERTY_DIRTY_AND_FLUSH_DORMANCY(AShapeInstanceCell, Instances, this);
+
+	return true;
+}
+
+uint32 AShapeInstanceCell::GetHitInstanceId(const FHitResult& Hit) const
+{
+	const int32 ShapeIndex = Components.IndexOfByKey(Hit.GetComponent());
+	if (ShapeIndex == INDEX_NONE || !ComponentInstanceIds[ShapeIndex].IsValidIndex(Hit.Item)) return 0;
+
+	return ComponentInstanceIds[ShapeIndex][Hit.Item];
+}
+
+const FShapeInstance* AShapeInstanceCell::FindInstance(uint32 InstanceId) const
+{
+	return Instances.Items.FindByPredicate([InstanceId](const FShapeInstance& Instance) { return Instance.InstanceId == InstanceId; });
+}
+
+void AShapeInstanceCell::ShowInstance(const FShapeInstance& Instance)
+{
+	UInstancedStaticMeshComponent* Component = GetComponent(Instance.ShapeIndex);
+	if (!Component)
+	{
+		// Clients can receive shapes whose class was never loaded, they show up once it is
+		URecipeRegistrySubsystem* RecipeRegistry = URecipeRegistrySubsystem::Get(this);
+		if (RecipeRegistry && !RecipeRegistry->GetRegistry().IsShapeClassLoaded(Instance.ShapeIndex) && !RequestedShapeClasses.Contains(Instance.ShapeIndex))
+		{
+			RequestedShapeClasses.Add(Instance.ShapeIndex);
+			ShapeClassesHandles.Add(RecipeRegistry->RequestShapeClasses({ Instance.ShapeIndex }, FStreamableDelegate::CreateUObject(this, &ThisClass::OnShapeClassesLoaded)));
+		}
+		return;
+	}
+
+	Component->AddInstance(Instance.GetTransform(), true);
+	ComponentInstanceIds[Instance.ShapeIndex].Add(Instance.InstanceId);
+}
+
+void AShapeInstanceCell::HideInstance(const FShapeInstance& Instance)
+{
+	if (!Components.IsValidIndex(Instance.ShapeIndex) || !Components[Instance.ShapeIndex]) return;
+
+	TArray<uint32>& InstanceIds = ComponentInstanceIds[Instance.ShapeIndex];
+	const int32 InstanceIndex = InstanceIds.Find(Instance.InstanceId);
+	if (InstanceIndex == INDEX_NONE) return;
+
+	// Instanced static mesh components keep the order of the remaining instances, so do the ids
+	Components[Instance.ShapeIndex]->RemoveInstance(InstanceIndex);
+	InstanceIds.RemoveAt(InstanceIndex, 1, false);
+}
+
+UInstancedStaticMeshComponent* AShapeInstanceCell::GetComponent(int32 ShapeIndex)
+{
+	if (Components.IsValidIndex(ShapeIndex) && Components[ShapeIndex])
+	{
+		return Components[ShapeIndex];
+	}
+
+	const URecipeRegistrySubsystem* RecipeRegistry = URecipeRegistrySubsystem::Get(this);
+	const FShapeRecord* Shape = RecipeRegistry ? RecipeRegistry->GetRegistry().GetShape(ShapeIndex) : nullptr;
+	const AShape* ShapeCDO = Shape && Shape->ShapeClass ? Shape->ShapeClass->GetDefaultObject<AShape>() : nullptr;
+
+	// Same collision as the shape actors so players and moving shapes still collide with them,
+	// no overlap events: machines promote the shapes inside their box instead
+	UInstancedStaticMeshComponent* Component = ShapeCDO ? ShapeCDO->CreateInstancedMesh(this) : nullptr;
+	if (!Component) return nullptr;
+
+	if (Components.Num() <= ShapeIndex)
+	{
+		Components.SetNum(ShapeIndex + 1);
+		ComponentInstanceIds.SetNum(ShapeIndex + 1);
+	}
+
+	Components[ShapeIndex] = Component;
+	return Component;
+}
+
+void AShapeInstanceCell::OnShapeClassesLoaded()
+{
+	ShapeClassesHandles.RemoveAll([](const TSharedPtr<FStreamableHandle>& Handle) { return !Handle || Handle->HasLoadCompleted(); });
+
+	const URecipeRegistrySubsystem* RecipeRegistry = URecipeRegistrySubsystem::Get(this);
+	if (!RecipeRegistry) return;
+
+	// Shapes of classes that had no mesh yet were never shown
+	TBitArray<> Waiting(false, RecipeRegistry->GetRegistry().GetNumShapes());
+	for (const FShapeInstance& Instance : Instances.Items)
+	{
+		const bool bHasComponent = Components.IsValidIndex(Instance.ShapeIndex) && Components[Instance.ShapeIndex];
+		if (!bHasComponent && RecipeRegistry->GetRegistry().IsShapeClassLoaded(Instance.ShapeIndex))
+		{
+			Waiting[Instance.ShapeIndex] = true;
+		}
+	}
+
+	for (const FShapeInstance& Instance : Instances.Items)
+	{
+		if (Waiting.IsValidIndex(Instance.ShapeIndex) && Waiting[Instance.ShapeIndex])
+		{
+			ShowInstance(Instance);
+		}
+	}
+}
+
+void AShapeInstanceCell::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	FDoRepLifetimeParams Params;
+	Params.bIsPushBased = true;
+
+	DOREPLIFETIME_WITH_PARAMS_FAST(AShapeInstanceCell, Instances, Params);
+}
@@ -0,0 +1,130 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "Net/Serialization/FastArraySerializer.h"
+#include "ShapeInstanceCell.generated.h"
+
+class AShapeInstanceCell;
+class UInstancedStaticMeshComponent;
+struct FStreamableHandle;
+
+/** A demoted shape: its type and transform, no actor */
+USTRUCT()
+struct FShapeInstance : public FFastArraySerializerItem
+{
+	GENERATED_BODY()
+
+	/** Unique in the world, identifies the shape in promotion requests */
+	UPROPERTY()
+	uint32 InstanceId = 0;
+
+	/** Index of the shape in the recipe registry */
+	UPROPERTY()
+	uint16 ShapeIndex = 0;
+
+	UPROPERTY()
+	FVector_NetQuantize10 Location;
+
+	UPROPERTY()
+	FRotator Rotation = FRotator::ZeroRotator;
+
+	UPROPERTY()
+	FVector_NetQuantize100 Scale = FVector::OneVector;
+
+	FTransform GetTransform() const { return FTransform(Rotation, Location, Scale); }
+
+	void PostReplicatedAdd(const struct FShapeInstanceArray& InArraySerializer);
+	void PreReplicatedRemove(const struct FShapeInstanceArray& InArraySerializer);
+};
+
+/** Demoted shapes of a cell, only added and removed entries are sent */
+USTRUCT()
+struct FShapeInstanceArray : public FFastArraySerializer
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	TArray<FShapeInstance> Items;
+
+	/** Cell the array belongs to, shows and hides the instances as they replicate */
+	AShapeInstanceCell* Cell = nullptr;
+
+	bool NetDeltaSerialize(FNetDeltaSerializeInfo& DeltaParms)
+	{
+		return FFastArraySerializer::FastArrayDeltaSerialize<FShapeInstance, FShapeInstanceArray>(Items, DeltaParms, *this);
+	}
+};
+
+template<>
+struct TStructOpsTypeTraits<FShapeInstanceArray> : public TStructOpsTypeTraitsBase2<FShapeInstanceArray>
+{
+	enum
+	{
+		WithNetDeltaSerializer = true,
+	};
+};
+
+/**
+ * Shapes of one replication grid cell demoted by UShapeDemotionSubsystem.
+ * Each shape class is drawn by one instanced static mesh component with the mesh, materials and collision of the class,
+ * so demoted shapes still block and can be traced but have no actor, no physics simulation and no replication of their own.
+ * The instances are replicated as a fast array, relevant to the connections viewing the cell.
+ */
+UCLASS(NotPlaceable, Transient)
+class IBTEST_API AShapeInstanceCell : public AActor
+{
+	GENERATED_BODY()
+
+private:
+
+	UPROPERTY(Replicated)
+	FShapeInstanceArray Instances;
+
+	/** Instanced meshes by registry shape index, created on first use */
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UInstancedStaticMeshComponent>> Components;
+
+	/** Instance ids of each component, in the order of its instances */
+	TArray<TArray<uint32>> ComponentInstanceIds;
+
+	/** Client: shape classes requested for received instances, kept loaded until then */
+	TArray<int32> RequestedShapeClasses;
+	TArray<TSharedPtr<FStreamableHandle>> ShapeClassesHandles;
+
+public:
+
+	AShapeInstanceCell();
+
+	/** Demote a shape into this cell (server only) */
+	void AddInstance(uint32 InstanceId, int32 ShapeIndex, const FTransform& Transform);
+
+	/** Remove a demoted shape from this cell and return it, false if the cell does not hold it (server only) */
+	bool RemoveInstance(uint32 InstanceId, FShapeInstance& OutInstance);
+
+	/** Id of the demoted shape hit by a trace against this cell, 0 if the hit is not on an instance */
+	uint32 GetHitInstanceId(const FHitResult& Hit) const;
+
+	const FShapeInstance* FindInstance(uint32 InstanceId) const;
+
+	FORCEINLINE const TArray<FShapeInstance>& GetInstances() const { return Instances.Items; }
+
+	/** Add the instance to the mesh of its class, loading the class first if needed */
+	void ShowInstance(const FShapeInstance& Instance);
+
+	void HideInstance(const FShapeInstance& Instance);
+
+	// AActor Begin
+	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+	// AActor End
+
+private:
+
+	/** Return the instanced mesh of a shape class, null until the class is loaded */
+	UInstancedStaticMeshComponent* GetComponent(int32 ShapeIndex);
+
+	/** Client: show the instances that were waiting for their class */
+	void OnShapeClassesLoaded();
+};
@@ -0,0 +1,250 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Networking/ShapePhysicsState.h"
+#include "Serialization/BitReader.h"
+#include "Serialization/BitWriter.h"
+
+namespace
+{
+	const float LocationScale = 10.f;
+	const float RotationScale = 32767.f;
+	const float LinearVelocityScale = 1.f;
+	const float AngularVelocityScale = 1.f;
+
+	/** Received samples kept by clients, must cover the samples in flight during a round trip */
+	const int32 MaxReceivedSamples = 32;
+
+	int64 NumBitsSent = 0;
+
+	/** Last sample acknowledged by a connection, base of its next delta */
+	class FShapePhysicsBaseState : public INetDeltaBaseState
+	{
+	public:
+
+		explicit FShapePhysicsBaseState(const FShapePhysicsSample& InSample)
+			: Sample(InSample)
+		{
+		}
+
+		virtual bool IsStateEqual(INetDeltaBaseState* OtherState) override
+		{
+			const FShapePhysicsBaseState* Other = static_cast<const FShapePhysicsBaseState*>(OtherState);
+			return Other && Sample.Sequence == Other->Sample.Sequence && Sample.IsSameState(Other->Sample);
+		}
+
+		FShapePhysicsSample Sample;
+	};
+
+	FORCEINLINE uint32 ZigZagEncode(int32 Value)
+	{
+		return (static_cast<uint32>(Value) << 1) ^ static_cast<uint32>(Value >> 31);
+	}
+
+	FORCEINLINE int32 ZigZagDecode(uint32 Value)
+	{
+		return static_cast<int32>(Value >> 1) ^ -static_cast<int32>(Value & 1);
+	}
+
+	FORCEINLINE int32 QuantizeValue(double Value, float Scale)
+	{
+		return static_cast<int32>(FMath::Clamp<double>(FMath::RoundToDouble(Value * Scale), MIN_int32, MAX_int32));
+	}
+}
+
+void FShapePhysicsSample::Quantize(const FTransform& Transform, const FVector& LinearVelocity, const FVector& AngularVelocityInDegrees, bool bInSleeping)
+{
+	const FVector Location = Transform.GetLocation();
+
+	// q and -q are the same rotation, keeping w positive lets us rebuild it from x, y, z
+	FQuat Rotation = Transform.GetRotation().GetNormalized();
+	if (Rotation.W < 0.f)
+	{
+		Rotation = -Rotation;
+	}
+
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		Values[Axis] = QuantizeValue(Location[Axis], LocationScale);
+		Values[6 + Axis] = QuantizeValue(LinearVelocity[Axis], LinearVelocityScale);
+		Values[9 + Axis] = QuantizeValue(AngularVelocityInDegrees[Axis], AngularVelocityScale);
+	}
+
+	Values[3] = QuantizeValue(Rotation.X, RotationScale);
+	Values[4] = QuantizeValue(Rotation.Y, RotationScale);
+	Values[5] = QuantizeValue(Rotation.Z, RotationScale);
+
+	bSleeping = bInSleeping;
+}
+
+FVector FShapePhysicsSample::GetLocation() const
+{
+	return FVector(Values[0], Values[1], Values[2]) / LocationScale;
+}
+
+FQuat FShapePhysicsSample::GetRotation() const
+{
+	const double X = Values[3] / RotationScale;
+	const double Y = Values[4] / RotationScale;
+	const double Z = Values[5] / RotationScale;
+	const double W = FMath::Sqrt(FMath::Max(0.0, 1.0 - X * X - Y * Y - Z * Z));
+
+	return FQuat(X, Y, Z, W).GetNormalized();
+}
+
+FVector FShapePhysicsSample::GetLinearVelocity() const
+{
+	return FVector(Values[6], Values[7], Values[8]) / LinearVelocityScale;
+}
+
+FVector FShapePhysicsSample::GetAngularVelocityInDegrees() const
+{
+	return FVector(Values[9], Values[10], Values[11]) / AngularVelocityScale;
+}
+
+bool FShapePhysicsSample::IsSameState(const FShapePhysicsSample& Other) const
+{
+	return bSleeping == Other.bSleeping && FMemory::Memcmp(Values, Other.Values, sizeof(Values)) == 0;
+}
+
+bool FShapePhysicsState::Update(const FShapePhysicsSample& Sample)
+{
+	if (Sample.IsSameState(Current)) return false;
+
+	const uint16 Sequence = Current.Sequence + 1;
+	Current = Sample;
+	Current.Sequence = Sequence;
+
+	return true;
+}
+
+bool FShapePhysicsState::NetDeltaSerialize(FNetDeltaSerializeInfo& DeltaParms)
+{
+	if (DeltaParms.Writer)
+	{
+		FBitWriter& Writer = *DeltaParms.Writer;
+		const FShapePhysicsBaseState* BaseState = static_cast<const FShapePhysicsBaseState*>(DeltaParms.OldState);
+
+		// Nothing changed since the state acknowledged by this connection
+		if (BaseState && BaseState->Sample.Sequence == Current.Sequence) return false;
+
+		// Clients only keep the last MaxReceivedSamples samples, older bases may be gone and the full state is sent instead
+		if (BaseState && static_cast<uint16>(Current.Sequence - BaseState->Sample.Sequence) >= MaxReceivedSamples)
+		{
+			BaseState = nullptr;
+		}
+
+		const int64 StartBits = Writer.GetNumBits();
+
+		uint16 Sequence = Current.Sequence;
+		Writer << Sequence;
+
+		uint8 bHasBase = BaseState ? 1 : 0;
+		Writer.SerializeBits(&bHasBase, 1);
+		if (bHasBase)
+		{
+			uint16 BaseSequence = BaseState->Sample.Sequence;
+			Writer << BaseSequence;
+		}
+
+		uint8 bSleeping = Current.bSleeping ? 1 : 0;
+		Writer.SerializeBits(&bSleeping, 1);
+
+		for (int32 i = 0; i < FShapePhysicsSample::NumValues; ++i)
+		{
+			const int32 Delta = Current.Values[i] - (BaseState ? BaseState->Sample.Values[i] : 0);
+
+			uint8 bChanged = Delta != 0 ? 1 : 0;
+			Writer.SerializeBits(&bChanged, 1);
+			if (bChanged)
+			{
+				uint32 EncodedDelta = ZigZagEncode(Delta);
+				Writer.SerializeIntPacked(EncodedDelta);
+			}
+		}
+
+		*DeltaParms.NewState = MakeShared<FShapePhysicsBaseState>(Current);
+
+		AddBitsSent(Writer.GetNumBits() - StartBits);
+		return true;
+	}
+
+	if (DeltaParms.Reader)
+	{
+		FBitReader& Reader = *DeltaParms.Reader;
+
+		uint16 Sequence = 0;
+		Reader << Sequence;
+
+		uint8 bHasBase = 0;
+		Reader.SerializeBits(&bHasBase, 1);
+
+		uint16 BaseSequence = 0;
+		if (bHasBase)
+		{
+			Reader << BaseSequence;
+		}
+
+		uint8 bSleeping = 0;
+		Reader.SerializeBits(&bSleeping, 1);
+
+		int32 Deltas[FShapePhysicsSample::NumValues] = {};
+		for (int32 i = 0; i < FShapePhysicsSample::NumValues; ++i)
+		{
+			uint8 bChanged = 0;
+			Reader.SerializeBits(&bChanged, 1);
+			if (bChanged)
+			{
+				uint32 EncodedDelta = 0;
+				Reader.SerializeIntPacked(EncodedDelta);
+				Deltas[i] = ZigZagDecode(EncodedDelta);
+			}
+		}
+
+		if (Reader.IsError()) return false;
+
+		const FShapePhysicsSample* BaseSample = nullptr;
+		if (bHasBase)
+		{
+			BaseSample = ReceivedSamples.FindByPredicate([BaseSequence](const FShapePhysicsSample& Sample) { return Sample.Sequence == BaseSequence; });
+
+			// Every acknowledged sample was stored and the server never uses a base older than the kept samples,
+			// so this only guards against a corrupted stream. Current is left untouched
+			if (!BaseSample) return true;
+		}
+
+		FShapePhysicsSample Sample;
+		Sample.Sequence = Sequence;
+		Sample.bSleeping = bSleeping != 0;
+		for (int32 i = 0; i < FShapePhysicsSample::NumValues; ++i)
+		{
+			Sample.Values[i] = (BaseSample ? BaseSample->Values[i] : 0) + Deltas[i];
+		}
+
+		Current = Sample;
+
+		if (ReceivedSamples.Num() == MaxReceivedSamples)
+		{
+			ReceivedSamples.RemoveAt(0, 1, false);
+		}
+		ReceivedSamples.Add(Sample);
+
+		return true;
+	}
+
+	return false;
+}
+
+int64 FShapePhysicsState::GetNumBitsSent()
+{
+	return NumBitsSent;
+}
+
+void FShapePhysicsState::AddBitsSent(int64 NumBits)
+{
+	NumBitsSent += NumBits;
+}
+
+void FShapePhysicsState::ResetBitsSent()
+{
+	NumBitsSent = 0;
+}
@@ -0,0 +1,77 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/NetSerialization.h"
+#include "ShapePhysicsState.generated.h"
+
+/** Rigid body state of a shape, quantized to integers so it can be delta compressed */
+struct IBTEST_API FShapePhysicsSample
+{
+	/** Location in 1/10 cm, rotation as the x, y, z of a quaternion with positive w on 16 bits, velocities in cm/s and deg/s */
+	static constexpr int32 NumValues = 12;
+
+	int32 Values[NumValues] = {};
+
+	/** Incremented by the server every time the sample changes, identifies delta bases */
+	uint16 Sequence = 0;
+
+	bool bSleeping = false;
+
+	void Quantize(const FTransform& Transform, const FVector& LinearVelocity, const FVector& AngularVelocityInDegrees, bool bInSleeping);
+
+	FVector GetLocation() const;
+
+	FQuat GetRotation() const;
+
+	FVector GetLinearVelocity() const;
+
+	FVector GetAngularVelocityInDegrees() const;
+
+	/** Compare the quantized state, ignoring the sequence */
+	bool IsSameState(const FShapePhysicsSample& Other) const;
+};
+
+/**
+ * Replicated physics state of a shape, used instead of the stock replicated movement.
+ * Every update is delta compressed against the last state acknowledged by the connection,
+ * unchanged values cost a single bit. Clients keep a short history of received samples to decode the deltas.
+ */
+USTRUCT()
+struct IBTEST_API FShapePhysicsState
+{
+	GENERATED_BODY()
+
+	/** Latest sample, captured by the server or decoded by the client */
+	FShapePhysicsSample Current;
+
+	/** Set a new sample on the server, return false if the quantized state did not change */
+	bool Update(const FShapePhysicsSample& Sample);
+
+	bool NetDeltaSerialize(FNetDeltaSerializeInfo& DeltaParms);
+
+	/** Client: true once a sample has been decoded into Current */
+	FORCEINLINE bool HasReceivedSample() const { return !ReceivedSamples.IsEmpty(); }
+
+	/** Payload bits written by all shape states since the last reset, used to compare against stock replication */
+	static int64 GetNumBitsSent();
+
+	static void AddBitsSent(int64 NumBits);
+
+	static void ResetBitsSent();
+
+private:
+
+	/** Samples received by the client, bases of the next deltas */
+	TArray<FShapePhysicsSample> ReceivedSamples;
+};
+
+template<>
+struct TStructOpsTypeTraits<FShapePhysicsState> : public TStructOpsTypeTraitsBase2<FShapePhysicsState>
+{
+	enum
+	{
+		WithNetDeltaSerializer = true,
+	};
+};
@@ -2,17 +2,448 @@
 
 
 #include "Shape.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Engine/NetDriver.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "HAL/IConsoleManager.h"
+#include "Serialization/BitWriter.h"
+#include "Subsystems/NetDormancySubsystem.h"
+#include "Subsystems/RecipeRegistrySubsystem.h"
+#include "Subsystems/ShapeDemotionSubsystem.h"
+#include "Net/UnrealNetwork.h"
+#include "Net/Core/PushModel/PushModel.h"
+
+namespace
+{
+	int32 PhysicsReplicationMode = 1;
+	FAutoConsoleVariableRef CVarPhysicsReplicationMode(
+		TEXT("IBTest.Shape.PhysicsReplication"),
+		PhysicsReplicationMode,
+		TEXT("Physics replication of shapes spawned or activated from now on. 0: stock replicated movement, 1: quantized delta compressed state"));
+
+	float InterpolationDelay = 0.1f;
+	FAutoConsoleVariableRef CVarInterpolationDelay(
+		TEXT("IBTest.Shape.InterpolationDelay"),
+		InterpolationDelay,
+		TEXT("Seconds clients stay behind the received shape states, so there are two states to interpolate between"));
+
+	/** Clients extrapolate with the last velocity for at most this time when states are late */
+	const double MaxExtrapolationTime = 0.25;
+
+	/** Received states kept by clients, older ones are dropped */
+	const int32 MaxBufferedStates = 8;
+
+	/** Stock replicated movement bits measured since the last report */
+	int64 NumMovementBitsSent = 0;
+
+	double ReplicationStatsStartTime = 0.0;
+
+	FAutoConsoleCommandWithWorld ReplicationStatsCommand(
+		TEXT("IBTest.Shape.ReplicationStats"),
+		TEXT("Print the physics replication payload per shape per second since the last call, then reset it"),
+		FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+			{
+				if (!World || !World->GetNetDriver() || World->GetNetMode() == NM_Client) return;
+
+				int32 NumShapes = 0;
+				for (TActorIterator<AShape> It(World); It; ++It)
+				{
+					NumShapes += It->IsPooled() ? 0 : 1;
+				}
+
+				const double Now = FPlatformTime::Seconds();
+				const double Duration = Now - ReplicationStatsStartTime;
+				const int32 NumConnections = FMath::Max(World->GetNetDriver()->ClientConnections.Num(), 1);
+
+				// Quantized states are written once per connection, stock movement is measured once per update
+				const double QuantizedBytes = FShapePhysicsState::GetNumBitsSent() / 8.0 / NumConnections;
+				const double StockBytes = NumMovementBitsSent / 8.0;
+				const double Scale = (NumShapes > 0 && Duration > 0.0) ? 1.0 / (NumShapes * Duration) : 0.0;
+
+				UE_LOG(LogTemp, Log, TEXT("Shape replication over %.1f s, %d shapes: quantized %.1f bytes/shape/s, stock movement %.1f bytes/shape/s (per connection)"),
+					Duration, NumShapes, QuantizedBytes * Scale, StockBytes * Scale);
+
+				FShapePhysicsState::ResetBitsSent();
+				NumMovementBitsSent = 0;
+				ReplicationStatsStartTime = Now;
+			}));
+
+	bool IsSameMovement(const FRepMovement& A, const FRepMovement& B)
+	{
+		return A.Location == B.Location && A.Rotation == B.Rotation && A.LinearVelocity == B.LinearVelocity &&
+			A.AngularVelocity == B.AngularVelocity && A.bSimulatedPhysicSleep == B.bSimulatedPhysicSleep && A.bRepPhysics == B.bRepPhysics;
+	}
+}
 
 // Sets default values
 AShape::AShape()
+	: ShapeIndex(INDEX_NONE)
+	, bPooled(false)
+	, bLocallyGrabbed(false)
 {
- 	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
-	PrimaryActorTick.bCanEverTick = false;
+	// Only ticks on clients while interpolating the replicated physics state
+	PrimaryActorTick.bCanEverTick = true;
+	PrimaryActorTick.bStartWithTickEnabled = false;
 
 	MeshComponent = CreateDefaultSubobject<UStaticMeshComponent>(TEXT("Mesh Component"));
 	MeshComponent->SetCollisionProfileName(UCollisionProfile::BlockAll_ProfileName);
+
+	// Sleep and wake events drive net dormancy
+	MeshComponent->BodyInstance.bGenerateWakeEvents = true;
 	RootComponent = MeshComponent;
 
 	SetReplicates(true);
-	SetReplicateMovement(true);
+
+	// The server picks the physics replication in BeginPlay
+	SetReplicateMovement(false);
+}
+
+void AShape::PostInitializeComponents()
+{
+	Super::PostInitializeComponents();
+
+	// Resolved before any overlap is generated for this shape
+	if (const URecipeRegistrySubsystem* RecipeRegistry = URecipeRegistrySubsystem::Get(this))
+	{
+		ShapeIndex = RecipeRegistry->GetRegistry().FindShapeIndex(ShapeID);
+	}
+}
+
+void AShape::BeginPlay()
+{
+	Super::BeginPlay();
+
+	if (HasAuthority())
+	{
+		ApplyReplicationMode();
+
+		if (MeshComponent)
+		{
+			MeshComponent->OnComponentSleep.AddDynamic(this, &ThisClass::OnBodySleep);
+			MeshComponent->OnComponentWake.AddDynamic(this, &ThisClass::OnBodyWake);
+		}
+	}
+	else
+	{
+		// The replication mode came with the initial state, copies only simulate with stock replicated movement
+		ApplyPooledState();
+	}
+}
+
+UInstancedStaticMeshComponent* AShape::CreateInstancedMesh(AActor* Owner) const
+{
+	if (!Owner || !MeshComponent) return nullptr;
+
+	UInstancedStaticMeshComponent* Component = NewObject<UInstancedStaticMeshComponent>(Owner);
+	Component->SetStaticMesh(MeshComponent->GetStaticMesh());
+	for (int32 MaterialIndex = 0; MaterialIndex < MeshComponent->GetNumMaterials(); ++MaterialIndex)
+	{
+		Component->SetMaterial(MaterialIndex, MeshComponent->GetMaterial(MaterialIndex));
+	}
+
+	// Instances never generate overlaps, whoever needs them tracks the instances itself
+	Component->SetCollisionProfileName(MeshComponent->GetCollisionProfileName());
+	Component->SetGenerateOverlapEvents(false);
+	Component->SetupAttachment(Owner->GetRootComponent());
+	Component->RegisterComponent();
+
+	return Component;
+}
+
+void AShape::ApplyReplicationMode()
+{
+	if (!HasAuthority()) return;
+
+	SetReplicateMovement(PhysicsReplicationMode == 0);
+}
+
+void AShape::DeactivatePooled()
+{
+	if (bPooled) return;
+
+	// Resting shapes may already be dormant
+	bPooled = true;
+	MARK_PROPERTY_DIRTY_AND_FLUSH_DORMANCY(AShape, bPooled, this);
+
+	ApplyPooledState();
+
+	// Pending dormancy still sends the hidden state before the channel goes dormant
+	UNetDormancySubsystem::SetActorDormant(this);
+}
+
+void AShape::FinishSpawningPooled(const FTransform& Transform)
+{
+	// Collision is off before the components register, so no overlap is ever generated
+	bPooled = true;
+	ApplyPooledState();
+
+	FinishSpawning(Transform);
+
+	UNetDormancySubsystem::SetActorDormant(this);
+}
+
+void AShape::ActivatePooled(const FTransform& Transform)
+{
+	if (!bPooled) return;
+
+	UNetDormancySubsystem::WakeUpActor(this);
+	ApplyReplicationMode();
+
+	// Move while collision is still disabled so no overlap is generated at the previous location
+	SetActorTransform(Transform, false, nullptr, ETeleportType::ResetPhysics);
+
+	bPooled = false;
+	MARK_PROPERTY_DIRTY_FROM_NAME(AShape, bPooled, this);
+
+	ApplyPooledState();
+	ForceNetUpdate();
+}
+
+void AShape::SetLocallyGrabbed(bool bInLocallyGrabbed)
+{
+	if (bLocallyGrabbed == bInLocallyGrabbed) return;
+
+	bLocallyGrabbed = bInLocallyGrabbed;
+
+	if (HasAuthority()) return;
+
+	// Physics handles need a simulating body, interpolated copies only simulate while grabbed
+	if (MeshComponent && !bPooled)
+	{
+		MeshComponent->SetSimulatePhysics(ShouldSimulatePhysics());
+	}
+
+	// Blend back to the latest server state once released
+	if (!bLocallyGrabbed)
+	{
+		if (IsReplicatingMovement())
+		{
+			OnRep_ReplicatedMovement();
+		}
+		else
+		{
+			SetActorTickEnabled(!PhysicsStateBuffer.IsEmpty());
+		}
+	}
+}
+
+void AShape::OnRep_ReplicatedMovement()
+{
+	if (bLocallyGrabbed) return;
+
+	Super::OnRep_ReplicatedMovement();
+}
+
+void AShape::WakeUpNetDormancy()
+{
+	if (!bPooled)
+	{
+		UNetDormancySubsystem::WakeUpActor(this);
+	}
+}
+
+void AShape::OnBodySleep(UPrimitiveComponent* SleepingComponent, FName BoneName)
+{
+	if (bPooled) return;
+
+	// The resting state goes out with the last update before the channel goes dormant
+	if (!IsReplicatingMovement())
+	{
+		CapturePhysicsState();
+	}
+
+	UNetDormancySubsystem::SetActorDormant(this);
+
+	if (UShapeDemotionSubsystem* ShapeDemotion = GetWorld()->GetSubsystem<UShapeDemotionSubsystem>())
+	{
+		ShapeDemotion->NotifyShapeResting(this);
+	}
+}
+
+void AShape::OnBodyWake(UPrimitiveComponent* WakingComponent, FName BoneName)
+{
+	WakeUpNetDormancy();
+
+	if (UShapeDemotionSubsystem* ShapeDemotion = GetWorld()->GetSubsystem<UShapeDemotionSubsystem>())
+	{
+		ShapeDemotion->NotifyShapeAwake(this);
+	}
+}
+
+void AShape::NotifyActorBeginOverlap(AActor* OtherActor)
+{
+	Super::NotifyActorBeginOverlap(OtherActor);
+
+	if (HasAuthority())
+	{
+		WakeUpNetDormancy();
+	}
+}
+
+void AShape::OnRep_ReplicateMovement()
+{
+	Super::OnRep_ReplicateMovement();
+
+	// Switch between simulated and interpolated copies
+	ApplyPooledState();
+}
+
+void AShape::PreReplication(IRepChangedPropertyTracker& ChangedPropertyTracker)
+{
+	Super::PreReplication(ChangedPropertyTracker);
+
+	if (bPooled) return;
+
+	if (IsReplicatingMovement())
+	{
+		MeasureReplicatedMovement();
+	}
+	else
+	{
+		CapturePhysicsState();
+	}
+}
+
+void AShape::CapturePhysicsState()
+{
+	if (!MeshComponent) return;
+
+	const bool bSleeping = !MeshComponent->IsAnyRigidBodyAwake();
+
+	// The resting state was already sent, nothing moves until the body wakes up
+	if (bSleeping && PhysicsState.Current.bSleeping) return;
+
+	FShapePhysicsSample Sample;
+	Sample.Quantize(GetActorTransform(), MeshComponent->GetPhysicsLinearVelocity(), MeshComponent->GetPhysicsAngularVelocityInDegrees(), bSleeping);
+
+	if (PhysicsState.Update(Sample))
+	{
+		MARK_PROPERTY_DIRTY_FROM_NAME(AShape, PhysicsState, this);
+	}
+}
+
+void AShape::MeasureReplicatedMovement()
+{
+	const FRepMovement& Movement = GetReplicatedMovement();
+	if (IsSameMovement(Movement, LastMeasuredMovement)) return;
+
+	LastMeasuredMovement = Movement;
+
+	FBitWriter Writer(0, true);
+	bool bSuccess = false;
+	LastMeasuredMovement.NetSerialize(Writer, nullptr, bSuccess);
+
+	NumMovementBitsSent += Writer.GetNumBits();
+}
+
+void AShape::OnRep_PhysicsState()
+{
+	// Deltas whose base is missing leave Current as it was, there is nothing new to interpolate to
+	const bool bAlreadyBuffered = !PhysicsStateBuffer.IsEmpty() && PhysicsStateBuffer.Last().Sample.Sequence == PhysicsState.Current.Sequence;
+	if (!PhysicsState.HasReceivedSample() || bAlreadyBuffered) return;
+
+	if (PhysicsStateBuffer.Num() == MaxBufferedStates)
+	{
+		PhysicsStateBuffer.RemoveAt(0, 1, false);
+	}
+	PhysicsStateBuffer.Add({ PhysicsState.Current, GetWorld()->GetTimeSeconds() });
+
+	if (!bLocallyGrabbed && !bPooled)
+	{
+		SetActorTickEnabled(true);
+	}
+}
+
+void AShape::Tick(float DeltaSeconds)
+{
+	Super::Tick(DeltaSeconds);
+
+	if (HasAuthority() || bLocallyGrabbed || bPooled || IsReplicatingMovement() || PhysicsStateBuffer.IsEmpty())
+	{
+		SetActorTickEnabled(false);
+		return;
+	}
+
+	InterpolatePhysicsState();
+}
+
+void AShape::InterpolatePhysicsState()
+{
+	const double RenderTime = GetWorld()->GetTimeSeconds() - InterpolationDelay;
+
+	// Drop states that are fully behind the render time, keeping one to interpolate from
+	while (PhysicsStateBuffer.Num() > 1 && PhysicsStateBuffer[1].ReceiveTime <= RenderTime)
+	{
+		PhysicsStateBuffer.RemoveAt(0, 1, false);
+	}
+
+	const FBufferedPhysicsState& From = PhysicsStateBuffer[0];
+
+	FVector Location;
+	FQuat Rotation;
+
+	if (PhysicsStateBuffer.Num() > 1)
+	{
+		const FBufferedPhysicsState& To = PhysicsStateBuffer[1];
+		const double Alpha = FMath::Clamp((RenderTime - From.ReceiveTime) / FMath::Max(To.ReceiveTime - From.ReceiveTime, UE_KINDA_SMALL_NUMBER), 0.0, 1.0);
+
+		Location = FMath::Lerp(From.Sample.GetLocation(), To.Sample.GetLocation(), Alpha);
+		Rotation = FQuat::Slerp(From.Sample.GetRotation(), To.Sample.GetRotation(), Alpha);
+	}
+	else
+	{
+		// Late state, keep moving with the last velocity for a little while
+		const double ExtrapolationTime = From.Sample.bSleeping ? 0.0 : FMath::Clamp(RenderTime - From.ReceiveTime, 0.0, MaxExtrapolationTime);
+
+		Location = From.Sample.GetLocation() + From.Sample.GetLinearVelocity() * ExtrapolationTime;
+		Rotation = From.Sample.GetRotation();
+
+		// Resting state reached, no need to tick until the shape moves again
+		if (From.Sample.bSleeping)
+		{
+			SetActorTickEnabled(false);
+		}
+	}
+
+	SetActorLocationAndRotation(Location, Rotation, false, nullptr, ETeleportType::TeleportPhysics);
+}
+
+bool AShape::ShouldSimulatePhysics() const
+{
+	return HasAuthority() || IsReplicatingMovement() || bLocallyGrabbed;
+}
+
+void AShape::OnRep_Pooled()
+{
+	ApplyPooledState();
+}
+
+void AShape::ApplyPooledState()
+{
+	SetActorHiddenInGame(bPooled);
+	SetActorEnableCollision(!bPooled);
+
+	if (MeshComponent)
+	{
+		MeshComponent->SetSimulatePhysics(!bPooled && ShouldSimulatePhysics());
+	}
+
+	if (!bPooled)
+	{
+		UpdateOverlaps();
+	}
+}
+
+void AShape::GetLifetimeReplicatedProps(TArray< FLifetimeProperty >& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	// Using push model
+	FDoRepLifetimeParams Params;
+	Params.bIsPushBased = true;
+	Params.RepNotifyCondition = REPNOTIFY_OnChanged;
+
+	DOREPLIFETIME_WITH_PARAMS_FAST(AShape, bPooled, Params);
+	DOREPLIFETIME_WITH_PARAMS_FAST(AShape, PhysicsState, Params);
 }
@@ -5,8 +5,11 @@
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
 #include "GameplayTagContainer.h"
+#include "Networking/ShapePhysicsState.h"
 #include "Shape.generated.h"
 
+class UInstancedStaticMeshComponent;
+
 UCLASS()
 class IBTEST_API AShape : public AActor
 {
@@ -18,6 +21,80 @@ public:
 
 	FORCEINLINE FName GetShapeID() { return ShapeID; }
 
+	/** Index of this shape in the recipe registry, INDEX_NONE if unknown */
+	FORCEINLINE int32 GetShapeIndex() const { return ShapeIndex; }
+
+	FORCEINLINE UStaticMeshComponent* GetMeshComponent() const { return MeshComponent; }
+
+	/** Create and register an instanced mesh on Owner with the mesh, materials and collision profile of this shape, called on class default objects */
+	UInstancedStaticMeshComponent* CreateInstancedMesh(AActor* Owner) const;
+
+	/** True while the shape is waiting in the shape pool */
+	FORCEINLINE bool IsPooled() const { return bPooled; }
+
+	/** Hide the shape, disable physics and collision and put it to net dormancy (server only) */
+	void DeactivatePooled();
+
+	/** Finish a deferred spawn straight into the pool, the shape never shows or collides at the spawn transform (server only) */
+	void FinishSpawningPooled(const FTransform& Transform);
+
+	/** Bring a pooled shape back into the world at the given transform (server only) */
+	void ActivatePooled(const FTransform& Transform);
+
+	/** Resume regular replication, used when something is about to move the shape (server only) */
+	void WakeUpNetDormancy();
+
+	/** Set by the owning client while it grabs the shape, replicated movement is ignored meanwhile */
+	void SetLocallyGrabbed(bool bInLocallyGrabbed);
+
+	// AActor Begin
+	virtual void Tick(float DeltaSeconds) override;
+	virtual void PreReplication(IRepChangedPropertyTracker& ChangedPropertyTracker) override;
+	virtual void OnRep_ReplicatedMovement() override;
+	virtual void OnRep_ReplicateMovement() override;
+	virtual void NotifyActorBeginOverlap(AActor* OtherActor) override;
+	// AActor End
+
+protected:
+
+	virtual void PostInitializeComponents() override;
+
+	virtual void BeginPlay() override;
+
+	UFUNCTION()
+	void OnRep_Pooled();
+
+	UFUNCTION()
+	void OnRep_PhysicsState();
+
+	/** Server: resting shapes stop replicating until they move again, and can be demoted after a while */
+	UFUNCTION()
+	void OnBodySleep(UPrimitiveComponent* SleepingComponent, FName BoneName);
+
+	UFUNCTION()
+	void OnBodyWake(UPrimitiveComponent* WakingComponent, FName BoneName);
+
+	/** Server: pick stock replicated movement or the quantized physics state, see IBTest.Shape.PhysicsReplication */
+	void ApplyReplicationMode();
+
+	/** Server: sample the body into the replicated physics state, sleeping bodies are sent once then skipped */
+	void CapturePhysicsState();
+
+	/** Server: measure what stock replicated movement sends, for comparison with the quantized state */
+	void MeasureReplicatedMovement();
+
+	/** Client: move the shape between the buffered physics states */
+	void InterpolatePhysicsState();
+
+	/** Physics run on the server, on clients using stock replicated movement and on the client grabbing the shape */
+	bool ShouldSimulatePhysics() const;
+
+	/** Apply the pooled state to the components, on both server and clients */
+	void ApplyPooledState();
+
+	// Replication
+	void GetLifetimeReplicatedProps(TArray< FLifetimeProperty >& OutLifetimeProps) const override;
+
 public:
 
 	// Unique String ID of this shape
@@ -26,6 +103,33 @@ public:
 
 private:
 
+	/** Registry index resolved from ShapeID, cached so machines never have to hash names */
+	int32 ShapeIndex;
+
+	/** The shape is inactive and owned by the shape pool */
+	UPROPERTY(ReplicatedUsing=OnRep_Pooled)
+	bool bPooled;
+
+	/** The owning client moves its copy of the shape with its own physics handle */
+	bool bLocallyGrabbed;
+
+	/** Quantized rigid body state, replaces replicated movement unless stock replication is used */
+	UPROPERTY(ReplicatedUsing=OnRep_PhysicsState)
+	FShapePhysicsState PhysicsState;
+
+	/** Physics state received by a client and the time it arrived */
+	struct FBufferedPhysicsState
+	{
+		FShapePhysicsSample Sample;
+		double ReceiveTime;
+	};
+
+	/** Client: latest received states, oldest first */
+	TArray<FBufferedPhysicsState> PhysicsStateBuffer;
+
+	/** Server: last stock movement measured, to only count the updates that are actually sent */
+	FRepMovement LastMeasuredMovement;
+
 	UPROPERTY(VisibleAnywhere)
 	TObjectPtr<UStaticMeshComponent> MeshComponent;
 };
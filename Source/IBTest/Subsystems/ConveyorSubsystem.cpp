@@ -0,0 +1,113 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Subsystems/ConveyorSubsystem.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+
+#include "IBTest.h"
+#include "Conveyor.h"
+
+namespace
+{
+	FAutoConsoleCommandWithWorld ConveyorStatsCommand(
+		TEXT("IBTest.Conveyors.Stats"),
+		TEXT("Print the number of belts and items and the average update cost for the current world"),
+		FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+			{
+				if (const UConveyorSubsystem* ConveyorSubsystem = World ? World->GetSubsystem<UConveyorSubsystem>() : nullptr)
+				{
+					ConveyorSubsystem->DumpStats();
+				}
+			}));
+}
+
+void UConveyorSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	if (Conveyors.IsEmpty()) return;
+
+	IBTEST_SCOPE_CYCLE_COUNTER(ConveyorUpdate);
+
+	const uint64 StartCycles = FPlatformTime::Cycles64();
+
+	const ENetMode NetMode = GetWorld()->GetNetMode();
+	const bool bAuthority = NetMode != NM_Client;
+	const bool bDrawItems = NetMode != NM_DedicatedServer;
+
+	int32 NumItems = 0;
+	for (int32 Index = Conveyors.Num() - 1; Index >= 0; --Index)
+	{
+		AConveyor* Conveyor = Conveyors[Index].Get();
+		if (!Conveyor)
+		{
+			Conveyors.RemoveAtSwap(Index, 1, false);
+			continue;
+		}
+
+		Conveyor->AdvanceItems(DeltaTime);
+		NumItems += Conveyor->GetNumItems();
+
+		if (bAuthority)
+		{
+			Conveyor->DeliverItems();
+			Conveyor->AbsorbWaitingShapes();
+		}
+	}
+
+	// Drawn once every belt moved, so items handed from one belt to the next are drawn on one of them only
+	if (bDrawItems)
+	{
+		for (const TWeakObjectPtr<AConveyor>& WeakConveyor : Conveyors)
+		{
+			if (AConveyor* Conveyor = WeakConveyor.Get())
+			{
+				Conveyor->DrawItems();
+			}
+		}
+	}
+
+	IBTEST_INC_COUNTER(ConveyorItems, NumItems);
+
+	++NumFrames;
+	UpdateCycles += FPlatformTime::Cycles64() - StartCycles;
+}
+
+TStatId UConveyorSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UConveyorSubsystem, STATGROUP_Tickables);
+}
+
+bool UConveyorSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+void UConveyorSubsystem::RegisterConveyor(AConveyor* Conveyor)
+{
+	Conveyors.AddUnique(Conveyor);
+}
+
+void UConveyorSubsystem::UnregisterConveyor(AConveyor* Conveyor)
+{
+	Conveyors.RemoveSingleSwap(Conveyor, false);
+}
+
+void UConveyorSubsystem::DumpStats() const
+{
+	int32 NumItems = 0;
+	int64 NumDelivered = 0;
+	for (const TWeakObjectPtr<AConveyor>& WeakConveyor : Conveyors)
+	{
+		if (const AConveyor* Conveyor = WeakConveyor.Get())
+		{
+			NumItems += Conveyor->GetNumItems();
+			NumDelivered += Conveyor->GetNumDelivered();
+		}
+	}
+
+	const double AverageUpdateUs = NumFrames > 0 ? FPlatformTime::ToMilliseconds64(UpdateCycles) * 1000.0 / NumFrames : 0.0;
+
+	UE_LOG(LogTemp, Log, TEXT("Conveyor stats for %s: Belts=%d Items=%d Delivered=%lld AverageUpdate=%.2f us over %lld frames"),
+		*GetNameSafe(GetWorld()), Conveyors.Num(), NumItems, NumDelivered, AverageUpdateUs, NumFrames);
+}
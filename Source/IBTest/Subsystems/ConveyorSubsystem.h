@@ -0,0 +1,49 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "ConveyorSubsystem.generated.h"
+
+class AConveyor;
+
+/**
+ * Moves the items of every conveyor of the world once per frame, instead of one actor tick per belt.
+ * The server also delivers the items reaching the end of their belt and puts waiting shapes on belts,
+ * clients and listen servers update the instanced meshes of the belts whose items moved.
+ * IBTest.Conveyors.Stats prints the number of belts and items and the cost of the update.
+ */
+UCLASS()
+class IBTEST_API UConveyorSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+private:
+
+	/** Conveyors that began play */
+	TArray<TWeakObjectPtr<AConveyor>> Conveyors;
+
+	int64 NumFrames = 0;
+	uint64 UpdateCycles = 0;
+
+public:
+
+	// FTickableGameObject Begin
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+	// FTickableGameObject End
+
+	void RegisterConveyor(AConveyor* Conveyor);
+
+	void UnregisterConveyor(AConveyor* Conveyor);
+
+	/** Print belt and item counts and the average update cost to the log */
+	void DumpStats() const;
+
+protected:
+
+	// UWorldSubsystem Begin
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	// UWorldSubsystem End
+};
@@ -0,0 +1,143 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Subsystems/CosmeticEventSubsystem.h"
+#include "Camera/PlayerCameraManager.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/IConsoleManager.h"
+
+#include "GameplaySettings.h"
+#include "Machine.h"
+#include "Networking/PayloadSizePackageMap.h"
+
+namespace
+{
+	FAutoConsoleCommandWithWorld CosmeticStatsCommand(
+		TEXT("IBTest.Cosmetics.Stats"),
+		TEXT("Print cosmetic event counters and the average size of the replicated event batches"),
+		FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+			{
+				if (const UCosmeticEventSubsystem* CosmeticEvents = World ? World->GetSubsystem<UCosmeticEventSubsystem>() : nullptr)
+				{
+					CosmeticEvents->DumpStats();
+				}
+			}));
+
+#if !UE_BUILD_SHIPPING
+	bool bMeasurePayload = false;
+	FAutoConsoleVariableRef CVarMeasurePayload(
+		TEXT("IBTest.Cosmetics.MeasurePayload"),
+		bMeasurePayload,
+		TEXT("Serialize every cosmetic event batch a second time when it is sent, to report its size with IBTest.Cosmetics.Stats"));
+#endif
+}
+
+bool UCosmeticEventSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+void UCosmeticEventSubsystem::QueueEvent(AMachine* Machine, ECosmeticEvent Type, int32 Count)
+{
+	if (!Machine || Count <= 0) return;
+
+	++NumEventsQueued;
+
+	const ENetMode NetMode = GetWorld()->GetNetMode();
+	if (NetMode != NM_DedicatedServer)
+	{
+		PlayEvent(Machine, Type, Count);
+	}
+
+	if (NetMode == NM_DedicatedServer || NetMode == NM_ListenServer)
+	{
+		if (ACosmeticEventCell* Cell = GetCell(Machine->GetActorLocation()))
+		{
+			Cell->AddEvent(Machine, Type, Count);
+		}
+	}
+}
+
+void UCosmeticEventSubsystem::PlayEvent(AMachine* Machine, ECosmeticEvent Type, int32 Count)
+{
+	if (!Machine || GetWorld()->GetNetMode() == NM_DedicatedServer) return;
+
+	if (!IsInCosmeticRange(Machine->GetActorLocation()))
+	{
+		++NumEventsCulled;
+		return;
+	}
+
+	++NumEventsPlayed;
+	Machine->PlayCosmeticEvent(Type, Count);
+}
+
+void UCosmeticEventSubsystem::RecordBatchSent(const FCosmeticEventBatch& Batch)
+{
+	++NumBatchesSent;
+	NumBatchEventsSent += Batch.Events.Num();
+
+#if !UE_BUILD_SHIPPING
+	if (!bMeasurePayload) return;
+
+	if (!SizePackageMap)
+	{
+		SizePackageMap = NewObject<UPayloadSizePackageMap>(this);
+	}
+
+	FNetBitWriter Writer(SizePackageMap, 8192);
+	FCosmeticEventBatch BatchCopy = Batch;
+	bool bSuccess = false;
+	BatchCopy.NetSerialize(Writer, SizePackageMap, bSuccess);
+
+	++NumBatchesMeasured;
+	NumBatchBitsMeasured += Writer.GetNumBits();
+#endif
+}
+
+ACosmeticEventCell* UCosmeticEventSubsystem::GetCell(const FVector& Location)
+{
+	// Same cells as the replication graph grid, so a cell is relevant to the connections viewing its machines
+	const UGameplaySettings* Settings = GetDefault<UGameplaySettings>();
+	const FIntPoint CellCoords = Settings->GetReplicationGridCell(Location);
+
+	TObjectPtr<ACosmeticEventCell>& Cell = Cells.FindOrAdd(CellCoords);
+	if (!IsValid(Cell))
+	{
+		const FVector CellCenter = Settings->GetReplicationGridCellCenter(CellCoords, Location.Z);
+
+		FActorSpawnParameters SpawnParameters;
+		SpawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+		Cell = GetWorld()->SpawnActor<ACosmeticEventCell>(CellCenter, FRotator::ZeroRotator, SpawnParameters);
+	}
+
+	return Cell;
+}
+
+bool UCosmeticEventSubsystem::IsInCosmeticRange(const FVector& Location) const
+{
+	const float CullDistance = GetDefault<UGameplaySettings>()->CosmeticEventCullDistance;
+	if (CullDistance <= 0.f) return true;
+
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		const APlayerController* PlayerController = It->Get();
+		if (!PlayerController || !PlayerController->IsLocalController() || !PlayerController->PlayerCameraManager) continue;
+
+		if (FVector::DistSquared(PlayerController->PlayerCameraManager->GetCameraLocation(), Location) <= FMath::Square(CullDistance))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void UCosmeticEventSubsystem::DumpStats() const
+{
+	UE_LOG(LogTemp, Log, TEXT("Cosmetic events for %s: Cells=%d Queued=%lld Played=%lld Culled=%lld Discarded=%lld"),
+		*GetNameSafe(GetWorld()), Cells.Num(), NumEventsQueued, NumEventsPlayed, NumEventsCulled, NumEventsDiscarded);
+	UE_LOG(LogTemp, Log, TEXT("  Batches=%lld with %.1f events each, %.1f bytes each over %lld measured"),
+		NumBatchesSent, NumBatchesSent > 0 ? static_cast<double>(NumBatchEventsSent) / NumBatchesSent : 0.0,
+		NumBatchesMeasured > 0 ? NumBatchBitsMeasured / 8.0 / NumBatchesMeasured : 0.0, NumBatchesMeasured);
+}
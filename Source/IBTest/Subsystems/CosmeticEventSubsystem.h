@@ -0,0 +1,76 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Networking/CosmeticEventCell.h"
+#include "CosmeticEventSubsystem.generated.h"
+
+class AMachine;
+class UPayloadSizePackageMap;
+
+/**
+ * Routes machine cosmetic events (crafts, toggles, errors).
+ * The server queues them in the ACosmeticEventCell of the replication grid cell the machine is in, clients play them when
+ * the cell batch arrives. Players of listen servers and standalone games play them right away.
+ * Events further than CosmeticEventCullDistance from the local view are skipped, and dedicated servers never play any.
+ * Outside shipping builds, IBTest.Cosmetics.MeasurePayload measures the size of the batches sent.
+ */
+UCLASS()
+class IBTEST_API UCosmeticEventSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+private:
+
+	/** Cells spawned so far, by grid coordinates (server only) */
+	UPROPERTY(Transient)
+	TMap<FIntPoint, TObjectPtr<ACosmeticEventCell>> Cells;
+
+	int64 NumEventsQueued = 0;
+	int64 NumBatchesSent = 0;
+	int64 NumBatchEventsSent = 0;
+	int64 NumEventsPlayed = 0;
+	int64 NumEventsCulled = 0;
+	int64 NumEventsDiscarded = 0;
+
+	/** Writes the machine references of measured batches, created on first measure */
+	UPROPERTY(Transient)
+	TObjectPtr<UPayloadSizePackageMap> SizePackageMap;
+
+	/** Batches measured and their total size */
+	int64 NumBatchesMeasured = 0;
+	int64 NumBatchBitsMeasured = 0;
+
+public:
+
+	/** Play the event locally when there is a local player and send it to the clients viewing the machine (server only) */
+	void QueueEvent(AMachine* Machine, ECosmeticEvent Type, int32 Count = 1);
+
+	/** Play an event received from the server, or queued on a listen server */
+	void PlayEvent(AMachine* Machine, ECosmeticEvent Type, int32 Count);
+
+	/** Count a batch sent by a cell, and measure it when IBTest.Cosmetics.MeasurePayload is set */
+	void RecordBatchSent(const FCosmeticEventBatch& Batch);
+
+	/** Count events dropped by a cell because they waited too long for a net update */
+	void RecordEventsDiscarded(int32 NumEvents) { NumEventsDiscarded += NumEvents; }
+
+	/** Print event counters to the log */
+	void DumpStats() const;
+
+protected:
+
+	// UWorldSubsystem Begin
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	// UWorldSubsystem End
+
+private:
+
+	/** Find or spawn the cell containing the location */
+	ACosmeticEventCell* GetCell(const FVector& Location);
+
+	/** Return true if the location is close enough to a local view for its effects to be seen */
+	bool IsInCosmeticRange(const FVector& Location) const;
+};
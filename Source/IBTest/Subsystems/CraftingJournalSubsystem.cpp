@@ -0,0 +1,131 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Subsystems/CraftingJournalSubsystem.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/CommandLine.h"
+#include "Misc/DateTime.h"
+#include "Misc/Paths.h"
+
+#include "GameplaySettings.h"
+#include "Machine.h"
+#include "Subsystems/RecipeRegistrySubsystem.h"
+
+namespace
+{
+	FAutoConsoleCommandWithWorld JournalStatsCommand(
+		TEXT("IBTest.Journal.Stats"),
+		TEXT("Print the crafting journal file and the number of records written and dropped"),
+		FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+			{
+				if (const UCraftingJournalSubsystem* CraftingJournal = World ? World->GetSubsystem<UCraftingJournalSubsystem>() : nullptr)
+				{
+					CraftingJournal->DumpStats();
+				}
+			}));
+}
+
+void UCraftingJournalSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	bRecordingRequested = GetDefault<UGameplaySettings>()->bRecordCraftingJournal || FParse::Param(FCommandLine::Get(), TEXT("CraftingJournal"));
+}
+
+void UCraftingJournalSubsystem::Deinitialize()
+{
+	Writer.Close();
+
+	Super::Deinitialize();
+}
+
+bool UCraftingJournalSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+bool UCraftingJournalSubsystem::OpenJournal()
+{
+	// Only the server runs the machine logic
+	if (GetWorld()->GetNetMode() == NM_Client) return false;
+
+	const URecipeRegistrySubsystem* RecipeRegistry = URecipeRegistrySubsystem::Get(this);
+	if (!RecipeRegistry) return false;
+
+	FCraftingJournalHeader Header;
+	Header.NumShapes = RecipeRegistry->GetRegistry().GetNumShapes();
+	Header.NumRecipes = RecipeRegistry->GetRegistry().GetNumRecipes();
+
+	const FString Filename = FPaths::ProjectSavedDir() / TEXT("Journals")
+		/ FString::Printf(TEXT("Crafting_%s_%s.ibj"), *GetWorld()->GetMapName(), *FDateTime::Now().ToString());
+
+	if (!Writer.Open(Filename, Header)) return false;
+
+	UE_LOG(LogTemp, Log, TEXT("Crafting journal: recording to %s"), *Filename);
+	return true;
+}
+
+int32 UCraftingJournalSubsystem::RegisterMachine(const AMachine* Machine, const TArray<int32>& RecipeIndices)
+{
+	if (!bRecordingRequested || !Machine) return INDEX_NONE;
+
+	if (!Writer.IsOpen() && !OpenJournal())
+	{
+		bRecordingRequested = false;
+		return INDEX_NONE;
+	}
+
+	// Ids are stored in 16 bits
+	if (NumMachines > MAX_uint16)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Crafting journal: too many machines, %s is not recorded"), *Machine->GetName());
+		return INDEX_NONE;
+	}
+
+	const int32 MachineId = NumMachines++;
+
+	Record(MachineId, ECraftingJournalEvent::MachineAdded, Machine->IsMachineEnabled() ? 1 : 0, Machine->bDrainIngredients ? 1 : 0);
+
+	for (const int32 RecipeIndex : RecipeIndices)
+	{
+		Record(MachineId, ECraftingJournalEvent::MachineRecipe, RecipeIndex);
+	}
+
+	return MachineId;
+}
+
+void UCraftingJournalSubsystem::RecordRecipesChanged(int32 MachineId, const TArray<int32>& RecipeIndices)
+{
+	Record(MachineId, ECraftingJournalEvent::RecipesChanged);
+
+	for (const int32 RecipeIndex : RecipeIndices)
+	{
+		Record(MachineId, ECraftingJournalEvent::MachineRecipe, RecipeIndex);
+	}
+}
+
+void UCraftingJournalSubsystem::Record(int32 MachineId, ECraftingJournalEvent Type, int32 Index, int32 Count)
+{
+	FCraftingJournalRecord JournalRecord;
+	JournalRecord.Time = GetWorld()->GetTimeSeconds();
+	JournalRecord.Machine = static_cast<uint16>(MachineId);
+	JournalRecord.Type = Type;
+	JournalRecord.Padding = 0;
+	JournalRecord.Index = Index;
+	JournalRecord.Count = Count;
+
+	Writer.Add(JournalRecord);
+}
+
+void UCraftingJournalSubsystem::DumpStats() const
+{
+	if (!Writer.IsOpen())
+	{
+		UE_LOG(LogTemp, Log, TEXT("Crafting journal for %s: not recording, enable bRecordCraftingJournal or start with -CraftingJournal"), *GetNameSafe(GetWorld()));
+		return;
+	}
+
+	UE_LOG(LogTemp, Log, TEXT("Crafting journal for %s: %s Machines=%d Written=%lld (%.1f KiB) Dropped=%lld"),
+		*GetNameSafe(GetWorld()), *Writer.GetFilename(), NumMachines, Writer.GetNumWritten(),
+		Writer.GetNumWritten() * sizeof(FCraftingJournalRecord) / 1024.0, Writer.GetNumDropped());
+}
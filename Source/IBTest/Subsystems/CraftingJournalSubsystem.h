@@ -0,0 +1,63 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Crafting/CraftingJournal.h"
+#include "CraftingJournalSubsystem.generated.h"
+
+class AMachine;
+
+/**
+ * Records every ingredient change, toggle and craft of the server machines to Saved/Journals,
+ * so a heavy crafting session can be replayed headlessly with the CraftingReplay commandlet.
+ * Enabled by bRecordCraftingJournal or -CraftingJournal, machines register when they begin play.
+ */
+UCLASS()
+class IBTEST_API UCraftingJournalSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+private:
+
+	FCraftingJournalWriter Writer;
+
+	/** Recording was asked for, the file is created when the first machine registers */
+	bool bRecordingRequested = false;
+
+	int32 NumMachines = 0;
+
+public:
+
+	// USubsystem Begin
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	// USubsystem End
+
+	/**
+	 * Start recording a machine, write its recipes and state.
+	 * Return the id passed to Record, or INDEX_NONE if the journal is not recording.
+	 */
+	int32 RegisterMachine(const AMachine* Machine, const TArray<int32>& RecipeIndices);
+
+	/** Record new recipes for a registered machine, its ingredients are cleared */
+	void RecordRecipesChanged(int32 MachineId, const TArray<int32>& RecipeIndices);
+
+	/** Queue a record for a registered machine, see ECraftingJournalEvent for the meaning of Index and Count */
+	void Record(int32 MachineId, ECraftingJournalEvent Type, int32 Index = 0, int32 Count = 0);
+
+	/** Print the journal file and record counters to the log */
+	void DumpStats() const;
+
+protected:
+
+	// UWorldSubsystem Begin
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	// UWorldSubsystem End
+
+private:
+
+	/** Create the journal file, return false if recording is not possible */
+	bool OpenJournal();
+};
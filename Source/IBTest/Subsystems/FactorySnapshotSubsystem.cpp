@@ -0,0 +1,548 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Subsystems/FactorySnapshotSubsystem.h"
+#include "Async/Async.h"
+#include "Components/PrimitiveComponent.h"
+#include "Engine/StreamableManager.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/CommandLine.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "TimerManager.h"
+
+#include "Conveyor.h"
+#include "GameplaySettings.h"
+#include "Machine.h"
+#include "Shape.h"
+#include "Subsystems/RecipeRegistrySubsystem.h"
+#include "Subsystems/ShapeDemotionSubsystem.h"
+#include "Subsystems/ShapePoolSubsystem.h"
+
+namespace
+{
+	FAutoConsoleCommandWithWorld SaveSnapshotCommand(
+		TEXT("IBTest.Snapshot.Save"),
+		TEXT("Save the machines and shapes of the current world now, e.g. before migrating the server"),
+		FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+			{
+				if (UFactorySnapshotSubsystem* FactorySnapshot = World ? World->GetSubsystem<UFactorySnapshotSubsystem>() : nullptr)
+				{
+					FactorySnapshot->SaveSnapshot();
+				}
+			}));
+}
+
+bool FFactorySnapshot::Serialize(FArchive& Ar)
+{
+	uint32 Magic = ExpectedMagic;
+	uint32 Version = LatestVersion;
+	Ar << Magic;
+	Ar << Version;
+
+	if (Ar.IsLoading() && (Magic != ExpectedMagic || Version > LatestVersion)) return false;
+
+	Ar << ShapeIDs;
+
+	int32 NumMachines = Machines.Num();
+	Ar << NumMachines;
+
+	if (Ar.IsLoading())
+	{
+		if (NumMachines < 0 || NumMachines > Ar.TotalSize()) return false;
+		Machines.SetNum(NumMachines);
+	}
+
+	for (FMachineSnapshot& Machine : Machines)
+	{
+		uint8 bMachineEnabled = Machine.bEnabled ? 1 : 0;
+		Ar << Machine.Name;
+		Ar << bMachineEnabled;
+		Machine.bEnabled = bMachineEnabled != 0;
+	}
+
+	int32 NumShapes = Shapes.Num();
+	Ar << NumShapes;
+
+	if (Ar.IsLoading())
+	{
+		if (NumShapes < 0 || NumShapes > Ar.TotalSize()) return false;
+		Shapes.SetNum(NumShapes);
+	}
+
+	for (FShapeSnapshot& Shape : Shapes)
+	{
+		// Types and machines are small indices, machines are offset by one so loose shapes are 0
+		uint32 Type = static_cast<uint32>(Shape.Type);
+		uint32 Machine = static_cast<uint32>(Shape.Machine + 1);
+		uint8 bSleeping = Shape.bSleeping ? 1 : 0;
+
+		Ar.SerializeIntPacked(Type);
+		Ar.SerializeIntPacked(Machine);
+		Ar << Shape.Location;
+		Ar << Shape.Rotation;
+		Ar << bSleeping;
+
+		// Resting shapes, most of them, have no velocity to save
+		if (!bSleeping)
+		{
+			Ar << Shape.LinearVelocity;
+			Ar << Shape.AngularVelocity;
+		}
+
+		Shape.Type = static_cast<int32>(Type);
+		Shape.Machine = static_cast<int32>(Machine) - 1;
+		Shape.bSleeping = bSleeping != 0;
+	}
+
+	// Version 1 snapshots saved belt items as loose shapes
+	if (Version < 2) return !Ar.IsError();
+
+	int32 NumConveyors = Conveyors.Num();
+	Ar << NumConveyors;
+
+	if (Ar.IsLoading())
+	{
+		if (NumConveyors < 0 || NumConveyors > Ar.TotalSize()) return false;
+		Conveyors.SetNum(NumConveyors);
+	}
+
+	for (FConveyorSnapshot& Conveyor : Conveyors)
+	{
+		int32 NumItems = Conveyor.Items.Num();
+		Ar << Conveyor.Name;
+		Ar << NumItems;
+
+		if (Ar.IsLoading())
+		{
+			if (NumItems < 0 || NumItems > Ar.TotalSize()) return false;
+			Conveyor.Items.SetNum(NumItems);
+		}
+
+		for (FConveyorItemSnapshot& Item : Conveyor.Items)
+		{
+			uint32 Type = static_cast<uint32>(Item.Type);
+			Ar.SerializeIntPacked(Type);
+			Ar << Item.Distance;
+			Item.Type = static_cast<int32>(Type);
+		}
+	}
+
+	return !Ar.IsError();
+}
+
+void UFactorySnapshotSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	bEnabled = GetDefault<UGameplaySettings>()->bFactorySnapshots || FParse::Param(FCommandLine::Get(), TEXT("FactorySnapshot"));
+
+	TearDownHandle = FWorldDelegates::OnWorldBeginTearDown.AddUObject(this, &ThisClass::OnWorldBeginTearDown);
+}
+
+void UFactorySnapshotSubsystem::Deinitialize()
+{
+	FWorldDelegates::OnWorldBeginTearDown.Remove(TearDownHandle);
+
+	if (PendingWrite.IsValid())
+	{
+		PendingWrite.Wait();
+	}
+
+	Super::Deinitialize();
+}
+
+bool UFactorySnapshotSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+void UFactorySnapshotSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	// Machines and shapes only live on the server
+	if (InWorld.GetNetMode() == NM_Client)
+	{
+		bEnabled = false;
+	}
+
+	if (!bEnabled) return;
+
+	LoadSnapshot();
+
+	const float Interval = GetDefault<UGameplaySettings>()->FactorySnapshotInterval;
+	if (Interval > 0.f)
+	{
+		InWorld.GetTimerManager().SetTimer(SaveTimerHandle, this, &ThisClass::SaveSnapshot, Interval, true);
+	}
+}
+
+FString UFactorySnapshotSubsystem::GetSnapshotFilename() const
+{
+	return FPaths::ProjectSavedDir() / TEXT("Snapshots") / UWorld::RemovePIEPrefix(GetWorld()->GetMapName()) + TEXT(".ibs");
+}
+
+void UFactorySnapshotSubsystem::SaveSnapshot()
+{
+	// A snapshot taken halfway through a restore would lose the shapes not spawned yet
+	if (!bEnabled || IsRestoring()) return;
+
+	if (PendingWrite.IsValid() && !PendingWrite.IsReady())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Factory snapshot: the previous snapshot is still being written, skipping this one"));
+		return;
+	}
+
+	const uint64 StartCycles = FPlatformTime::Cycles64();
+
+	FFactorySnapshot Snapshot;
+	CaptureSnapshot(Snapshot);
+
+	const double CaptureMs = FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - StartCycles);
+
+	PendingWrite = Async(EAsyncExecution::ThreadPool, [Snapshot = MoveTemp(Snapshot), Filename = GetSnapshotFilename(), CaptureMs]() mutable
+		{
+			const uint64 WriteStartCycles = FPlatformTime::Cycles64();
+
+			TArray<uint8> Data;
+			FMemoryWriter Writer(Data);
+			Snapshot.Serialize(Writer);
+
+			// Written next to the previous snapshot then swapped, a crash while writing keeps the previous one
+			const FString TempFilename = Filename + TEXT(".tmp");
+			if (!FFileHelper::SaveArrayToFile(Data, *TempFilename) || !IFileManager::Get().Move(*Filename, *TempFilename, true, true))
+			{
+				UE_LOG(LogTemp, Error, TEXT("Factory snapshot: cannot write %s"), *Filename);
+				return;
+			}
+
+			UE_LOG(LogTemp, Log, TEXT("Factory snapshot: saved %d machines, %d belts and %d shapes to %s (%.1f KiB), capture %.2f ms on the game thread, serialize and write %.2f ms"),
+				Snapshot.Machines.Num(), Snapshot.Conveyors.Num(), Snapshot.Shapes.Num(), *Filename, Data.Num() / 1024.0,
+				CaptureMs, FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - WriteStartCycles));
+		});
+}
+
+void UFactorySnapshotSubsystem::CaptureSnapshot(FFactorySnapshot& OutSnapshot) const
+{
+	const URecipeRegistrySubsystem* RecipeRegistry = URecipeRegistrySubsystem::Get(this);
+	if (!RecipeRegistry) return;
+
+	const FRecipeRegistry& Registry = RecipeRegistry->GetRegistry();
+	for (int32 ShapeIndex = 0; ShapeIndex < Registry.GetNumShapes(); ++ShapeIndex)
+	{
+		OutSnapshot.ShapeIDs.Add(Registry.GetShape(ShapeIndex)->ShapeID.ToString());
+	}
+
+	TMap<const AShape*, int32> IngredientMachines;
+	for (TActorIterator<AMachine> It(GetWorld()); It; ++It)
+	{
+		const int32 MachineIndex = OutSnapshot.Machines.Num();
+
+		FMachineSnapshot& Machine = OutSnapshot.Machines.AddDefaulted_GetRef();
+		Machine.Name = It->GetName();
+		Machine.bEnabled = It->IsMachineEnabled();
+
+		for (const TArray<AShape*>& Shapes : It->ShapeIngredients)
+		{
+			for (const AShape* Shape : Shapes)
+			{
+				IngredientMachines.Add(Shape, MachineIndex);
+			}
+		}
+
+		// Ingredients delivered by conveyors come back as shapes inside the machine
+		for (int32 ShapeIndex = 0; ShapeIndex < Registry.GetNumShapes(); ++ShapeIndex)
+		{
+			const int32 MatcherShapeIndex = It->RecipeMatcher.FindShapeIndex(ShapeIndex);
+			const int32 NumItems = MatcherShapeIndex != INDEX_NONE ? It->ItemIngredients[MatcherShapeIndex] : 0;
+			for (int32 Item = 0; Item < NumItems; ++Item)
+			{
+				FShapeSnapshot& Saved = OutSnapshot.Shapes.AddDefaulted_GetRef();
+				Saved.Type = ShapeIndex;
+				Saved.Machine = MachineIndex;
+				Saved.Location = FVector3f(It->GetActorLocation());
+			}
+		}
+	}
+
+	for (TActorIterator<AShape> It(GetWorld()); It; ++It)
+	{
+		const AShape* Shape = *It;
+		if (Shape->IsPooled() || Shape->IsActorBeingDestroyed() || Shape->GetShapeIndex() == INDEX_NONE) continue;
+
+		FShapeSnapshot& Saved = OutSnapshot.Shapes.AddDefaulted_GetRef();
+		Saved.Type = Shape->GetShapeIndex();
+
+		const int32* Machine = IngredientMachines.Find(Shape);
+		Saved.Machine = Machine ? *Machine : INDEX_NONE;
+
+		Saved.Location = FVector3f(Shape->GetActorLocation());
+		Saved.Rotation = FQuat4f(Shape->GetActorQuat());
+
+		if (const UPrimitiveComponent* Body = Cast<UPrimitiveComponent>(Shape->GetRootComponent()))
+		{
+			Saved.bSleeping = !Body->RigidBodyIsAwake();
+			Saved.LinearVelocity = FVector3f(Body->GetPhysicsLinearVelocity());
+			Saved.AngularVelocity = FVector3f(Body->GetPhysicsAngularVelocityInDegrees());
+		}
+	}
+
+	for (TActorIterator<AConveyor> It(GetWorld()); It; ++It)
+	{
+		if (It->GetNumItems() == 0) continue;
+
+		FConveyorSnapshot& Conveyor = OutSnapshot.Conveyors.AddDefaulted_GetRef();
+		Conveyor.Name = It->GetName();
+		Conveyor.Items.Reserve(It->GetNumItems());
+
+		It->ForEachItem([&Conveyor](int32 ShapeIndex, float Distance)
+			{
+				Conveyor.Items.Add({ ShapeIndex, Distance });
+			});
+	}
+
+	// Demoted shapes are saved like resting loose shapes, they come back as actors and get demoted again once they rest
+	if (const UShapeDemotionSubsystem* ShapeDemotion = GetWorld()->GetSubsystem<UShapeDemotionSubsystem>())
+	{
+		ShapeDemotion->ForEachDemotedShape([&OutSnapshot](const FShapeInstance& Instance)
+			{
+				FShapeSnapshot& Saved = OutSnapshot.Shapes.AddDefaulted_GetRef();
+				Saved.Type = Instance.ShapeIndex;
+				Saved.Location = FVector3f(Instance.Location);
+				Saved.Rotation = FQuat4f(Instance.Rotation.Quaternion());
+			});
+	}
+}
+
+void UFactorySnapshotSubsystem::LoadSnapshot()
+{
+	RestoreStartTime = FPlatformTime::Seconds();
+
+	// Nothing to restore on the first run of a map
+	TArray<uint8> Data;
+	if (!FFileHelper::LoadFileToArray(Data, *GetSnapshotFilename(), FILEREAD_Silent)) return;
+
+	TUniquePtr<FFactorySnapshot> Snapshot = MakeUnique<FFactorySnapshot>();
+	FMemoryReader Reader(Data);
+	if (!Snapshot->Serialize(Reader))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Factory snapshot: %s is not a version %u snapshot, starting from the level"), *GetSnapshotFilename(), FFactorySnapshot::LatestVersion);
+		return;
+	}
+
+	RestoreLoadMs = (FPlatformTime::Seconds() - RestoreStartTime) * 1000.0;
+
+	URecipeRegistrySubsystem* RecipeRegistry = URecipeRegistrySubsystem::Get(this);
+	if (!RecipeRegistry) return;
+
+	PendingRestore = MoveTemp(Snapshot);
+	NumRestoreFrames = 0;
+
+	// Machines begin play after the world subsystems, so the restore never starts before the next frame
+	RestoreClassesHandle = RecipeRegistry->RequestAllShapeClasses(FStreamableDelegate::CreateWeakLambda(this, [this]()
+		{
+			GetWorld()->GetTimerManager().SetTimerForNextTick(this, &ThisClass::BeginRestore);
+		}));
+}
+
+void UFactorySnapshotSubsystem::BeginRestore()
+{
+	const URecipeRegistrySubsystem* RecipeRegistry = URecipeRegistrySubsystem::Get(this);
+	if (!PendingRestore || !RecipeRegistry) return;
+
+	const FRecipeRegistry& Registry = RecipeRegistry->GetRegistry();
+
+	RestoredShapeTypes.Reset();
+	for (const FString& ShapeID : PendingRestore->ShapeIDs)
+	{
+		RestoredShapeTypes.Add(Registry.FindShapeIndex(FName(*ShapeID)));
+	}
+
+	TMap<FString, AMachine*> LevelMachines;
+	for (TActorIterator<AMachine> It(GetWorld()); It; ++It)
+	{
+		LevelMachines.Add(It->GetName(), *It);
+	}
+
+	// Machines hold their evaluations until every ingredient is back
+	RestoredMachines.Reset();
+	RestoredMachines.SetNum(PendingRestore->Machines.Num());
+	for (int32 MachineIndex = 0; MachineIndex < PendingRestore->Machines.Num(); ++MachineIndex)
+	{
+		const FMachineSnapshot& Saved = PendingRestore->Machines[MachineIndex];
+		if (AMachine* const* Machine = LevelMachines.Find(Saved.Name))
+		{
+			(*Machine)->BeginSnapshotRestore(Saved.bEnabled);
+			RestoredMachines[MachineIndex] = *Machine;
+		}
+	}
+
+	// The snapshot replaces the shapes placed in the level, they go to the pool and get reused by the restore
+	UShapePoolSubsystem* ShapePool = GetWorld()->GetSubsystem<UShapePoolSubsystem>();
+
+	if (UShapeDemotionSubsystem* ShapeDemotion = GetWorld()->GetSubsystem<UShapeDemotionSubsystem>())
+	{
+		ShapeDemotion->RemoveDemotedShapes();
+	}
+
+	TArray<AShape*> LevelShapes;
+	for (TActorIterator<AShape> It(GetWorld()); It; ++It)
+	{
+		if (!It->IsPooled())
+		{
+			LevelShapes.Add(*It);
+		}
+	}
+
+	for (AShape* Shape : LevelShapes)
+	{
+		if (ShapePool)
+		{
+			ShapePool->ReleaseShape(Shape);
+		}
+		else
+		{
+			Shape->Destroy();
+		}
+	}
+
+	// Belt items are not actors, they are all put back right away in their saved order
+	TMap<FString, AConveyor*> LevelConveyors;
+	for (TActorIterator<AConveyor> It(GetWorld()); It; ++It)
+	{
+		It->RemoveAllItems();
+		LevelConveyors.Add(It->GetName(), *It);
+	}
+
+	for (const FConveyorSnapshot& Saved : PendingRestore->Conveyors)
+	{
+		AConveyor* const* Conveyor = LevelConveyors.Find(Saved.Name);
+		if (!Conveyor) continue;
+
+		for (const FConveyorItemSnapshot& Item : Saved.Items)
+		{
+			// Shapes removed from the table since the snapshot are dropped
+			const int32 ShapeIndex = RestoredShapeTypes.IsValidIndex(Item.Type) ? RestoredShapeTypes[Item.Type] : INDEX_NONE;
+			if (ShapeIndex != INDEX_NONE)
+			{
+				(*Conveyor)->RestoreItem(ShapeIndex, Item.Distance);
+			}
+		}
+	}
+
+	RestoreCursor = 0;
+	RestoreNextBatch();
+}
+
+void UFactorySnapshotSubsystem::RestoreNextBatch()
+{
+	const URecipeRegistrySubsystem* RecipeRegistry = URecipeRegistrySubsystem::Get(this);
+	if (!PendingRestore || !RecipeRegistry) return;
+
+	const FRecipeRegistry& Registry = RecipeRegistry->GetRegistry();
+	UShapePoolSubsystem* ShapePool = GetWorld()->GetSubsystem<UShapePoolSubsystem>();
+
+	++NumRestoreFrames;
+
+	const TArray<FShapeSnapshot>& Shapes = PendingRestore->Shapes;
+	const int32 BatchEnd = FMath::Min(RestoreCursor + FMath::Max(GetDefault<UGameplaySettings>()->FactorySnapshotRestoreBatchSize, 1), Shapes.Num());
+
+	for (; RestoreCursor < BatchEnd; ++RestoreCursor)
+	{
+		const FShapeSnapshot& Saved = Shapes[RestoreCursor];
+
+		// Shapes removed from the table since the snapshot are dropped
+		const int32 ShapeIndex = RestoredShapeTypes.IsValidIndex(Saved.Type) ? RestoredShapeTypes[Saved.Type] : INDEX_NONE;
+		const FShapeRecord* Record = Registry.GetShape(ShapeIndex);
+		if (!Record || !Record->ShapeClass) continue;
+
+		// Shapes resting on each other must not be pushed apart
+		const FTransform Transform(FQuat(Saved.Rotation), FVector(Saved.Location));
+		AShape* Shape = nullptr;
+		if (ShapePool)
+		{
+			Shape = ShapePool->AcquireShape(Record->ShapeClass, Transform, nullptr, ESpawnActorCollisionHandlingMethod::AlwaysSpawn);
+		}
+		else
+		{
+			FActorSpawnParameters SpawnParameters;
+			SpawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+			Shape = GetWorld()->SpawnActor<AShape>(Record->ShapeClass, Transform, SpawnParameters);
+		}
+
+		if (!Shape) continue;
+
+		if (UPrimitiveComponent* Body = Cast<UPrimitiveComponent>(Shape->GetRootComponent()))
+		{
+			if (Saved.bSleeping)
+			{
+				Body->PutRigidBodyToSleep();
+			}
+			else
+			{
+				Body->SetPhysicsLinearVelocity(FVector(Saved.LinearVelocity));
+				Body->SetPhysicsAngularVelocityInDegrees(FVector(Saved.AngularVelocity));
+			}
+		}
+
+		if (AMachine* Machine = RestoredMachines.IsValidIndex(Saved.Machine) ? RestoredMachines[Saved.Machine].Get() : nullptr)
+		{
+			Machine->RestoreIngredient(Shape);
+		}
+	}
+
+	if (RestoreCursor < Shapes.Num())
+	{
+		GetWorld()->GetTimerManager().SetTimerForNextTick(this, &ThisClass::RestoreNextBatch);
+		return;
+	}
+
+	EndRestore();
+}
+
+void UFactorySnapshotSubsystem::EndRestore()
+{
+	int32 NumMachines = 0;
+	for (const TWeakObjectPtr<AMachine>& WeakMachine : RestoredMachines)
+	{
+		if (AMachine* Machine = WeakMachine.Get())
+		{
+			Machine->EndSnapshotRestore();
+			++NumMachines;
+		}
+	}
+
+	UE_LOG(LogTemp, Log, TEXT("Factory snapshot: restored %d/%d machines, %d belts and %d shapes from %s in %.2f ms over %d frames, load %.2f ms"),
+		NumMachines, PendingRestore->Machines.Num(), PendingRestore->Conveyors.Num(), PendingRestore->Shapes.Num(), *GetSnapshotFilename(),
+		(FPlatformTime::Seconds() - RestoreStartTime) * 1000.0, NumRestoreFrames, RestoreLoadMs);
+
+	PendingRestore.Reset();
+	RestoredMachines.Reset();
+	RestoredShapeTypes.Reset();
+	RestoreClassesHandle.Reset();
+}
+
+void UFactorySnapshotSubsystem::OnWorldBeginTearDown(UWorld* World)
+{
+	if (World != GetWorld() || !bEnabled) return;
+
+	GetWorld()->GetTimerManager().ClearTimer(SaveTimerHandle);
+
+	// The last periodic snapshot must not make this one skip
+	if (PendingWrite.IsValid())
+	{
+		PendingWrite.Wait();
+	}
+
+	SaveSnapshot();
+
+	if (PendingWrite.IsValid())
+	{
+		PendingWrite.Wait();
+	}
+}
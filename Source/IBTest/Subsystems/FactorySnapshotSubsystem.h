@@ -0,0 +1,169 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/Future.h"
+#include "Engine/EngineTypes.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "FactorySnapshotSubsystem.generated.h"
+
+class AMachine;
+class AShape;
+struct FStreamableHandle;
+
+/** Saved state of a machine placed in the level, matched by actor name on restore */
+struct FMachineSnapshot
+{
+	FString Name;
+
+	bool bEnabled = true;
+};
+
+/** Saved state of a shape in the world, pooled shapes are not saved */
+struct FShapeSnapshot
+{
+	/** Index in FFactorySnapshot::ShapeIDs */
+	int32 Type = INDEX_NONE;
+
+	/** Index in FFactorySnapshot::Machines of the machine holding the shape as an ingredient, INDEX_NONE for loose shapes */
+	int32 Machine = INDEX_NONE;
+
+	FVector3f Location = FVector3f::ZeroVector;
+
+	FQuat4f Rotation = FQuat4f::Identity;
+
+	FVector3f LinearVelocity = FVector3f::ZeroVector;
+
+	FVector3f AngularVelocity = FVector3f::ZeroVector;
+
+	bool bSleeping = true;
+};
+
+/** Saved item of a belt */
+struct FConveyorItemSnapshot
+{
+	/** Index in FFactorySnapshot::ShapeIDs */
+	int32 Type = INDEX_NONE;
+
+	/** Distance along the belt */
+	float Distance = 0.f;
+};
+
+/** Saved items of a belt placed in the level, front item first, matched by actor name on restore */
+struct FConveyorSnapshot
+{
+	FString Name;
+
+	TArray<FConveyorItemSnapshot> Items;
+};
+
+/**
+ * Machines, belt items and shapes of a world.
+ * Shapes refer to their type by shape id, so snapshots survive reordered shape tables.
+ */
+struct FFactorySnapshot
+{
+	static constexpr uint32 ExpectedMagic = 0x53424249; // "IBBS"
+	/** 2: belt items are saved on their belt instead of as loose shapes */
+	static constexpr uint32 LatestVersion = 2;
+
+	TArray<FString> ShapeIDs;
+
+	TArray<FMachineSnapshot> Machines;
+
+	TArray<FShapeSnapshot> Shapes;
+
+	TArray<FConveyorSnapshot> Conveyors;
+
+	/** Read or write the versioned binary form. Return false if a loaded archive is not a snapshot this version can read */
+	bool Serialize(FArchive& Ar);
+};
+
+/**
+ * Saves the machines, belt items and loose shapes of the server to Saved/Snapshots/<Map>.ibs, and restores them when the map starts again.
+ * The state is captured on the game thread then serialized and written by a worker thread, every FactorySnapshotInterval
+ * and when the world is torn down. On restore, shapes are spawned FactorySnapshotRestoreBatchSize per frame and linked
+ * straight to their machine, machines evaluate their recipes once the whole snapshot is back instead of once per overlap.
+ * Enabled by bFactorySnapshots or -FactorySnapshot.
+ */
+UCLASS()
+class IBTEST_API UFactorySnapshotSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+private:
+
+	/** Snapshot being restored, released once every shape is spawned */
+	TUniquePtr<FFactorySnapshot> PendingRestore;
+
+	/** Machines of PendingRestore, by snapshot machine index */
+	TArray<TWeakObjectPtr<AMachine>> RestoredMachines;
+
+	/** Registry shape indices of PendingRestore shape types */
+	TArray<int32> RestoredShapeTypes;
+
+	/** Next shape of PendingRestore to spawn */
+	int32 RestoreCursor = 0;
+
+	/** Keeps shape classes loaded while restoring */
+	TSharedPtr<FStreamableHandle> RestoreClassesHandle;
+
+	/** Write running on a worker thread */
+	TFuture<void> PendingWrite;
+
+	FTimerHandle SaveTimerHandle;
+
+	FDelegateHandle TearDownHandle;
+
+	bool bEnabled = false;
+
+	double RestoreStartTime = 0.0;
+
+	double RestoreLoadMs = 0.0;
+
+	int32 NumRestoreFrames = 0;
+
+public:
+
+	// USubsystem Begin
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	// USubsystem End
+
+	// UWorldSubsystem Begin
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	// UWorldSubsystem End
+
+	/** Capture the world and write it in the background, skipped while the previous write is still running */
+	void SaveSnapshot();
+
+	FORCEINLINE bool IsRestoring() const { return PendingRestore.IsValid(); }
+
+protected:
+
+	// UWorldSubsystem Begin
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	// UWorldSubsystem End
+
+private:
+
+	FString GetSnapshotFilename() const;
+
+	/** Copy the state of the machines and shapes, game thread only */
+	void CaptureSnapshot(FFactorySnapshot& OutSnapshot) const;
+
+	/** Read the snapshot of this map and start restoring it once the shape classes are loaded */
+	void LoadSnapshot();
+
+	/** Replace the level shapes, belt items and machine states with the snapshot ones */
+	void BeginRestore();
+
+	/** Spawn the next batch of shapes, then schedule the next batch or end the restore */
+	void RestoreNextBatch();
+
+	void EndRestore();
+
+	/** Save a last snapshot before the actors go away, and wait for it to be written */
+	void OnWorldBeginTearDown(UWorld* World);
+};
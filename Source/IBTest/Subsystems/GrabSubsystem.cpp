@@ -0,0 +1,241 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Subsystems/GrabSubsystem.h"
+#include "Components/PrimitiveComponent.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "HAL/IConsoleManager.h"
+#include "Physics/Experimental/PhysScene_Chaos.h"
+#include "PBDRigidsSolver.h"
+#include "PhysicsProxy/SingleParticlePhysicsProxy.h"
+
+#include "IBTest.h"
+#include "IBTestCharacter.h"
+
+namespace
+{
+	FAutoConsoleCommandWithWorld GrabStatsCommand(
+		TEXT("IBTest.Grab.Stats"),
+		TEXT("Print the game thread cost of character ticks and grabbing, and the physics thread cost of the grab driver, since the last call"),
+		FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+			{
+				if (UGrabSubsystem* GrabSubsystem = World ? World->GetSubsystem<UGrabSubsystem>() : nullptr)
+				{
+					GrabSubsystem->DumpStats();
+				}
+			}));
+
+	/** Spring pulling the body toward its target, in 1/s², critically damped */
+	const float GrabStiffness = 750.f;
+	const float GrabDamping = 2.f * FMath::Sqrt(GrabStiffness);
+
+	/** Fraction of the angular velocity removed per second, keeps grabbed shapes from spinning */
+	const float GrabAngularDamping = 5.f;
+
+	/** Targets are not extrapolated further than this when the game thread stalls */
+	const float MaxTargetExtrapolation = 0.1f;
+}
+
+void FGrabSimCallback::OnPreSimulate_Internal()
+{
+	const uint64 StartCycles = FPlatformTime::Cycles64();
+
+	if (const FGrabSimInput* Input = GetConsumerInput_Internal())
+	{
+		Targets = Input->Targets;
+		GravityZ = Input->GravityZ;
+		InputSimTime = GetSimTime_Internal();
+
+		// Cached targets outlive the step, they must never point to a proxy the solver is about to free
+		if (!UnregisteredProxies.IsEmpty())
+		{
+			Targets.RemoveAllSwap([this](const FGrabTarget& Target) { return UnregisteredProxies.Contains(Target.Proxy); }, false);
+			UnregisteredProxies.Reset();
+		}
+	}
+
+	const Chaos::FReal DeltaTime = GetDeltaTime_Internal();
+	const float TimeSinceInput = static_cast<float>(GetSimTime_Internal() - InputSimTime);
+
+	for (const FGrabTarget& Target : Targets)
+	{
+		Chaos::FRigidBodyHandle_Internal* Body = Target.Proxy ? Target.Proxy->GetPhysicsThreadAPI() : nullptr;
+		if (!Body || Body->ObjectState() != Chaos::EObjectStateType::Dynamic) continue;
+
+		const FVector TargetLocation = Target.Location + Target.Velocity * FMath::Min(Target.Age + TimeSinceInput, MaxTargetExtrapolation);
+
+		// Spring toward the target, damped relative to its motion, gravity is cancelled so the body does not sag
+		const FVector Acceleration = (TargetLocation - Body->X()) * GrabStiffness + (Target.Velocity - Body->V()) * GrabDamping - FVector(0.f, 0.f, GravityZ);
+		Body->AddForce(Acceleration * Body->M());
+
+		Body->SetW(Body->W() * FMath::Max(0., 1. - GrabAngularDamping * DeltaTime));
+	}
+
+	NumSteps.fetch_add(1, std::memory_order_relaxed);
+	NumCycles.fetch_add(FPlatformTime::Cycles64() - StartCycles, std::memory_order_relaxed);
+}
+
+void FGrabSimCallback::OnParticlesUnregistered_Internal(TArray<TTuple<Chaos::FUniqueIdx, FSingleParticlePhysicsProxy*>>& Proxies)
+{
+	for (const TTuple<Chaos::FUniqueIdx, FSingleParticlePhysicsProxy*>& Unregistered : Proxies)
+	{
+		FSingleParticlePhysicsProxy* Proxy = Unregistered.Get<1>();
+		UnregisteredProxies.Add(Proxy);
+		Targets.RemoveAllSwap([Proxy](const FGrabTarget& Target) { return Target.Proxy == Proxy; }, false);
+	}
+}
+
+void UGrabSubsystem::Deinitialize()
+{
+	if (SimCallback)
+	{
+		FPhysScene* PhysScene = GetWorld()->GetPhysicsScene();
+		if (Chaos::FPhysicsSolver* Solver = PhysScene ? PhysScene->GetSolver() : nullptr)
+		{
+			Solver->UnregisterAndFreeSimCallbackObject_External(SimCallback);
+		}
+
+		SimCallback = nullptr;
+	}
+
+	Super::Deinitialize();
+}
+
+bool UGrabSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+void UGrabSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	++NumFrames;
+
+	if (!SimCallback) return;
+
+	IBTEST_SCOPE_CYCLE_COUNTER(GrabUpdate);
+
+	const uint64 StartCycles = FPlatformTime::Cycles64();
+	const double Time = GetWorld()->GetTimeSeconds();
+
+	// Sent every frame, even empty, the physics thread keeps the last input it received
+	FGrabSimInput* Input = SimCallback->GetProducerInputData_External();
+	Input->GravityZ = GetWorld()->GetGravityZ();
+
+	for (int32 Index = Grabs.Num() - 1; Index >= 0; --Index)
+	{
+		const FGrab& Grab = Grabs[Index];
+		UPrimitiveComponent* Component = Grab.Component.Get();
+		if (!Component)
+		{
+			Grabs.RemoveAtSwap(Index, 1, false);
+			continue;
+		}
+
+		FBodyInstance* BodyInstance = Component->GetBodyInstance();
+		if (!BodyInstance || !BodyInstance->IsInstanceSimulatingPhysics()) continue;
+
+		// Sleeping bodies ignore forces
+		if (!BodyInstance->IsInstanceAwake())
+		{
+			BodyInstance->WakeInstance();
+		}
+
+		FGrabTarget& Target = Input->Targets.AddDefaulted_GetRef();
+		Target.Proxy = BodyInstance->GetPhysicsActorHandle();
+		Target.Location = Grab.Location;
+		Target.Velocity = Grab.Velocity;
+		Target.Age = static_cast<float>(Time - Grab.SampleTime);
+	}
+
+	TickCycles += FPlatformTime::Cycles64() - StartCycles;
+}
+
+TStatId UGrabSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGrabSubsystem, STATGROUP_Tickables);
+}
+
+void UGrabSubsystem::BeginGrab(UPrimitiveComponent* Component)
+{
+	if (!Component) return;
+
+	if (!SimCallback)
+	{
+		FPhysScene* PhysScene = GetWorld()->GetPhysicsScene();
+		Chaos::FPhysicsSolver* Solver = PhysScene ? PhysScene->GetSolver() : nullptr;
+		if (!Solver) return;
+
+		SimCallback = Solver->CreateAndRegisterSimCallbackObject_External<FGrabSimCallback>();
+	}
+
+	FGrab* Grab = FindGrab(Component);
+	if (!Grab)
+	{
+		Grab = &Grabs.AddDefaulted_GetRef();
+		Grab->Component = Component;
+	}
+
+	Grab->Location = Component->GetComponentLocation();
+	Grab->Velocity = FVector::ZeroVector;
+	Grab->SampleTime = GetWorld()->GetTimeSeconds();
+
+	Component->WakeRigidBody();
+}
+
+void UGrabSubsystem::SetGrabTarget(UPrimitiveComponent* Component, const FVector& Location, const FVector& Velocity)
+{
+	if (FGrab* Grab = FindGrab(Component))
+	{
+		Grab->Location = Location;
+		Grab->Velocity = Velocity;
+		Grab->SampleTime = GetWorld()->GetTimeSeconds();
+	}
+}
+
+void UGrabSubsystem::EndGrab(UPrimitiveComponent* Component)
+{
+	Grabs.RemoveAllSwap([Component](const FGrab& Grab) { return Grab.Component == Component; }, false);
+}
+
+void UGrabSubsystem::RecordCharacterTick(uint64 Cycles)
+{
+	++NumCharacterTicks;
+	CharacterTickCycles += Cycles;
+}
+
+UGrabSubsystem::FGrab* UGrabSubsystem::FindGrab(const UPrimitiveComponent* Component)
+{
+	return Grabs.FindByPredicate([Component](const FGrab& Grab) { return Grab.Component == Component; });
+}
+
+void UGrabSubsystem::DumpStats()
+{
+	int32 NumCharacters = 0;
+	int32 NumTickingCharacters = 0;
+	for (TActorIterator<AIBTestCharacter> It(GetWorld()); It; ++It)
+	{
+		++NumCharacters;
+		NumTickingCharacters += It->IsActorTickEnabled() ? 1 : 0;
+	}
+
+	const double Frames = FMath::Max<int64>(NumFrames, 1);
+	const double CharacterTickMs = FPlatformTime::ToMilliseconds64(CharacterTickCycles) / Frames;
+	const double TickMs = FPlatformTime::ToMilliseconds64(TickCycles) / Frames;
+
+	const int64 NumSteps = SimCallback ? SimCallback->NumSteps.exchange(0) : 0;
+	const uint64 StepCycles = SimCallback ? SimCallback->NumCycles.exchange(0) : 0;
+
+	UE_LOG(LogTemp, Log, TEXT("Grab stats for %s over %lld frames: Characters=%d Ticking=%d Grabs=%d"),
+		*GetNameSafe(GetWorld()), NumFrames, NumCharacters, NumTickingCharacters, Grabs.Num());
+	UE_LOG(LogTemp, Log, TEXT("  Game thread: %.1f character ticks/frame, %.4f ms/frame (%.4f ms per 100 characters), grab input %.4f ms/frame"),
+		NumCharacterTicks / Frames, CharacterTickMs, NumCharacters > 0 ? CharacterTickMs * 100.0 / NumCharacters : 0.0, TickMs);
+	UE_LOG(LogTemp, Log, TEXT("  Physics thread: %lld steps, %.4f ms/step"),
+		NumSteps, NumSteps > 0 ? FPlatformTime::ToMilliseconds64(StepCycles) / NumSteps : 0.0);
+
+	NumFrames = 0;
+	NumCharacterTicks = 0;
+	CharacterTickCycles = 0;
+	TickCycles = 0;
+}
@@ -0,0 +1,136 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Chaos/SimCallbackInput.h"
+#include "Chaos/SimCallbackObject.h"
+#include "PhysicsInterfaceDeclaresCore.h"
+#include "Subsystems/WorldSubsystem.h"
+#include <atomic>
+#include "GrabSubsystem.generated.h"
+
+class UPrimitiveComponent;
+
+/** Grab target of one body, sent by the game thread every frame */
+struct FGrabTarget
+{
+	FPhysicsActorHandle Proxy = nullptr;
+
+	/** Target at the time it was sampled, and its velocity used to extrapolate between samples */
+	FVector Location = FVector::ZeroVector;
+	FVector Velocity = FVector::ZeroVector;
+
+	/** Seconds between the sample and the frame the input was sent */
+	float Age = 0.f;
+};
+
+struct FGrabSimInput : public Chaos::FSimCallbackInput
+{
+	TArray<FGrabTarget> Targets;
+
+	float GravityZ = 0.f;
+
+	void Reset()
+	{
+		Targets.Reset();
+	}
+};
+
+/**
+ * Pulls grabbed bodies toward their target before every physics step, substeps included.
+ * Targets are extrapolated from the last game thread input, so bodies follow smoothly even when the game thread
+ * runs at a fraction of the physics rate. Targets of bodies removed from the solver are dropped as soon as they unregister.
+ */
+class FGrabSimCallback : public Chaos::TSimCallbackObject<FGrabSimInput, Chaos::FSimCallbackNoOutput,
+	Chaos::ESimCallbackOptions::Presimulate | Chaos::ESimCallbackOptions::ParticleUnregister>
+{
+public:
+
+	/** Physics steps run and the time spent driving grabs, read by the game thread */
+	std::atomic<int64> NumSteps{ 0 };
+	std::atomic<uint64> NumCycles{ 0 };
+
+private:
+
+	/** Latest input received, kept for the steps that get none */
+	TArray<FGrabTarget> Targets;
+	float GravityZ = 0.f;
+
+	/** Simulation time the latest input was received at */
+	Chaos::FReal InputSimTime = 0.;
+
+	/** Bodies unregistered since the latest input, which may have been sent before they were */
+	TArray<FPhysicsActorHandle> UnregisteredProxies;
+
+	virtual void OnPreSimulate_Internal() override;
+	virtual void OnParticlesUnregistered_Internal(TArray<TTuple<Chaos::FUniqueIdx, FSingleParticlePhysicsProxy*>>& Proxies) override;
+};
+
+/**
+ * Grabbed bodies of the world, driven from the physics thread by FGrabSimCallback.
+ * Characters only tick while they grab something, to feed their target here once per frame.
+ */
+UCLASS()
+class IBTEST_API UGrabSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+private:
+
+	struct FGrab
+	{
+		TWeakObjectPtr<UPrimitiveComponent> Component;
+
+		FVector Location = FVector::ZeroVector;
+		FVector Velocity = FVector::ZeroVector;
+		double SampleTime = 0.;
+	};
+
+	TArray<FGrab> Grabs;
+
+	/** Owned by the physics solver, created with the first grab */
+	FGrabSimCallback* SimCallback = nullptr;
+
+	/** Game thread cost of grabbing, characters included */
+	int64 NumFrames = 0;
+	int64 NumCharacterTicks = 0;
+	uint64 CharacterTickCycles = 0;
+	uint64 TickCycles = 0;
+
+public:
+
+	// USubsystem Begin
+	virtual void Deinitialize() override;
+	// USubsystem End
+
+	// FTickableGameObject Begin
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+	// FTickableGameObject End
+
+	/** Start pulling the body of the component toward its grab target, which starts at its current location */
+	void BeginGrab(UPrimitiveComponent* Component);
+
+	/** Set where the grabbed component is pulled to and how fast that target moves */
+	void SetGrabTarget(UPrimitiveComponent* Component, const FVector& Location, const FVector& Velocity);
+
+	/** Stop driving the component */
+	void EndGrab(UPrimitiveComponent* Component);
+
+	/** Count the game thread time of a character tick */
+	void RecordCharacterTick(uint64 Cycles);
+
+	/** Print game and physics thread grab costs to the log, and reset them */
+	void DumpStats();
+
+protected:
+
+	// UWorldSubsystem Begin
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	// UWorldSubsystem End
+
+private:
+
+	FGrab* FindGrab(const UPrimitiveComponent* Component);
+};
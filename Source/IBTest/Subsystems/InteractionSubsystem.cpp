@@ -0,0 +1,338 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Subsystems/InteractionSubsystem.h"
+#include "Components/PrimitiveComponent.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/IConsoleManager.h"
+
+#include "IBTestCharacter.h"
+#include "Interfaces/IInteractionInterface.h"
+#include "Networking/InteractionRequest.h"
+#include "Networking/PayloadSizePackageMap.h"
+
+namespace
+{
+	bool bFocusHighlight = true;
+	FAutoConsoleVariableRef CVarFocusHighlight(
+		TEXT("IBTest.Interaction.FocusHighlight"),
+		bFocusHighlight,
+		TEXT("Render the interactable in front of local players in the custom depth pass, for the highlight post process"));
+
+	FAutoConsoleCommandWithWorld InteractionTraceStatsCommand(
+		TEXT("IBTest.Interaction.TraceStats"),
+		TEXT("Print the interactable registry and interaction trace counters for the current world"),
+		FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+			{
+				if (const UInteractionSubsystem* InteractionSubsystem = World ? World->GetSubsystem<UInteractionSubsystem>() : nullptr)
+				{
+					InteractionSubsystem->DumpStats();
+				}
+			}));
+
+#if !UE_BUILD_SHIPPING
+	bool bMeasurePayload = false;
+	FAutoConsoleVariableRef CVarMeasurePayload(
+		TEXT("IBTest.Interaction.MeasurePayload"),
+		bMeasurePayload,
+		TEXT("Serialize every interaction RPC sent by local players a second time, as a full FHitResult, to compare payloads with IBTest.Interaction.Stats"));
+
+	FAutoConsoleCommandWithWorld InteractionPayloadStatsCommand(
+		TEXT("IBTest.Interaction.Stats"),
+		TEXT("Print the average payload of interaction RPCs, compact requests against full FHitResult parameters"),
+		FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+			{
+				if (const UInteractionSubsystem* InteractionSubsystem = World ? World->GetSubsystem<UInteractionSubsystem>() : nullptr)
+				{
+					InteractionSubsystem->DumpPayloadStats();
+				}
+			}));
+#endif
+
+	void SetHighlighted(AActor* Actor, bool bHighlighted)
+	{
+		if (!Actor) return;
+
+		Actor->ForEachComponent<UPrimitiveComponent>(false, [bHighlighted](UPrimitiveComponent* Component)
+			{
+				Component->SetRenderCustomDepth(bHighlighted);
+			});
+	}
+}
+
+bool FInteractable::CanInteract() const
+{
+	return NativeInterface ? NativeInterface->CanInteract_Implementation() : IInteractionInterface::Execute_CanInteract(Actor.Get());
+}
+
+void FInteractable::Interact1() const
+{
+	if (NativeInterface)
+	{
+		NativeInterface->Interact1_Implementation();
+	}
+	else
+	{
+		IInteractionInterface::Execute_Interact1(Actor.Get());
+	}
+}
+
+void FInteractable::Interact2() const
+{
+	if (NativeInterface)
+	{
+		NativeInterface->Interact2_Implementation();
+	}
+	else
+	{
+		IInteractionInterface::Execute_Interact2(Actor.Get());
+	}
+}
+
+void UInteractionSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	UWorld* World = GetWorld();
+	ActorSpawnedHandle = World->AddOnActorSpawnedHandler(FOnActorSpawned::FDelegate::CreateUObject(this, &ThisClass::OnActorSpawned));
+	ActorDestroyedHandle = World->AddOnActorDestroyedHandler(FOnActorDestroyed::FDelegate::CreateUObject(this, &ThisClass::OnActorDestroyed));
+}
+
+void UInteractionSubsystem::Deinitialize()
+{
+	UWorld* World = GetWorld();
+	World->RemoveOnActorSpawnedHandler(ActorSpawnedHandle);
+	World->RemoveOnActorDestroyededHandler(ActorDestroyedHandle);
+
+	Super::Deinitialize();
+}
+
+void UInteractionSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	// Actors placed in the level, actors streamed in later are registered when first traced
+	for (TActorIterator<AActor> It(&InWorld); It; ++It)
+	{
+		RegisterActor(*It);
+	}
+}
+
+bool UInteractionSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+void UInteractionSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	UpdateViewers();
+
+	UWorld* World = GetWorld();
+	for (FFocusViewer& Viewer : Viewers)
+	{
+		CollectTrace(Viewer);
+		UpdateFocus(Viewer);
+
+		AIBTestCharacter* Character = Viewer.Character.Get();
+
+		// Same ray and parameters as AIBTestCharacter::PlayerTrace, all viewers are traced in one batch
+
+		FVector StartLocation;
+		FVector EndLocation;
+		Character->GetPlayerInteractionRange(StartLocation, EndLocation);
+
+		Viewer.PendingTrace = World->AsyncLineTraceByChannel(EAsyncTraceType::Single, StartLocation, EndLocation, ECC_Visibility, Character->GetInteractionQueryParams());
+		Viewer.PendingTraceFrame = GFrameCounter;
+		++NumTraces;
+	}
+}
+
+TStatId UInteractionSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UInteractionSubsystem, STATGROUP_Tickables);
+}
+
+const FInteractable* UInteractionSubsystem::FindInteractable(AActor* Actor)
+{
+	if (!Actor) return nullptr;
+
+	if (const FInteractable* Interactable = Interactables.Find(Actor))
+	{
+		return Interactable;
+	}
+
+	return RegisterActor(Actor);
+}
+
+bool UInteractionSubsystem::GetFocusHit(const AIBTestCharacter* Character, FHitResult& OutHit)
+{
+	FFocusViewer* Viewer = Viewers.FindByPredicate([Character](const FFocusViewer& Viewer) { return Viewer.Character == Character; });
+	if (!Viewer) return false;
+
+	CollectTrace(*Viewer);
+
+	// Older hits belong to a view the player already left
+	if (Viewer->FocusHitFrame == 0 || GFrameCounter - Viewer->FocusHitFrame > 1) return false;
+
+	OutHit = Viewer->FocusHit;
+	++NumFocusHits;
+
+	return true;
+}
+
+const FInteractable* UInteractionSubsystem::RegisterActor(AActor* Actor)
+{
+	const EInteractableClass InteractableClass = GetInteractableClass(Actor->GetClass());
+	if (InteractableClass == EInteractableClass::None) return nullptr;
+
+	FInteractable& Interactable = Interactables.FindOrAdd(Actor);
+	Interactable.Actor = Actor;
+	Interactable.NativeInterface = InteractableClass == EInteractableClass::Native ? Cast<IInteractionInterface>(Actor) : nullptr;
+
+	return &Interactable;
+}
+
+UInteractionSubsystem::EInteractableClass UInteractionSubsystem::GetInteractableClass(UClass* Class)
+{
+	if (const EInteractableClass* InteractableClass = InteractableClasses.Find(Class))
+	{
+		return *InteractableClass;
+	}
+
+	EInteractableClass InteractableClass = EInteractableClass::None;
+	if (Class->ImplementsInterface(UInteractionInterface::StaticClass()))
+	{
+		// A blueprint override of any event replaces the native implementation, those classes go through the event dispatch
+		InteractableClass = Cast<IInteractionInterface>(Class->GetDefaultObject()) ? EInteractableClass::Native : EInteractableClass::Blueprint;
+
+		for (const FName FunctionName : { GET_FUNCTION_NAME_CHECKED(IInteractionInterface, CanInteract), GET_FUNCTION_NAME_CHECKED(IInteractionInterface, Interact1), GET_FUNCTION_NAME_CHECKED(IInteractionInterface, Interact2) })
+		{
+			const UFunction* Function = Class->FindFunctionByName(FunctionName);
+			if (!Function || !Function->HasAnyFunctionFlags(FUNC_Native))
+			{
+				InteractableClass = EInteractableClass::Blueprint;
+			}
+		}
+	}
+
+	InteractableClasses.Add(Class, InteractableClass);
+	return InteractableClass;
+}
+
+void UInteractionSubsystem::OnActorSpawned(AActor* Actor)
+{
+	RegisterActor(Actor);
+}
+
+void UInteractionSubsystem::OnActorDestroyed(AActor* Actor)
+{
+	Interactables.Remove(Actor);
+}
+
+void UInteractionSubsystem::UpdateViewers()
+{
+	// Dedicated servers have no local player and never trace here
+	TArray<AIBTestCharacter*, TInlineAllocator<4>> Characters;
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		const APlayerController* PlayerController = It->Get();
+		if (AIBTestCharacter* Character = PlayerController && PlayerController->IsLocalController() ? Cast<AIBTestCharacter>(PlayerController->GetPawn()) : nullptr)
+		{
+			Characters.Add(Character);
+		}
+	}
+
+	for (int32 Index = Viewers.Num() - 1; Index >= 0; --Index)
+	{
+		if (!Characters.Contains(Viewers[Index].Character.Get()))
+		{
+			SetHighlighted(Viewers[Index].FocusedActor.Get(), false);
+			Viewers.RemoveAtSwap(Index, 1, false);
+		}
+	}
+
+	for (AIBTestCharacter* Character : Characters)
+	{
+		if (!Viewers.ContainsByPredicate([Character](const FFocusViewer& Viewer) { return Viewer.Character == Character; }))
+		{
+			Viewers.AddDefaulted_GetRef().Character = Character;
+		}
+	}
+}
+
+void UInteractionSubsystem::CollectTrace(FFocusViewer& Viewer)
+{
+	if (!Viewer.PendingTrace.IsValid()) return;
+
+	FTraceDatum TraceDatum;
+	if (!GetWorld()->QueryTraceData(Viewer.PendingTrace, TraceDatum)) return;
+
+	Viewer.FocusHit = TraceDatum.OutHits.Num() > 0 ? TraceDatum.OutHits[0] : FHitResult(TraceDatum.Start, TraceDatum.End);
+	Viewer.FocusHitFrame = Viewer.PendingTraceFrame;
+	Viewer.PendingTrace = FTraceHandle();
+}
+
+void UInteractionSubsystem::UpdateFocus(FFocusViewer& Viewer)
+{
+	AActor* FocusedActor = nullptr;
+	if (bFocusHighlight && Viewer.FocusHitFrame != 0)
+	{
+		const FInteractable* Interactable = FindInteractable(Viewer.FocusHit.GetActor());
+		FocusedActor = Interactable ? Interactable->Actor.Get() : nullptr;
+	}
+
+	if (FocusedActor == Viewer.FocusedActor.Get()) return;
+
+	SetHighlighted(Viewer.FocusedActor.Get(), false);
+	SetHighlighted(FocusedActor, true);
+	Viewer.FocusedActor = FocusedActor;
+}
+
+void UInteractionSubsystem::RecordInteractionPayload(const FInteractionRequest& Request, const FHitResult& HitResult)
+{
+#if !UE_BUILD_SHIPPING
+	if (!bMeasurePayload) return;
+
+	if (!SizePackageMap)
+	{
+		SizePackageMap = NewObject<UPayloadSizePackageMap>(this);
+	}
+
+	// Both encodings go through bit writers of their own, as the RPC parameters would
+	bool bSuccess = false;
+
+	FNetBitWriter RequestWriter(SizePackageMap, 256);
+	FInteractionRequest RequestCopy = Request;
+	RequestCopy.NetSerialize(RequestWriter, SizePackageMap, bSuccess);
+
+	FNetBitWriter HitResultWriter(SizePackageMap, 8192);
+	FHitResult HitResultCopy = HitResult;
+	HitResultCopy.NetSerialize(HitResultWriter, SizePackageMap, bSuccess);
+
+	++NumMeasuredPayloads;
+	NumRequestBits += RequestWriter.GetNumBits();
+	NumHitResultBits += HitResultWriter.GetNumBits();
+#endif
+}
+
+void UInteractionSubsystem::DumpPayloadStats() const
+{
+	UE_LOG(LogTemp, Log, TEXT("Interaction RPC payload over %lld interactions: compact %.1f bytes, FHitResult %.1f bytes"),
+		NumMeasuredPayloads, NumMeasuredPayloads > 0 ? NumRequestBits / 8.0 / NumMeasuredPayloads : 0.0,
+		NumMeasuredPayloads > 0 ? NumHitResultBits / 8.0 / NumMeasuredPayloads : 0.0);
+}
+
+void UInteractionSubsystem::DumpStats() const
+{
+	int32 NumNative = 0;
+	for (const auto& Interactable : Interactables)
+	{
+		NumNative += Interactable.Value.NativeInterface ? 1 : 0;
+	}
+
+	UE_LOG(LogTemp, Log, TEXT("Interaction stats for %s: Interactables=%d (Native=%d Blueprint=%d) Viewers=%d, AsyncTraces=%lld FocusHits=%lld SyncTraces=%lld"),
+		*GetNameSafe(GetWorld()), Interactables.Num(), NumNative, Interactables.Num() - NumNative, Viewers.Num(), NumTraces, NumFocusHits, NumSyncTraces);
+}
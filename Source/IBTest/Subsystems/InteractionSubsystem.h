@@ -0,0 +1,160 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/HitResult.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "WorldCollision.h"
+#include "InteractionSubsystem.generated.h"
+
+class AIBTestCharacter;
+class IInteractionInterface;
+class UPayloadSizePackageMap;
+struct FInteractionRequest;
+
+/**
+ * Actor implementing IInteractionInterface, as stored in the interaction registry.
+ * Calls go straight to the native implementation when the class does not override it in blueprint,
+ * and through the BlueprintNativeEvent dispatch otherwise.
+ */
+struct FInteractable
+{
+	TWeakObjectPtr<AActor> Actor;
+
+	/** Set when every interaction event of the class is implemented in C++ */
+	IInteractionInterface* NativeInterface = nullptr;
+
+	bool CanInteract() const;
+	void Interact1() const;
+	void Interact2() const;
+};
+
+/**
+ * Interaction queries of the world.
+ * Keeps a registry of the actors implementing IInteractionInterface, so traced actors resolve to an interface
+ * without class checks or reflection, and traces the focus ray of every locally controlled character once per
+ * frame as a batch of async traces. Interactions and grabs reuse the focus hit of the previous frame,
+ * which also drives the focus highlight.
+ * Outside shipping builds, IBTest.Interaction.MeasurePayload measures the interaction RPCs sent by local players.
+ */
+UCLASS()
+class IBTEST_API UInteractionSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+private:
+
+	enum class EInteractableClass : uint8
+	{
+		None,
+		Blueprint,
+		Native,
+	};
+
+	/** Focus ray of a locally controlled character */
+	struct FFocusViewer
+	{
+		TWeakObjectPtr<AIBTestCharacter> Character;
+
+		/** Trace issued this frame, read back next frame */
+		FTraceHandle PendingTrace;
+		uint64 PendingTraceFrame = 0;
+
+		/** Last trace read back and the frame it was issued in */
+		FHitResult FocusHit;
+		uint64 FocusHitFrame = 0;
+
+		/** Interactable currently highlighted for this viewer */
+		TWeakObjectPtr<AActor> FocusedActor;
+	};
+
+	/** Interactable actors of the world */
+	TMap<TObjectKey<AActor>, FInteractable> Interactables;
+
+	/** Classes already checked, so traced shapes are only checked once per class */
+	TMap<TObjectKey<UClass>, EInteractableClass> InteractableClasses;
+
+	TArray<FFocusViewer> Viewers;
+
+	FDelegateHandle ActorSpawnedHandle;
+	FDelegateHandle ActorDestroyedHandle;
+
+	/** Async traces issued */
+	int64 NumTraces = 0;
+
+	/** Interaction traces answered from the batched focus traces */
+	int64 NumFocusHits = 0;
+
+	/** Interaction traces that had no fresh focus trace and ran synchronously */
+	int64 NumSyncTraces = 0;
+
+	/** Writes object references of measured payloads, created on first measure */
+	UPROPERTY(Transient)
+	TObjectPtr<UPayloadSizePackageMap> SizePackageMap;
+
+	/** Interactions measured, their compact request payload and the same interaction as a full FHitResult */
+	int64 NumMeasuredPayloads = 0;
+	int64 NumRequestBits = 0;
+	int64 NumHitResultBits = 0;
+
+public:
+
+	// USubsystem Begin
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	// USubsystem End
+
+	// UWorldSubsystem Begin
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	// UWorldSubsystem End
+
+	// FTickableGameObject Begin
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+	// FTickableGameObject End
+
+	/** Return the registry entry of the actor, or null if it does not implement IInteractionInterface */
+	const FInteractable* FindInteractable(AActor* Actor);
+
+	/** Get the focus hit of a locally controlled character traced last frame, false if there is none */
+	bool GetFocusHit(const AIBTestCharacter* Character, FHitResult& OutHit);
+
+	/** Count an interaction trace that could not use a focus hit */
+	void RecordSyncTrace() { ++NumSyncTraces; }
+
+	/** Client: measure an interaction RPC against the FHitResult it replaces, when IBTest.Interaction.MeasurePayload is set */
+	void RecordInteractionPayload(const FInteractionRequest& Request, const FHitResult& HitResult);
+
+	/** Print registry and trace counters to the log */
+	void DumpStats() const;
+
+	/** Print the average bytes per interaction of both encodings */
+	void DumpPayloadStats() const;
+
+protected:
+
+	// UWorldSubsystem Begin
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	// UWorldSubsystem End
+
+private:
+
+	/** Add the actor to the registry if its class implements IInteractionInterface */
+	const FInteractable* RegisterActor(AActor* Actor);
+
+	EInteractableClass GetInteractableClass(UClass* Class);
+
+	void OnActorSpawned(AActor* Actor);
+
+	void OnActorDestroyed(AActor* Actor);
+
+	/** Keep one viewer per locally controlled character */
+	void UpdateViewers();
+
+	/** Read back the trace of the viewer if it is ready */
+	void CollectTrace(FFocusViewer& Viewer);
+
+	/** Move the highlight to the interactable hit by the viewer */
+	void UpdateFocus(FFocusViewer& Viewer);
+};
@@ -0,0 +1,390 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Subsystems/MachineSubsystem.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "Async/ParallelFor.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/VectorRegister.h"
+
+#include "Machine.h"
+#include "GameplaySettings.h"
+
+namespace
+{
+	/** Lanes compared at once, count blocks are padded to a multiple of it */
+	constexpr int32 NumSimdLanes = 4;
+
+	/** True if every count covers the requirement in the same lane */
+	FORCEINLINE bool HasIngredients(const int32* Counts, const int32* Required, int32 NumLanes)
+	{
+		for (int32 Lane = 0; Lane < NumLanes; Lane += NumSimdLanes)
+		{
+			const VectorRegister4Int Missing = VectorIntCompareGT(VectorIntLoad(Required + Lane), VectorIntLoad(Counts + Lane));
+			if (VectorMaskBits(VectorCastIntToFloat(Missing)) != 0) return false;
+		}
+
+		return true;
+	}
+
+	/** Remove the requirements of NumCrafts completions from the counts */
+	FORCEINLINE void RemoveIngredients(int32* Counts, const int32* Required, int32 NumLanes, int32 NumCrafts)
+	{
+		const VectorRegister4Int Multiplier = VectorIntSet1(NumCrafts);
+		for (int32 Lane = 0; Lane < NumLanes; Lane += NumSimdLanes)
+		{
+			const VectorRegister4Int Used = VectorIntMultiply(VectorIntLoad(Required + Lane), Multiplier);
+			VectorIntStore(VectorIntSubtract(VectorIntLoad(Counts + Lane), Used), Counts + Lane);
+		}
+	}
+
+	FAutoConsoleCommandWithWorld MachineStatsCommand(
+		TEXT("IBTest.Machines.Stats"),
+		TEXT("Print recipe evaluation counters for the current world"),
+		FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+			{
+				if (const UMachineSubsystem* MachineSubsystem = World ? World->GetSubsystem<UMachineSubsystem>() : nullptr)
+				{
+					MachineSubsystem->DumpStats();
+				}
+			}));
+
+	FAutoConsoleCommandWithWorldAndArgs MachineProfileCommand(
+		TEXT("IBTest.Machines.Profile"),
+		TEXT("Print crafts per second and average recipe evaluation cost of every machine. Pass reset to restart the counters"),
+		FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+			{
+				UMachineSubsystem* MachineSubsystem = World ? World->GetSubsystem<UMachineSubsystem>() : nullptr;
+				if (!MachineSubsystem) return;
+
+				if (Args.Contains(TEXT("reset")))
+				{
+					MachineSubsystem->ResetMachineProfiles();
+				}
+				else
+				{
+					MachineSubsystem->DumpMachineProfiles();
+				}
+			}));
+}
+
+void UMachineSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	if (DirtyMachines.IsEmpty()) return;
+
+	TimeSinceEvaluation += DeltaTime;
+	if (TimeSinceEvaluation < GetDefault<UGameplaySettings>()->RecipeEvaluationInterval) return;
+
+	EvaluateDirtyMachines();
+}
+
+TStatId UMachineSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UMachineSubsystem, STATGROUP_Tickables);
+}
+
+bool UMachineSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+void UMachineSubsystem::MarkMachineDirty(AMachine* Machine)
+{
+	if (!Machine) return;
+
+	++NumRequests;
+
+	if (Machine->IsEvaluatingRecipes())
+	{
+		// Shapes spawned by the evaluation itself are handled in the next pass
+		++NumReentrantRequests;
+	}
+
+	if (Machine->bPendingRecipeEvaluation) return;
+
+	Machine->bPendingRecipeEvaluation = true;
+	DirtyMachines.Add(Machine);
+}
+
+void UMachineSubsystem::EvaluateDirtyMachines()
+{
+	TimeSinceEvaluation = 0.f;
+
+	// Machines dirtied during this pass are kept for the next one
+	TArray<TWeakObjectPtr<AMachine>> MachinesToEvaluate = MoveTemp(DirtyMachines);
+	DirtyMachines.Reset();
+
+	const bool bBatchEvaluation = GetDefault<UGameplaySettings>()->bBatchRecipeEvaluation;
+
+	TArray<AMachine*> BatchedMachines;
+	for (const TWeakObjectPtr<AMachine>& WeakMachine : MachinesToEvaluate)
+	{
+		AMachine* Machine = WeakMachine.Get();
+		if (!Machine) continue;
+
+		Machine->bPendingRecipeEvaluation = false;
+
+		// Outputs feeding the next completion of the same machine have to land in the box first
+		const int32 Slot = Machine->EvaluationSlot;
+		if (bBatchEvaluation && Slot != INDEX_NONE && (Machine->bDrainIngredients || !SlotFeedsItself[Slot]))
+		{
+			BatchedMachines.Add(Machine);
+			continue;
+		}
+
+		Machine->EvaluateRecipes();
+		++NumEvaluations;
+	}
+
+	if (!BatchedMachines.IsEmpty())
+	{
+		EvaluateBatch(BatchedMachines);
+	}
+}
+
+void UMachineSubsystem::EvaluateBatch(const TArray<AMachine*>& Machines)
+{
+	const uint64 StartCycles = FPlatformTime::Cycles64();
+
+	// Everything the workers need is read on the game thread, they never touch the machines
+	struct FBatchedMachine
+	{
+		int32 Slot;
+		bool bDrainIngredients;
+		bool bEnabled;
+	};
+
+	TArray<FBatchedMachine> BatchedMachines;
+	BatchedMachines.Reserve(Machines.Num());
+	for (const AMachine* Machine : Machines)
+	{
+		BatchedMachines.Add({ Machine->EvaluationSlot, Machine->bDrainIngredients, Machine->IsMachineEnabled() });
+	}
+
+	TArray<TArray<FMachineCraft>> MachineCrafts;
+	MachineCrafts.SetNum(Machines.Num());
+
+	TArray<uint64> ComputeCycles;
+	ComputeCycles.SetNumZeroed(Machines.Num());
+
+	const bool bSingleThread = Machines.Num() < GetDefault<UGameplaySettings>()->ParallelEvaluationMinMachines;
+	ParallelFor(Machines.Num(), [this, &BatchedMachines, &MachineCrafts, &ComputeCycles](int32 Index)
+		{
+			const uint64 MachineStartCycles = FPlatformTime::Cycles64();
+
+			const FBatchedMachine& Machine = BatchedMachines[Index];
+			if (Machine.bEnabled)
+			{
+				ComputeCrafts(Machine.Slot, Machine.bDrainIngredients, MachineCrafts[Index]);
+			}
+
+			ComputeCycles[Index] = FPlatformTime::Cycles64() - MachineStartCycles;
+		},
+		bSingleThread ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+
+	// One list of crafts for the whole batch, in machine order
+	Crafts.Reset();
+	for (const TArray<FMachineCraft>& Found : MachineCrafts)
+	{
+		Crafts.Append(Found);
+	}
+
+	// Completing crafts spawns and releases shapes, which only the game thread can do
+	int32 FirstCraft = 0;
+	for (int32 Index = 0; Index < Machines.Num(); ++Index)
+	{
+		const int32 NumMachineCrafts = MachineCrafts[Index].Num();
+		if (IsValid(Machines[Index]))
+		{
+			Machines[Index]->ApplyEvaluation(MakeArrayView(Crafts.GetData() + FirstCraft, NumMachineCrafts), ComputeCycles[Index]);
+		}
+
+		FirstCraft += NumMachineCrafts;
+	}
+
+	NumEvaluations += Machines.Num();
+	NumBatchedEvaluations += Machines.Num();
+	++NumBatches;
+	BatchCycles += FPlatformTime::Cycles64() - StartCycles;
+}
+
+void UMachineSubsystem::ComputeCrafts(int32 MachineSlot, bool bDrainIngredients, TArray<FMachineCraft>& OutCrafts) const
+{
+	const int32 NumLanes = SlotNumLanes[MachineSlot];
+	const int32 NumRecipes = SlotNumRecipes[MachineSlot];
+	const int32* Requirements = RecipeRequirements.GetData() + SlotRequirementOffsets[MachineSlot];
+
+	// Crafts are taken from a copy, the machine counts only change when the game thread completes them
+	TArray<int32, TInlineAllocator<32>> Counts;
+	Counts.Append(IngredientCounts.GetData() + SlotCountOffsets[MachineSlot], NumLanes);
+
+	if (bDrainIngredients)
+	{
+		// As FRecipeMatcher::ComputeCraftCounts: every recipe in priority order, as many times as what is left allows
+		for (int32 RecipeIndex = 0; RecipeIndex < NumRecipes; ++RecipeIndex)
+		{
+			const int32* Required = Requirements + RecipeIndex * NumLanes;
+			if (!HasIngredients(Counts.GetData(), Required, NumLanes)) continue;
+
+			int32 NumCrafts = MAX_int32;
+			for (int32 Lane = 0; Lane < NumLanes; ++Lane)
+			{
+				if (Required[Lane] > 0)
+				{
+					NumCrafts = FMath::Min(NumCrafts, Counts[Lane] / Required[Lane]);
+				}
+			}
+
+			RemoveIngredients(Counts.GetData(), Required, NumLanes, NumCrafts);
+			OutCrafts.Add({ MachineSlot, RecipeIndex, NumCrafts });
+		}
+
+		return;
+	}
+
+	// As AMachine::EvaluateRecipes: passes completing every satisfied recipe once in priority order, until none is.
+	// Completions of the same recipe in a row are merged
+	bool bCrafted = false;
+	do
+	{
+		bCrafted = false;
+		for (int32 RecipeIndex = 0; RecipeIndex < NumRecipes; ++RecipeIndex)
+		{
+			const int32* Required = Requirements + RecipeIndex * NumLanes;
+			if (!HasIngredients(Counts.GetData(), Required, NumLanes)) continue;
+
+			RemoveIngredients(Counts.GetData(), Required, NumLanes, 1);
+			bCrafted = true;
+
+			if (!OutCrafts.IsEmpty() && OutCrafts.Last().RecipeIndex == RecipeIndex)
+			{
+				++OutCrafts.Last().NumCrafts;
+			}
+			else
+			{
+				OutCrafts.Add({ MachineSlot, RecipeIndex, 1 });
+			}
+		}
+	}
+	while (bCrafted);
+}
+
+int32 UMachineSubsystem::RegisterMachine(AMachine* Machine)
+{
+	const FRecipeMatcher& Matcher = Machine->RecipeMatcher;
+
+	// Whole vectors per block, recipes are checked with no remainder lanes
+	const int32 NumLanes = Align(FMath::Max(Matcher.GetNumShapes(), 1), NumSimdLanes);
+	const int32 NumRecipes = Matcher.GetNumRecipes();
+
+	// Machines re-initializing their recipes and machines streamed back in get their previous lanes back
+	const int32 FreeIndex = FreeSlots.IndexOfByPredicate([this, NumLanes, NumRecipes](int32 FreeSlot)
+		{
+			return SlotNumLanes[FreeSlot] == NumLanes && SlotNumRecipes[FreeSlot] == NumRecipes;
+		});
+
+	int32 Slot = INDEX_NONE;
+	if (FreeIndex != INDEX_NONE)
+	{
+		Slot = FreeSlots[FreeIndex];
+		FreeSlots.RemoveAtSwap(FreeIndex, 1, false);
+		SlotMachines[Slot] = Machine;
+	}
+	else
+	{
+		Slot = SlotMachines.Add(Machine);
+		SlotCountOffsets.Add(IngredientCounts.AddUninitialized(NumLanes));
+		SlotRequirementOffsets.Add(RecipeRequirements.AddUninitialized(NumLanes * NumRecipes));
+		SlotNumLanes.Add(NumLanes);
+		SlotNumRecipes.Add(NumRecipes);
+		SlotFeedsItself.Add(false);
+	}
+
+	int32* Counts = IngredientCounts.GetData() + SlotCountOffsets[Slot];
+	FMemory::Memzero(Counts, NumLanes * sizeof(int32));
+	for (int32 ShapeIndex = 0; ShapeIndex < Matcher.GetNumShapes(); ++ShapeIndex)
+	{
+		Counts[ShapeIndex] = Matcher.GetShapeCount(ShapeIndex);
+	}
+
+	int32* Requirements = RecipeRequirements.GetData() + SlotRequirementOffsets[Slot];
+	FMemory::Memzero(Requirements, NumLanes * NumRecipes * sizeof(int32));
+
+	bool bFeedsItself = false;
+	for (int32 RecipeIndex = 0; RecipeIndex < NumRecipes; ++RecipeIndex)
+	{
+		const FCompiledRecipe& Recipe = Matcher.GetRecipe(RecipeIndex);
+
+		int32* Required = Requirements + RecipeIndex * NumLanes;
+		for (const FRecipeRequirement& Requirement : Recipe.Requirements)
+		{
+			Required[Requirement.ShapeIndex] = Requirement.Count;
+		}
+
+		bFeedsItself |= Matcher.FindShapeIndex(Recipe.Record->OutShapeIndex) != INDEX_NONE;
+	}
+
+	SlotFeedsItself[Slot] = bFeedsItself;
+
+	return Slot;
+}
+
+void UMachineSubsystem::UnregisterMachine(int32 MachineSlot)
+{
+	if (!SlotMachines.IsValidIndex(MachineSlot) || FreeSlots.Contains(MachineSlot)) return;
+
+	SlotMachines[MachineSlot] = nullptr;
+	FreeSlots.Add(MachineSlot);
+}
+
+void UMachineSubsystem::DumpStats() const
+{
+	UE_LOG(LogTemp, Log, TEXT("Machine stats for %s: Requests=%lld Evaluations=%lld Saved=%lld Reentrant=%lld Dirty=%d"),
+		*GetNameSafe(GetWorld()), NumRequests, NumEvaluations, NumRequests - NumEvaluations, NumReentrantRequests, DirtyMachines.Num());
+
+	const double AverageBatchUs = NumBatches > 0 ? FPlatformTime::ToMilliseconds64(BatchCycles) * 1000.0 / NumBatches : 0.0;
+	UE_LOG(LogTemp, Log, TEXT("  Batched: Evaluations=%lld Batches=%lld AverageBatch=%.2f us Slots=%d Free=%d Counts=%.1f KB Requirements=%.1f KB"),
+		NumBatchedEvaluations, NumBatches, AverageBatchUs, SlotMachines.Num(), FreeSlots.Num(),
+		IngredientCounts.GetAllocatedSize() / 1024.0, RecipeRequirements.GetAllocatedSize() / 1024.0);
+}
+
+void UMachineSubsystem::DumpMachineProfiles() const
+{
+	TArray<const AMachine*> Machines;
+	for (TActorIterator<AMachine> It(GetWorld()); It; ++It)
+	{
+		Machines.Add(*It);
+	}
+
+	Machines.Sort([](const AMachine& A, const AMachine& B) { return A.NumCompletedCrafts > B.NumCompletedCrafts; });
+
+	const double Now = FPlatformTime::Seconds();
+
+	UE_LOG(LogTemp, Log, TEXT("Machine profiles for %s: %d machines"), *GetNameSafe(GetWorld()), Machines.Num());
+
+	for (const AMachine* Machine : Machines)
+	{
+		const double Duration = FMath::Max(Now - Machine->ProfileStartTime, UE_DOUBLE_KINDA_SMALL_NUMBER);
+		const double AverageMatchUs = Machine->NumProfiledEvaluations > 0
+			? FPlatformTime::ToMilliseconds64(Machine->EvaluationCycles) * 1000.0 / Machine->NumProfiledEvaluations
+			: 0.0;
+
+		UE_LOG(LogTemp, Log, TEXT("  %s: Crafts=%lld (%.2f/s over %.0f s) Evaluations=%lld AverageMatch=%.2f us"),
+			*Machine->GetName(), Machine->NumCompletedCrafts, Machine->NumCompletedCrafts / Duration, Duration, Machine->NumProfiledEvaluations, AverageMatchUs);
+	}
+}
+
+void UMachineSubsystem::ResetMachineProfiles()
+{
+	const double Now = FPlatformTime::Seconds();
+
+	for (TActorIterator<AMachine> It(GetWorld()); It; ++It)
+	{
+		It->NumCompletedCrafts = 0;
+		It->NumProfiledEvaluations = 0;
+		It->EvaluationCycles = 0;
+		It->ProfileStartTime = Now;
+	}
+}
@@ -0,0 +1,142 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "MachineSubsystem.generated.h"
+
+class AMachine;
+
+/** Crafts of a recipe found by a batched evaluation, completed by the game thread */
+struct FMachineCraft
+{
+	/** Evaluation slot of the machine */
+	int32 MachineSlot;
+
+	/** Index of the recipe in the machine matcher */
+	int32 RecipeIndex;
+
+	/** Number of completions, in a row for machines that complete their recipes one at a time */
+	int32 NumCrafts;
+};
+
+/**
+ * Coalesces recipe evaluation of all machines in the world.
+ * Machines are marked dirty when their ingredients change and are evaluated once at the end of the frame,
+ * or once per RecipeEvaluationInterval, no matter how many shapes entered them in the meantime.
+ *
+ * With bBatchRecipeEvaluation, the subsystem keeps the ingredient counts of every machine in one array, in blocks of
+ * lanes padded to the SIMD width, and the requirements of their recipes in the same lanes. Dirty machines are evaluated
+ * together with ParallelFor over those arrays, recipes are checked 4 lanes at a time, and the crafts found come back as
+ * one list of FMachineCraft the game thread completes. Machines completing recipes one at a time whose outputs feed their
+ * own recipes are still evaluated on their own, their outputs land in the box in the middle of the evaluation.
+ */
+UCLASS()
+class IBTEST_API UMachineSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+private:
+
+	/** Machines waiting for their recipes to be evaluated */
+	TArray<TWeakObjectPtr<AMachine>> DirtyMachines;
+
+	/** Time accumulated since the last evaluation */
+	float TimeSinceEvaluation = 0.f;
+
+	/** Number of evaluations requested by machines */
+	int64 NumRequests = 0;
+
+	/** Number of evaluations actually run */
+	int64 NumEvaluations = 0;
+
+	/** Number of requests made while the machine was being evaluated, deferred to the next pass */
+	int64 NumReentrantRequests = 0;
+
+	/** Machine of each evaluation slot, null while the slot is free */
+	TArray<TWeakObjectPtr<AMachine>> SlotMachines;
+
+	/** Slots given back by machines, reused by machines with the same number of lanes and recipes */
+	TArray<int32> FreeSlots;
+
+	/** First lane of each slot in IngredientCounts */
+	TArray<int32> SlotCountOffsets;
+
+	/** First requirement of each slot in RecipeRequirements */
+	TArray<int32> SlotRequirementOffsets;
+
+	/** Number of lanes of each slot, a multiple of the SIMD width */
+	TArray<int32> SlotNumLanes;
+
+	/** Number of recipes of each slot, their requirements follow each other from SlotRequirementOffsets */
+	TArray<int32> SlotNumRecipes;
+
+	/** The outputs of the slot machine are ingredients of its own recipes */
+	TArray<bool> SlotFeedsItself;
+
+	/** Ingredient counts of every machine, one block of lanes per slot, a lane per matcher shape */
+	TArray<int32> IngredientCounts;
+
+	/** Requirements of every machine recipe, one block of lanes per recipe in the lanes of its machine */
+	TArray<int32> RecipeRequirements;
+
+	/** Crafts found by the last batch */
+	TArray<FMachineCraft> Crafts;
+
+	/** Machines evaluated in batches, number of batches and their cost */
+	int64 NumBatchedEvaluations = 0;
+	int64 NumBatches = 0;
+	uint64 BatchCycles = 0;
+
+public:
+
+	// FTickableGameObject Begin
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+	// FTickableGameObject End
+
+	/** Request a recipe evaluation of the given machine */
+	void MarkMachineDirty(AMachine* Machine);
+
+	/** Evaluate all dirty machines right away */
+	void EvaluateDirtyMachines();
+
+	/** Give the machine a block of the ingredient counts for batched evaluations, return its slot. Free slots of the same size are reused */
+	int32 RegisterMachine(AMachine* Machine);
+
+	/** Give the slot back, its lanes are reused by the next machine of the same size */
+	void UnregisterMachine(int32 MachineSlot);
+
+	/** Number of slots ever allocated, free ones included */
+	FORCEINLINE int32 GetNumSlots() const { return SlotMachines.Num(); }
+
+	/** Mirror the count of a matcher shape of the machine in its slot, shapes outside the slot are ignored */
+	FORCEINLINE void SetIngredientCount(int32 MachineSlot, int32 ShapeIndex, int32 Count)
+	{
+		if (!SlotNumLanes.IsValidIndex(MachineSlot) || ShapeIndex < 0 || ShapeIndex >= SlotNumLanes[MachineSlot]) return;
+
+		IngredientCounts[SlotCountOffsets[MachineSlot] + ShapeIndex] = Count;
+	}
+
+	/** Print evaluation counters to the log */
+	void DumpStats() const;
+
+	/** Print the craft throughput and average evaluation cost of every machine, busiest first */
+	void DumpMachineProfiles() const;
+
+	/** Restart the per machine craft and evaluation counters */
+	void ResetMachineProfiles();
+
+protected:
+
+	/** Evaluate the machines as one batch, then complete their crafts on the game thread */
+	void EvaluateBatch(const TArray<AMachine*>& Machines);
+
+	/** Find the crafts of a slot from its counts, as AMachine::EvaluateRecipes would make them. Reads the subsystem arrays only */
+	void ComputeCrafts(int32 MachineSlot, bool bDrainIngredients, TArray<FMachineCraft>& OutCrafts) const;
+
+	// UWorldSubsystem Begin
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	// UWorldSubsystem End
+};
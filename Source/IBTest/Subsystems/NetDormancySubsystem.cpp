@@ -0,0 +1,106 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Subsystems/NetDormancySubsystem.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "HAL/IConsoleManager.h"
+
+#include "Machine.h"
+#include "Shape.h"
+
+namespace
+{
+	FAutoConsoleCommandWithWorld DormancyStatsCommand(
+		TEXT("IBTest.Dormancy.Stats"),
+		TEXT("Print dormant and awake shape and machine counts for the current world"),
+		FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+			{
+				if (const UNetDormancySubsystem* DormancySubsystem = World ? World->GetSubsystem<UNetDormancySubsystem>() : nullptr)
+				{
+					DormancySubsystem->DumpStats();
+				}
+			}));
+
+	template<typename ActorType>
+	void CountDormancy(UWorld* World, int32& OutNumDormant, int32& OutNumAwake)
+	{
+		OutNumDormant = 0;
+		OutNumAwake = 0;
+
+		for (TActorIterator<ActorType> It(World); It; ++It)
+		{
+			if (It->NetDormancy > DORM_Awake)
+			{
+				++OutNumDormant;
+			}
+			else
+			{
+				++OutNumAwake;
+			}
+		}
+	}
+}
+
+bool UNetDormancySubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+UNetDormancySubsystem* UNetDormancySubsystem::Get(const AActor* Actor)
+{
+	const UWorld* World = Actor ? Actor->GetWorld() : nullptr;
+	return World ? World->GetSubsystem<UNetDormancySubsystem>() : nullptr;
+}
+
+void UNetDormancySubsystem::SetActorDormant(AActor* Actor)
+{
+	if (!Actor || !Actor->HasAuthority() || Actor->NetDormancy == DORM_DormantAll) return;
+
+	// Changes made before this call are still sent before the channel goes dormant
+	Actor->SetNetDormancy(DORM_DormantAll);
+
+	if (UNetDormancySubsystem* DormancySubsystem = Get(Actor))
+	{
+		++DormancySubsystem->NumDormancies;
+	}
+}
+
+void UNetDormancySubsystem::WakeUpActor(AActor* Actor)
+{
+	if (!Actor || !Actor->HasAuthority() || Actor->NetDormancy <= DORM_Awake) return;
+
+	Actor->SetNetDormancy(DORM_Awake);
+
+	if (UNetDormancySubsystem* DormancySubsystem = Get(Actor))
+	{
+		++DormancySubsystem->NumWakeUps;
+	}
+}
+
+void UNetDormancySubsystem::FlushActor(AActor* Actor)
+{
+	if (!Actor || !Actor->HasAuthority() || Actor->NetDormancy <= DORM_Awake) return;
+
+	Actor->FlushNetDormancy();
+
+	if (UNetDormancySubsystem* DormancySubsystem = Get(Actor))
+	{
+		++DormancySubsystem->NumFlushes;
+	}
+}
+
+void UNetDormancySubsystem::DumpStats() const
+{
+	UWorld* World = GetWorld();
+
+	int32 NumDormantShapes;
+	int32 NumAwakeShapes;
+	CountDormancy<AShape>(World, NumDormantShapes, NumAwakeShapes);
+
+	int32 NumDormantMachines;
+	int32 NumAwakeMachines;
+	CountDormancy<AMachine>(World, NumDormantMachines, NumAwakeMachines);
+
+	UE_LOG(LogTemp, Log, TEXT("Dormancy stats for %s: Shapes Dormant=%d Awake=%d, Machines Dormant=%d Awake=%d, Dormancies=%lld WakeUps=%lld Flushes=%lld"),
+		*GetNameSafe(World), NumDormantShapes, NumAwakeShapes, NumDormantMachines, NumAwakeMachines, NumDormancies, NumWakeUps, NumFlushes);
+}
@@ -0,0 +1,71 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Net/Core/PushModel/PushModel.h"
+#include "NetDormancySubsystem.generated.h"
+
+/**
+ * Mark a push model property dirty and send it even if its actor is dormant.
+ * Used by actors that stay dormant between changes, the actor goes back to dormancy once the change is sent.
+ */
+#define MARK_PROPERTY_DIRTY_AND_FLUSH_DORMANCY(ClassName, PropertyName, Object) \
+	do \
+	{ \
+		MARK_PROPERTY_DIRTY_FROM_NAME(ClassName, PropertyName, Object); \
+		UNetDormancySubsystem::FlushActor(Object); \
+	} \
+	while (0)
+
+/**
+ * Net dormancy of resting shapes and idle machines.
+ * Shapes go dormant when their body falls asleep and wake up when it wakes, is grabbed or overlaps something.
+ * Machines are always dormant and flushed whenever they change, see MARK_PROPERTY_DIRTY_AND_FLUSH_DORMANCY.
+ * Dormant actors are skipped by the net driver instead of being compared every net update.
+ */
+UCLASS()
+class IBTEST_API UNetDormancySubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+private:
+
+	/** Number of times actors were put to dormancy */
+	int64 NumDormancies = 0;
+
+	/** Number of times dormant actors were woken up */
+	int64 NumWakeUps = 0;
+
+	/** Number of times dormant actors sent a change without waking up */
+	int64 NumFlushes = 0;
+
+public:
+
+	/** Stop replicating the actor until it is woken up or flushed (server only) */
+	static void SetActorDormant(AActor* Actor);
+
+	/** Bring a dormant actor back to regular replication (server only) */
+	static void WakeUpActor(AActor* Actor);
+
+	/**
+	 * Send the pending property changes of a dormant actor, it stays dormant afterwards (server only).
+	 * Channels only reopen at the next net update, RPCs called on the actor in the meantime never reach dormant connections:
+	 * anything a dormant actor has to send goes through a replicated property, machine effects through ACosmeticEventCell.
+	 */
+	static void FlushActor(AActor* Actor);
+
+	/** Print dormant and awake actor counts to the log */
+	void DumpStats() const;
+
+protected:
+
+	// UWorldSubsystem Begin
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	// UWorldSubsystem End
+
+private:
+
+	static UNetDormancySubsystem* Get(const AActor* Actor);
+};
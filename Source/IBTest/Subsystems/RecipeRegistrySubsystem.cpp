@@ -0,0 +1,93 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Subsystems/RecipeRegistrySubsystem.h"
+#include "Engine/Engine.h"
+#include "Engine/GameInstance.h"
+#include "Engine/World.h"
+
+#include "GameplaySettings.h"
+
+void URecipeRegistrySubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	Registry.Build(*GetDefault<UGameplaySettings>());
+}
+
+const FMachineRecipes& URecipeRegistrySubsystem::GetMachineRecipes(const TArray<FName>& RecipeIDs)
+{
+	if (const FMachineRecipes* Recipes = MachineRecipes.Find(RecipeIDs))
+	{
+		return *Recipes;
+	}
+
+	FMachineRecipes& Recipes = MachineRecipes.Add(RecipeIDs);
+	for (const FName& RecipeID : RecipeIDs)
+	{
+		const int32 RecipeIndex = Registry.FindRecipeIndex(RecipeID);
+		if (RecipeIndex != INDEX_NONE)
+		{
+			Recipes.RecipeIndices.Add(RecipeIndex);
+		}
+	}
+
+	// Registry recipes are baked in priority order, so the matcher keeps them in index order
+	Recipes.RecipeIndices.Sort();
+
+	TArray<const FRecipeRecord*> Records;
+	for (const int32 RecipeIndex : Recipes.RecipeIndices)
+	{
+		Records.Add(Registry.GetRecipe(RecipeIndex));
+	}
+
+	Recipes.Matcher.Compile(Records, Registry.GetNumShapes());
+
+	return Recipes;
+}
+
+URecipeRegistrySubsystem* URecipeRegistrySubsystem::Get(const UObject* WorldContextObject)
+{
+	const UWorld* World = GEngine ? GEngine->GetWorldFromContextObject(WorldContextObject, EGetWorldErrorMode::ReturnNull) : nullptr;
+	const UGameInstance* GameInstance = World ? World->GetGameInstance() : nullptr;
+
+	return GameInstance ? GameInstance->GetSubsystem<URecipeRegistrySubsystem>() : nullptr;
+}
+
+TSharedPtr<FStreamableHandle> URecipeRegistrySubsystem::RequestShapeClasses(const TArray<int32>& ShapeIndices, FStreamableDelegate Callback /* = FStreamableDelegate() */)
+{
+	TArray<FSoftObjectPath> PathsToLoad;
+	for (const int32 ShapeIndex : ShapeIndices)
+	{
+		const FShapeRecord* Shape = Registry.GetShape(ShapeIndex);
+		if (Shape && !Shape->ShapeClass && !Shape->ShapeClassPath.IsNull())
+		{
+			PathsToLoad.AddUnique(Shape->ShapeClassPath.ToSoftObjectPath());
+		}
+	}
+
+	if (PathsToLoad.IsEmpty())
+	{
+		Callback.ExecuteIfBound();
+		return nullptr;
+	}
+
+	return StreamableManager.RequestAsyncLoad(PathsToLoad, FStreamableDelegate::CreateUObject(this, &ThisClass::OnShapeClassesLoaded, Callback));
+}
+
+TSharedPtr<FStreamableHandle> URecipeRegistrySubsystem::RequestAllShapeClasses(FStreamableDelegate Callback /* = FStreamableDelegate() */)
+{
+	TArray<int32> ShapeIndices;
+	for (int32 ShapeIndex = 0; ShapeIndex < Registry.GetNumShapes(); ++ShapeIndex)
+	{
+		ShapeIndices.Add(ShapeIndex);
+	}
+
+	return RequestShapeClasses(ShapeIndices, Callback);
+}
+
+void URecipeRegistrySubsystem::OnShapeClassesLoaded(FStreamableDelegate Callback)
+{
+	Registry.ResolveShapeClasses();
+
+	Callback.ExecuteIfBound();
+}
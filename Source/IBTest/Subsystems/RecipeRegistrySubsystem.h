@@ -0,0 +1,71 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/GameInstanceSubsystem.h"
+#include "Engine/StreamableManager.h"
+#include "Crafting/RecipeRegistry.h"
+#include "Crafting/RecipeMatcher.h"
+#include "RecipeRegistrySubsystem.generated.h"
+
+/** Recipe list of a machine, compiled once and shared by every machine holding the same list */
+struct FMachineRecipes
+{
+	/** Registry indices of the recipes in priority order, which is also the order of the matcher recipes */
+	TArray<int32> RecipeIndices;
+
+	/** Compiled recipes with empty counters, machines copy it */
+	FRecipeMatcher Matcher;
+};
+
+/**
+ * Resolves the recipe and shape data tables once per game instance.
+ * Machines, buttons and spawning code query the flat records by index instead of looking up data table rows.
+ */
+UCLASS()
+class IBTEST_API URecipeRegistrySubsystem : public UGameInstanceSubsystem
+{
+	GENERATED_BODY()
+
+private:
+
+	UPROPERTY()
+	FRecipeRegistry Registry;
+
+	/** Streams shape classes in the background */
+	FStreamableManager StreamableManager;
+
+	/** Compiled recipes by machine recipe list */
+	TMap<TArray<FName>, FMachineRecipes> MachineRecipes;
+
+public:
+
+	// USubsystem Begin
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	// USubsystem End
+
+	FORCEINLINE const FRecipeRegistry& GetRegistry() const { return Registry; }
+
+	/**
+	 * Return the compiled recipes of a machine recipe list. Unknown recipes are skipped.
+	 * Only the first machine with a given list looks up its recipes and compiles them.
+	 */
+	const FMachineRecipes& GetMachineRecipes(const TArray<FName>& RecipeIDs);
+
+	/**
+	 * Stream in the classes of the given shapes without blocking the game thread.
+	 * Callback is executed once all of them are resolved, right away if they already are.
+	 * The returned handle keeps the classes loaded, it is null when nothing had to be loaded.
+	 */
+	TSharedPtr<FStreamableHandle> RequestShapeClasses(const TArray<int32>& ShapeIndices, FStreamableDelegate Callback = FStreamableDelegate());
+
+	/** Stream in the classes of all shapes */
+	TSharedPtr<FStreamableHandle> RequestAllShapeClasses(FStreamableDelegate Callback = FStreamableDelegate());
+
+	static URecipeRegistrySubsystem* Get(const UObject* WorldContextObject);
+
+private:
+
+	void OnShapeClassesLoaded(FStreamableDelegate Callback);
+};
@@ -0,0 +1,166 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Subsystems/ServerStatsSubsystem.h"
+#include "Engine/Engine.h"
+#include "Engine/NetConnection.h"
+#include "Engine/NetDriver.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/App.h"
+#include "Misc/CoreDelegates.h"
+
+#include "GameplaySettings.h"
+
+namespace
+{
+	FAutoConsoleCommandWithWorld ServerStatsCommand(
+		TEXT("IBTest.ServerStats"),
+		TEXT("Print server frame time, RPC and bandwidth percentiles gathered since the last report"),
+		FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+			{
+				if (UServerStatsSubsystem* ServerStats = World ? World->GetSubsystem<UServerStatsSubsystem>() : nullptr)
+				{
+					ServerStats->Report();
+				}
+			}));
+
+	/** Value below which the given fraction of the sorted samples fall */
+	float GetPercentile(const TArray<float>& SortedSamples, float Fraction)
+	{
+		if (SortedSamples.IsEmpty()) return 0.f;
+
+		const int32 Index = FMath::Clamp(FMath::CeilToInt(SortedSamples.Num() * Fraction) - 1, 0, SortedSamples.Num() - 1);
+		return SortedSamples[Index];
+	}
+
+	FString FormatPercentiles(TArray<float>& Samples)
+	{
+		Samples.Sort();
+
+		return FString::Printf(TEXT("p50=%.1f p90=%.1f p99=%.1f max=%.1f"),
+			GetPercentile(Samples, 0.5f), GetPercentile(Samples, 0.9f), GetPercentile(Samples, 0.99f), GetPercentile(Samples, 1.f));
+	}
+}
+
+void UServerStatsSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	WorldTickStartHandle = FWorldDelegates::OnWorldTickStart.AddUObject(this, &ThisClass::OnWorldTickStart);
+	EndFrameHandle = FCoreDelegates::OnEndFrame.AddUObject(this, &ThisClass::OnEndFrame);
+}
+
+void UServerStatsSubsystem::Deinitialize()
+{
+	FWorldDelegates::OnWorldTickStart.Remove(WorldTickStartHandle);
+	FCoreDelegates::OnEndFrame.Remove(EndFrameHandle);
+
+	Super::Deinitialize();
+}
+
+bool UServerStatsSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+UServerStatsSubsystem* UServerStatsSubsystem::Get(const UObject* WorldContextObject)
+{
+	const UWorld* World = GEngine ? GEngine->GetWorldFromContextObject(WorldContextObject, EGetWorldErrorMode::ReturnNull) : nullptr;
+	return World ? World->GetSubsystem<UServerStatsSubsystem>() : nullptr;
+}
+
+void UServerStatsSubsystem::RecordRPC(const AActor* Actor)
+{
+	// Listen server players call the RPC implementations directly and have no connection
+	UNetConnection* Connection = Actor ? Actor->GetNetConnection() : nullptr;
+	if (!Connection) return;
+
+	++ConnectionRPCs.FindOrAdd(Connection);
+}
+
+void UServerStatsSubsystem::RecordDroppedRPC(const AActor* Actor)
+{
+	++NumDroppedRPCs;
+	++TotalDroppedRPCs;
+}
+
+void UServerStatsSubsystem::OnWorldTickStart(UWorld* World, ELevelTick TickType, float DeltaTime)
+{
+	if (World != GetWorld()) return;
+
+	FrameStartCycles = FPlatformTime::Cycles64();
+}
+
+void UServerStatsSubsystem::OnEndFrame()
+{
+	// Frame start is only set once our world ticked
+	if (FrameStartCycles == 0 || !IsServerWorld()) return;
+
+	// Measured from the start of the world tick, so the time the server idles to honor its tick rate is not included
+	FrameTimes.Add(FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - FrameStartCycles));
+	FrameStartCycles = 0;
+
+	const float DeltaTime = FApp::GetDeltaTime();
+
+	TimeSinceSample += DeltaTime;
+	if (TimeSinceSample >= 1.f)
+	{
+		SampleConnections();
+	}
+
+	const float ReportInterval = GetDefault<UGameplaySettings>()->ServerStatsReportInterval;
+	TimeSinceReport += DeltaTime;
+	if (ReportInterval > 0.f && TimeSinceReport >= ReportInterval)
+	{
+		Report();
+	}
+}
+
+void UServerStatsSubsystem::SampleConnections()
+{
+	const UNetDriver* NetDriver = GetWorld()->GetNetDriver();
+	if (NetDriver)
+	{
+		for (UNetConnection* Connection : NetDriver->ClientConnections)
+		{
+			if (!Connection) continue;
+
+			const int32* NumRPCs = ConnectionRPCs.Find(Connection);
+			RPCRates.Add((NumRPCs ? *NumRPCs : 0) / TimeSinceSample);
+
+			// Updated by the connection once per stat period
+			InBytesRates.Add(Connection->InBytesPerSecond);
+			OutBytesRates.Add(Connection->OutBytesPerSecond);
+		}
+
+		MaxConnections = FMath::Max(MaxConnections, NetDriver->ClientConnections.Num());
+	}
+
+	ConnectionRPCs.Reset();
+	TimeSinceSample = 0.f;
+}
+
+void UServerStatsSubsystem::Report()
+{
+	UE_LOG(LogTemp, Display, TEXT("Server stats for %s over %.1f s, %d connections, %d frames"),
+		*GetNameSafe(GetWorld()), TimeSinceReport, MaxConnections, FrameTimes.Num());
+	UE_LOG(LogTemp, Display, TEXT("  Frame time (ms):            %s"), *FormatPercentiles(FrameTimes));
+	UE_LOG(LogTemp, Display, TEXT("  RPCs/s per connection:      %s"), *FormatPercentiles(RPCRates));
+	UE_LOG(LogTemp, Display, TEXT("  In bytes/s per connection:  %s"), *FormatPercentiles(InBytesRates));
+	UE_LOG(LogTemp, Display, TEXT("  Out bytes/s per connection: %s"), *FormatPercentiles(OutBytesRates));
+	UE_LOG(LogTemp, Display, TEXT("  Dropped RPCs:               %d (%lld total)"), NumDroppedRPCs, TotalDroppedRPCs);
+
+	FrameTimes.Reset();
+	RPCRates.Reset();
+	InBytesRates.Reset();
+	OutBytesRates.Reset();
+	NumDroppedRPCs = 0;
+	TimeSinceReport = 0.f;
+	MaxConnections = 0;
+}
+
+bool UServerStatsSubsystem::IsServerWorld() const
+{
+	const ENetMode NetMode = GetWorld()->GetNetMode();
+	return NetMode == NM_DedicatedServer || NetMode == NM_ListenServer;
+}
@@ -0,0 +1,84 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "ServerStatsSubsystem.generated.h"
+
+class UNetConnection;
+
+/**
+ * Server side load statistics, used to find where the server stops scaling under bot clients.
+ * Samples the frame time, the gameplay RPCs received and the bandwidth of every client connection,
+ * and logs them as percentiles every ServerStatsReportInterval.
+ */
+UCLASS()
+class IBTEST_API UServerStatsSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+private:
+
+	/** Frame times of the current report, in milliseconds */
+	TArray<float> FrameTimes;
+
+	/** Per connection per second samples of the current report */
+	TArray<float> RPCRates;
+	TArray<float> InBytesRates;
+	TArray<float> OutBytesRates;
+
+	/** RPCs received from each connection since the last sample */
+	TMap<TWeakObjectPtr<UNetConnection>, int32> ConnectionRPCs;
+
+	/** RPCs dropped by rate limiting, since the last report and since the start */
+	int32 NumDroppedRPCs = 0;
+	int64 TotalDroppedRPCs = 0;
+
+	FDelegateHandle WorldTickStartHandle;
+	FDelegateHandle EndFrameHandle;
+
+	uint64 FrameStartCycles = 0;
+
+	float TimeSinceSample = 0.f;
+
+	float TimeSinceReport = 0.f;
+
+	int32 MaxConnections = 0;
+
+public:
+
+	// USubsystem Begin
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	// USubsystem End
+
+	/** Count a gameplay RPC received from the connection owning the given actor */
+	void RecordRPC(const AActor* Actor);
+
+	/** Count a gameplay RPC ignored because its connection exceeded its rate limit */
+	void RecordDroppedRPC(const AActor* Actor);
+
+	/** Log the percentiles gathered since the last report and start a new one */
+	void Report();
+
+	static UServerStatsSubsystem* Get(const UObject* WorldContextObject);
+
+protected:
+
+	// UWorldSubsystem Begin
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	// UWorldSubsystem End
+
+private:
+
+	void OnWorldTickStart(UWorld* World, ELevelTick TickType, float DeltaTime);
+
+	void OnEndFrame();
+
+	/** Add one sample per client connection */
+	void SampleConnections();
+
+	/** Return true if the world is a dedicated or listen server */
+	bool IsServerWorld() const;
+};
@@ -0,0 +1,423 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Subsystems/ShapeDemotionSubsystem.h"
+#include "Components/StaticMeshComponent.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/IConsoleManager.h"
+#include "Serialization/ArchiveCountMem.h"
+#include "TimerManager.h"
+
+#include "IBTest.h"
+#include "GameplaySettings.h"
+#include "Machine.h"
+#include "Shape.h"
+#include "Subsystems/RecipeRegistrySubsystem.h"
+#include "Subsystems/ShapePoolSubsystem.h"
+
+namespace
+{
+	/** Shapes demoted or promoted near players per update, spreads the work of a player walking into a crowded area */
+	const int32 MaxDemotionsPerUpdate = 256;
+	const int32 MaxPromotionsPerUpdate = 256;
+
+	/** Number of shapes the memory report is scaled to */
+	const int32 ReportedShapeCount = 10000;
+
+	FAutoConsoleCommandWithWorld DemotionStatsCommand(
+		TEXT("IBTest.Shapes.DemotionStats"),
+		TEXT("Print the number and memory of shape actors and demoted shapes for the current world"),
+		FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+			{
+				if (const UShapeDemotionSubsystem* ShapeDemotion = World ? World->GetSubsystem<UShapeDemotionSubsystem>() : nullptr)
+				{
+					ShapeDemotion->DumpStats();
+				}
+			}));
+
+	FAutoConsoleCommandWithWorld DemoteAllCommand(
+		TEXT("IBTest.Shapes.DemoteAll"),
+		TEXT("Demote every resting shape now, whatever its rest time and distance to players (server only)"),
+		FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+			{
+				if (UShapeDemotionSubsystem* ShapeDemotion = World ? World->GetSubsystem<UShapeDemotionSubsystem>() : nullptr)
+				{
+					ShapeDemotion->UpdateDemotions(true);
+				}
+			}));
+
+	FAutoConsoleCommandWithWorldAndArgs SpawnShapeFieldCommand(
+		TEXT("IBTest.Shapes.SpawnField"),
+		TEXT("Drop <Count> shapes (default 10000) on a grid in front of the first player, to measure demotion at scale (server only)"),
+		FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+			{
+				if (UShapeDemotionSubsystem* ShapeDemotion = World ? World->GetSubsystem<UShapeDemotionSubsystem>() : nullptr)
+				{
+					ShapeDemotion->SpawnShapeField(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : ReportedShapeCount);
+				}
+			}));
+
+	/** Estimated memory of an actor and its components, physics bodies excluded */
+	SIZE_T GetActorMemory(AActor* Actor)
+	{
+		SIZE_T Memory = FArchiveCountMem(Actor).GetMax() + Actor->GetResourceSizeBytes(EResourceSizeMode::Exclusive);
+		for (UActorComponent* Component : Actor->GetComponents())
+		{
+			Memory += FArchiveCountMem(Component).GetMax() + Component->GetResourceSizeBytes(EResourceSizeMode::Exclusive);
+		}
+
+		return Memory;
+	}
+}
+
+bool UShapeDemotionSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+void UShapeDemotionSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	// Shapes are only ever demoted by the server, clients get the cells
+	bEnabled = GetDefault<UGameplaySettings>()->bDemoteRestingShapes && InWorld.GetNetMode() != NM_Client;
+	if (!bEnabled) return;
+
+	// Level shapes may start asleep and never send a sleep event, awake ones are dropped by the first update
+	const double Now = InWorld.GetTimeSeconds();
+	for (TActorIterator<AShape> It(&InWorld); It; ++It)
+	{
+		RestingShapes.Add(*It, Now);
+	}
+
+	InWorld.GetTimerManager().SetTimer(UpdateTimerHandle, FTimerDelegate::CreateUObject(this, &ThisClass::UpdateDemotions, false),
+		GetDefault<UGameplaySettings>()->ShapeDemotionInterval, true);
+}
+
+void UShapeDemotionSubsystem::NotifyShapeResting(AShape* Shape)
+{
+	if (bEnabled && Shape)
+	{
+		RestingShapes.Add(Shape, GetWorld()->GetTimeSeconds());
+	}
+}
+
+void UShapeDemotionSubsystem::NotifyShapeAwake(AShape* Shape)
+{
+	RestingShapes.Remove(Shape);
+}
+
+void UShapeDemotionSubsystem::UpdateDemotions(bool bForce /* = false */)
+{
+	if (!bEnabled) return;
+
+	TArray<FVector> PlayerLocations;
+	GetPlayerLocations(PlayerLocations);
+
+	PromoteShapesNearPlayers(PlayerLocations);
+	DemoteRestingShapes(PlayerLocations, bForce);
+}
+
+void UShapeDemotionSubsystem::GetPlayerLocations(TArray<FVector>& OutLocations) const
+{
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		const APlayerController* PlayerController = It->Get();
+		if (!PlayerController) continue;
+
+		FVector ViewLocation;
+		FRotator ViewRotation;
+		PlayerController->GetPlayerViewPoint(ViewLocation, ViewRotation);
+		OutLocations.Add(ViewLocation);
+	}
+}
+
+void UShapeDemotionSubsystem::DemoteRestingShapes(const TArray<FVector>& PlayerLocations, bool bForce)
+{
+	const UGameplaySettings* Settings = GetDefault<UGameplaySettings>();
+	const double Now = GetWorld()->GetTimeSeconds();
+	const double DemotionDistanceSquared = FMath::Square(Settings->ShapeDemotionDistance);
+
+	TArray<AShape*> ShapesToDemote;
+	TArray<AActor*> OverlappedMachines;
+	for (auto It = RestingShapes.CreateIterator(); It; ++It)
+	{
+		AShape* Shape = It->Key.ResolveObjectPtr();
+		const UPrimitiveComponent* Body = Shape ? Shape->GetMeshComponent() : nullptr;
+
+		// Pooled shapes and shapes that woke up without an event come back with their next sleep event
+		if (!IsValid(Shape) || Shape->IsPooled() || Shape->GetShapeIndex() == INDEX_NONE || !Body || Body->RigidBodyIsAwake())
+		{
+			It.RemoveCurrent();
+			continue;
+		}
+
+		if (!bForce)
+		{
+			if (ShapesToDemote.Num() >= MaxDemotionsPerUpdate) break;
+
+			if (Now - It->Value < Settings->ShapeDemotionDelay) continue;
+
+			const FVector Location = Shape->GetActorLocation();
+			if (PlayerLocations.ContainsByPredicate([&Location, DemotionDistanceSquared](const FVector& PlayerLocation) { return FVector::DistSquared(PlayerLocation, Location) < DemotionDistanceSquared; }))
+			{
+				continue;
+			}
+		}
+
+		// Ingredients stay actors, machines hold them by pointer
+		Shape->GetOverlappingActors(OverlappedMachines, AMachine::StaticClass());
+		if (!OverlappedMachines.IsEmpty()) continue;
+
+		ShapesToDemote.Add(Shape);
+		It.RemoveCurrent();
+	}
+
+	for (AShape* Shape : ShapesToDemote)
+	{
+		DemoteShape(Shape);
+	}
+}
+
+void UShapeDemotionSubsystem::DemoteShape(AShape* Shape)
+{
+	UShapePoolSubsystem* ShapePool = GetWorld()->GetSubsystem<UShapePoolSubsystem>();
+	AShapeInstanceCell* Cell = GetCell(Shape->GetActorLocation());
+	if (!ShapePool || !Cell) return;
+
+	const FTransform Transform = Shape->GetActorTransform();
+	const int32 ShapeIndex = Shape->GetShapeIndex();
+
+	// The actor body goes away before the instance body takes its place
+	ShapePool->ReleaseShape(Shape);
+	Cell->AddInstance(NextInstanceId, ShapeIndex, Transform);
+
+	NextInstanceId = FMath::Max<uint32>(NextInstanceId + 1, 1);
+	++NumDemoted;
+	IBTEST_INC_COUNTER(ShapesDemoted, 1);
+}
+
+void UShapeDemotionSubsystem::PromoteShapesNearPlayers(const TArray<FVector>& PlayerLocations)
+{
+	if (PlayerLocations.IsEmpty()) return;
+
+	const UGameplaySettings* Settings = GetDefault<UGameplaySettings>();
+	const double PromotionDistanceSquared = FMath::Square(Settings->ShapePromotionDistance);
+	const double CellReachSquared = FMath::Square(Settings->ShapePromotionDistance + Settings->ReplicationGridCellSize * UE_HALF_SQRT_2);
+
+	TArray<TPair<AShapeInstanceCell*, uint32>> ShapesToPromote;
+	for (const auto& Cell : Cells)
+	{
+		if (!IsValid(Cell.Value) || Cell.Value->GetInstances().IsEmpty()) continue;
+
+		// Cells out of reach of every player are skipped as a whole
+		const FVector CellCenter = Settings->GetReplicationGridCellCenter(Cell.Key, 0.0);
+		if (!PlayerLocations.ContainsByPredicate([&CellCenter, CellReachSquared](const FVector& PlayerLocation) { return FVector::DistSquared2D(PlayerLocation, CellCenter) <= CellReachSquared; }))
+		{
+			continue;
+		}
+
+		for (const FShapeInstance& Instance : Cell.Value->GetInstances())
+		{
+			if (PlayerLocations.ContainsByPredicate([&Instance, PromotionDistanceSquared](const FVector& PlayerLocation) { return FVector::DistSquared(PlayerLocation, Instance.Location) <= PromotionDistanceSquared; }))
+			{
+				ShapesToPromote.Add({ Cell.Value, Instance.InstanceId });
+				if (ShapesToPromote.Num() >= MaxPromotionsPerUpdate) break;
+			}
+		}
+
+		if (ShapesToPromote.Num() >= MaxPromotionsPerUpdate) break;
+	}
+
+	for (const TPair<AShapeInstanceCell*, uint32>& Shape : ShapesToPromote)
+	{
+		NumPromotedNearPlayers += PromoteShape(Shape.Key, Shape.Value) ? 1 : 0;
+	}
+}
+
+void UShapeDemotionSubsystem::PromoteShapesInBox(const FBox& Box)
+{
+	const UGameplaySettings* Settings = GetDefault<UGameplaySettings>();
+	const FVector HalfCell(Settings->ReplicationGridCellSize * 0.5, Settings->ReplicationGridCellSize * 0.5, 0.0);
+
+	TArray<TPair<AShapeInstanceCell*, uint32>> ShapesToPromote;
+	for (const auto& Cell : Cells)
+	{
+		if (!IsValid(Cell.Value)) continue;
+
+		const FVector CellCenter = Settings->GetReplicationGridCellCenter(Cell.Key, 0.0);
+		if (!Box.IntersectXY(FBox(CellCenter - HalfCell, CellCenter + HalfCell))) continue;
+
+		for (const FShapeInstance& Instance : Cell.Value->GetInstances())
+		{
+			if (Box.IsInside(Instance.Location))
+			{
+				ShapesToPromote.Add({ Cell.Value, Instance.InstanceId });
+			}
+		}
+	}
+
+	for (const TPair<AShapeInstanceCell*, uint32>& Shape : ShapesToPromote)
+	{
+		NumPromotedByMachines += PromoteShape(Shape.Key, Shape.Value) ? 1 : 0;
+	}
+}
+
+AShape* UShapeDemotionSubsystem::PromoteTracedShape(AShapeInstanceCell* Cell, uint32 InstanceId)
+{
+	AShape* Shape = PromoteShape(Cell, InstanceId);
+	NumPromotedByTrace += Shape ? 1 : 0;
+
+	return Shape;
+}
+
+AShape* UShapeDemotionSubsystem::PromoteShape(AShapeInstanceCell* Cell, uint32 InstanceId)
+{
+	FShapeInstance Instance;
+	if (!IsValid(Cell) || !Cell->RemoveInstance(InstanceId, Instance)) return nullptr;
+
+	const URecipeRegistrySubsystem* RecipeRegistry = URecipeRegistrySubsystem::Get(this);
+	const FShapeRecord* ShapeRecord = RecipeRegistry ? RecipeRegistry->GetRegistry().GetShape(Instance.ShapeIndex) : nullptr;
+	UShapePoolSubsystem* ShapePool = GetWorld()->GetSubsystem<UShapePoolSubsystem>();
+
+	// The instance body is gone, the actor goes exactly where the shape rested
+	AShape* Shape = ShapeRecord && ShapePool
+		? ShapePool->AcquireShape(ShapeRecord->ShapeClass, Instance.GetTransform(), nullptr, ESpawnActorCollisionHandlingMethod::AlwaysSpawn)
+		: nullptr;
+
+	if (!Shape)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Shape demotion: cannot promote shape %d, it stays demoted"), Instance.ShapeIndex);
+		Cell->AddInstance(InstanceId, Instance.ShapeIndex, Instance.GetTransform());
+		return nullptr;
+	}
+
+	IBTEST_INC_COUNTER(ShapesPromoted, 1);
+	return Shape;
+}
+
+AShapeInstanceCell* UShapeDemotionSubsystem::GetCell(const FVector& Location)
+{
+	// Same cells as the replication graph grid, so a cell is relevant to the connections viewing its shapes
+	const UGameplaySettings* Settings = GetDefault<UGameplaySettings>();
+	const FIntPoint CellCoords = Settings->GetReplicationGridCell(Location);
+
+	TObjectPtr<AShapeInstanceCell>& Cell = Cells.FindOrAdd(CellCoords);
+	if (!IsValid(Cell))
+	{
+		FActorSpawnParameters SpawnParameters;
+		SpawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+		Cell = GetWorld()->SpawnActor<AShapeInstanceCell>(Settings->GetReplicationGridCellCenter(CellCoords, Location.Z), FRotator::ZeroRotator, SpawnParameters);
+	}
+
+	return Cell;
+}
+
+void UShapeDemotionSubsystem::ForEachDemotedShape(TFunctionRef<void(const FShapeInstance&)> Visitor) const
+{
+	for (const auto& Cell : Cells)
+	{
+		if (!IsValid(Cell.Value)) continue;
+
+		for (const FShapeInstance& Instance : Cell.Value->GetInstances())
+		{
+			Visitor(Instance);
+		}
+	}
+}
+
+void UShapeDemotionSubsystem::RemoveDemotedShapes()
+{
+	for (const auto& Cell : Cells)
+	{
+		if (IsValid(Cell.Value))
+		{
+			Cell.Value->Destroy();
+		}
+	}
+
+	Cells.Reset();
+}
+
+void UShapeDemotionSubsystem::SpawnShapeField(int32 Count)
+{
+	UWorld* World = GetWorld();
+	const APlayerController* PlayerController = World->GetFirstPlayerController();
+	const URecipeRegistrySubsystem* RecipeRegistry = URecipeRegistrySubsystem::Get(this);
+	UShapePoolSubsystem* ShapePool = World->GetSubsystem<UShapePoolSubsystem>();
+	if (World->GetNetMode() == NM_Client || !PlayerController || !RecipeRegistry || !ShapePool || Count <= 0) return;
+
+	const FRecipeRegistry& Registry = RecipeRegistry->GetRegistry();
+	TArray<TSubclassOf<AShape>> ShapeClasses;
+	for (int32 ShapeIndex = 0; ShapeIndex < Registry.GetNumShapes(); ++ShapeIndex)
+	{
+		if (Registry.IsShapeClassLoaded(ShapeIndex))
+		{
+			ShapeClasses.Add(Registry.GetShape(ShapeIndex)->ShapeClass);
+		}
+	}
+
+	if (ShapeClasses.IsEmpty()) return;
+
+	FVector ViewLocation;
+	FRotator ViewRotation;
+	PlayerController->GetPlayerViewPoint(ViewLocation, ViewRotation);
+
+	// Square grid starting a little ahead of the player, shapes fall to the ground and fall asleep there
+	const double Spacing = 100.0;
+	const int32 Side = FMath::CeilToInt(FMath::Sqrt(static_cast<float>(Count)));
+	const FRotator Yaw(0.0, ViewRotation.Yaw, 0.0);
+	const FVector Origin = ViewLocation + Yaw.RotateVector(FVector(500.0, -0.5 * Side * Spacing, 100.0));
+
+	for (int32 Index = 0; Index < Count; ++Index)
+	{
+		const FVector Location = Origin + Yaw.RotateVector(FVector((Index / Side) * Spacing, (Index % Side) * Spacing, 0.0));
+		ShapePool->AcquireShape(ShapeClasses[Index % ShapeClasses.Num()], FTransform(Location), nullptr, ESpawnActorCollisionHandlingMethod::AlwaysSpawn);
+	}
+
+	UE_LOG(LogTemp, Log, TEXT("Shape demotion: spawned %d shapes, IBTest.Shapes.DemoteAll demotes them once they rest"), Count);
+}
+
+void UShapeDemotionSubsystem::DumpStats() const
+{
+	int32 NumShapeActors = 0;
+	int32 NumPooledShapes = 0;
+	SIZE_T ShapeActorsMemory = 0;
+	for (TActorIterator<AShape> It(GetWorld()); It; ++It)
+	{
+		if (It->IsPooled())
+		{
+			++NumPooledShapes;
+			continue;
+		}
+
+		++NumShapeActors;
+		ShapeActorsMemory += GetActorMemory(*It);
+	}
+
+	int32 NumDemotedShapes = 0;
+	int32 NumCells = 0;
+	SIZE_T DemotedShapesMemory = 0;
+	for (const auto& Cell : Cells)
+	{
+		if (!IsValid(Cell.Value)) continue;
+
+		++NumCells;
+		NumDemotedShapes += Cell.Value->GetInstances().Num();
+		DemotedShapesMemory += GetActorMemory(Cell.Value);
+	}
+
+	const double BytesPerActor = NumShapeActors > 0 ? static_cast<double>(ShapeActorsMemory) / NumShapeActors : 0.0;
+	const double BytesPerDemoted = NumDemotedShapes > 0 ? static_cast<double>(DemotedShapesMemory) / NumDemotedShapes : 0.0;
+
+	UE_LOG(LogTemp, Log, TEXT("Shape demotion for %s: %d shape actors (%d more pooled), %d demoted shapes in %d cells"),
+		*GetNameSafe(GetWorld()), NumShapeActors, NumPooledShapes, NumDemotedShapes, NumCells);
+	UE_LOG(LogTemp, Log, TEXT("  Memory: %.1f KiB per shape actor, %.1f bytes per demoted shape (physics bodies excluded)"),
+		BytesPerActor / 1024.0, BytesPerDemoted);
+	UE_LOG(LogTemp, Log, TEXT("  %d shapes: %d actors and %.1f MiB as actors, %d actors and %.1f MiB demoted"),
+		ReportedShapeCount, ReportedShapeCount, BytesPerActor * ReportedShapeCount / (1024.0 * 1024.0),
+		NumCells, BytesPerDemoted * ReportedShapeCount / (1024.0 * 1024.0));
+	UE_LOG(LogTemp, Log, TEXT("  Demoted=%lld Promoted near players=%lld, by traces=%lld, by machines=%lld Resting=%d"),
+		NumDemoted, NumPromotedNearPlayers, NumPromotedByTrace, NumPromotedByMachines, RestingShapes.Num());
+}
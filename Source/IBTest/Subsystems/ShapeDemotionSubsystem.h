@@ -0,0 +1,105 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/EngineTypes.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Networking/ShapeInstanceCell.h"
+#include "ShapeDemotionSubsystem.generated.h"
+
+class AShape;
+
+/**
+ * Turns shapes resting far from every player into instanced meshes, and back into actors when they are needed again.
+ * Shapes asleep for ShapeDemotionDelay and further than ShapeDemotionDistance from every player are released to the shape
+ * pool and kept as an entry of the AShapeInstanceCell of their replication grid cell. They become actors again when a player
+ * comes within ShapePromotionDistance, traces or grabs them, or when a machine box covers them.
+ * Runs on the server every ShapeDemotionInterval, enabled by bDemoteRestingShapes.
+ * IBTest.Shapes.DemotionStats compares the memory of shape actors and demoted shapes.
+ */
+UCLASS()
+class IBTEST_API UShapeDemotionSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+private:
+
+	/** Cells spawned so far, by grid coordinates */
+	UPROPERTY(Transient)
+	TMap<FIntPoint, TObjectPtr<AShapeInstanceCell>> Cells;
+
+	/** Shapes whose body fell asleep, and the time it did */
+	TMap<TObjectKey<AShape>, double> RestingShapes;
+
+	/** Id of the next demoted shape, 0 is never used */
+	uint32 NextInstanceId = 1;
+
+	FTimerHandle UpdateTimerHandle;
+
+	bool bEnabled = false;
+
+	int64 NumDemoted = 0;
+	int64 NumPromotedNearPlayers = 0;
+	int64 NumPromotedByTrace = 0;
+	int64 NumPromotedByMachines = 0;
+
+public:
+
+	// UWorldSubsystem Begin
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	// UWorldSubsystem End
+
+	/** Start counting the rest time of a shape (server only) */
+	void NotifyShapeResting(AShape* Shape);
+
+	/** Stop counting the rest time of a shape (server only) */
+	void NotifyShapeAwake(AShape* Shape);
+
+	/** Turn a demoted shape back into an actor, null if the cell does not hold it anymore (server only) */
+	AShape* PromoteTracedShape(AShapeInstanceCell* Cell, uint32 InstanceId);
+
+	/** Turn every demoted shape inside the box back into an actor (server only) */
+	void PromoteShapesInBox(const FBox& Box);
+
+	/** Demote the resting shapes far from every player and promote the demoted shapes near one, bForce demotes every resting shape */
+	void UpdateDemotions(bool bForce = false);
+
+	/** Call Visitor on every demoted shape */
+	void ForEachDemotedShape(TFunctionRef<void(const FShapeInstance&)> Visitor) const;
+
+	/** Forget every demoted shape without promoting it, used when a factory snapshot replaces the shapes */
+	void RemoveDemotedShapes();
+
+	/** Print shape actor and demoted shape counts and memory to the log */
+	void DumpStats() const;
+
+	/** Drop Count shapes of random loaded classes on a grid in front of the first player, to measure demotion at scale (server only) */
+	void SpawnShapeField(int32 Count);
+
+protected:
+
+	// UWorldSubsystem Begin
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	// UWorldSubsystem End
+
+private:
+
+	/** Find or spawn the cell containing the location */
+	AShapeInstanceCell* GetCell(const FVector& Location);
+
+	/** Release the shape to the pool and add it to its cell */
+	void DemoteShape(AShape* Shape);
+
+	/** Remove the shape from its cell and acquire an actor in its place */
+	AShape* PromoteShape(AShapeInstanceCell* Cell, uint32 InstanceId);
+
+	/** Demote the resting shapes that qualify, bForce ignores their rest time, their distance to players and the per update budget */
+	void DemoteRestingShapes(const TArray<FVector>& PlayerLocations, bool bForce);
+
+	/** Promote the demoted shapes within ShapePromotionDistance of a player */
+	void PromoteShapesNearPlayers(const TArray<FVector>& PlayerLocations);
+
+	/** View locations of every player */
+	void GetPlayerLocations(TArray<FVector>& OutLocations) const;
+};
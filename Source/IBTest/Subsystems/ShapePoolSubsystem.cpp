@@ -0,0 +1,153 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Subsystems/ShapePoolSubsystem.h"
+#include "Engine/World.h"
+#include "Engine/StreamableManager.h"
+#include "HAL/IConsoleManager.h"
+
+#include "Shape.h"
+#include "GameplaySettings.h"
+#include "Subsystems/RecipeRegistrySubsystem.h"
+
+namespace
+{
+	FAutoConsoleCommandWithWorld ShapePoolStatsCommand(
+		TEXT("IBTest.ShapePool.Stats"),
+		TEXT("Print shape pool usage for the current world"),
+		FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+			{
+				if (const UShapePoolSubsystem* ShapePool = World ? World->GetSubsystem<UShapePoolSubsystem>() : nullptr)
+				{
+					ShapePool->DumpStats();
+				}
+			}));
+}
+
+void UShapePoolSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	// Shapes are only ever spawned by the server
+	if (InWorld.GetNetMode() == NM_Client || GetDefault<UGameplaySettings>()->ShapePoolWarmSize <= 0) return;
+
+	if (URecipeRegistrySubsystem* RecipeRegistry = URecipeRegistrySubsystem::Get(&InWorld))
+	{
+		WarmUpHandle = RecipeRegistry->RequestAllShapeClasses(FStreamableDelegate::CreateUObject(this, &ThisClass::WarmAllPools));
+	}
+}
+
+void UShapePoolSubsystem::WarmAllPools()
+{
+	WarmUpHandle.Reset();
+
+	const URecipeRegistrySubsystem* RecipeRegistry = URecipeRegistrySubsystem::Get(GetWorld());
+	if (!RecipeRegistry) return;
+
+	const int32 WarmSize = GetDefault<UGameplaySettings>()->ShapePoolWarmSize;
+	const FRecipeRegistry& Registry = RecipeRegistry->GetRegistry();
+	for (int32 ShapeIndex = 0; ShapeIndex < Registry.GetNumShapes(); ++ShapeIndex)
+	{
+		WarmPool(Registry.GetShape(ShapeIndex)->ShapeClass, WarmSize);
+	}
+}
+
+bool UShapePoolSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+AShape* UShapePoolSubsystem::AcquireShape(TSubclassOf<AShape> ShapeClass, const FTransform& Transform, AActor* Owner /* = nullptr */,
+	ESpawnActorCollisionHandlingMethod CollisionHandling /* = AdjustIfPossibleButAlwaysSpawn */)
+{
+	if (!ShapeClass) return nullptr;
+
+	FShapePool& Pool = Pools.FindOrAdd(ShapeClass.Get());
+
+	AShape* Shape = nullptr;
+	while (!Shape && !Pool.FreeShapes.IsEmpty())
+	{
+		// Pooled shapes can still be destroyed externally, e.g. during level streaming
+		Shape = Pool.FreeShapes.Pop(false);
+		Shape = IsValid(Shape) ? Shape : nullptr;
+	}
+
+	if (Shape)
+	{
+		Shape->SetOwner(Owner);
+		Shape->ActivatePooled(Transform);
+		++Pool.NumReused;
+	}
+	else
+	{
+		Shape = SpawnShape(ShapeClass, Transform, Owner, CollisionHandling);
+		if (!Shape) return nullptr;
+
+		++Pool.NumSpawned;
+	}
+
+	++Pool.NumActive;
+	Pool.ActiveHighWaterMark = FMath::Max(Pool.ActiveHighWaterMark, Pool.NumActive);
+
+	return Shape;
+}
+
+void UShapePoolSubsystem::ReleaseShape(AShape* Shape)
+{
+	if (!IsValid(Shape) || Shape->IsPooled()) return;
+
+	FShapePool& Pool = Pools.FindOrAdd(Shape->GetClass());
+	Pool.NumActive = FMath::Max(Pool.NumActive - 1, 0);
+
+	if (Pool.FreeShapes.Num() >= GetDefault<UGameplaySettings>()->ShapePoolMaxSize)
+	{
+		++Pool.NumDiscarded;
+		Shape->Destroy();
+		return;
+	}
+
+	Shape->DeactivatePooled();
+	Pool.FreeShapes.Add(Shape);
+	Pool.FreeHighWaterMark = FMath::Max(Pool.FreeHighWaterMark, Pool.FreeShapes.Num());
+}
+
+void UShapePoolSubsystem::WarmPool(TSubclassOf<AShape> ShapeClass, int32 Count)
+{
+	if (!ShapeClass) return;
+
+	FShapePool& Pool = Pools.FindOrAdd(ShapeClass.Get());
+	while (Pool.FreeShapes.Num() < Count)
+	{
+		// Spawned pooled, a machine or belt input box around the origin must not see warm shapes
+		AShape* Shape = GetWorld()->SpawnActorDeferred<AShape>(ShapeClass, FTransform::Identity, nullptr, nullptr, ESpawnActorCollisionHandlingMethod::AlwaysSpawn);
+		if (!Shape) break;
+
+		Shape->FinishSpawningPooled(FTransform::Identity);
+
+		++Pool.NumSpawned;
+		Pool.FreeShapes.Add(Shape);
+	}
+
+	Pool.FreeHighWaterMark = FMath::Max(Pool.FreeHighWaterMark, Pool.FreeShapes.Num());
+}
+
+void UShapePoolSubsystem::DumpStats() const
+{
+	UE_LOG(LogTemp, Log, TEXT("Shape pool stats for %s:"), *GetNameSafe(GetWorld()));
+
+	for (const auto& Pool : Pools)
+	{
+		const FShapePool& Stats = Pool.Value;
+		UE_LOG(LogTemp, Log, TEXT("  %s: Active=%d (peak %d) Free=%d (peak %d) Spawned=%d Reused=%d Discarded=%d"),
+			*GetNameSafe(Pool.Key), Stats.NumActive, Stats.ActiveHighWaterMark, Stats.FreeShapes.Num(), Stats.FreeHighWaterMark,
+			Stats.NumSpawned, Stats.NumReused, Stats.NumDiscarded);
+	}
+}
+
+AShape* UShapePoolSubsystem::SpawnShape(TSubclassOf<AShape> ShapeClass, const FTransform& Transform, AActor* Owner, ESpawnActorCollisionHandlingMethod CollisionHandling)
+{
+	FActorSpawnParameters SpawnParameters;
+	SpawnParameters.SpawnCollisionHandlingOverride = CollisionHandling;
+	SpawnParameters.Owner = Owner;
+
+	return GetWorld()->SpawnActor<AShape>(ShapeClass, Transform, SpawnParameters);
+}
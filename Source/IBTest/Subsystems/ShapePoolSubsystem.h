@@ -0,0 +1,96 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Engine/EngineTypes.h"
+#include "Templates/SubclassOf.h"
+#include "ShapePoolSubsystem.generated.h"
+
+class AShape;
+struct FStreamableHandle;
+
+/** Inactive shapes and usage stats for a single shape class */
+USTRUCT()
+struct FShapePool
+{
+	GENERATED_BODY()
+
+	/** Shapes ready to be reused */
+	UPROPERTY()
+	TArray<TObjectPtr<AShape>> FreeShapes;
+
+	/** Shapes currently handed out by the pool */
+	int32 NumActive = 0;
+
+	/** Highest number of shapes handed out at the same time */
+	int32 ActiveHighWaterMark = 0;
+
+	/** Highest number of shapes waiting in the pool at the same time */
+	int32 FreeHighWaterMark = 0;
+
+	/** Number of shapes that had to be spawned */
+	int32 NumSpawned = 0;
+
+	/** Number of shapes reused instead of being spawned */
+	int32 NumReused = 0;
+
+	/** Number of released shapes destroyed because the pool was full */
+	int32 NumDiscarded = 0;
+};
+
+/**
+ * Server side pool of shape actors, keyed by shape class.
+ * Released shapes are hidden, lose physics and collision and go net dormant, then get reactivated
+ * in place of spawning a new actor.
+ */
+UCLASS()
+class IBTEST_API UShapePoolSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+private:
+
+	UPROPERTY()
+	TMap<TObjectPtr<UClass>, FShapePool> Pools;
+
+	/** Keeps shape classes loaded while the pools are warmed up */
+	TSharedPtr<FStreamableHandle> WarmUpHandle;
+
+public:
+
+	// UWorldSubsystem Begin
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	// UWorldSubsystem End
+
+	/**
+	 * Return a shape of the given class at the given transform, reusing a pooled one when possible.
+	 * CollisionHandling applies to newly spawned shapes, reused ones are always moved to the exact transform.
+	 */
+	AShape* AcquireShape(TSubclassOf<AShape> ShapeClass, const FTransform& Transform, AActor* Owner = nullptr,
+		ESpawnActorCollisionHandlingMethod CollisionHandling = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButAlwaysSpawn);
+
+	/** Give a shape back to the pool instead of destroying it */
+	void ReleaseShape(AShape* Shape);
+
+	/** Spawn shapes of the given class until the pool holds at least Count of them */
+	void WarmPool(TSubclassOf<AShape> ShapeClass, int32 Count);
+
+	/** Print pool stats to the log */
+	void DumpStats() const;
+
+protected:
+
+	// UWorldSubsystem Begin
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	// UWorldSubsystem End
+
+private:
+
+	/** Warm the pools of all shape classes, once they have been streamed in */
+	void WarmAllPools();
+
+	AShape* SpawnShape(TSubclassOf<AShape> ShapeClass, const FTransform& Transform, AActor* Owner,
+		ESpawnActorCollisionHandlingMethod CollisionHandling = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButAlwaysSpawn);
+};